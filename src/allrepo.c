@@ -49,6 +49,171 @@ static void collect_argv(Blob *pExtra, int iStart){
   }
 }
 
+#if INTERFACE
+/*
+** Commands that "fossil all" and "fossil sync --all" run one after
+** another, or several at a time on helper threads.
+*/
+struct AllRunner {
+  WorkPipe *pPipe;        /* Helper threads.  NULL to run commands serially */
+  int nJob;               /* Number of commands run */
+  int nFail;              /* Number of commands that failed */
+  int bTiming;            /* Report the time taken by every command */
+  sqlite3_int64 tmStart;  /* When the first command was started */
+  Blob report;            /* Summary lines for the report at the end */
+};
+#endif
+
+/*
+** One command run by an AllRunner
+*/
+typedef struct AllJob AllJob;
+struct AllJob {
+  char *zLabel;           /* Name used for the command in reports */
+  char *zHeader;          /* Text shown ahead of the output */
+  char *zCmd;             /* The command */
+  int rc;                 /* Exit status */
+  sqlite3_int64 msElapsed;  /* How long the command took */
+  Blob out;               /* Standard output and standard error */
+};
+
+/*
+** Run a command on a helper thread and capture its output.  This runs
+** in a helper thread and so must not use the database.
+*/
+static void all_job_run(void *pArg){
+  AllJob *p = (AllJob*)pArg;
+  sqlite3_int64 tmStart = current_time_in_milliseconds();
+  FILE *in;
+  in = popen(p->zCmd, "r");
+  if( in==0 ){
+    p->rc = -1;
+  }else{
+    char zBuf[4096];
+    size_t n;
+    while( (n = fread(zBuf, 1, sizeof(zBuf), in))>0 ){
+      blob_append(&p->out, zBuf, (int)n);
+    }
+    p->rc = pclose(in);
+  }
+  p->msElapsed = current_time_in_milliseconds() - tmStart;
+}
+
+/*
+** Record the outcome of a command and free it
+*/
+static void all_job_done(AllRunner *pRun, AllJob *p){
+  pRun->nJob++;
+  if( p->rc ) pRun->nFail++;
+  if( p->rc || pRun->bTiming ){
+    blob_appendf(&pRun->report, "%8.3fs  %s%s\n",
+                 p->msElapsed/1000.0, p->zLabel, p->rc ? "  FAILED" : "");
+  }
+  fossil_free(p->zLabel);
+  fossil_free(p->zHeader);
+  fossil_free(p->zCmd);
+  blob_reset(&p->out);
+  fossil_free(p);
+}
+
+/*
+** Show the output of a command that ran on a helper thread
+*/
+static void all_job_show(AllRunner *pRun, AllJob *p){
+  fossil_print("%s%s", p->zHeader, blob_str(&p->out));
+  if( p->rc ){
+    fossil_print("%s: failed\n", p->zLabel);
+  }
+  fflush(stdout);
+  all_job_done(pRun, p);
+}
+
+/*
+** Show the output of the commands that have finished on helper threads,
+** in the order in which they were started.  If bWait is true, wait
+** for all of them.
+*/
+static void all_runner_collect(AllRunner *pRun, int bWait){
+  AllJob *p;
+  while( (p = (AllJob*)workpipe_pop(pRun->pPipe, bWait))!=0 ){
+    all_job_show(pRun, p);
+  }
+}
+
+/*
+** Prepare to run commands nJob at a time.  If nJob is 1 or threads are
+** not available, commands are run one after another and their output
+** goes straight to the terminal.
+*/
+void all_runner_begin(AllRunner *pRun, int nJob, int bTiming){
+  memset(pRun, 0, sizeof(*pRun));
+  pRun->bTiming = bTiming;
+  pRun->tmStart = current_time_in_milliseconds();
+  blob_zero(&pRun->report);
+  if( nJob>1 ){
+    pRun->pPipe = workpipe_new(nJob, nJob*2, all_job_run);
+  }
+}
+
+/*
+** Run command zCmd, after showing zHeader.  zLabel names the command
+** in the report at the end.  Return the number of commands that have
+** failed so far.  When commands run on helper threads, this returns
+** without waiting for zCmd to finish.
+*/
+int all_runner_run(
+  AllRunner *pRun,
+  const char *zLabel,
+  const char *zHeader,
+  const char *zCmd
+){
+  AllJob *p = fossil_malloc( sizeof(*p) );
+  memset(p, 0, sizeof(*p));
+  blob_zero(&p->out);
+  p->zLabel = fossil_strdup(zLabel);
+  p->zHeader = fossil_strdup(zHeader);
+  if( pRun->pPipe==0 ){
+    sqlite3_int64 tmStart = current_time_in_milliseconds();
+    fossil_print("%s", zHeader);
+    fflush(stdout);
+    p->rc = fossil_system(zCmd);
+    p->msElapsed = current_time_in_milliseconds() - tmStart;
+    all_job_done(pRun, p);
+    return pRun->nFail;
+  }
+  fossil_assert_safe_command_string(zCmd);
+  p->zCmd = mprintf("%s 2>&1", zCmd);
+  if( workpipe_full(pRun->pPipe) ){
+    all_job_show(pRun, (AllJob*)workpipe_pop(pRun->pPipe, 1));
+  }
+  workpipe_push(pRun->pPipe, p);
+  all_runner_collect(pRun, 0);
+  return pRun->nFail;
+}
+
+/*
+** Wait for all commands to finish.  Report on the failures, and on
+** every command if timing was requested.  Return the number of
+** commands that failed.
+*/
+int all_runner_end(AllRunner *pRun){
+  if( pRun->pPipe ){
+    all_runner_collect(pRun, 1);
+    workpipe_free(pRun->pPipe);
+    pRun->pPipe = 0;
+  }
+  if( blob_size(&pRun->report) ){
+    fossil_print("%s", blob_str(&pRun->report));
+  }
+  if( pRun->nFail || pRun->bTiming ){
+    fossil_print("%d of %d commands failed in %.3f seconds\n",
+                 pRun->nFail, pRun->nJob,
+                 (current_time_in_milliseconds() - pRun->tmStart)/1000.0);
+  }
+  blob_reset(&pRun->report);
+  return pRun->nFail;
+}
+
 
 /*
 ** COMMAND: all
@@ -140,8 +305,14 @@ static void collect_argv(Blob *pExtra, int iStart){
 **
 ** Options:
 **   --dry-run         If given, display instead of run actions.
+**   --jobs N          Run the subcommand on N repositories at a time.  The
+**                     output of each one is shown when it finishes, in
+**                     the usual order.  Default: 1
 **   --showfile        Show the repository or checkout being operated upon.
 **   --stop-on-error   Halt immediately if any subprocess fails.
+**   --timing          Show how long the subcommand took on each repository.
+**
+** Failures are listed at the end, with the time that each one took.
 */
 void all_cmd(void){
   int n;
@@ -156,9 +327,15 @@ void all_cmd(void){
   int stopOnError;
   int nToDel = 0;
   int showLabel = 0;
+  int nJob;
+  int bTiming;
+  AllRunner run;
+  Blob hdr;
 
   (void)find_option("dontstop",0,0);   /* Legacy.  Now the default */
   stopOnError = find_option("stop-on-error",0,0)!=0;
+  nJob = fossil_thread_count(find_option("jobs",0,1), 1);
+  bTiming = find_option("timing",0,0)!=0;
   dryRunFlag = find_option("dry-run","n",0)!=0;
   if( !dryRunFlag ){
     dryRunFlag = find_option("test",0,0)!=0; /* deprecated */
@@ -193,6 +370,7 @@ void all_cmd(void){
     blob_appendf(&extra, " %$", zDest);
   }else if( strncmp(zCmd, "clean", n)==0 ){
     zCmd = "clean --chdir";
+    nJob = 1;   /* clean might prompt */
     collect_argument(&extra, "allckouts",0);
     collect_argument_value(&extra, "case-sensitive");
     collect_argument_value(&extra, "clean");
@@ -383,9 +561,11 @@ void all_cmd(void){
     );
   }
   db_multi_exec("CREATE TEMP TABLE toDel(x TEXT)");
+  all_runner_begin(&run, dryRunFlag ? 1 : nJob, bTiming);
+  blob_zero(&hdr);
   db_prepare(&q, "SELECT name, tag FROM repolist ORDER BY 1");
   while( db_step(&q)==SQLITE_ROW ){
-    int rc;
+    int nFail = run.nFail;
     const char *zFilename = db_column_text(&q, 0);
 #if !USE_SEE
     if( sqlite3_strglob("*.efossil", zFilename)==0 ) continue;
@@ -401,8 +581,10 @@ void all_cmd(void){
     if( zCmd[0]=='l' ){
       fossil_print("%s\n", zFilename);
       continue;
-    }else if( showFile ){
-      fossil_print("%s: %s\n", useCheckouts ? "checkout" : "repository",
+    }
+    blob_truncate(&hdr, 0);
+    if( showFile ){
+      blob_appendf(&hdr, "%s: %s\n", useCheckouts ? "checkout" : "repository",
                    zFilename);
     }
     zSyscmd = mprintf("%$ %s %$%s",
@@ -411,25 +593,29 @@ void all_cmd(void){
       int len = (int)strlen(zFilename);
       int nStar = 80 - (len + 15);
       if( nStar<2 ) nStar = 1;
-      fossil_print("%.13c %s %.*c\n", '*', zFilename, nStar, '*');
-      fflush(stdout);
+      blob_appendf(&hdr, "%.13c %s %.*c\n", '*', zFilename, nStar, '*');
     }
     if( !quiet || dryRunFlag ){
-      fossil_print("%s\n", zSyscmd);
-      fflush(stdout);
+      blob_appendf(&hdr, "%s\n", zSyscmd);
+    }
+    if( dryRunFlag ){
+      fossil_print("%s", blob_str(&hdr));
+    }else{
+      all_runner_run(&run, zFilename, blob_str(&hdr), zSyscmd);
     }
-    rc = dryRunFlag ? 0 : fossil_system(zSyscmd);
     free(zSyscmd);
-    if( rc ){
+    if( run.nFail>nFail ){
       if( stopOnError ) break;
       /* If there is an error, pause briefly, but do not stop.  The brief
       ** pause is so that if the prior command failed with Ctrl-C then there
       ** will be time to stop the whole thing with a second Ctrl-C. */
-      sqlite3_sleep(330);
+      if( run.pPipe==0 ) sqlite3_sleep(330);
     }
   }
   db_finalize(&q);
+  all_runner_end(&run);
 
+  blob_reset(&hdr);
   blob_reset(&extra);
 
   /* If any repositories whose names appear in the ~/.fossil file could not
@@ -429,6 +429,14 @@ void backoffice_check_if_needed(void){
   }
 }
 
+/*
+** Return true if backoffice_check_if_needed() has decided that a
+** backoffice process should be started once the database is closed.
+*/
+int backoffice_is_pending(void){
+  return backofficeDb!=0 && strcmp(backofficeDb,"x")!=0;
+}
+
 /*
 ** Call this routine to disable backoffice
 */
@@ -636,6 +644,8 @@ void backoffice_work(void){
   if( nThis ){ backoffice_log("%d SMTPs", nThis); nTotal += nThis; }
   nThis = hook_backoffice();
   if( nThis ){ backoffice_log("%d hooks", nThis); nTotal += nThis; }
+  nThis = cache_backoffice();
+  if( nThis ){ backoffice_log("%d archives", nThis); nTotal += nThis; }
 
   /* Close the log */
   if( backofficeFILE ){
@@ -831,10 +841,15 @@ void backoffice_run_if_needed(void){
   {
     pid_t pid = fork();
     if( pid>0 ){
-      /* This is the parent in a successful fork().  Return immediately. */
+      /* This is the parent in a successful fork().  Return immediately.
+      ** The work has been handed off, so a process that opens the
+      ** repository again, such as a "fossil server --workers" worker,
+      ** can start the backoffice again later. */
       backofficeTrace(
         "/***** Subprocess %d creates backoffice child %d *****/\n",
         GETPID(), (int)pid);
+      fossil_free(backofficeDb);
+      backofficeDb = 0;
       return;
     }
     if( pid==0 ){
@@ -25,6 +25,9 @@
 #else
 #  include <zlib.h>
 #endif
+#if defined(FOSSIL_ENABLE_ZSTD)
+#  include <zstd.h>
+#endif
 #include "blob.h"
 #if defined(_WIN32)
 #include <fcntl.h>
@@ -1045,17 +1048,27 @@ void blob_compress(Blob *pIn, Blob *pOut){
 /*
 ** COMMAND: test-compress
 **
-** Usage: %fossil test-compress INPUTFILE OUTPUTFILE
+** Usage: %fossil test-compress ?--zstd? INPUTFILE OUTPUTFILE
 **
 ** Run compression on INPUTFILE and write the result into OUTPUTFILE.
 **
-** This is used to test and debug the blob_compress() routine.
+** This is used to test and debug the blob_compress() routine.  With
+** the --zstd option, blob_compress_zstd() is used instead.
 */
 void compress_cmd(void){
   Blob f;
-  if( g.argc!=4 ) usage("INPUTFILE OUTPUTFILE");
+  int bZstd = find_option("zstd",0,0)!=0;
+  if( g.argc!=4 ) usage("?--zstd? INPUTFILE OUTPUTFILE");
   blob_read_from_file(&f, g.argv[2], ExtFILE);
-  blob_compress(&f, &f);
+  if( bZstd ){
+#if defined(FOSSIL_ENABLE_ZSTD)
+    blob_compress_zstd(&f, &f);
+#else
+    fossil_fatal("this fossil was built without Zstandard support");
+#endif
+  }else{
+    blob_compress(&f, &f);
+  }
   blob_write_to_file(&f, g.argv[3]);
 }
 
@@ -1153,20 +1166,103 @@ int blob_uncompress(Blob *pIn, Blob *pOut){
   return 0;
 }
 
+#if defined(FOSSIL_ENABLE_ZSTD)
+/*
+** Compression level used by blob_compress_zstd().  Sync messages are
+** compressed once and sent once, so a fast level is the right choice.
+*/
+#define BLOB_ZSTD_LEVEL 3
+
+/*
+** Compress blob pIn using Zstandard and store the result in pOut.  As
+** with blob_compress(), the first four bytes of the output hold the
+** size of the uncompressed input, big-endian.  It is ok for pIn and
+** pOut to be the same blob.
+**
+** pOut must be either uninitialized or the same as pIn.
+*/
+void blob_compress_zstd(Blob *pIn, Blob *pOut){
+  unsigned int nIn = blob_size(pIn);
+  size_t nOut = ZSTD_compressBound(nIn);
+  unsigned char *outBuf;
+  Blob temp;
+  blob_zero(&temp);
+  blob_resize(&temp, nOut+4);
+  outBuf = (unsigned char*)blob_buffer(&temp);
+  outBuf[0] = nIn>>24 & 0xff;
+  outBuf[1] = nIn>>16 & 0xff;
+  outBuf[2] = nIn>>8 & 0xff;
+  outBuf[3] = nIn & 0xff;
+  nOut = ZSTD_compress(&outBuf[4], nOut, blob_buffer(pIn), nIn,
+                       BLOB_ZSTD_LEVEL);
+  if( ZSTD_isError(nOut) ){
+    fossil_fatal("zstd compression failed: %s", ZSTD_getErrorName(nOut));
+  }
+  blob_resize(&temp, nOut+4);
+  if( pOut==pIn ) blob_reset(pOut);
+  assert_blob_is_reset(pOut);
+  *pOut = temp;
+}
+
+/*
+** Uncompress blob pIn, which was compressed by blob_compress_zstd(),
+** and store the result in pOut.  It is ok for pIn and pOut to be the
+** same blob.  Return 0 on success and 1 if pIn is not valid.
+**
+** pOut must be either uninitialized or the same as pIn.
+*/
+int blob_uncompress_zstd(Blob *pIn, Blob *pOut){
+  unsigned int nOut;
+  unsigned char *inBuf;
+  unsigned int nIn = blob_size(pIn);
+  size_t rc;
+  Blob temp;
+  if( nIn<=4 ){
+    return 0;
+  }
+  inBuf = (unsigned char*)blob_buffer(pIn);
+  nOut = (inBuf[0]<<24) + (inBuf[1]<<16) + (inBuf[2]<<8) + inBuf[3];
+  blob_zero(&temp);
+  blob_resize(&temp, nOut+1);
+  rc = ZSTD_decompress(blob_buffer(&temp), nOut, &inBuf[4], nIn - 4);
+  if( ZSTD_isError(rc) || rc!=nOut ){
+    blob_reset(&temp);
+    return 1;
+  }
+  blob_resize(&temp, nOut);
+  if( pOut==pIn ) blob_reset(pOut);
+  assert_blob_is_reset(pOut);
+  *pOut = temp;
+  return 0;
+}
+#endif /* FOSSIL_ENABLE_ZSTD */
+
 /*
 ** COMMAND: test-uncompress
 **
-** Usage: %fossil test-uncompress IN OUT
+** Usage: %fossil test-uncompress ?--zstd? IN OUT
 **
 ** Read the content of file IN, uncompress that content, and write the
 ** result into OUT.  This command is intended for testing of the
-** blob_compress() function.
+** blob_compress() function, or of blob_compress_zstd() with the
+** --zstd option.
 */
 void uncompress_cmd(void){
   Blob f;
-  if( g.argc!=4 ) usage("INPUTFILE OUTPUTFILE");
+  int bZstd = find_option("zstd",0,0)!=0;
+  if( g.argc!=4 ) usage("?--zstd? INPUTFILE OUTPUTFILE");
   blob_read_from_file(&f, g.argv[2], ExtFILE);
-  blob_uncompress(&f, &f);
+  if( bZstd ){
+#if defined(FOSSIL_ENABLE_ZSTD)
+    if( blob_uncompress_zstd(&f, &f) ){
+      fossil_fatal("not a valid Zstandard compressed file");
+    }
+#else
+    fossil_fatal("this fossil was built without Zstandard support");
+#endif
+  }else{
+    blob_uncompress(&f, &f);
+  }
   blob_write_to_file(&f, g.argv[3]);
 }
 
@@ -145,6 +145,7 @@ void page_dir(void){
   int rid = 0;
   char *zUuid = 0;
   Manifest *pM = 0;
+  ManifestIndex *pIdx = 0;
   const char *zSubdirLink;
   int linkTrunk = 1;
   int linkTip = 1;
@@ -162,13 +163,16 @@ void page_dir(void){
   /* If the name= parameter is an empty string, make it a NULL pointer */
   if( zD && strlen(zD)==0 ){ zD = 0; }
 
-  /* If a specific check-in is requested, fetch and parse it.  If the
-  ** specific check-in does not exist, clear zCI.  zCI==0 will cause all
-  ** files from all check-ins to be displayed.
+  /* If a specific check-in is requested, fetch and parse it, or use
+  ** its file index if it has one.  If the specific check-in does not
+  ** exist, clear zCI.  zCI==0 will cause all files from all check-ins
+  ** to be displayed.
   */
   if( zCI ){
-    pM = manifest_get_by_name(zCI, &rid);
-    if( pM ){
+    rid = name_to_typed_rid(zCI, "ci");
+    if( is_a_version(rid) ) pIdx = manifest_index_get(rid);
+    if( pIdx==0 ) pM = manifest_get_by_name(zCI, &rid);
+    if( pM || pIdx ){
       int trunkRid = symbolic_name_to_rid("tag:trunk", "ci");
       linkTrunk = trunkRid && rid != trunkRid;
       linkTip = rid != symbolic_name_to_rid("tip", "ci");
@@ -261,23 +265,26 @@ void page_dir(void){
   if( zCI ){
     Stmt ins;
     ManifestFile *pFile;
-    ManifestFile *pPrev = 0;
+    ManifestFile sFile;
+    const char *zPrev = 0;
     int nPrev = 0;
+    int iFile = 0;
     int c;
 
     db_prepare(&ins,
        "INSERT OR IGNORE INTO localfiles VALUES(pathelement(:x,0), :u)"
     );
-    manifest_file_rewind(pM);
-    while( (pFile = manifest_file_next(pM,0))!=0 ){
+    if( pM ) manifest_file_rewind(pM);
+    while( (pFile = pIdx ? manifest_index_next(pIdx, &iFile, &sFile)
+                         : manifest_file_next(pM,0))!=0 ){
       if( nD>0
        && (fossil_strncmp(pFile->zName, zD, nD-1)!=0
            || pFile->zName[nD-1]!='/')
       ){
         continue;
       }
-      if( pPrev
-       && fossil_strncmp(&pFile->zName[nD],&pPrev->zName[nD],nPrev)==0
+      if( zPrev
+       && fossil_strncmp(&pFile->zName[nD],&zPrev[nD],nPrev)==0
        && (pFile->zName[nD+nPrev]==0 || pFile->zName[nD+nPrev]=='/')
       ){
         continue;
@@ -286,8 +293,8 @@ void page_dir(void){
       db_bind_text(&ins, ":u", pFile->zUuid);
       db_step(&ins);
       db_reset(&ins);
-      pPrev = pFile;
-      for(nPrev=0; (c=pPrev->zName[nD+nPrev]) && c!='/'; nPrev++){}
+      zPrev = pFile->zName;
+      for(nPrev=0; (c=zPrev[nD+nPrev]) && c!='/'; nPrev++){}
       if( c=='/' ) nPrev++;
     }
     db_finalize(&ins);
@@ -332,6 +339,7 @@ void page_dir(void){
   }
   db_finalize(&q);
   manifest_destroy(pM);
+  manifest_index_free(pIdx);
   @ </ul></div>
 
   /* If the "noreadme" query parameter is present, do not try to
@@ -637,6 +645,7 @@ void page_tree(void){
   char *zUuid = 0;
   Blob dirname;
   Manifest *pM = 0;
+  ManifestIndex *pIdx = 0;
   double rNow = 0;
   char *zNow = 0;
   int useMtime = atoi(PD("mtime","0"));
@@ -690,13 +699,16 @@ void page_tree(void){
   /* If the name= parameter is an empty string, make it a NULL pointer */
   if( zD && strlen(zD)==0 ){ zD = 0; }
 
-  /* If a specific check-in is requested, fetch and parse it.  If the
-  ** specific check-in does not exist, clear zCI.  zCI==0 will cause all
-  ** files from all check-ins to be displayed.
+  /* If a specific check-in is requested, make sure that it exists.  Use
+  ** its file index for that if it has one, rather than parsing it.  If
+  ** the specific check-in does not exist, clear zCI.  zCI==0 will cause
+  ** all files from all check-ins to be displayed.
   */
   if( zCI ){
-    pM = manifest_get_by_name(zCI, &rid);
-    if( pM ){
+    rid = name_to_typed_rid(zCI, "ci");
+    if( is_a_version(rid) ) pIdx = manifest_index_get(rid);
+    if( pIdx==0 ) pM = manifest_get_by_name(zCI, &rid);
+    if( pM || pIdx ){
       int trunkRid = symbolic_name_to_rid("tag:trunk", "ci");
       linkTrunk = trunkRid && rid != trunkRid;
       linkTip = rid != symbolic_name_to_rid("tip", "ci");
@@ -916,6 +928,8 @@ void page_tree(void){
   @ </ul></div>
   builtin_request_js("tree.js");
   style_footer();
+  manifest_destroy(pM);
+  manifest_index_free(pIdx);
 
   /* We could free memory used by sTree here if we needed to.  But
   ** the process is about to exit, so doing so would not really accomplish
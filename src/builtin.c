@@ -227,8 +227,25 @@ static struct {
   int nReq;            /* Number of slots in aReq[] currently used */
   int nSent;           /* Number of slots in aReq[] fulfilled */
   int eDelivery;       /* Delivery mechanism */
+  int bBootstrap;      /* The window.fossil object has been emitted */
+  int bFossilJs;       /* builtin_emit_fossil_js_once() has been called */
+  int bBundled;        /* All fossil.*.js files have been bundled */
 } builtin;
 
+/*
+** Forget which javascript files have been requested, so that a
+** server process can generate another page, and return to delivery
+** mode eDelivery, since a page might have changed it.
+*/
+void builtin_reset_request(int eDelivery){
+  builtin.eDelivery = eDelivery;
+  builtin.nReq = 0;
+  builtin.nSent = 0;
+  builtin.bBootstrap = 0;
+  builtin.bFossilJs = 0;
+  builtin.bBundled = 0;
+}
+
 #if INTERFACE
 /* Various delivery mechanisms.  The 0 option is the default.
 */
@@ -304,6 +321,19 @@ void builtin_request_js(const char *zFilename){
   builtin.aReq[builtin.nReq++] = i;
 }
 
+/*
+** Return true if the javascript file named by zFilename has already
+** been requested for the current page.
+*/
+static int builtin_js_is_requested(const char *zFilename){
+  int i = builtin_file_index(zFilename);
+  int j;
+  for(j=0; j<builtin.nReq; j++){
+    if( builtin.aReq[j]==i ) return 1;
+  }
+  return 0;
+}
+
 /*
 ** Fulfill all pending requests for javascript files.
 **
@@ -588,8 +618,7 @@ int builtin_vtab_register(sqlite3 *db){
 ** 2) Emits the static fossil.bootstrap.js using builtin_request_js().
 */
 void builtin_emit_script_fossil_bootstrap(int addScriptTag){
-  static int once = 0;
-  if(0==once++){
+  if(0==builtin.bBootstrap++){
     char * zName;
     /* Set up the generic/app-agnostic parts of window.fossil
     ** which require C-level state... */
@@ -685,30 +714,28 @@ void builtin_emit_script_fossil_bootstrap(int addScriptTag){
 ** re-queue them later are harmless no-ops.
 */
 static int builtin_emit_fossil_js_once(const char * zName){
-  static int once = 0;
   int i;
-  static struct FossilJs {
+  static const struct FossilJs {
     const char * zName; /* NAME part of fossil.NAME.js */
-    int emitted;        /* True if already emitted. */
     const char * zDeps; /* \0-delimited list of other FossilJs
                         ** entries: all known deps of this one. Each
                         ** REQUIRES an EXPLICIT trailing \0, including
                         ** the final one! */
   } fjs[] = {
   /* This list ordering isn't strictly important. */
-  {"confirmer",      0, 0},
-  {"copybutton",     0, "dom\0"},
-  {"dom",            0, 0},
-  {"fetch",          0, 0},
-  {"numbered-lines", 0, "popupwidget\0copybutton\0"},
-  {"pikchr",         0, "dom\0"},
-  {"popupwidget",    0, "dom\0"},
-  {"storage",        0, 0},
-  {"tabs",           0, "dom\0"}
+  {"confirmer",      0},
+  {"copybutton",     "dom\0"},
+  {"dom",            0},
+  {"fetch",          0},
+  {"numbered-lines", "popupwidget\0copybutton\0"},
+  {"pikchr",         "dom\0"},
+  {"popupwidget",    "dom\0"},
+  {"storage",        0},
+  {"tabs",           "dom\0"}
   };
   const int nFjs = sizeof(fjs) / sizeof(fjs[0]);
-  if(0==once){
-    ++once;
+  if(0==builtin.bFossilJs){
+    ++builtin.bFossilJs;
     builtin_emit_script_fossil_bootstrap(1);
   }
   if(0==zName){
@@ -719,10 +746,12 @@ static int builtin_emit_fossil_js_once(const char * zName){
   }
   for( i = 0; i < nFjs; ++i ){
     if(0==strcmp(zName, fjs[i].zName)){
-      if(fjs[i].emitted){
+      char nameBuffer[50];
+      sqlite3_snprintf(sizeof(nameBuffer)-1, nameBuffer,
+                       "fossil.%s.js", fjs[i].zName);
+      if(builtin_js_is_requested(nameBuffer)){
         return -1;
       }else{
-        char nameBuffer[50];
         if(fjs[i].zDeps){
           const char * zDep = fjs[i].zDeps;
           while(*zDep!=0){
@@ -730,10 +759,7 @@ static int builtin_emit_fossil_js_once(const char * zName){
             zDep += strlen(zDep)+1/*NUL delimiter*/;
           }
         }
-        sqlite3_snprintf(sizeof(nameBuffer)-1, nameBuffer,
-                         "fossil.%s.js", fjs[i].zName);
         builtin_request_js(nameBuffer);
-        fjs[i].emitted = 1;
         return 1;
       }
     }
@@ -853,13 +879,12 @@ void test_js_once(void){
 ** emitted the next time builtin_fulfill_js_requests() is called.
 */
 void builtin_fossil_js_bundle_or( const char * zApi, ... ) {
-  static int bundled = 0;
   const char *zArg;
   va_list vargs;
 
   if(JS_BUNDLED == builtin_get_js_delivery_mode()){
-    if(!bundled){
-      bundled = 1;
+    if(!builtin.bBundled){
+      builtin.bBundled = 1;
       builtin_emit_fossil_js_once(0);
       builtin_fulfill_js_requests();
     }
@@ -15,7 +15,11 @@
 *******************************************************************************
 **
 ** This file implements a cache for expense operations such as
-** /zip and /tarball.
+** /zip and /tarball.  The same cache file also holds fully expanded
+** copies of artifacts that are expensive to reconstruct because they
+** sit at the end of long delta chains, the results of annotating
+** files, and the packs of artifacts that are sent to clients that
+** clone the repository.
 */
 #include "config.h"
 #include <sqlite3.h>
@@ -38,6 +42,25 @@ static char *cacheName(void){
   return mprintf("%.*s.cache", i, g.zRepositoryName);
 }
 
+/*
+** Return true if the cache database db lacks some of the tables and
+** columns that cacheOpen() creates.  The IEND column of the clonepack
+** table is the most recent addition to the schema.
+*/
+static int cacheSchemaIsStale(sqlite3 *db){
+  sqlite3_stmt *pStmt = 0;
+  int rc = 1;
+  if( sqlite3_prepare_v2(db,
+         "SELECT 1 FROM pragma_table_info('clonepack') WHERE name='iend'",
+         -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+  ){
+    rc = 0;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
 /*
 ** Attempt to open the cache database, if such a database exists.
 ** Make sure the cache table exists within that database.
@@ -64,22 +87,59 @@ static sqlite3 *cacheOpen(int bForce){
     return 0;
   }
   sqlite3_busy_timeout(db, 5000);
-  if( sqlite3_table_column_metadata(db,0,"blob","key",0,0,0,0,0)!=SQLITE_OK ){
+  if( cacheSchemaIsStale(db) ){
     rc = sqlite3_exec(db,
        "PRAGMA page_size=8192;"
+       "DROP TABLE IF EXISTS clonepack;" /* Older packs lack IEND */
        "CREATE TABLE IF NOT EXISTS blob(id INTEGER PRIMARY KEY, data BLOB);"
        "CREATE TABLE IF NOT EXISTS cache("
          "key TEXT PRIMARY KEY,"     /* Key used to access the cache */
          "id INT REFERENCES blob,"   /* The cache content */
          "sz INT,"                   /* Size of content in bytes */
          "tm INT,"                   /* Last access time (unix timestampe) */
-         "nref INT"                  /* Number of uses */
+         "nref INT,"                 /* Number of uses */
+         "cost INT"                  /* Milliseconds taken to build it */
        ");"
        "CREATE TRIGGER IF NOT EXISTS cacheDel AFTER DELETE ON cache BEGIN"
        "  DELETE FROM blob WHERE id=OLD.id;"
-       "END;",
+       "END;"
+       "CREATE TABLE IF NOT EXISTS artifact("
+         "hash TEXT PRIMARY KEY,"    /* Artifact hash */
+         "data BLOB,"                /* Fully expanded artifact content */
+         "sz INT,"                   /* Size of content in bytes */
+         "tm INT"                    /* Last access time (unix timestamp) */
+       ");"
+       "CREATE INDEX IF NOT EXISTS artifactTm ON artifact(tm,sz);"
+       "CREATE TABLE IF NOT EXISTS annotation("
+         "key TEXT PRIMARY KEY,"     /* Check-in, flags and filename */
+         "data BLOB,"                /* Encoded annotation */
+         "tm INT"                    /* Last access time (unix timestamp) */
+       ");"
+       "CREATE TABLE IF NOT EXISTS mindex("
+         "hash TEXT PRIMARY KEY,"    /* Check-in hash */
+         "data BLOB,"                /* Binary file index */
+         "tm INT"                    /* Last access time (unix timestamp) */
+       ");"
+       "CREATE TABLE IF NOT EXISTS clonepack("
+         "seqno INTEGER PRIMARY KEY," /* First sequence number in the pack */
+         "iend INT,"                 /* Sequence number after the last one */
+         "summary TEXT,"             /* Summary of the BLOB rows packed */
+         "data BLOB,"                /* The pack */
+         "tm INT"                    /* Last access time (unix timestamp) */
+       ");"
+       "CREATE TABLE IF NOT EXISTS cachestat("
+         "name TEXT PRIMARY KEY,"    /* Name of the statistic */
+         "n INT"                     /* Its value */
+       ");",
        0, 0, 0
     );
+    if( rc==SQLITE_OK
+     && sqlite3_table_column_metadata(db,0,"cache","cost",0,0,0,0,0)
+          !=SQLITE_OK
+    ){
+      /* A cache file from before build costs were recorded */
+      rc = sqlite3_exec(db, "ALTER TABLE cache ADD COLUMN cost INT", 0,0,0);
+    }
     if( rc!=SQLITE_OK ){
       sqlite3_close(db);
       return 0;
@@ -88,6 +148,17 @@ static sqlite3 *cacheOpen(int bForce){
   return db;
 }
 
+/*
+** Return true if the cache database exists, so that content handed
+** to cache_write() will be kept.
+*/
+int cache_is_enabled(void){
+  char *zDbName = cacheName();
+  int rc = zDbName!=0 && file_size(zDbName, ExtFILE)>0;
+  fossil_free(zDbName);
+  return rc;
+}
+
 /*
 ** Attempt to construct a prepared statement for the cache database.
 */
@@ -138,12 +209,54 @@ static void cache_register_sizename(sqlite3 *db){
                           cache_sizename, 0, 0);
 }
 
+/*
+** Add n to the statistic zName in the cache file.
+*/
+static void cache_stat_add(sqlite3 *db, const char *zName, i64 n){
+  sqlite3_stmt *pStmt = cacheStmt(db,
+     "INSERT INTO cachestat(name,n) VALUES(?1,?2)"
+     " ON CONFLICT(name) DO UPDATE SET n=n+excluded.n");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zName, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(pStmt, 2, n);
+    sqlite3_step(pStmt);
+    sqlite3_finalize(pStmt);
+  }
+}
+
+/*
+** Return the value of statistic zName from the cache file.
+*/
+static i64 cache_stat(sqlite3 *db, const char *zName){
+  sqlite3_stmt *pStmt = cacheStmt(db,
+     "SELECT n FROM cachestat WHERE name=?1");
+  i64 n = 0;
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zName, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ) n = sqlite3_column_int64(pStmt, 0);
+    sqlite3_finalize(pStmt);
+  }
+  return n;
+}
+
+/*
+** The order in which entries are kept in the cache, most valuable
+** first.  This is approximately LRU (least recently used).  However,
+** each access of an entry buys that entry an extra hour of grace, and
+** each second that it took to build buys it ten minutes, so that
+** entries that are popular or costly to rebuild are held longer.  Each
+** kind of grace is limited to 2 days worth.
+*/
+#define CACHE_PRIORITY \
+  "(tm + 3600*min(nRef,48) + min(600*coalesce(cost,0)/1000,172800))"
+
 /*
 ** Attempt to write pContent into the cache.  If the cache file does
 ** not exist, then this routine is a no-op.  Older cache entries might
-** be deleted.
+** be deleted.  msCost is the number of milliseconds that it took to
+** build pContent.
 */
-void cache_write(Blob *pContent, const char *zKey){
+void cache_write(Blob *pContent, const char *zKey, i64 msCost){
   sqlite3 *db;
   sqlite3_stmt *pStmt;
   int rc = 0;
@@ -160,32 +273,29 @@ void cache_write(Blob *pContent, const char *zKey){
   if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_write_end;
   sqlite3_finalize(pStmt);
   pStmt = cacheStmt(db,
-      "INSERT OR IGNORE INTO cache(key,sz,tm,nref,id)"
-      "VALUES(?1,?2,strftime('%s','now'),1,?3)"
+      "INSERT OR IGNORE INTO cache(key,sz,tm,nref,id,cost)"
+      "VALUES(?1,?2,strftime('%s','now'),1,?3,?4)"
   );
   if( pStmt==0 ) goto cache_write_end;
   sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
   sqlite3_bind_int(pStmt, 2, blob_size(pContent));
   sqlite3_bind_int(pStmt, 3, sqlite3_last_insert_rowid(db));
+  sqlite3_bind_int64(pStmt, 4, msCost);
   if( sqlite3_step(pStmt)!=SQLITE_DONE) goto cache_write_end;
   rc = sqlite3_changes(db);
 
   /* If the write was successful, truncate the cache to keep at most
-  ** max-cache-entry entries in the cache.
-  **
-  ** The cache entry replacement algorithm is approximately LRU
-  ** (least recently used).  However, each access of an entry buys
-  ** that entry an extra hour of grace, so that more commonly accessed
-  ** entries are held in cache longer.  The extra "grace" allotted to
-  ** an entry is limited to 2 days worth.
+  ** max-cache-entry entries in the cache, in CACHE_PRIORITY order.
   */
   if( rc ){
+    cache_stat_add(db, "builds", 1);
+    cache_stat_add(db, "build-ms", msCost);
     nKeep = db_get_int("max-cache-entry",10);
     sqlite3_finalize(pStmt);
     pStmt = cacheStmt(db,
                  "DELETE FROM cache WHERE rowid IN ("
                     "SELECT rowid FROM cache"
-                    " ORDER BY (tm + 3600*min(nRef,48)) DESC"
+                    " ORDER BY " CACHE_PRIORITY " DESC"
                     " LIMIT -1 OFFSET ?1)");
     if( pStmt ){
       sqlite3_bind_int(pStmt, 1, nKeep);
@@ -225,7 +335,7 @@ int cache_read(Blob *pContent, const char *zKey){
     blob_append(pContent, sqlite3_column_blob(pStmt, 0),
                           sqlite3_column_bytes(pStmt, 0));
     rc = 1;
-    sqlite3_reset(pStmt);
+    sqlite3_finalize(pStmt);
     pStmt = cacheStmt(db,
               "UPDATE cache SET nref=nref+1, tm=strftime('%s','now')"
               " WHERE key=?1");
@@ -235,12 +345,656 @@ int cache_read(Blob *pContent, const char *zKey){
     }
   }
   sqlite3_finalize(pStmt);
+  cache_stat_add(db, rc ? "hits" : "misses", 1);
 cache_read_done:
   sqlite3_exec(db, "COMMIT", 0, 0, 0);
   sqlite3_close(db);
   return rc;
 }
 
+/*
+** Archive pre-generation.
+**
+** If the archive-pregen setting names any of the "tarball", "zip" and
+** "sqlar" pages, the backoffice builds those archives ahead of time for
+** the newest check-ins that are tagged "release" or that are the tips
+** of open branches, so that the first person to download a new release
+** does not have to wait for it.  The archives are cached under the
+** same keys as the download links on the /info page.  At most half of
+** max-cache-entry goes to these archives.  Those that are still wanted
+** are touched on every run so that they stay in the cache, while older
+** releases drop off the list and age out in the usual way.
+**
+** Each run of the backoffice builds at most one archive.  Return the
+** number built.
+*/
+int cache_backoffice(void){
+  static const char *const azPage[] = { "tarball", "zip", "sqlar" };
+  const char *azWant[count(azPage)];
+  char *zPregen;
+  Glob *pGlob;
+  sqlite3 *db;
+  sqlite3_stmt *pTouch;
+  Stmt q;
+  char *zPJ;
+  int *aRid;
+  char **azUuid;
+  int nWant = 0, nCkin, nBuilt = 0, i, j, n = 0;
+
+  zPregen = db_get("archive-pregen", 0);
+  pGlob = glob_create(zPregen);
+  fossil_free(zPregen);
+  for(i=0; i<count(azPage); i++){
+    if( glob_match(pGlob, azPage[i]) ) azWant[nWant++] = azPage[i];
+  }
+  glob_free(pGlob);
+  if( nWant==0 ) return 0;
+  nCkin = db_get_int("max-cache-entry",10)/2/nWant;
+  if( nCkin<=0 ) return 0;
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  pTouch = cacheStmt(db,
+     "UPDATE cache SET tm=strftime('%s','now') WHERE key=?1");
+  if( pTouch==0 ){
+    sqlite3_close(db);
+    return 0;
+  }
+  zPJ = archive_project_name();
+  aRid = fossil_malloc( sizeof(aRid[0])*nCkin );
+  azUuid = fossil_malloc( sizeof(azUuid[0])*nCkin );
+  db_prepare(&q,
+     "SELECT blob.rid, blob.uuid FROM event, blob"
+     " WHERE blob.rid=event.objid"
+     "   AND event.objid IN ("
+     "     SELECT rid FROM tagxref"
+     "      WHERE tagid=(SELECT tagid FROM tag WHERE tagname='sym-release')"
+     "        AND tagtype>0"
+     "     UNION"
+     "     SELECT rid FROM leaf"
+     "      WHERE NOT EXISTS(SELECT 1 FROM tagxref"
+     "                        WHERE rid=leaf.rid AND tagid=%d AND tagtype>0))"
+     " ORDER BY event.mtime DESC LIMIT %d",
+     TAG_CLOSED, nCkin
+  );
+  while( n<nCkin && db_step(&q)==SQLITE_ROW ){
+    aRid[n] = db_column_int(&q, 0);
+    azUuid[n++] = fossil_strdup(db_column_text(&q, 1));
+  }
+  db_finalize(&q);
+  for(j=0; j<n; j++){
+    for(i=0; i<nWant; i++){
+      char *zName = mprintf("%s-%S", zPJ, azUuid[j]);
+      char *zKey = mprintf("/%s/%s/%q", azWant[i], azUuid[j], zName);
+      sqlite3_bind_text(pTouch, 1, zKey, -1, SQLITE_STATIC);
+      sqlite3_step(pTouch);
+      sqlite3_reset(pTouch);
+      if( sqlite3_changes(db)==0 && nBuilt==0 ){
+        Blob archive;
+        i64 tmStart = current_time_in_milliseconds();
+        blob_zero(&archive);
+        archive_of_checkin(azWant[i], aRid[j], zName, &archive);
+        cache_write(&archive, zKey, current_time_in_milliseconds()-tmStart);
+        cache_stat_add(db, "prebuilt", 1);
+        blob_reset(&archive);
+        nBuilt++;
+      }
+      fossil_free(zKey);
+      fossil_free(zName);
+    }
+    fossil_free(azUuid[j]);
+  }
+  fossil_free(aRid);
+  fossil_free(azUuid);
+  fossil_free(zPJ);
+  sqlite3_finalize(pTouch);
+  sqlite3_close(db);
+  return nBuilt;
+}
+
+/*
+** The materialized-artifact cache.
+**
+** content_get() reconstructs an artifact by applying every delta in
+** its chain.  When that chain is long, the fully expanded artifact is
+** saved in the "artifact" table of the cache file so that the next
+** request (perhaps from a different process) can skip the work.  Entries
+** are keyed by artifact hash so they never go stale, but they are
+** removed when an artifact is redeltified or purged.
+**
+** The artifact cache is used only if the cache file exists and the
+** max-artifact-cache setting is greater than zero.  A single connection
+** to the cache file is held open for the life of the process since
+** content_get() is called many times per request.
+*/
+static struct {
+  sqlite3 *db;          /* Connection to the cache file.  NULL if disabled */
+  char *zRepo;          /* Repository for which the cache was opened */
+  i64 szMax;            /* Value of the max-artifact-cache setting */
+  i64 szTotal;          /* Size of the cached artifacts.  -1 if unknown */
+} artCache;
+
+/*
+** When the artifact cache grows beyond max-artifact-cache bytes, the
+** least recently used entries are removed until it is below this
+** percentage of that size, so that the work of finding them is not
+** repeated on every write.
+*/
+#define ARTIFACT_CACHE_LOW_PCT 90
+
+/*
+** Close the connection to the materialized-artifact cache, if it is open.
+*/
+void cache_artifact_close(void){
+  sqlite3_close(artCache.db);
+  artCache.db = 0;
+  fossil_free(artCache.zRepo);
+  artCache.zRepo = 0;
+}
+
+/*
+** Return the connection to the materialized-artifact cache, opening
+** it if necessary.  Return NULL if the artifact cache is disabled.
+*/
+static sqlite3 *cacheArtifactDb(void){
+  char *z;
+  if( artCache.zRepo
+   && fossil_strcmp(artCache.zRepo, g.zRepositoryName)==0
+  ){
+    return artCache.db;
+  }
+  cache_artifact_close();
+  if( g.zRepositoryName==0 ) return 0;
+  artCache.zRepo = fossil_strdup(g.zRepositoryName);
+  z = db_get("max-artifact-cache", "0");
+  artCache.szMax = strtoll(z, 0, 10);
+  artCache.szTotal = -1;
+  fossil_free(z);
+  if( artCache.szMax>0 ){
+    artCache.db = cacheOpen(0);
+    if( artCache.db ) sqlite3_busy_timeout(artCache.db, 1000);
+  }
+  return artCache.db;
+}
+
+/*
+** Return true if the materialized-artifact cache is enabled.
+*/
+int cache_artifact_enabled(void){
+  return cacheArtifactDb()!=0;
+}
+
+/*
+** Attempt to read the expanded content of the artifact with hash zHash
+** from the materialized-artifact cache and append it to pContent.  The
+** cached content must be exactly sz bytes in size.  Return non-zero on
+** success and zero if the artifact is not cached.
+*/
+int cache_artifact_read(const char *zHash, int sz, Blob *pContent){
+  sqlite3 *db = cacheArtifactDb();
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+  i64 tm = 0;
+
+  if( db==0 ) return 0;
+  pStmt = cacheStmt(db,
+     "SELECT data, tm<strftime('%s','now')-3600 FROM artifact WHERE hash=?1");
+  if( pStmt==0 ) return 0;
+  sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+  if( sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_bytes(pStmt, 0)==sz
+  ){
+    blob_append(pContent, sqlite3_column_blob(pStmt, 0), sz);
+    tm = sqlite3_column_int(pStmt, 1);
+    rc = 1;
+  }
+  sqlite3_finalize(pStmt);
+
+  /* Refresh the access time at most once per hour, so that repeated
+  ** hits on a popular artifact do not each require a write. */
+  if( tm ){
+    pStmt = cacheStmt(db,
+       "UPDATE artifact SET tm=strftime('%s','now') WHERE hash=?1");
+    if( pStmt ){
+      sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+  }
+  return rc;
+}
+
+/*
+** Return the total size of the artifacts in the materialized-artifact
+** cache, as recorded in the cache file.  The artifactTm index covers
+** this query, so the content itself is not read.
+*/
+static i64 cache_artifact_total(sqlite3 *db){
+  sqlite3_stmt *pStmt = cacheStmt(db,
+     "SELECT total(sz) FROM artifact INDEXED BY artifactTm");
+  i64 n = 0;
+  if( pStmt ){
+    if( sqlite3_step(pStmt)==SQLITE_ROW ) n = sqlite3_column_int64(pStmt, 0);
+    sqlite3_finalize(pStmt);
+  }
+  return n;
+}
+
+/*
+** Remove the least recently used entries from the materialized-artifact
+** cache until its total size is no more than szLow.
+**
+** The entries to remove are all chosen before any of them is deleted,
+** since deleting rows from a table while a query on that same table is
+** still being stepped gives undefined results.
+*/
+static void cache_artifact_evict(sqlite3 *db, i64 szLow){
+  sqlite3_stmt *pList, *pDel;
+  i64 *aRowid = 0;
+  int nRowid = 0, nAlloc = 0, i;
+  i64 szTotal = artCache.szTotal;
+
+  pList = cacheStmt(db, "SELECT rowid, sz FROM artifact ORDER BY tm");
+  if( pList==0 ) return;
+  while( szTotal>szLow && sqlite3_step(pList)==SQLITE_ROW ){
+    if( nRowid>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aRowid = fossil_realloc(aRowid, nAlloc*sizeof(aRowid[0]));
+    }
+    aRowid[nRowid++] = sqlite3_column_int64(pList, 0);
+    szTotal -= sqlite3_column_int64(pList, 1);
+  }
+  sqlite3_finalize(pList);
+  pDel = cacheStmt(db, "DELETE FROM artifact WHERE rowid=?1");
+  if( pDel ){
+    for(i=0; i<nRowid; i++){
+      sqlite3_bind_int64(pDel, 1, aRowid[i]);
+      sqlite3_step(pDel);
+      sqlite3_reset(pDel);
+    }
+    sqlite3_finalize(pDel);
+    artCache.szTotal = szTotal;
+  }
+  fossil_free(aRowid);
+}
+
+/*
+** Save the expanded content of artifact zHash in the materialized-artifact
+** cache.  The least recently used entries are removed as necessary to
+** keep the total size of the cache within max-artifact-cache bytes.
+**
+** The total size is tracked as entries are added.  Other processes
+** might be adding entries too, so the total is only read from the
+** cache file again when it appears to exceed the limit.
+*/
+void cache_artifact_write(const char *zHash, Blob *pContent){
+  sqlite3 *db = cacheArtifactDb();
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  if( db==0 || blob_size(pContent)>artCache.szMax ) return;
+  if( sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0)!=SQLITE_OK ) return;
+  if( artCache.szTotal<0 ) artCache.szTotal = cache_artifact_total(db);
+
+  /* An entry that is already present is replaced, so its size no longer
+  ** counts toward the total. */
+  pStmt = cacheStmt(db, "SELECT sz FROM artifact WHERE hash=?1");
+  if( pStmt==0 ) goto cache_artifact_write_end;
+  sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+  if( sqlite3_step(pStmt)==SQLITE_ROW ){
+    artCache.szTotal -= sqlite3_column_int64(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+
+  pStmt = cacheStmt(db,
+     "REPLACE INTO artifact(hash,data,sz,tm)"
+     " VALUES(?1,?2,?3,strftime('%s','now'))");
+  if( pStmt==0 ) goto cache_artifact_write_end;
+  sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(pStmt, 2, blob_buffer(pContent), blob_size(pContent),
+                    SQLITE_STATIC);
+  sqlite3_bind_int(pStmt, 3, blob_size(pContent));
+  if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_artifact_write_end;
+  rc = 1;
+  artCache.szTotal += blob_size(pContent);
+  if( artCache.szTotal>artCache.szMax ){
+    artCache.szTotal = cache_artifact_total(db);
+    if( artCache.szTotal>artCache.szMax ){
+      cache_artifact_evict(db, artCache.szMax/100*ARTIFACT_CACHE_LOW_PCT);
+    }
+  }
+
+cache_artifact_write_end:
+  sqlite3_finalize(pStmt);
+  sqlite3_exec(db, rc ? "COMMIT" : "ROLLBACK", 0, 0, 0);
+  if( !rc ) artCache.szTotal = -1;
+}
+
+/*
+** Remove the artifact with hash zHash from the materialized-artifact
+** cache, if it is there.
+*/
+void cache_artifact_invalidate(const char *zHash){
+  sqlite3 *db = cacheArtifactDb();
+  sqlite3_stmt *pStmt;
+  if( db==0 ) return;
+  pStmt = cacheStmt(db, "DELETE FROM artifact WHERE hash=?1");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+    sqlite3_step(pStmt);
+    sqlite3_finalize(pStmt);
+  }
+  artCache.szTotal = -1;
+}
+
+/*
+** The annotation cache.
+**
+** Annotating a file with a long history means reconstructing and
+** diffing every ancestor version of the file.  The result is saved in
+** the "annotation" table of the cache file so that the next request
+** for the same file can reuse it, or extend the annotation of an
+** earlier version.  The format of the data is private to the annotation
+** code in diff.c.  Keys include the hash of a check-in, so entries
+** never go stale.  At most max-annotate-cache entries are kept.
+*/
+
+/*
+** Look for each of the nKey keys in azKey[] in the annotation cache, in
+** order.  Put the data for the first one found into pData and return
+** its index.  Return -1 if none of the keys are in the cache, or if
+** there is no cache.
+*/
+int cache_annotation_read(int nKey, char **azKey, Blob *pData){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int i, rc = -1;
+  i64 tm = 0;
+
+  if( nKey<=0 || db_get_int("max-annotate-cache", 1000)<=0 ) return -1;
+  db = cacheOpen(0);
+  if( db==0 ) return -1;
+  pStmt = cacheStmt(db,
+     "SELECT data, tm<strftime('%s','now')-3600 FROM annotation"
+     " WHERE key=?1");
+  for(i=0; pStmt && i<nKey; i++){
+    sqlite3_bind_text(pStmt, 1, azKey[i], -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      blob_append(pData, sqlite3_column_blob(pStmt, 0),
+                         sqlite3_column_bytes(pStmt, 0));
+      tm = sqlite3_column_int(pStmt, 1);
+      rc = i;
+      break;
+    }
+    sqlite3_reset(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  if( tm ){
+    pStmt = cacheStmt(db,
+       "UPDATE annotation SET tm=strftime('%s','now') WHERE key=?1");
+    if( pStmt ){
+      sqlite3_bind_text(pStmt, 1, azKey[rc], -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+  }
+  sqlite3_close(db);
+  return rc;
+}
+
+/*
+** Save pData in the annotation cache under zKey, removing the least
+** recently used entries as necessary.  This is a no-op if there is no
+** cache file.
+*/
+void cache_annotation_write(const char *zKey, Blob *pData){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int nKeep = db_get_int("max-annotate-cache", 1000);
+  int rc = 0;
+
+  if( nKeep<=0 ) return;
+  db = cacheOpen(0);
+  if( db==0 ) return;
+  sqlite3_busy_timeout(db, 10000);
+  sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
+  pStmt = cacheStmt(db,
+     "REPLACE INTO annotation(key,data,tm)"
+     " VALUES(?1,?2,strftime('%s','now'))");
+  if( pStmt==0 ) goto cache_annotation_write_end;
+  sqlite3_bind_text(pStmt, 1, zKey, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(pStmt, 2, blob_buffer(pData), blob_size(pData),
+                    SQLITE_STATIC);
+  if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_annotation_write_end;
+  sqlite3_finalize(pStmt);
+  rc = 1;
+  pStmt = cacheStmt(db,
+     "DELETE FROM annotation WHERE rowid IN ("
+     "  SELECT rowid FROM annotation ORDER BY tm DESC, rowid DESC"
+     "  LIMIT -1 OFFSET ?1)");
+  if( pStmt ){
+    sqlite3_bind_int(pStmt, 1, nKeep);
+    sqlite3_step(pStmt);
+  }
+
+cache_annotation_write_end:
+  sqlite3_finalize(pStmt);
+  sqlite3_exec(db, rc ? "COMMIT" : "ROLLBACK", 0, 0, 0);
+  sqlite3_close(db);
+}
+
+/*
+** Remove all entries from the annotation cache.
+*/
+void cache_annotation_clear(void){
+  sqlite3 *db = cacheOpen(0);
+  if( db==0 ) return;
+  sqlite3_exec(db, "DELETE FROM annotation", 0, 0, 0);
+  sqlite3_close(db);
+}
+
+/*
+** The check-in file index cache.
+**
+** Check-ins with a very large number of files get a binary index of
+** their file list, built by manifest_index_for() in manifest.c.  The
+** index is kept in the "mindex" table of the cache file, keyed by the
+** check-in hash, so entries never go stale.  At most MX_MINDEX_CACHE
+** entries are kept.
+*/
+#ifndef MX_MINDEX_CACHE
+# define MX_MINDEX_CACHE 100
+#endif
+
+/*
+** Put the file index for check-in zHash into pData and return true.
+** Return false if it is not in the cache, or if there is no cache.
+*/
+int cache_mindex_read(const char *zHash, Blob *pData){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  pStmt = cacheStmt(db, "SELECT data FROM mindex WHERE hash=?1");
+  if( pStmt ){
+    sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      blob_append(pData, sqlite3_column_blob(pStmt, 0),
+                         sqlite3_column_bytes(pStmt, 0));
+      rc = 1;
+    }
+    sqlite3_finalize(pStmt);
+  }
+  if( rc ){
+    pStmt = cacheStmt(db,
+       "UPDATE mindex SET tm=strftime('%s','now') WHERE hash=?1");
+    if( pStmt ){
+      sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+  }
+  sqlite3_close(db);
+  return rc;
+}
+
+/*
+** Save the file index pData for check-in zHash, removing the least
+** recently used entries as necessary.  This is a no-op if there is no
+** cache file.
+*/
+void cache_mindex_write(const char *zHash, Blob *pData){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  db = cacheOpen(0);
+  if( db==0 ) return;
+  sqlite3_busy_timeout(db, 10000);
+  sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
+  pStmt = cacheStmt(db,
+     "REPLACE INTO mindex(hash,data,tm)"
+     " VALUES(?1,?2,strftime('%s','now'))");
+  if( pStmt==0 ) goto cache_mindex_write_end;
+  sqlite3_bind_text(pStmt, 1, zHash, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(pStmt, 2, blob_buffer(pData), blob_size(pData),
+                    SQLITE_STATIC);
+  if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_mindex_write_end;
+  sqlite3_finalize(pStmt);
+  rc = 1;
+  pStmt = cacheStmt(db,
+     "DELETE FROM mindex WHERE rowid IN ("
+     "  SELECT rowid FROM mindex ORDER BY tm DESC, rowid DESC"
+     "  LIMIT -1 OFFSET ?1)");
+  if( pStmt ){
+    sqlite3_bind_int(pStmt, 1, MX_MINDEX_CACHE);
+    sqlite3_step(pStmt);
+  }
+
+cache_mindex_write_end:
+  sqlite3_finalize(pStmt);
+  sqlite3_exec(db, rc ? "COMMIT" : "ROLLBACK", 0, 0, 0);
+  sqlite3_close(db);
+}
+
+/*
+** The clone pack cache.
+**
+** Clone protocol 4 sends artifacts in packs of consecutive sequence
+** numbers, built by send_clone_pack() in xfer.c.  Each pack is kept in
+** the "clonepack" table of the cache file under its first sequence
+** number, together with the sequence number that follows it and a
+** summary of the BLOB rows that it was built from.  A pack whose
+** summary no longer matches is built again and replaces the old one,
+** so there is never more than one entry for each first sequence
+** number.  At most max-clone-pack-cache entries are kept.
+*/
+
+/*
+** Put the pack that begins with sequence number iFirst into pData,
+** write the sequence number that follows it into *piEnd, and return
+** true, provided that the pack was built from BLOB rows that match the
+** summary that xSummary() returns for its range of sequence numbers.
+** Return false otherwise, or if there is no cache.
+*/
+int cache_clonepack_read(
+  int iFirst,
+  char *(*xSummary)(int,int),
+  Blob *pData,
+  int *piEnd
+){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int rc = 0;
+
+  if( db_get_int("max-clone-pack-cache", 1000)<=0 ) return 0;
+  db = cacheOpen(0);
+  if( db==0 ) return 0;
+  pStmt = cacheStmt(db,
+     "SELECT iend, summary, data FROM clonepack WHERE seqno=?1");
+  if( pStmt ){
+    sqlite3_bind_int(pStmt, 1, iFirst);
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      int iEnd = sqlite3_column_int(pStmt, 0);
+      char *zSummary = iEnd>iFirst ? xSummary(iFirst, iEnd) : 0;
+      if( zSummary && fossil_strcmp(zSummary,
+                         (const char*)sqlite3_column_text(pStmt, 1))==0 ){
+        blob_append(pData, sqlite3_column_blob(pStmt, 2),
+                           sqlite3_column_bytes(pStmt, 2));
+        *piEnd = iEnd;
+        rc = 1;
+      }
+      fossil_free(zSummary);
+    }
+    sqlite3_finalize(pStmt);
+  }
+  if( rc ){
+    pStmt = cacheStmt(db,
+       "UPDATE clonepack SET tm=strftime('%s','now') WHERE seqno=?1");
+    if( pStmt ){
+      sqlite3_bind_int(pStmt, 1, iFirst);
+      sqlite3_step(pStmt);
+      sqlite3_finalize(pStmt);
+    }
+  }
+  cache_stat_add(db, rc ? "hits" : "misses", 1);
+  sqlite3_close(db);
+  return rc;
+}
+
+/*
+** Save the pack pData that holds sequence numbers iFirst through
+** iEnd-1 and that was built from BLOB rows that match zSummary.  Remove
+** the least recently used packs as necessary.  This is a no-op if there
+** is no cache file.
+*/
+void cache_clonepack_write(
+  int iFirst,
+  int iEnd,
+  const char *zSummary,
+  Blob *pData,
+  i64 msCost
+){
+  sqlite3 *db;
+  sqlite3_stmt *pStmt;
+  int nKeep = db_get_int("max-clone-pack-cache", 1000);
+  int rc = 0;
+
+  if( nKeep<=0 ) return;
+  db = cacheOpen(0);
+  if( db==0 ) return;
+  sqlite3_busy_timeout(db, 10000);
+  sqlite3_exec(db, "BEGIN IMMEDIATE", 0, 0, 0);
+  pStmt = cacheStmt(db,
+     "REPLACE INTO clonepack(seqno,iend,summary,data,tm)"
+     " VALUES(?1,?2,?3,?4,strftime('%s','now'))");
+  if( pStmt==0 ) goto cache_clonepack_write_end;
+  sqlite3_bind_int(pStmt, 1, iFirst);
+  sqlite3_bind_int(pStmt, 2, iEnd);
+  sqlite3_bind_text(pStmt, 3, zSummary, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(pStmt, 4, blob_buffer(pData), blob_size(pData),
+                    SQLITE_STATIC);
+  if( sqlite3_step(pStmt)!=SQLITE_DONE ) goto cache_clonepack_write_end;
+  sqlite3_finalize(pStmt);
+  rc = 1;
+  cache_stat_add(db, "builds", 1);
+  cache_stat_add(db, "build-ms", msCost);
+  pStmt = cacheStmt(db,
+     "DELETE FROM clonepack WHERE rowid IN ("
+     "  SELECT rowid FROM clonepack ORDER BY tm DESC, rowid DESC"
+     "  LIMIT -1 OFFSET ?1)");
+  if( pStmt ){
+    sqlite3_bind_int(pStmt, 1, nKeep);
+    sqlite3_step(pStmt);
+  }
+
+cache_clonepack_write_end:
+  sqlite3_finalize(pStmt);
+  sqlite3_exec(db, rc ? "COMMIT" : "ROLLBACK", 0, 0, 0);
+  sqlite3_close(db);
+}
+
 /*
 ** Create a cache database for the current repository if no such
 ** database already exists.
@@ -269,6 +1023,18 @@ void cache_initialize(void){
 ** The cache is stored in a file that is distinct from the repository
 ** but that is held in the same directory as the repository.  The cache
 ** file can be deleted in order to completely disable the cache.
+**
+** If the max-artifact-cache setting is greater than zero, the cache
+** file also holds expanded copies of artifacts that have long delta
+** chains, up to a total of max-artifact-cache bytes.  The cache file
+** also holds up to max-annotate-cache results of the annotate and
+** blame commands and web pages, file indexes for check-ins that
+** have at least manifest-index files, and up to max-clone-pack-cache
+** packs of artifacts for clients that clone the repository.
+**
+** If the archive-pregen setting is used, the backoffice fills the cache
+** with archives of new releases and of the tips of open branches
+** before anyone asks for them.
 */
 void cache_cmd(void){
   const char *zCmd;
@@ -299,7 +1065,11 @@ void cache_cmd(void){
   }else if( strncmp(zCmd, "clear", nCmd)==0 ){
     db = cacheOpen(0);
     if( db ){
-      sqlite3_exec(db, "DELETE FROM cache; DELETE FROM blob; VACUUM;",0,0,0);
+      sqlite3_exec(db, "DELETE FROM cache; DELETE FROM blob;"
+                       "DELETE FROM artifact; DELETE FROM annotation;"
+                       "DELETE FROM mindex; DELETE FROM clonepack;"
+                       "DELETE FROM cachestat;"
+                       "VACUUM;",0,0,0);
       sqlite3_close(db);
       fossil_print("cache cleared\n");
     }else{
@@ -336,7 +1106,52 @@ void cache_cmd(void){
       fossil_free(zDbName);
     }
   }else if( strncmp(zCmd, "status", nCmd)==0 ){
-    fossil_print("TBD...\n");
+    db = cacheOpen(0);
+    if( db==0 ){
+      fossil_print("cache does not exist\n");
+    }else{
+      char *zDbName = cacheName();
+      cache_register_sizename(db);
+      pStmt = cacheStmt(db,
+           "SELECT 'Pages:', count(*), sizename(coalesce(sum(sz),0))"
+           "  FROM cache"
+           " UNION ALL "
+           "SELECT 'Artifacts:', count(*), sizename(coalesce(sum(sz),0))"
+           "  FROM artifact"
+           " UNION ALL "
+           "SELECT 'Annotations:', count(*),"
+           "       sizename(coalesce(sum(length(data)),0))"
+           "  FROM annotation"
+           " UNION ALL "
+           "SELECT 'File-indexes:', count(*),"
+           "       sizename(coalesce(sum(length(data)),0))"
+           "  FROM mindex"
+           " UNION ALL "
+           "SELECT 'Clone-packs:', count(*),"
+           "       sizename(coalesce(sum(length(data)),0))"
+           "  FROM clonepack"
+      );
+      if( pStmt ){
+        while( sqlite3_step(pStmt)==SQLITE_ROW ){
+          fossil_print("%-13s %6d entries %10s\n",
+             sqlite3_column_text(pStmt, 0),
+             sqlite3_column_int(pStmt, 1),
+             sqlite3_column_text(pStmt, 2));
+        }
+        sqlite3_finalize(pStmt);
+      }
+      fossil_print("Cache-file: %s  Size: %lld\n",
+                   zDbName, file_size(zDbName, ExtFILE));
+      fossil_print("Hits: %lld  Misses: %lld  Builds: %lld (%lld ms)"
+                   "  Pre-built: %lld\n",
+                   cache_stat(db, "hits"), cache_stat(db, "misses"),
+                   cache_stat(db, "builds"), cache_stat(db, "build-ms"),
+                   cache_stat(db, "prebuilt"));
+      sqlite3_close(db);
+      fossil_print("max-artifact-cache: %z\n",
+                   db_get("max-artifact-cache","0"));
+      fossil_free(zDbName);
+    }
   }else{
     fossil_fatal("Unknown subcommand \"%s\"."
                  " Should be one of: clear init list status", zCmd);
@@ -361,11 +1176,26 @@ void cache_page(void){
     @ The web-page cache is disabled for this repository
   }else{
     char *zDbName = cacheName();
+    i64 nHit = cache_stat(db, "hits");
+    i64 nMiss = cache_stat(db, "misses");
+    i64 nBuild = cache_stat(db, "builds");
     cache_register_sizename(db);
+    @ <p>hits: %lld(nHit)
+    @ misses: %lld(nMiss)
+    if( nHit+nMiss>0 ){
+      @ (hit rate %.1f(100.0*nHit/(nHit+nMiss))%%)
+    }
+    @ <br />archives built: %lld(nBuild)
+    if( nBuild>0 ){
+      @ (average build time %lld(cache_stat(db,"build-ms")/nBuild) ms)
+    }
+    @ <br />built ahead of time by the backoffice:
+    @ %lld(cache_stat(db,"prebuilt"))</p>
     pStmt = cacheStmt(db,
-         "SELECT key, sizename(sz), nRef, datetime(tm,'unixepoch')"
+         "SELECT key, sizename(sz), nRef, datetime(tm,'unixepoch'),"
+         "       coalesce(cost,0)"
          "  FROM cache"
-         " ORDER BY (tm + 3600*min(nRef,48)) DESC"
+         " ORDER BY " CACHE_PRIORITY " DESC"
     );
     if( pStmt ){
       @ <ol>
@@ -374,7 +1204,8 @@ void cache_page(void){
         @ <li><p>%z(href("%R/cacheget?key=%T",zName))%h(zName)</a><br />
         @ size: %s(sqlite3_column_text(pStmt,1))
         @ hit-count: %d(sqlite3_column_int(pStmt,2))
-        @ last-access: %s(sqlite3_column_text(pStmt,3))</p></li>
+        @ last-access: %s(sqlite3_column_text(pStmt,3))
+        @ build-time: %d(sqlite3_column_int(pStmt,4)) ms</p></li>
       }
       sqlite3_finalize(pStmt);
       @ </ol>
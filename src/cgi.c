@@ -41,6 +41,9 @@
 # include <sys/time.h>
 # include <sys/wait.h>
 # include <sys/select.h>
+# include <poll.h>
+# include <fcntl.h>
+# include <signal.h>
 #endif
 #ifdef __EMX__
   typedef int socklen_t;
@@ -106,6 +109,18 @@
 static Blob cgiContent[2] = { BLOB_INITIALIZER, BLOB_INITIALIZER };
 static Blob *pContent = &cgiContent[0];
 
+/*
+** A page that generates a large reply can call cgi_stream_begin() to
+** send the HTTP header right away.  After that, the content is sent
+** in pieces of about CGI_STREAM_CHUNK bytes as it is generated, and
+** cgi_reply() only sends what is left.
+*/
+#define CGI_STREAM_CHUNK 65536
+static int cgiStreaming = 0;       /* 1: streaming  2: streaming with gzip */
+static int cgiChunked = 0;         /* Use "Transfer-Encoding: chunked" */
+static Blob *pStreamCopy = 0;      /* Also append streamed content here */
+static void cgi_stream_send(const char*,int,int);
+
 /*
 ** Set the destination buffer into which to accumulate CGI content.
 */
@@ -140,7 +155,15 @@ int cgi_body_contains(const char *zNeedle){
 ** Append reply content to what already exists.
 */
 void cgi_append_content(const char *zData, int nAmt){
+  if( cgiStreaming && nAmt>=CGI_STREAM_CHUNK ){
+    /* Send big pieces of a streamed reply without copying them */
+    cgi_stream_send(zData, nAmt, 0);
+    return;
+  }
   blob_append(pContent, zData, nAmt);
+  if( cgiStreaming && blob_size(pContent)>=CGI_STREAM_CHUNK ){
+    cgi_stream_send(0, 0, 0);
+  }
 }
 
 /*
@@ -193,6 +216,26 @@ static int iReplyStatus = 200;               /* Reply status code */
 static Blob extraHeader = BLOB_INITIALIZER;  /* Extra header text */
 static int rangeStart = 0;                   /* Start of Range: */
 static int rangeEnd = 0;                     /* End of Range: plus 1 */
+static int iHttpMinor = 0;                   /* 1 for HTTP/1.1 requests */
+static int nKeepAlive = 0;                   /* Idle timeout of connection */
+static int cgiKeepAlive = 0;                 /* Keep connection after reply */
+
+/*
+** Allow the connection to stay open after the reply to the next HTTP
+** request, if the client asks for that, and tell the client that it
+** will be closed after nIdle seconds of inactivity.  If nIdle is zero,
+** the connection is closed after the next reply.
+*/
+void cgi_keep_alive(int nIdle){
+  nKeepAlive = nIdle>0 ? nIdle : 0;
+}
+
+/*
+** Return true if the connection stays open after the current reply.
+*/
+int cgi_is_keep_alive(void){
+  return cgiKeepAlive;
+}
 
 /*
 ** Set the reply content type
@@ -201,6 +244,13 @@ void cgi_set_content_type(const char *zType){
   zContentType = mprintf("%s", zType);
 }
 
+/*
+** Return the reply content type
+*/
+const char *cgi_content_type(void){
+  return zContentType;
+}
+
 /*
 ** Set the reply content to the specified BLOB.
 */
@@ -280,10 +330,10 @@ static int is_gzippable(void){
 }
 
 /*
-** Do a normal HTTP reply
+** Send the status line and the header lines that do not depend on
+** the content of the reply.
 */
-void cgi_reply(void){
-  int total_size;
+static void cgi_reply_header(void){
   if( iReplyStatus<=0 ){
     iReplyStatus = 200;
     zReplyStatus = "OK";
@@ -297,9 +347,15 @@ void cgi_reply(void){
       iReplyStatus = 206;
       zReplyStatus = "Partial Content";
     }
-    fprintf(g.httpOut, "HTTP/1.0 %d %s\r\n", iReplyStatus, zReplyStatus);
+    fprintf(g.httpOut, "HTTP/1.%d %d %s\r\n", iHttpMinor,
+            iReplyStatus, zReplyStatus);
     fprintf(g.httpOut, "Date: %s\r\n", cgi_rfc822_datestamp(time(0)));
-    fprintf(g.httpOut, "Connection: close\r\n");
+    if( cgiKeepAlive ){
+      fprintf(g.httpOut, "Connection: keep-alive\r\n");
+      fprintf(g.httpOut, "Keep-Alive: timeout=%d\r\n", nKeepAlive);
+    }else{
+      fprintf(g.httpOut, "Connection: close\r\n");
+    }
     fprintf(g.httpOut, "X-UA-Compatible: IE=edge\r\n");
   }else{
     assert( rangeEnd==0 );
@@ -341,6 +397,162 @@ void cgi_reply(void){
   ** These headers are probably best added by the web server hosting fossil as
   ** a CGI script.
   */
+}
+
+/*
+** Send one piece of a streamed reply.
+*/
+static void cgi_stream_write(const char *z, int n){
+  if( n<=0 ) return;
+  if( cgiChunked ) fprintf(g.httpOut, "%x\r\n", n);
+  fwrite(z, 1, n, g.httpOut);
+  if( cgiChunked ) fprintf(g.httpOut, "\r\n");
+}
+
+/*
+** Pass n bytes of content of a streamed reply to the client, through
+** the compressor if there is one.
+*/
+static void cgi_stream_content(const char *z, int n){
+  if( n<=0 ) return;
+  if( pStreamCopy ) blob_append(pStreamCopy, z, n);
+  if( cgiStreaming==2 ){
+    gzip_step(z, n);
+  }else{
+    cgi_stream_write(z, n);
+  }
+}
+
+/*
+** Send the content accumulated so far in a streamed reply, followed
+** by the n bytes in z.  If bFinal is true, this is the end of the
+** reply.
+*/
+static void cgi_stream_send(const char *z, int n, int bFinal){
+  Blob out;
+  int i;
+  blob_zero(&out);
+  for(i=0; i<2; i++){
+    cgi_stream_content(blob_buffer(&cgiContent[i]),
+                       blob_size(&cgiContent[i]));
+    blob_truncate(&cgiContent[i], 0);
+  }
+  cgi_stream_content(z, n);
+  if( cgiStreaming==2 ){
+    if( bFinal ){
+      gzip_finish(&out);
+    }else{
+      gzip_drain(&out);
+    }
+    cgi_stream_write(blob_buffer(&out), blob_size(&out));
+    blob_reset(&out);
+  }
+  if( bFinal && cgiChunked ){
+    fprintf(g.httpOut, "0\r\n\r\n");
+  }
+  fflush(g.httpOut);
+}
+
+/*
+** Send the HTTP header now and send the content of the reply in
+** pieces while it is being generated, rather than holding all of it
+** in memory until cgi_reply().  The content type and any extra header
+** lines must be set before this routine is called.  Content that has
+** already been generated is sent first.
+**
+** If pCopy is not NULL, all content of the reply is also appended to
+** pCopy, before any Content-Encoding is applied, so that the caller
+** can cache it.
+**
+** Return true if the reply is being streamed.  Return false if the
+** reply has to be buffered as usual, for example because the request
+** is for a byte range or is a HEAD request.
+*/
+int cgi_stream_begin(Blob *pCopy){
+  if( cgiStreaming ) return 1;
+  if( g.httpOut==0 || iReplyStatus==304 || rangeEnd>0 ) return 0;
+  if( fossil_strcmp(P("REQUEST_METHOD"),"HEAD")==0 ) return 0;
+  if( fossil_strcmp(zContentType,"application/x-fossil")==0 ) return 0;
+  if( fossil_strcmp(zContentType,"application/x-fossil-zstd")==0 ) return 0;
+#ifdef FOSSIL_ENABLE_JSON
+  if( g.json.isJsonMode ) return 0;
+#endif
+  if( g.fullHttpReply ){
+    /* An HTTP/1.0 client learns where the reply ends by the closing
+    ** of the connection */
+    cgiChunked = iHttpMinor>0;
+    if( !cgiChunked ) cgiKeepAlive = 0;
+  }
+  cgiStreaming = is_gzippable() ? 2 : 1;
+  pStreamCopy = pCopy;
+  cgi_reply_header();
+  fprintf(g.httpOut, "Content-Type: %s; charset=utf-8\r\n", zContentType);
+  if( cgiStreaming==2 ){
+    gzip_begin(0);
+    fprintf(g.httpOut, "Content-Encoding: gzip\r\n");
+    fprintf(g.httpOut, "Vary: Accept-Encoding\r\n");
+  }
+  if( cgiChunked ){
+    fprintf(g.httpOut, "Transfer-Encoding: chunked\r\n");
+  }
+  fprintf(g.httpOut, "\r\n");
+  /* The header is gone, so an error can no longer be reported as a
+  ** web page. */
+  g.cgiOutput = 2;
+  cgi_stream_send(0, 0, 0);
+  return 1;
+}
+
+/*
+** Send all content of a streamed reply that has been generated so far.
+** This is a no-op if the reply is not being streamed.
+*/
+void cgi_stream_flush(void){
+  if( cgiStreaming ) cgi_stream_send(0, 0, 0);
+}
+
+/*
+** Make pContent the content of the reply, as with cgi_set_content().
+** A large reply that is going to be compressed is streamed instead,
+** so that it is not held in memory twice.
+*/
+void cgi_set_large_content(Blob *pContent){
+  if( blob_size(pContent)>=CGI_STREAM_CHUNK
+   && is_gzippable()
+   && cgi_stream_begin(0)
+  ){
+    cgi_append_content(blob_buffer(pContent), blob_size(pContent));
+    blob_reset(pContent);
+  }else{
+    cgi_set_content(pContent);
+  }
+}
+
+/*
+** Return true if the reply is being streamed.
+*/
+int cgi_is_streaming(void){
+  return cgiStreaming!=0;
+}
+
+/*
+** Do a normal HTTP reply
+*/
+void cgi_reply(void){
+  int total_size;
+  if( cgiStreaming ){
+    cgi_stream_send(0, 0, 1);
+    cgiStreaming = 0;
+    cgiChunked = 0;
+    pStreamCopy = 0;
+    CGIDEBUG(("-------- END cgi ---------\n"));
+    g.cgiOutput = 2;
+    if( g.db!=0 && iReplyStatus==200 ){
+      backoffice_check_if_needed();
+    }
+    return;
+  }
+  cgi_reply_header();
 
   /* Content intended for logged in users should only be cached in
   ** the browser, not some shared location.
@@ -351,6 +563,12 @@ void cgi_reply(void){
       cgi_combine_header_and_body();
       blob_compress(&cgiContent[0], &cgiContent[0]);
     }
+#if defined(FOSSIL_ENABLE_ZSTD)
+    if( fossil_strcmp(zContentType,"application/x-fossil-zstd")==0 ){
+      cgi_combine_header_and_body();
+      blob_compress_zstd(&cgiContent[0], &cgiContent[0]);
+    }
+#endif
 
     if( is_gzippable() && iReplyStatus!=206 ){
       int i;
@@ -434,6 +652,7 @@ NORETURN void cgi_redirect_with_status(
   cgi_printf("<html>\n<p>Redirect to %h</p>\n</html>\n", zLocation);
   cgi_set_status(iStat, zStat);
   free(zLocation);
+  cgiKeepAlive = 0;  /* This process exits after the reply */
   cgi_reply();
   fossil_exit(0);
 }
@@ -655,6 +874,52 @@ void cgi_setenv(const char *zName, const char *zValue){
   cgi_set_parameter_nocopy(zName, mprintf("%s",zValue), 0);
 }
 
+/*
+** Query parameters that were set before the first request was read,
+** for example by the --https option to "fossil server".
+*/
+static struct QParam *aBaseQP = 0;
+static int nBaseQP = 0;
+static int seqBaseQP = 0;
+static int sortBaseQP = 0;
+
+/*
+** A server process that handles more than one HTTP request calls this
+** routine once before reading its first request, to remember the query
+** parameters that should be present for every request.
+*/
+void cgi_save_baseline(void){
+  fossil_free(aBaseQP);
+  nBaseQP = nUsedQP;
+  seqBaseQP = seqQP;
+  sortBaseQP = sortQP;
+  aBaseQP = fossil_malloc( sizeof(aBaseQP[0])*(nBaseQP+1) );
+  memcpy(aBaseQP, aParamQP, sizeof(aBaseQP[0])*nBaseQP);
+}
+
+/*
+** Discard the reply and all query parameters of the previous request
+** and return to the state saved by cgi_save_baseline(), so that the
+** next request can be read.
+*/
+void cgi_reset_request(void){
+  cgi_reset_content();
+  pContent = &cgiContent[0];
+  zContentType = "text/html";
+  zReplyStatus = "OK";
+  iReplyStatus = 200;
+  blob_reset(&extraHeader);
+  rangeStart = 0;
+  rangeEnd = 0;
+  cgiStreaming = 0;
+  cgiChunked = 0;
+  pStreamCopy = 0;
+  if( nBaseQP>0 ) memcpy(aParamQP, aBaseQP, sizeof(aBaseQP[0])*nBaseQP);
+  nUsedQP = nBaseQP;
+  seqQP = seqBaseQP;
+  sortQP = sortBaseQP;
+}
+
 /*
 ** Add a list of query parameters or cookies to the parameter set.
 **
@@ -1177,6 +1442,12 @@ void cgi_init(void){
       blob_read_from_channel(&g.cgiIn, g.httpIn, len);
       blob_uncompress(&g.cgiIn, &g.cgiIn);
     }
+#if defined(FOSSIL_ENABLE_ZSTD)
+    else if( fossil_strcmp(zType, "application/x-fossil-zstd")==0 ){
+      blob_read_from_channel(&g.cgiIn, g.httpIn, len);
+      blob_uncompress_zstd(&g.cgiIn, &g.cgiIn);
+    }
+#endif
 #ifdef FOSSIL_ENABLE_JSON
     else if( noJson==0 && g.json.isJsonMode!=0 
              && json_can_consume_content_type(zType)!=0 ){
@@ -1530,7 +1801,7 @@ void cgi_tag_query_parameter(const char *zName){
 void cgi_printf(const char *zFormat, ...){
   va_list ap;
   va_start(ap,zFormat);
-  vxprintf(pContent,zFormat,ap);
+  cgi_vprintf(zFormat,ap);
   va_end(ap);
 }
 
@@ -1540,6 +1811,9 @@ void cgi_printf(const char *zFormat, ...){
 */
 void cgi_vprintf(const char *zFormat, va_list ap){
   vxprintf(pContent,zFormat,ap);
+  if( cgiStreaming && blob_size(pContent)>=CGI_STREAM_CHUNK ){
+    cgi_stream_send(0, 0, 0);
+  }
 }
 
 
@@ -1548,6 +1822,7 @@ void cgi_vprintf(const char *zFormat, va_list ap){
 */
 static NORETURN void malformed_request(const char *zMsg){
   cgi_set_status(501, "Not Implemented");
+  cgiKeepAlive = 0;
   cgi_printf(
     "<html><body><p>Bad Request: %s</p></body></html>\n", zMsg
   );
@@ -1691,6 +1966,9 @@ void cgi_handle_http_request(const char *zIpAddr){
   if( zToken[i] ) zToken[i++] = 0;
   cgi_setenv("PATH_INFO", zToken);
   cgi_setenv("QUERY_STRING", &zToken[i]);
+  zToken = extract_token(z, &z);
+  iHttpMinor = fossil_strcmp(zToken, "HTTP/1.1")==0;
+  cgiKeepAlive = nKeepAlive>0 && iHttpMinor;
   if( zIpAddr==0 ){
     zIpAddr = cgi_remote_ip(fileno(g.httpIn));
   }
@@ -1752,9 +2030,27 @@ void cgi_handle_http_request(const char *zIpAddr){
         rangeStart = x1;
         rangeEnd = x2+1;
       }
+    }else if( fossil_strcmp(zFieldName,"connection:")==0 ){
+      if( sqlite3_strlike("%close%", zVal, 0)==0 ){
+        cgiKeepAlive = 0;
+      }else if( sqlite3_strlike("%keep-alive%", zVal, 0)==0 ){
+        cgiKeepAlive = nKeepAlive>0;
+      }
+    }else if( fossil_strcmp(zFieldName,"transfer-encoding:")==0 ){
+      /* A request body that is not delimited by Content-Length cannot
+      ** be read, so the next request on the connection cannot be found */
+      nKeepAlive = 0;
+      cgiKeepAlive = 0;
     }
   }
   cgi_init();
+  if( atoi(PD("CONTENT_LENGTH","0"))>0 && g.zContentType==0 ){
+    /* cgi_init() does not read the body of this request */
+    cgiKeepAlive = 0;
+  }
+#ifdef FOSSIL_ENABLE_JSON
+  if( g.json.isJsonMode ) cgiKeepAlive = 0;
+#endif
   cgi_trace(0);
 }
 
@@ -1901,6 +2197,11 @@ void cgi_handle_ssh_http_request(const char *zIpAddr){
     if( fossil_strcmp(zType, "application/x-fossil")==0 ){
       blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
       blob_uncompress(&g.cgiIn, &g.cgiIn);
+#if defined(FOSSIL_ENABLE_ZSTD)
+    }else if( fossil_strcmp(zType, "application/x-fossil-zstd")==0 ){
+      blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
+      blob_uncompress_zstd(&g.cgiIn, &g.cgiIn);
+#endif
     }else if( fossil_strcmp(zType, "application/x-fossil-debug")==0 ){
       blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
     }else if( fossil_strcmp(zType, "application/x-fossil-uncompressed")==0 ){
@@ -2044,6 +2345,179 @@ void cgi_handle_scgi_request(void){
 # define FOSSIL_MAX_CONNECTIONS 1000
 #endif
 
+/*
+** Number of pre-forked worker processes used by cgi_http_server(), or
+** zero to fork a new child for every connection.
+*/
+static int nHttpWorker = 0;
+
+#if !defined(_WIN32)
+/*
+** In a pre-forked worker, the listening socket and the process id of
+** the parent that forked it.
+*/
+static int iWorkerListener = -1;
+static pid_t idWorkerParent = 0;
+
+/*
+** The parent side of the pre-forked worker pool.  Keep nHttpWorker
+** worker processes running, replacing each one as it exits.  Workers
+** return 0 out of this routine.  The parent never returns.
+*/
+static int cgi_http_worker_pool(int listener){
+  int nLive = 0;               /* Number of workers currently running */
+  int nRecent = 0;             /* Workers started during second tmRecent */
+  time_t tmRecent = 0;         /* Time of the most recent start */
+  pid_t child;
+
+  /* Workers compete to accept() each connection.  The losers must not
+  ** block, so make the listener non-blocking. */
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+  idWorkerParent = getpid();
+  while( 1 ){
+    while( nLive<nHttpWorker ){
+      time_t now = time(0);
+      if( now!=tmRecent ){
+        tmRecent = now;
+        nRecent = 0;
+      }else if( nRecent>=nHttpWorker*10 ){
+        /* Workers are exiting as fast as they start, perhaps because
+        ** the repository cannot be opened.  Do not spin. */
+        sleep(1);
+        continue;
+      }
+      child = fork();
+      if( child==0 ){
+        iWorkerListener = listener;
+        g.nPendingRequest = 1;
+        return 0;
+      }
+      if( child<0 ){
+        sleep(1);
+        break;
+      }
+      nLive++;
+      nRecent++;
+    }
+    child = waitpid(-1, 0, 0);
+    if( child>0 ){
+      nLive--;
+      if( g.fAnyTrace ){
+        fprintf(stderr, "/***** Worker %d has exited *****/\n", child);
+      }
+    }
+  }
+}
+#endif
+
+/*
+** Use a pool of nWorker pre-forked worker processes, rather than a new
+** child process for every connection, the next time cgi_http_server()
+** is called.
+*/
+void cgi_http_server_workers(int nWorker){
+  nHttpWorker = nWorker>0 ? nWorker : 0;
+}
+
+/*
+** Return true if this process is a pre-forked worker started by
+** cgi_http_server().
+*/
+int cgi_http_is_worker(void){
+#if !defined(_WIN32)
+  return iWorkerListener>=0;
+#else
+  return 0;
+#endif
+}
+
+/*
+** In a pre-forked worker, wait for the next connection and bind it to
+** g.httpIn and g.httpOut.  Return 0 when a connection is ready.  Return
+** non-zero if the worker should exit because the server has gone away,
+** or because xReady() returned non-zero.
+**
+** xReady() is called each time a connection is waiting, before it is
+** accepted.  If it returns non-zero, the connection is left for some
+** other worker.
+*/
+int cgi_http_worker_accept(int (*xReady)(void)){
+#if !defined(_WIN32)
+  while( getppid()==idWorkerParent ){
+    struct pollfd x;
+    struct sockaddr_in inaddr;
+    socklen_t lenaddr = sizeof(inaddr);
+    int connection;
+    x.fd = iWorkerListener;
+    x.events = POLLIN;
+    x.revents = 0;
+    /* Bury backoffice processes started by this worker */
+    while( waitpid(-1, 0, WNOHANG)>0 ){}
+    if( poll(&x, 1, 1000)<=0 ) continue;
+    if( xReady && xReady() ) break;
+    connection = accept(iWorkerListener, (struct sockaddr*)&inaddr, &lenaddr);
+    if( connection<0 ) continue;  /* Another worker took it */
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) & ~O_NONBLOCK);
+    g.httpIn = fdopen(connection, "rb");
+    g.httpOut = fdopen(dup(connection), "wb");
+    if( g.httpIn==0 || g.httpOut==0 ) return 1;
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+/*
+** In a pre-forked worker, close the connection opened by
+** cgi_http_worker_accept().
+*/
+void cgi_http_worker_close(void){
+  if( g.httpOut ) fclose(g.httpOut);
+  if( g.httpIn ) fclose(g.httpIn);
+  g.httpOut = 0;
+  g.httpIn = 0;
+}
+
+#if !defined(_WIN32)
+/*
+** SIGALRM handler for cgi_wait_for_request().  It only needs to
+** interrupt the read.
+*/
+static void cgi_idle_alarm(int x){
+  (void)x;
+}
+#endif
+
+/*
+** Wait for the client to send another request on a persistent
+** connection.  Return true if a request has started to arrive.  Return
+** false if the client closes the connection or leaves it idle for
+** longer than the timeout given to cgi_keep_alive().
+*/
+int cgi_wait_for_request(void){
+#if !defined(_WIN32)
+  struct sigaction sa, saOld;
+  int c;
+  if( g.httpIn==0 || nKeepAlive<=0 ) return 0;
+  /* Without SA_RESTART, the alarm makes the read fail with EINTR.  The
+  ** read has to go through the FILE object, because a pipelined
+  ** request might already be sitting in its buffer. */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = cgi_idle_alarm;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGALRM, &sa, &saOld);
+  alarm(nKeepAlive);
+  c = getc(g.httpIn);
+  alarm(0);
+  sigaction(SIGALRM, &saOld, 0);
+  if( c==EOF ) return 0;
+  ungetc(c, g.httpIn);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
 /*
 ** Implement an HTTP server daemon listening on port iPort.
 **
@@ -2051,6 +2525,12 @@ void cgi_handle_scgi_request(void){
 ** out of this procedure call.  The child will handle the request.
 ** The parent never returns from this procedure.
 **
+** If cgi_http_server_workers() has been called, instead start that many
+** worker processes up front and let each of them return.  A worker
+** uses cgi_http_worker_accept() to obtain connections, one at a time,
+** until it chooses to exit.  The parent starts a replacement for each
+** worker that exits.
+**
 ** Return 0 to each child as it runs.  If unable to establish a
 ** listening socket, return non-zero.
 */
@@ -2136,6 +2616,9 @@ int cgi_http_server(
       fossil_warning("cannot start browser: %s\n", zBrowser);
     }
   }
+  if( nHttpWorker>0 ){
+    return cgi_http_worker_pool(listener);
+  }
   while( 1 ){
 #if FOSSIL_MAX_CONNECTIONS>0
     while( nchildren>=FOSSIL_MAX_CONNECTIONS ){
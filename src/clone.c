@@ -79,6 +79,33 @@ void delete_private_content(void){
 }
 
 
+/*
+** Check the hash of every artifact received by a clone, using nJob
+** helper threads.  Artifacts are stored as they arrive without being
+** checked, so this is the only place where a damaged artifact from the
+** server would be noticed before the rebuild.  Abort the clone if any
+** artifact does not match its hash.
+*/
+static void clone_verify(int nJob){
+  VerifyResult *aRes;
+  int mxRid, rid;
+  fossil_print("Checking artifact hashes...\n");
+  aRes = verify_all_parallel(nJob, 0);
+  if( aRes==0 ) return;
+  mxRid = db_int(0, "SELECT max(rid) FROM blob");
+  for(rid=1; rid<=mxRid; rid++){
+    if( aRes[rid].eStatus==VERIFY_BADHASH ){
+      char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+      fossil_free(aRes);
+      db_close(1);
+      file_delete(g.argv[3]);
+      fossil_fatal("wrong hash on received artifact: %s - clone aborted",
+                   zUuid);
+    }
+  }
+  fossil_free(aRes);
+}
+
 /*
 ** COMMAND: clone
 **
@@ -118,12 +145,16 @@ void delete_private_content(void){
 ** Options:
 **    --admin-user|-A USERNAME   Make USERNAME the administrator
 **    --httpauth|-B USER:PASS    Add HTTP Basic Authorization to requests
+**    --jobs N                   Use N helper threads to check the hash of
+**                               every artifact received and to rebuild.
+**                               "auto" means one per CPU.  Default: 1
 **    --nocompress               Omit extra delta compression
 **    --once                     Don't remember the URI.
 **    --private                  Also clone private branches
 **    --save-http-password       Remember the HTTP password without asking
 **    --ssh-command|-c SSH       Use SSH as the "ssh" command
 **    --ssl-identity FILENAME    Use the SSL identity if requested by the server
+**    --stats                    Show how the time was spent on the network
 **    -u|--unversioned           Also sync unversioned content
 **    -v|--verbose               Show more statistics in output
 **
@@ -137,6 +168,7 @@ void clone_cmd(void){
   int urlFlags = URL_PROMPT_PW | URL_REMEMBER;
   int syncFlags = SYNC_CLONE;
   int noCompress = find_option("nocompress",0,0)!=0;
+  int nJob;                   /* Number of helper threads */
 
   /* Also clone private branches */
   if( find_option("private",0,0)!=0 ) syncFlags |= SYNC_PRIVATE;
@@ -146,8 +178,10 @@ void clone_cmd(void){
     urlFlags |= URL_REMEMBER_PW;
   }
   if( find_option("verbose","v",0)!=0) syncFlags |= SYNC_VERBOSE;
+  if( find_option("stats",0,0)!=0 ) syncFlags |= SYNC_STATS;
   if( find_option("unversioned","u",0)!=0 ) syncFlags |= SYNC_UNVERSIONED;
   zHttpAuth = find_option("httpauth","B",1);
+  nJob = fossil_thread_count(find_option("jobs",0,1), 1);
   zDefaultUser = find_option("admin-user","A",1);
   clone_ssh_find_options();
   url_proxy_options();
@@ -227,9 +261,11 @@ void clone_cmd(void){
       fossil_fatal("server returned an error - clone aborted");
     }
     db_open_repository(g.argv[3]);
+    if( nJob>1 ) clone_verify(nJob);
   }
   db_begin_transaction();
   fossil_print("Rebuilding repository meta-data...\n");
+  rebuild_set_jobs(nJob);
   rebuild_db(0, 1, 0);
   if( !noCompress ){
     fossil_print("Extra delta compression... "); fflush(stdout);
@@ -21,20 +21,69 @@
 #include "content.h"
 #include <assert.h>
 
+/*
+** Default limits on the artifact retrieval cache.  The cache holds at
+** most CONTENT_CACHE_MX_ENTRY entries using no more than
+** CONTENT_CACHE_MX_BYTES bytes of content.  Any single artifact larger
+** than one quarter of the byte budget is never admitted, since holding
+** it would flush out most of the other (more frequently reused) delta
+** bases.
+*/
+#ifndef CONTENT_CACHE_MX_ENTRY
+# define CONTENT_CACHE_MX_ENTRY 500
+#endif
+#ifndef CONTENT_CACHE_MX_BYTES
+# define CONTENT_CACHE_MX_BYTES 50000000
+#endif
+
+/*
+** Artifacts that need at least this many delta applications to
+** reconstruct are saved in the persistent materialized-artifact cache
+** (see cache_artifact_write()) if that cache is enabled.
+*/
+#ifndef CONTENT_PERSIST_DEPTH
+# define CONTENT_PERSIST_DEPTH 16
+#endif
+
+/*
+** One entry in the artifact retrieval cache.  Each entry is on a
+** hash chain keyed by rid and also on a doubly-linked list ordered
+** from most recently used (contentCache.pNewest) to least recently used
+** (contentCache.pOldest).
+*/
+typedef struct CacheLine CacheLine;
+struct CacheLine {
+  int rid;                  /* Artifact id */
+  int nDepth;               /* Delta applications needed to build content */
+  Blob content;             /* Content of the artifact */
+  CacheLine *pHashNext;     /* Next entry on the same hash chain */
+  CacheLine *pNewer;        /* Next more recently used entry */
+  CacheLine *pOlder;        /* Next less recently used entry */
+};
+
 /*
 ** The artifact retrieval cache
 */
 static struct {
   i64 szTotal;         /* Total size of all entries in the cache */
+  i64 szMax;           /* Maximum value for szTotal.  0 means default */
   int n;               /* Current number of cache entries */
-  int nAlloc;          /* Number of slots allocated in a[] */
-  int nextAge;         /* Age counter for implementing LRU */
-  struct cacheLine {   /* One instance of this for each cache entry */
-    int rid;                  /* Artifact id */
-    int age;                  /* Age.  Newer is larger */
-    Blob content;             /* Content of the artifact */
-  } *a;                /* The positive cache */
-  Bag inCache;         /* Set of artifacts currently in cache */
+  int nMax;            /* Maximum number of entries.  0 means default */
+  int nHash;           /* Number of slots in apHash[] */
+  CacheLine **apHash;  /* Hash table of cache entries, keyed by rid */
+  CacheLine *pNewest;  /* Most recently used entry */
+  CacheLine *pOldest;  /* Least recently used entry.  Evicted first */
+  char *zRepo;         /* Repository that the cached content came from */
+
+  /* Statistics, used by test-content-cache */
+  int nHit;            /* Number of content_get() calls satisfied by cache */
+  int nMiss;           /* Number of content_get() calls that missed */
+  int nApply;          /* Number of delta applications performed */
+  i64 nApplySaved;     /* Delta applications avoided by cache hits */
+  int nReject;         /* Insertions refused because content was too big */
+  int nEvict;          /* Entries evicted to make room */
+  int nPersistHit;     /* Artifacts found in the materialized-artifact cache */
+  int noPersist;       /* True to bypass the materialized-artifact cache */
 
   /*
   ** The missing artifact cache.
@@ -50,54 +99,158 @@ static struct {
 } contentCache;
 
 /*
-** Remove the oldest element from the content cache
+** The hash function for the content cache
 */
-static void content_cache_expire_oldest(void){
-  int i;
-  int mnAge = contentCache.nextAge;
-  int mn = -1;
-  for(i=0; i<contentCache.n; i++){
-    if( contentCache.a[i].age<mnAge ){
-      mnAge = contentCache.a[i].age;
-      mn = i;
-    }
+#define content_cache_hash(rid)  (((unsigned)(rid)*101)%contentCache.nHash)
+
+/*
+** Return the content cache entry for rid, or NULL if rid is not
+** in the cache.
+*/
+static CacheLine *content_cache_find(int rid){
+  CacheLine *p;
+  if( contentCache.nHash==0 ) return 0;
+  for(p=contentCache.apHash[content_cache_hash(rid)]; p; p=p->pHashNext){
+    if( p->rid==rid ) return p;
   }
-  if( mn>=0 ){
-    bag_remove(&contentCache.inCache, contentCache.a[mn].rid);
-    contentCache.szTotal -= blob_size(&contentCache.a[mn].content);
-    blob_reset(&contentCache.a[mn].content);
-    contentCache.n--;
-    contentCache.a[mn] = contentCache.a[contentCache.n];
+  return 0;
+}
+
+/*
+** Unlink p from the LRU list.
+*/
+static void content_cache_unlink(CacheLine *p){
+  if( p->pNewer ){
+    p->pNewer->pOlder = p->pOlder;
+  }else{
+    contentCache.pNewest = p->pOlder;
+  }
+  if( p->pOlder ){
+    p->pOlder->pNewer = p->pNewer;
+  }else{
+    contentCache.pOldest = p->pNewer;
+  }
+  p->pNewer = p->pOlder = 0;
+}
+
+/*
+** Make p the most recently used entry on the LRU list.  p must not
+** currently be on the list.
+*/
+static void content_cache_link_newest(CacheLine *p){
+  p->pOlder = contentCache.pNewest;
+  p->pNewer = 0;
+  if( contentCache.pNewest ){
+    contentCache.pNewest->pNewer = p;
+  }else{
+    contentCache.pOldest = p;
+  }
+  contentCache.pNewest = p;
+}
+
+/*
+** Resize the hash table so that it has nNew slots.
+*/
+static void content_cache_rehash(int nNew){
+  CacheLine *p;
+  fossil_free(contentCache.apHash);
+  contentCache.apHash = fossil_malloc( sizeof(CacheLine*)*nNew );
+  memset(contentCache.apHash, 0, sizeof(CacheLine*)*nNew);
+  contentCache.nHash = nNew;
+  for(p=contentCache.pNewest; p; p=p->pOlder){
+    unsigned h = content_cache_hash(p->rid);
+    p->pHashNext = contentCache.apHash[h];
+    contentCache.apHash[h] = p;
   }
 }
 
 /*
-** Add an entry to the content cache.
+** Remove the oldest element from the content cache
+*/
+static void content_cache_expire_oldest(void){
+  CacheLine *p = contentCache.pOldest;
+  CacheLine **pp;
+  if( p==0 ) return;
+  for(pp=&contentCache.apHash[content_cache_hash(p->rid)]; *pp!=p;
+      pp=&(*pp)->pHashNext){}
+  *pp = p->pHashNext;
+  content_cache_unlink(p);
+  contentCache.szTotal -= blob_size(&p->content);
+  contentCache.n--;
+  blob_reset(&p->content);
+  fossil_free(p);
+}
+
+/*
+** Set the maximum number of entries and the maximum number of bytes
+** of content held in the content cache.  A value of zero for either
+** limit selects the built-in default.
+*/
+void content_cache_set_limits(int nMax, i64 szMax){
+  contentCache.nMax = nMax;
+  contentCache.szMax = szMax;
+}
+
+/*
+** Reset the content cache statistics counters.
+*/
+static void content_cache_reset_stats(void){
+  contentCache.nHit = 0;
+  contentCache.nMiss = 0;
+  contentCache.nApply = 0;
+  contentCache.nApplySaved = 0;
+  contentCache.nReject = 0;
+  contentCache.nEvict = 0;
+  contentCache.nPersistHit = 0;
+}
+
+/*
+** Add an entry to the content cache.  nDepth is the number of delta
+** applications that were needed to reconstruct the content, and is
+** used only for statistics.
 **
 ** This routines hands responsibility for the artifact over to the cache.
 ** The cache will deallocate memory when it has finished with it.
 */
-void content_cache_insert(int rid, Blob *pBlob){
-  struct cacheLine *p;
-  if( contentCache.n>500 || contentCache.szTotal>50000000 ){
-    i64 szBefore;
-    do{
-      szBefore = contentCache.szTotal;
-      content_cache_expire_oldest();
-    }while( contentCache.szTotal>50000000 && contentCache.szTotal<szBefore );
-  }
-  if( contentCache.n>=contentCache.nAlloc ){
-    contentCache.nAlloc = contentCache.nAlloc*2 + 10;
-    contentCache.a = fossil_realloc(contentCache.a,
-                             contentCache.nAlloc*sizeof(contentCache.a[0]));
-  }
-  p = &contentCache.a[contentCache.n++];
+static void content_cache_insert_ex(int rid, Blob *pBlob, int nDepth){
+  CacheLine *p;
+  unsigned h;
+  int nMax = contentCache.nMax>0 ? contentCache.nMax : CONTENT_CACHE_MX_ENTRY;
+  i64 szMax = contentCache.szMax>0 ? contentCache.szMax
+                                    : CONTENT_CACHE_MX_BYTES;
+  i64 sz = blob_size(pBlob);
+
+  if( sz>szMax/4 || (p = content_cache_find(rid))!=0 ){
+    /* Too big to be worth holding, or already cached */
+    if( sz>szMax/4 ) contentCache.nReject++;
+    blob_reset(pBlob);
+    return;
+  }
+  while( contentCache.n>0
+      && (contentCache.n>=nMax || contentCache.szTotal+sz>szMax) ){
+    content_cache_expire_oldest();
+    contentCache.nEvict++;
+  }
+  if( contentCache.n>=contentCache.nHash ){
+    content_cache_rehash(contentCache.nHash*2 + 61);
+  }
+  if( contentCache.zRepo==0 && g.zRepositoryName ){
+    contentCache.zRepo = fossil_strdup(g.zRepositoryName);
+  }
+  p = fossil_malloc( sizeof(*p) );
   p->rid = rid;
-  p->age = contentCache.nextAge++;
-  contentCache.szTotal += blob_size(pBlob);
+  p->nDepth = nDepth;
   p->content = *pBlob;
   blob_zero(pBlob);
-  bag_insert(&contentCache.inCache, rid);
+  h = content_cache_hash(rid);
+  p->pHashNext = contentCache.apHash[h];
+  contentCache.apHash[h] = p;
+  content_cache_link_newest(p);
+  contentCache.szTotal += sz;
+  contentCache.n++;
+}
+void content_cache_insert(int rid, Blob *pBlob){
+  content_cache_insert_ex(rid, pBlob, 0);
 }
 
 /*
@@ -106,19 +259,46 @@ void content_cache_insert(int rid, Blob *pBlob){
 ** retain parts for future uses of the cache.
 */
 void content_clear_cache(int bFreeIt){
-  int i;
-  for(i=0; i<contentCache.n; i++){
-    blob_reset(&contentCache.a[i].content);
+  while( contentCache.pOldest ){
+    content_cache_expire_oldest();
   }
   bag_clear(&contentCache.missing);
   bag_clear(&contentCache.available);
-  bag_clear(&contentCache.inCache);
-  contentCache.n = 0;
-  contentCache.szTotal = 0;
+  fossil_free(contentCache.zRepo);
+  contentCache.zRepo = 0;
   if(bFreeIt){
-    fossil_free(contentCache.a);
-    contentCache.a = 0;
-    contentCache.nAlloc = 0;
+    fossil_free(contentCache.apHash);
+    contentCache.apHash = 0;
+    contentCache.nHash = 0;
+  }
+}
+
+/*
+** The content cache is keyed by rid, which is only meaningful within
+** a single repository.  A long-running process might close one
+** repository and open another.  When that happens, discard everything
+** that was cached for the prior repository.
+*/
+static void content_cache_check_repository(void){
+  if( contentCache.zRepo
+   && fossil_strcmp(contentCache.zRepo, g.zRepositoryName)!=0
+  ){
+    content_clear_cache(0);
+  }
+}
+
+/*
+** Remove artifact rid from the materialized-artifact cache.  This is
+** called whenever the delta chain for rid changes or when rid is about
+** to be removed from the repository.
+*/
+void content_forget_materialized(int rid){
+  char *zHash;
+  if( !cache_artifact_enabled() ) return;
+  zHash = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+  if( zHash ){
+    cache_artifact_invalidate(zHash);
+    fossil_free(zHash);
   }
 }
 
@@ -163,6 +343,7 @@ int content_size(int rid, int dflt){
 int content_is_available(int rid){
   int srcid;
   int depth = 0;  /* Limit to recursion depth */
+  content_cache_check_repository();
   while( depth++ < 10000000 ){
     if( bag_find(&contentCache.missing, rid) ){
       return 0;
@@ -236,12 +417,13 @@ static int content_of_blob(int rid, Blob *pBlob){
 */
 int content_get(int rid, Blob *pBlob){
   int rc;
-  int i;
   int nextRid;
+  CacheLine *pLine;
 
   assert( g.repositoryOpen );
   blob_zero(pBlob);
   if( rid==0 ) return 0;
+  content_cache_check_repository();
 
   /* Early out if we know the content is not available */
   if( bag_find(&contentCache.missing, rid) ){
@@ -249,15 +431,15 @@ int content_get(int rid, Blob *pBlob){
   }
 
   /* Look for the artifact in the cache first */
-  if( bag_find(&contentCache.inCache, rid) ){
-    for(i=0; i<contentCache.n; i++){
-      if( contentCache.a[i].rid==rid ){
-        blob_copy(pBlob, &contentCache.a[i].content);
-        contentCache.a[i].age = contentCache.nextAge++;
-        return 1;
-      }
-    }
+  if( (pLine = content_cache_find(rid))!=0 ){
+    blob_copy(pBlob, &pLine->content);
+    content_cache_unlink(pLine);
+    content_cache_link_newest(pLine);
+    contentCache.nHit++;
+    contentCache.nApplySaved += pLine->nDepth;
+    return 1;
   }
+  contentCache.nMiss++;
 
   nextRid = delta_source_rid(rid);
   if( nextRid==0 ){
@@ -267,13 +449,15 @@ int content_get(int rid, Blob *pBlob){
     int nAlloc = 10;
     int *a = 0;
     int mx;
+    int nDepth;            /* Delta applications needed to build pBlob */
+    char *zHash = 0;       /* Hash of rid, if it might be persisted */
     Blob delta, next;
 
     a = fossil_malloc( sizeof(a[0])*nAlloc );
     a[0] = rid;
     a[1] = nextRid;
     n = 1;
-    while( !bag_find(&contentCache.inCache, nextRid)
+    while( (pLine = content_cache_find(nextRid))==0
         && (nextRid = delta_source_rid(nextRid))>0 ){
       n++;
       if( n>=nAlloc ){
@@ -286,6 +470,23 @@ int content_get(int rid, Blob *pBlob){
       a[n] = nextRid;
     }
     mx = n;
+    nDepth = pLine ? pLine->nDepth : 0;
+    if( nDepth+mx>=CONTENT_PERSIST_DEPTH
+     && !contentCache.noPersist
+     && cache_artifact_enabled()
+    ){
+      zHash = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+      if( zHash
+       && cache_artifact_read(zHash, content_size(rid, -1), pBlob)
+      ){
+        contentCache.nPersistHit++;
+        contentCache.nApplySaved += nDepth+mx;
+        fossil_free(zHash);
+        free(a);
+        bag_insert(&contentCache.available, rid);
+        return 1;
+      }
+    }
     rc = content_get(a[n], pBlob);
     n--;
     while( rc && n>=0 ){
@@ -295,18 +496,24 @@ int content_get(int rid, Blob *pBlob){
           rc = 1;
         }else{
           blob_reset(&delta);
+          contentCache.nApply++;
           if( (mx-n)%8==0 ){
-            content_cache_insert(a[n+1], pBlob);
+            content_cache_insert_ex(a[n+1], pBlob, nDepth);
           }else{
             blob_reset(pBlob);
           }
           *pBlob = next;
+          nDepth++;
         }
       }
       n--;
     }
     free(a);
     if( !rc ) blob_reset(pBlob);
+    if( rc && zHash ){
+      cache_artifact_write(zHash, pBlob);
+    }
+    fossil_free(zHash);
   }
   if( rc==0 ){
     bag_insert(&contentCache.missing, rid);
@@ -316,6 +523,480 @@ int content_get(int rid, Blob *pBlob){
   return rc;
 }
 
+/*
+** Batched retrieval of many artifacts.
+**
+** Calling content_get() for each of many artifacts walks the delta
+** chain of every artifact separately, and expands any delta base that
+** the artifacts have in common once for each of them.  The
+** content_get_batch() routine instead finds the union of the delta
+** chains of all the artifacts requested, which is a forest with a
+** full-text artifact or a content cache entry at the root of each tree,
+** and then expands every node of that forest exactly once.
+*/
+typedef struct BatchNode BatchNode;
+struct BatchNode {
+  int rid;                  /* Artifact id */
+  int iParent;              /* Delta base, or -1 for a root */
+  int iChild;               /* First node that uses this one as a base */
+  int iSibling;             /* Next node with the same iParent */
+  int nPending;             /* Children that still need this content */
+  int iWant;                /* First request for this artifact, or -1 */
+  int nDepth;               /* Delta applications needed to build it */
+  int bFail;                /* True if the content could not be built */
+  int bCached;              /* Root that was in the content cache */
+};
+
+/*
+** The plan for a single call to content_get_batch()
+*/
+typedef struct ContentPlan ContentPlan;
+struct ContentPlan {
+  int n;                    /* Number of nodes */
+  int nAlloc;               /* Slots allocated in a[] */
+  BatchNode *a;             /* All nodes */
+  int nHash;                /* Slots in aHash[].  Power of two */
+  int *aHash;               /* Maps rid to node index+1 */
+  int *aNextWant;           /* Next request for the same artifact */
+};
+
+/*
+** Return the node for rid in plan p, or -1 if there is none.
+*/
+static int content_plan_find(ContentPlan *p, int rid){
+  unsigned h = ((unsigned)rid*101) & (p->nHash-1);
+  while( p->aHash[h] ){
+    if( p->a[p->aHash[h]-1].rid==rid ) return p->aHash[h]-1;
+    h = (h+1) & (p->nHash-1);
+  }
+  return -1;
+}
+
+/*
+** Add a node for rid to plan p and return its index.
+*/
+static int content_plan_add(ContentPlan *p, int rid){
+  unsigned h;
+  BatchNode *pNode;
+  if( p->n*2>=p->nHash ){
+    int i;
+    fossil_free(p->aHash);
+    p->nHash *= 2;
+    p->aHash = fossil_malloc( sizeof(int)*p->nHash );
+    memset(p->aHash, 0, sizeof(int)*p->nHash);
+    for(i=0; i<p->n; i++){
+      h = ((unsigned)p->a[i].rid*101) & (p->nHash-1);
+      while( p->aHash[h] ) h = (h+1) & (p->nHash-1);
+      p->aHash[h] = i+1;
+    }
+  }
+  if( p->n>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 20;
+    p->a = fossil_realloc(p->a, sizeof(p->a[0])*p->nAlloc);
+  }
+  pNode = &p->a[p->n];
+  pNode->rid = rid;
+  pNode->iParent = -1;
+  pNode->iChild = -1;
+  pNode->iSibling = -1;
+  pNode->nPending = 0;
+  pNode->iWant = -1;
+  pNode->bFail = 0;
+  pNode->bCached = 0;
+  h = ((unsigned)rid*101) & (p->nHash-1);
+  while( p->aHash[h] ) h = (h+1) & (p->nHash-1);
+  p->aHash[h] = ++p->n;
+  return p->n-1;
+}
+
+/*
+** Record that node iChild of plan p is a delta against node iParent.
+*/
+static void content_plan_link(ContentPlan *p, int iChild, int iParent){
+  p->a[iChild].iParent = iParent;
+  p->a[iChild].iSibling = p->a[iParent].iChild;
+  p->a[iParent].iChild = iChild;
+  p->a[iParent].nPending++;
+}
+
+/*
+** Retrieve the content of the nRid artifacts in aRid[].  For each i,
+** xVisit(pArg, i, pContent) is invoked exactly once, where pContent
+** holds the content of aRid[i], or is NULL if content_get() would fail
+** for that artifact.  The callback takes ownership of the content.
+** The callbacks happen in whatever order is convenient for expanding
+** deltas, not in the order of aRid[].
+*/
+void content_get_batch(
+  int nRid,                 /* Number of artifacts */
+  const int *aRid,          /* The artifacts to fetch */
+  void (*xVisit)(void*, int, Blob*),  /* Receives the content */
+  void *pArg                /* First argument to xVisit */
+){
+  ContentPlan plan;
+  Blob *aBase;              /* Content of nodes with pending children */
+  int *aStack;              /* Nodes waiting to be expanded */
+  int nStack = 0;
+  int i, j, k;
+  int nLoop = 0, mxLoop = 0;
+  CacheLine *pLine;
+
+  content_cache_check_repository();
+  memset(&plan, 0, sizeof(plan));
+  plan.nHash = 64;
+  plan.aHash = fossil_malloc( sizeof(int)*plan.nHash );
+  memset(plan.aHash, 0, sizeof(int)*plan.nHash);
+  plan.aNextWant = fossil_malloc( sizeof(int)*(nRid+1) );
+
+  /* Plan the traversal by walking the delta chain of each artifact up
+  ** to its root, or to an artifact that is already in the plan, or to
+  ** an artifact that is in the content cache. */
+  for(i=0; i<nRid; i++){
+    int rid = aRid[i];
+    int iChild = -1;
+    if( rid==0 || bag_find(&contentCache.missing, rid) ){
+      xVisit(pArg, i, 0);
+      continue;
+    }
+    k = content_plan_find(&plan, rid);
+    if( k<0 && content_cache_find(rid)==0 ){
+      contentCache.nMiss++;
+      if( !contentCache.noPersist && cache_artifact_enabled() ){
+        /* Deep delta chains might be materialized in the cache file */
+        char *zHash = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+        Blob content;
+        blob_zero(&content);
+        if( zHash
+         && cache_artifact_read(zHash, content_size(rid, -1), &content)
+        ){
+          contentCache.nPersistHit++;
+          fossil_free(zHash);
+          bag_insert(&contentCache.available, rid);
+          xVisit(pArg, i, &content);
+          continue;
+        }
+        fossil_free(zHash);
+      }
+    }
+    while( k<0 ){
+      int srcid;
+      k = content_plan_add(&plan, rid);
+      if( iChild>=0 ) content_plan_link(&plan, iChild, k);
+      if( content_cache_find(rid)!=0 ){
+        plan.a[k].bCached = 1;
+        break;
+      }
+      srcid = delta_source_rid(rid);
+      if( srcid==0 ) break;
+      if( mxLoop==0 ) mxLoop = db_int(0, "SELECT max(rid) FROM blob") + 1;
+      if( ++nLoop>mxLoop ){
+        fossil_panic("infinite loop in DELTA table");
+      }
+      iChild = k;
+      rid = srcid;
+      k = content_plan_find(&plan, rid);
+      if( k>=0 ) content_plan_link(&plan, iChild, k);
+    }
+    k = content_plan_find(&plan, aRid[i]);
+    plan.aNextWant[i] = plan.a[k].iWant;
+    plan.a[k].iWant = i;
+  }
+
+  /* Expand the forest depth-first from each root.  The content of a
+  ** node is kept only until the last of its children has used it. */
+  aBase = fossil_malloc( sizeof(Blob)*(plan.n+1) );
+  aStack = fossil_malloc( sizeof(int)*(plan.n+1) );
+  for(k=plan.n-1; k>=0; k--){
+    blob_zero(&aBase[k]);
+    if( plan.a[k].iParent<0 ) aStack[nStack++] = k;
+  }
+  while( nStack>0 ){
+    BatchNode *pNode = &plan.a[k = aStack[--nStack]];
+    Blob content;
+    int rc;
+    blob_zero(&content);
+    if( pNode->iParent<0 ){
+      if( (pLine = content_cache_find(pNode->rid))!=0 ){
+        blob_copy(&content, &pLine->content);
+        content_cache_unlink(pLine);
+        content_cache_link_newest(pLine);
+        if( pNode->iWant>=0 ){
+          contentCache.nHit++;
+          contentCache.nApplySaved += pLine->nDepth;
+        }
+        pNode->nDepth = pLine->nDepth;
+        rc = 1;
+      }else if( pNode->bCached ){
+        /* Evicted from the cache while other trees were expanded.  The
+        ** stored content might be a delta, so build it the long way. */
+        rc = content_get(pNode->rid, &content);
+      }else{
+        rc = content_of_blob(pNode->rid, &content);
+      }
+    }else{
+      BatchNode *pParent = &plan.a[pNode->iParent];
+      rc = 0;
+      pNode->nDepth = pParent->nDepth + 1;
+      if( !pParent->bFail ){
+        Blob delta;
+        if( content_of_blob(pNode->rid, &delta) ){
+          rc = blob_delta_apply(&aBase[pNode->iParent], &delta, &content)>=0;
+          blob_reset(&delta);
+          if( rc ) contentCache.nApply++;
+        }
+        if( --pParent->nPending==0 ) blob_reset(&aBase[pNode->iParent]);
+      }
+    }
+    pNode->bFail = !rc;
+    if( pNode->iChild>=0 ){
+      if( rc ){
+        blob_copy(&aBase[k], &content);
+        if( pNode->nDepth%8==0 && pNode->iParent>=0 ){
+          /* As in content_get(), keep some delta bases for next time */
+          Blob x;
+          blob_copy(&x, &content);
+          content_cache_insert_ex(pNode->rid, &x, pNode->nDepth);
+        }
+      }
+      for(j=pNode->iChild; j>=0; j=plan.a[j].iSibling){
+        aStack[nStack++] = j;
+      }
+    }
+    for(j=pNode->iWant; j>=0; j=plan.aNextWant[j]){
+      if( !rc ){
+        /* Let content_get() sort out phantoms and bad deltas */
+        Blob other;
+        xVisit(pArg, j, content_get(pNode->rid, &other) ? &other : 0);
+      }else if( plan.aNextWant[j]>=0 ){
+        Blob other;
+        blob_copy(&other, &content);
+        xVisit(pArg, j, &other);
+      }else{
+        bag_insert(&contentCache.available, pNode->rid);
+        xVisit(pArg, j, &content);
+        blob_zero(&content);
+      }
+    }
+    blob_reset(&content);
+  }
+  fossil_free(aStack);
+  fossil_free(aBase);
+  fossil_free(plan.a);
+  fossil_free(plan.aHash);
+  fossil_free(plan.aNextWant);
+}
+
+#if INTERFACE
+/*
+** A queue of artifacts that are read back in order, one at a time, but
+** are fetched from the repository in batches by content_get_batch().
+** Use it like this:
+**
+**     content_batch_init(&b);
+**     content_batch_add(&b, rid);       // For each artifact
+**     content_batch_next(&b, &x);       // For each artifact, in order
+**     content_batch_reset(&b);
+*/
+struct ContentBatch {
+  int n;                    /* Number of artifacts queued */
+  int nAlloc;               /* Slots allocated in aRid[] */
+  int *aRid;                /* The artifacts, in the order they are read */
+  int iNext;                /* Next artifact to be read */
+  int iFirst;               /* Artifact that aContent[0] holds */
+  int nContent;             /* Number of slots used in aContent[] */
+  Blob *aContent;           /* Content of the current batch */
+  u8 *aOk;                  /* True for each aContent[] that is valid */
+};
+#endif
+
+/*
+** Limits on the size of each batch fetched by a ContentBatch
+*/
+#ifndef CONTENT_BATCH_MX_ENTRY
+# define CONTENT_BATCH_MX_ENTRY 250
+#endif
+#ifndef CONTENT_BATCH_MX_BYTES
+# define CONTENT_BATCH_MX_BYTES 25000000
+#endif
+
+/*
+** Initialize an empty ContentBatch
+*/
+void content_batch_init(ContentBatch *p){
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Free all memory held by a ContentBatch and make it empty again
+*/
+void content_batch_reset(ContentBatch *p){
+  int i;
+  for(i=0; i<p->nContent; i++) blob_reset(&p->aContent[i]);
+  fossil_free(p->aRid);
+  fossil_free(p->aContent);
+  fossil_free(p->aOk);
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Queue artifact rid to be read by content_batch_next()
+*/
+void content_batch_add(ContentBatch *p, int rid){
+  if( p->n>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 20;
+    p->aRid = fossil_realloc(p->aRid, sizeof(p->aRid[0])*p->nAlloc);
+  }
+  p->aRid[p->n++] = rid;
+}
+
+/*
+** Callback from content_get_batch() for content_batch_next()
+*/
+static void content_batch_visit(void *pArg, int i, Blob *pContent){
+  ContentBatch *p = (ContentBatch*)pArg;
+  if( pContent ){
+    p->aContent[i] = *pContent;
+    p->aOk[i] = 1;
+  }
+}
+
+/*
+** Put the content of the next queued artifact into pBlob, which must be
+** uninitialized, and return 1.  If the artifact is a phantom, zero
+** pBlob and return 0, just like content_get().  Also return 0 if there
+** are no more queued artifacts.
+*/
+int content_batch_next(ContentBatch *p, Blob *pBlob){
+  int i;
+  blob_zero(pBlob);
+  if( p->iNext>=p->n ) return 0;
+  if( p->iNext>=p->iFirst+p->nContent ){
+    i64 sz = 0;
+    int n = 0;
+    p->iFirst = p->iNext;
+    while( p->iFirst+n<p->n
+        && n<CONTENT_BATCH_MX_ENTRY
+        && (n==0 || sz<CONTENT_BATCH_MX_BYTES)
+    ){
+      sz += content_size(p->aRid[p->iFirst+n], 0);
+      n++;
+    }
+    if( p->aContent==0 ){
+      p->aContent = fossil_malloc( sizeof(Blob)*CONTENT_BATCH_MX_ENTRY );
+      p->aOk = fossil_malloc( CONTENT_BATCH_MX_ENTRY );
+    }
+    p->nContent = n;
+    for(i=0; i<n; i++){
+      blob_zero(&p->aContent[i]);
+      p->aOk[i] = 0;
+    }
+    content_get_batch(n, &p->aRid[p->iFirst], content_batch_visit, p);
+  }
+  i = p->iNext++ - p->iFirst;
+  *pBlob = p->aContent[i];
+  blob_zero(&p->aContent[i]);
+  return p->aOk[i];
+}
+
+/*
+** COMMAND: test-content-batch
+**
+** Usage: %fossil test-content-batch ?CHECKIN? ?OPTIONS?
+**
+** Retrieve every file of CHECKIN, first with one content_get() call per
+** file and then as a batch using content_get_batch(), starting with an
+** empty content cache each time.  Verify that both give the same
+** results and report the time taken by each.
+**
+** Options:
+**    --all              Retrieve every artifact in the repository, in
+**                       order of rid, instead of the files of a check-in
+**    -R|--repository FILE  Use repository FILE
+*/
+void test_content_batch_cmd(void){
+  int bAll = find_option("all",0,0)!=0;
+  int *aRid = 0;
+  int n = 0, nAlloc = 0;
+  int i, nErr = 0, nApply, nApplyBatch, timerId;
+  sqlite3_uint64 tmGet, tmBatch;
+  i64 szTotal = 0;
+  ContentBatch b;
+  Stmt q;
+
+  db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+  verify_all_options();
+  if( bAll ){
+    db_prepare(&q, "SELECT rid FROM blob WHERE size>=0 ORDER BY rid");
+  }else{
+    int vid = name_to_typed_rid(g.argc>=3 ? g.argv[2] : "tip", "ci");
+    db_multi_exec(
+      "CREATE VIRTUAL TABLE IF NOT EXISTS temp.foci USING files_of_checkin;"
+    );
+    db_prepare(&q,
+      "SELECT blob.rid FROM foci, blob"
+      " WHERE foci.checkinID=%d AND blob.uuid=foci.uuid"
+      " ORDER BY foci.filename", vid);
+  }
+  while( db_step(&q)==SQLITE_ROW ){
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aRid = fossil_realloc(aRid, sizeof(aRid[0])*nAlloc);
+    }
+    aRid[n++] = db_column_int(&q, 0);
+  }
+  db_finalize(&q);
+
+  content_clear_cache(1);
+  content_cache_reset_stats();
+  timerId = fossil_timer_start();
+  for(i=0; i<n; i++){
+    Blob x;
+    content_get(aRid[i], &x);
+    szTotal += blob_size(&x);
+    blob_reset(&x);
+  }
+  tmGet = fossil_timer_stop(timerId);
+  nApply = contentCache.nApply;
+
+  content_clear_cache(1);
+  content_cache_reset_stats();
+  content_batch_init(&b);
+  for(i=0; i<n; i++) content_batch_add(&b, aRid[i]);
+  timerId = fossil_timer_start();
+  for(i=0; i<n; i++){
+    Blob x;
+    content_batch_next(&b, &x);
+    blob_reset(&x);
+  }
+  tmBatch = fossil_timer_stop(timerId);
+  nApplyBatch = contentCache.nApply;
+  content_batch_reset(&b);
+
+  /* Check the results, outside of the timings */
+  content_clear_cache(1);
+  content_batch_init(&b);
+  for(i=0; i<n; i++) content_batch_add(&b, aRid[i]);
+  for(i=0; i<n; i++){
+    Blob x, y;
+    int rc1 = content_batch_next(&b, &x);
+    int rc2 = content_get(aRid[i], &y);
+    if( rc1!=rc2 || blob_compare(&x, &y)!=0 ){
+      fossil_print("mismatch on rid %d\n", aRid[i]);
+      nErr++;
+    }
+    blob_reset(&x);
+    blob_reset(&y);
+  }
+  content_batch_reset(&b);
+  fossil_free(aRid);
+  fossil_print("artifacts:            %d (%lld bytes)\n", n, szTotal);
+  fossil_print("content_get:          %.3f seconds, %d delta-applies\n",
+               tmGet/1000000.0, nApply);
+  fossil_print("content_get_batch:    %.3f seconds, %d delta-applies\n",
+               tmBatch/1000000.0, nApplyBatch);
+  fossil_print("errors:               %d\n", nErr);
+}
+
 /*
 ** COMMAND: artifact*
 **
@@ -348,23 +1029,336 @@ void artifact_cmd(void){
 /*
 ** COMMAND: test-content-rawget
 **
+** Usage: %fossil test-content-rawget RECORDID ?FILENAME? ?--timing?
+**
 ** Extract a blob from the database and write it into a file.  This
 ** version does not expand the delta.
+**
+** With the --timing option, nothing is written.  Instead, report the
+** CPU time needed to extract the raw blob, to reconstruct the artifact
+** with all caches cold, and to reconstruct it again using the
+** materialized-artifact cache (see the max-artifact-cache setting).
 */
 void test_content_rawget_cmd(void){
   int rid;
   Blob content;
   const char *zFile;
-  if( g.argc!=4 && g.argc!=3 ) usage("RECORDID ?FILENAME?");
+  int bTiming = find_option("timing",0,0)!=0;
+  if( g.argc!=4 && g.argc!=3 ) usage("RECORDID ?FILENAME? ?--timing?");
   zFile = g.argc==4 ? g.argv[3] : "-";
   db_must_be_within_tree();
   rid = name_to_rid(g.argv[2]);
   blob_zero(&content);
+  if( bTiming ){
+    int timerId = fossil_timer_start();
+    int nDepth = 0;
+    int srcid = rid;
+    while( (srcid = delta_source_rid(srcid))>0 ) nDepth++;
+    db_blob(&content, "SELECT content FROM blob WHERE rid=%d", rid);
+    blob_uncompress(&content, &content);
+    blob_reset(&content);
+    fossil_print("delta-chain-length:  %d\n", nDepth);
+    fossil_print("artifact-cache:      %s\n",
+                 cache_artifact_enabled() ? "enabled" : "disabled");
+    fossil_print("raw-fetch:           %.3f ms\n",
+                 fossil_timer_reset(timerId)/1000.0);
+    content_clear_cache(0);
+    contentCache.noPersist = 1;
+    fossil_timer_reset(timerId);
+    content_get(rid, &content);
+    fossil_print("cold-expand:         %.3f ms\n",
+                 fossil_timer_reset(timerId)/1000.0);
+    blob_reset(&content);
+    contentCache.noPersist = 0;
+    content_clear_cache(0);
+    content_get(rid, &content);       /* Prime the artifact cache */
+    blob_reset(&content);
+    content_clear_cache(0);
+    fossil_timer_reset(timerId);
+    content_get(rid, &content);
+    fossil_print("warm-expand:         %.3f ms\n",
+                 fossil_timer_stop(timerId)/1000.0);
+    blob_reset(&content);
+    return;
+  }
   db_blob(&content, "SELECT content FROM blob WHERE rid=%d", rid);
   blob_uncompress(&content, &content);
   blob_write_to_file(&content, zFile);
 }
 
+/*
+** COMMAND: test-content-cache
+**
+** Usage: %fossil test-content-cache ?OPTIONS?
+**
+** Retrieve every artifact in the repository using content_get() and
+** then report how effective the artifact retrieval cache was at
+** avoiding the expansion of delta chains.
+**
+** Options:
+**    --budget BYTES     Hold at most BYTES bytes of content in the cache
+**    --entries N        Hold at most N artifacts in the cache
+**    --passes N         Make N passes over all artifacts.  Default: 1
+**    --random           Visit artifacts in random order
+**    -R|--repository FILE  Use repository FILE
+*/
+void test_content_cache_cmd(void){
+  const char *zBudget = find_option("budget",0,1);
+  const char *zEntries = find_option("entries",0,1);
+  const char *zPasses = find_option("passes",0,1);
+  int bRandom = find_option("random",0,0)!=0;
+  int nPass = zPasses ? atoi(zPasses) : 1;
+  int i, nGet = 0;
+  i64 szGet = 0;
+  int timerId;
+  sqlite3_uint64 elapsed;
+  Stmt q;
+
+  db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+  verify_all_options();
+  content_clear_cache(1);
+  content_cache_set_limits(zEntries ? atoi(zEntries) : 0,
+                           zBudget ? strtoll(zBudget, 0, 10) : 0);
+  content_cache_reset_stats();
+  timerId = fossil_timer_start();
+  for(i=0; i<nPass; i++){
+    db_prepare(&q, "SELECT rid FROM blob WHERE size>=0 ORDER BY %s",
+               bRandom ? "random()" : "rid");
+    while( db_step(&q)==SQLITE_ROW ){
+      Blob content;
+      content_get(db_column_int(&q,0), &content);
+      szGet += blob_size(&content);
+      nGet++;
+      blob_reset(&content);
+    }
+    db_finalize(&q);
+  }
+  elapsed = fossil_timer_stop(timerId);
+  fossil_print("artifacts-fetched:    %d\n", nGet);
+  fossil_print("bytes-fetched:        %lld\n", szGet);
+  fossil_print("cache-hits:           %d\n", contentCache.nHit);
+  fossil_print("cache-misses:         %d\n", contentCache.nMiss);
+  fossil_print("hit-ratio:            %.1f%%\n",
+     contentCache.nHit+contentCache.nMiss==0 ? 0.0 :
+     100.0*contentCache.nHit/(contentCache.nHit+contentCache.nMiss));
+  fossil_print("delta-applies:        %d\n", contentCache.nApply);
+  fossil_print("delta-applies-saved:  %lld\n", contentCache.nApplySaved);
+  fossil_print("cache-entries:        %d\n", contentCache.n);
+  fossil_print("cache-bytes:          %lld\n", contentCache.szTotal);
+  fossil_print("evictions:            %d\n", contentCache.nEvict);
+  fossil_print("artifact-cache-hits:  %d\n", contentCache.nPersistHit);
+  fossil_print("rejected-too-large:   %d\n", contentCache.nReject);
+  fossil_print("cpu-time:             %.3f seconds\n", elapsed/1000000.0);
+}
+
+#if INTERFACE
+/*
+** A delta tree is a full-text artifact together with every artifact
+** that is derived from it, directly or indirectly, by delta.  The
+** nodes are stored in depth-first preorder, so that the parent of each
+** node comes before the node itself and the descendants of each node
+** immediately follow it.  The content of each node is the compressed
+** content of the BLOB table: full text for the root and a delta against
+** the parent for all other nodes.
+**
+** A ContentTree is loaded from the database by content_tree_load() on
+** the main thread and can then be expanded by content_tree_expand() on
+** any thread.
+*/
+struct ContentTreeNode {
+  int rid;                   /* Artifact id */
+  int size;                  /* Value of blob.size */
+  int iParent;               /* Index of the parent node.  -1 for root */
+  int nChild;                /* Number of children */
+  Blob data;                 /* Compressed content from the BLOB table */
+  char zUuid[HNAME_MAX+1];   /* Artifact hash */
+};
+struct ContentTree {
+  int n;                     /* Number of nodes */
+  int nAlloc;                /* Slots allocated in a[] */
+  ContentTreeNode *a;        /* Nodes of the tree, in preorder */
+};
+#endif
+
+/*
+** Because the tree is loaded using a stack, a node's descendants are
+** not necessarily contiguous.  Reorder the nodes of p into true
+** depth-first preorder, so that content_tree_expand() only needs to hold
+** the expanded content of the ancestors of the current node.
+*/
+static void content_tree_preorder(ContentTree *p){
+  ContentTreeNode *aNew;
+  int *aFirst, *aNext, *aMap, *aStack;
+  int i, n = 0, nStack = 0;
+  if( p->n<3 ) return;
+  aFirst = fossil_malloc( sizeof(int)*p->n*4 );
+  aNext = &aFirst[p->n];
+  aMap = &aNext[p->n];
+  aStack = &aMap[p->n];
+  for(i=0; i<p->n; i++) aFirst[i] = -1;
+  for(i=p->n-1; i>0; i--){
+    aNext[i] = aFirst[p->a[i].iParent];
+    aFirst[p->a[i].iParent] = i;
+  }
+  aNew = fossil_malloc( sizeof(aNew[0])*p->nAlloc );
+  aStack[nStack++] = 0;
+  while( nStack>0 ){
+    int j, k = aStack[--nStack];
+    aMap[k] = n;
+    aNew[n] = p->a[k];
+    if( k>0 ) aNew[n].iParent = aMap[p->a[k].iParent];
+    n++;
+    for(j=aFirst[k]; j>=0; j=aNext[j]) aStack[nStack++] = j;
+  }
+  assert( n==p->n );
+  fossil_free(p->a);
+  p->a = aNew;
+  fossil_free(aFirst);
+}
+
+/*
+** Append a new node to p and return a pointer to it.
+*/
+static ContentTreeNode *content_tree_append(
+  ContentTree *p,            /* The tree to which the node is added */
+  Stmt *pQuery,              /* Row holding rid, size, uuid and content */
+  int iParent                /* Index of the parent, or -1 for the root */
+){
+  ContentTreeNode *pNode;
+  if( p->n>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2;
+    p->a = fossil_realloc(p->a, sizeof(p->a[0])*p->nAlloc);
+  }
+  pNode = &p->a[p->n++];
+  pNode->rid = db_column_int(pQuery, 0);
+  pNode->size = db_column_int(pQuery, 1);
+  pNode->iParent = iParent;
+  pNode->nChild = 0;
+  sqlite3_snprintf(sizeof(pNode->zUuid), pNode->zUuid, "%s",
+                   db_column_text(pQuery, 2));
+  blob_zero(&pNode->data);
+  db_column_blob(pQuery, 3, &pNode->data);
+  if( iParent>=0 ) p->a[iParent].nChild++;
+  return pNode;
+}
+
+/*
+** Load the delta tree rooted at artifact rid from the database.
+** Phantoms and any artifacts in pSkip (which may be NULL) are omitted,
+** together with everything derived from them.  Return NULL if rid is
+** itself a phantom.
+*/
+ContentTree *content_tree_load(int rid, Bag *pSkip){
+  static Stmt q1, q2;
+  ContentTree *p;
+  int *aStack;               /* Nodes whose children are not yet loaded */
+  int nStack = 0;
+  int nStackAlloc = 20;
+
+  db_static_prepare(&q1,
+     "SELECT rid, size, uuid, content FROM blob WHERE rid=:rid AND size>=0"
+  );
+  db_static_prepare(&q2,
+     "SELECT blob.rid, blob.size, blob.uuid, blob.content FROM delta, blob"
+     " WHERE delta.srcid=:rid AND blob.rid=delta.rid AND blob.size>=0"
+  );
+  db_bind_int(&q1, ":rid", rid);
+  if( db_step(&q1)!=SQLITE_ROW ){
+    db_reset(&q1);
+    return 0;
+  }
+  p = fossil_malloc( sizeof(*p) );
+  p->n = 0;
+  p->nAlloc = 20;
+  p->a = fossil_malloc( sizeof(p->a[0])*p->nAlloc );
+  content_tree_append(p, &q1, -1);
+  db_reset(&q1);
+  aStack = fossil_malloc( sizeof(aStack[0])*nStackAlloc );
+  aStack[nStack++] = 0;
+  while( nStack>0 ){
+    int iParent = aStack[--nStack];
+    db_bind_int(&q2, ":rid", p->a[iParent].rid);
+    while( db_step(&q2)==SQLITE_ROW ){
+      if( pSkip && bag_find(pSkip, db_column_int(&q2, 0)) ) continue;
+      content_tree_append(p, &q2, iParent);
+      if( nStack>=nStackAlloc ){
+        nStackAlloc *= 2;
+        aStack = fossil_realloc(aStack, sizeof(aStack[0])*nStackAlloc);
+      }
+      aStack[nStack++] = p->n-1;
+    }
+    db_reset(&q2);
+  }
+  fossil_free(aStack);
+  content_tree_preorder(p);
+  return p;
+}
+
+/*
+** Expand every artifact in delta tree p, in preorder, and invoke
+** xVisit(pArg, pNode, pContent) for each one.  The xVisit callback
+** takes ownership of the content.  pContent is NULL for any artifact
+** that content_get() would fail to reconstruct because the delta
+** against its parent (or against some more distant ancestor) cannot
+** be applied.
+**
+** The compressed content in p is consumed.  Afterwards the only thing
+** left to do with p is to pass it to content_tree_free().
+**
+** This routine does not use the database and so is safe to run
+** in a helper thread.
+*/
+void content_tree_expand(
+  ContentTree *p,
+  void (*xVisit)(void*, ContentTreeNode*, Blob*),
+  void *pArg
+){
+  int *aStack = fossil_malloc( sizeof(int)*p->n );
+  Blob *aBase = fossil_malloc( sizeof(Blob)*p->n );
+  char *aFail = fossil_malloc( p->n );
+  int nStack = 0;
+  int i;
+  for(i=0; i<p->n; i++){
+    ContentTreeNode *pNode = &p->a[i];
+    Blob content;
+    while( nStack>0 && aStack[nStack-1]!=pNode->iParent ){
+      blob_reset(&aBase[--nStack]);
+    }
+    blob_zero(&content);
+    aFail[i] = 0;
+    blob_uncompress(&pNode->data, &pNode->data);
+    if( pNode->iParent<0 ){
+      content = pNode->data;
+      blob_zero(&pNode->data);
+    }else if( aFail[pNode->iParent]
+           || blob_delta_apply(&aBase[nStack-1], &pNode->data, &content)<0 ){
+      aFail[i] = 1;
+    }
+    blob_reset(&pNode->data);
+    if( pNode->nChild>0 ){
+      aStack[nStack] = i;
+      blob_copy(&aBase[nStack], &content);
+      nStack++;
+    }
+    xVisit(pArg, pNode, aFail[i] ? 0 : &content);
+  }
+  while( nStack>0 ) blob_reset(&aBase[--nStack]);
+  fossil_free(aFail);
+  fossil_free(aBase);
+  fossil_free(aStack);
+}
+
+/*
+** Free a delta tree.
+*/
+void content_tree_free(ContentTree *p){
+  int i;
+  if( p==0 ) return;
+  for(i=0; i<p->n; i++) blob_reset(&p->a[i].data);
+  fossil_free(p->a);
+  fossil_free(p);
+}
+
 /*
 ** The following flag is set to disable the automatic calls to
 ** manifest_crosslink() when a record is dephantomized.  This
@@ -640,7 +1634,11 @@ int content_put_ex(
 
   /* Make arrangements to verify that the data can be recovered
   ** before we commit */
-  verify_before_commit(rid);
+  if( zUuid==0 ){
+    verify_before_commit_local(rid);
+  }else{
+    verify_before_commit(rid);
+  }
   return rid;
 }
 
@@ -898,6 +1896,7 @@ int content_deltify(int rid, int *aSrc, int nSrc, int force){
     db_finalize(&s1);
     db_finalize(&s2);
     verify_before_commit(rid);
+    content_forget_materialized(rid);
     rc = 1;
   }
   blob_reset(&data);
@@ -928,7 +1927,7 @@ void test_content_deltify_cmd(void){
 /*
 ** Return true if Blob p looks like it might be a parsable control artifact.
 */
-static int looks_like_control_artifact(Blob *p){
+int looks_like_control_artifact(Blob *p){
   const char *z = blob_buffer(p);
   int n = blob_size(p);
   if( n<10 ) return 0;
@@ -950,6 +1949,9 @@ static int looks_like_control_artifact(Blob *p){
 **    -d|--db-only       Run "PRAGMA integrity_check" on the database only.
 **                       No other validation is performed.
 **
+**    --jobs N           Use N helper threads to reconstruct and hash
+**                       artifacts.  "auto" means one per CPU.  Default: 1
+**
 **    --parse            Parse all manifests, wikis, tickets, events, and
 **                       so forth, reporting any errors found.
 **
@@ -968,6 +1970,11 @@ void test_integrity(void){
   int bParse = find_option("parse",0,0)!=0;
   int bDbOnly = find_option("db-only","d",0)!=0;
   int bQuick = find_option("quick","q",0)!=0;
+  int nJob = fossil_thread_count(find_option("jobs",0,1), 1);
+  VerifyResult *aRes = 0;
+  i64 szTotal = 0;
+  sqlite3_int64 tmStart;
+  double rElapsed;
   db_find_and_open_repository(OPEN_ANY_SCHEMA, 2);
   if( bDbOnly || bQuick ){
     const char *zType = bQuick ? "quick" : "integrity";
@@ -1004,6 +2011,10 @@ void test_integrity(void){
   }
   db_finalize(&q);
 
+  tmStart = current_time_in_milliseconds();
+  if( nJob>1 ){
+    aRes = verify_all_parallel(nJob, 1);
+  }
   db_prepare(&q, "SELECT rid, uuid, size FROM blob ORDER BY rid");
   total = db_int(0, "SELECT max(rid) FROM blob");
   while( db_step(&q)==SQLITE_ROW ){
@@ -1011,6 +2022,8 @@ void test_integrity(void){
     const char *zUuid = db_column_text(&q, 1);
     int nUuid = db_column_bytes(&q, 1);
     int size = db_column_int(&q, 2);
+    int szGot;
+    int hashOk;
     n1++;
     fossil_print("  %d/%d\r", n1, total);
     fflush(stdout);
@@ -1018,13 +2031,27 @@ void test_integrity(void){
       fossil_print("skip phantom %d %s\n", rid, zUuid);
       continue;  /* Ignore phantoms */
     }
-    content_get(rid, &content);
-    if( blob_size(&content)!=size ){
+    if( aRes && aRes[rid].eStatus!=VERIFY_UNCHECKED ){
+      /* Already reconstructed and hashed by a helper thread */
+      szGot = aRes[rid].sz;
+      hashOk = aRes[rid].eStatus==VERIFY_OK;
+      if( bParse && aRes[rid].isControl ){
+        content_get(rid, &content);
+      }else{
+        blob_zero(&content);
+      }
+    }else{
+      content_get(rid, &content);
+      szGot = blob_size(&content);
+      hashOk = hname_verify_hash_local(&content, zUuid, nUuid)!=0;
+    }
+    szTotal += szGot;
+    if( szGot!=size ){
       fossil_print("size mismatch on artifact %d: wanted %d but got %d\n",
-                     rid, size, blob_size(&content));
+                     rid, size, szGot);
       nErr++;
     }
-    if( !hname_verify_hash(&content, zUuid, nUuid) ){
+    if( !hashOk ){
       fossil_print("wrong hash on artifact %d\n",rid);
       nErr++;
     }
@@ -1060,8 +2087,15 @@ void test_integrity(void){
     n2++;
   }
   db_finalize(&q);
+  fossil_free(aRes);
+  rElapsed = (current_time_in_milliseconds() - tmStart)/1000.0;
   fossil_print("%d non-phantom blobs (out of %d total) checked:  %d errors\n",
                n2, n1, nErr);
+  fossil_print("%lld bytes checked in %.3f seconds", szTotal, rElapsed);
+  if( rElapsed>0.0 ){
+    fossil_print(", %.1f MB/s", szTotal/(rElapsed*1000000.0));
+  }
+  fossil_print("\n");
   if( bParse ){
     static const char *const azType[] = { 0, "manifest", "cluster",
         "control", "wiki", "ticket", "attachment", "event" };
@@ -192,6 +192,14 @@ void cookie_render(void){
   cookies.bIsInit = 0;
 }
 
+/* Discard the preferences of the previous request, so that a server
+** process can begin another.
+*/
+void cookie_reset_request(void){
+  fossil_free(cookies.zCookieValue);
+  memset(&cookies, 0, sizeof(cookies));
+}
+
 /* Return the value of a preference cookie.
 */
 const char *cookie_value(const char *zPName, const char *zDefault){
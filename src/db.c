@@ -66,6 +66,15 @@ struct Stmt {
 ** error handling cases.
 */
 #define empty_Stmt_m {BLOB_INITIALIZER,NULL, NULL, NULL, 0, 0}
+
+/*
+** Used by db_is_new_connection() to remember the database connection
+** for which some one-time setup was last done.
+*/
+struct DbSeen {
+  sqlite3 *pDb;           /* The connection */
+  int nOpen;              /* Number of db_open() calls when it was seen */
+};
 #endif /* INTERFACE */
 const struct Stmt empty_Stmt = empty_Stmt_m;
 
@@ -144,6 +153,11 @@ static struct DbLocalData {
   PROTECT_USER|PROTECT_CONFIG|PROTECT_BASELINE,  /* protectMask */
   0, 0, 0, 0, 0, 0, };
 
+/*
+** Number of database connections opened by db_open()
+*/
+static int nDbOpen = 0;
+
 /*
 ** Arrange for the given file to be deleted on a failure.
 */
@@ -1594,6 +1608,21 @@ void db_maybe_set_encryption_key(sqlite3 *db, const char *zDbName){
   blob_reset(&key);
 }
 
+/*
+** Return true if pDb is a connection for which the caller has not yet
+** done its one-time setup, such as registering SQL functions.  *pSeen
+** is the caller's record of the connection for which it last did that
+** setup.  A connection that replaces a closed one might be allocated at
+** the same address, so connections are told apart by the number of
+** connections opened so far as well.
+*/
+int db_is_new_connection(sqlite3 *pDb, DbSeen *pSeen){
+  if( pSeen->pDb==pDb && pSeen->nOpen==nDbOpen ) return 0;
+  pSeen->pDb = pDb;
+  pSeen->nOpen = nDbOpen;
+  return 1;
+}
+
 /*
 ** Open a database file.  Return a pointer to the new database
 ** connection.  An error results in process abort.
@@ -1602,6 +1631,7 @@ LOCAL sqlite3 *db_open(const char *zDbName){
   int rc;
   sqlite3 *db;
 
+  nDbOpen++;
   if( g.fSqlTrace ) fossil_trace("-- sqlite3_open: [%s]\n", zDbName);
   if( strcmp(zDbName, g.nameOfExe)==0 ){
     extern int sqlite3_appendvfs_init(
@@ -2358,6 +2388,52 @@ void db_must_be_within_tree(void){
   db_verify_schema();
 }
 
+/*
+** Undo the changes that handling an HTTP request makes to the database
+** connection, so that a long-running server process can use the same
+** connection for its next request:  reset every statement so that no
+** read transaction is left open, drop TEMP tables and views, and
+** forget any authorizer or pending db_optional_sql() changes.
+**
+** Return zero if the connection is ready for reuse.  Return non-zero
+** if it is not, for example because a transaction is still pending
+** or because the configuration database has been attached.  In that
+** case the caller should close the database and exit.
+*/
+int db_request_cleanup(void){
+  sqlite3_stmt *pStmt = 0;
+  Stmt q;
+  Blob sql;
+  if( g.db==0 || !g.repositoryOpen ) return 1;
+  if( db.nBegin>0 || !sqlite3_get_autocommit(g.db) ) return 1;
+  if( db.nProtect>0 || db.nDeleteOnFail>0 ) return 1;
+  if( g.zConfigDbName || g.dbConfig ) return 1;
+  while( db.nBeforeCommit>0 ){
+    /* Optional changes are discarded if nothing else was changed */
+    sqlite3_free(db.azBeforeCommit[--db.nBeforeCommit]);
+  }
+  while( (pStmt = sqlite3_next_stmt(g.db, pStmt))!=0 ){
+    sqlite3_reset(pStmt);
+  }
+  db_clear_authorizer();
+  blob_init(&sql, 0, 0);
+  db_prepare(&q,
+    "SELECT type, name FROM temp.sqlite_schema"
+    " WHERE type IN ('table','view') AND name NOT LIKE 'sqlite_%%'"
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    blob_append_sql(&sql, "DROP %s IF EXISTS temp.\"%w\";\n",
+                    db_column_text(&q,0)/*safe-for-%s*/,
+                    db_column_text(&q,1));
+  }
+  db_finalize(&q);
+  if( blob_size(&sql)>0 ){
+    db_exec_sql(blob_sql_text(&sql));
+  }
+  blob_reset(&sql);
+  return 0;
+}
+
 /*
 ** Close the database connection.
 **
@@ -3689,6 +3765,27 @@ struct Setting {
 ** OFF by default, for portability.
 */
 /*
+** SETTING: archive-jobs    width=16 default=1
+** The number of helper threads used to compress each ZIP, SQLAR or
+** tarball archive, for the /zip, /sqlar and /tarball pages and for the
+** "fossil zip", "fossil sqlar" and "fossil tarball" commands.  "auto"
+** means one thread per CPU.  The default of 1 compresses archives
+** serially.  ZIP and SQLAR archives come out the same either way.  A
+** tarball compressed on more than one thread is compressed in blocks,
+** so its gzip stream differs from the serial one, though it unpacks to
+** the same files.
+*/
+/*
+** SETTING: archive-pregen  width=40
+** A list of the archive pages, "tarball", "zip" and "sqlar", whose
+** archives the backoffice should build ahead of time for the newest
+** check-ins that are tagged "release" or that are the tips of open
+** branches.  The archives go into the web-page cache (see the "fossil
+** cache" command), which must exist, and take up at most half of
+** max-cache-entry.  Only one archive is built per backoffice run.
+** Empty, the default, means none.
+*/
+/*
 ** SETTING: auto-captcha    boolean default=on variable=autocaptcha
 ** If enabled, the /login page provides a button that will automatically
 ** fill in the captcha password.  This makes things easier for human users,
@@ -3824,6 +3921,16 @@ struct Setting {
 ** Administration of the HTTP UI.
 */
 /*
+** SETTING: diff-algorithm  width=15 default=fossil
+** The algorithm used by the built-in diff, by annotate, and by merge.
+** "fossil" is the original Fossil algorithm, which is fast and looks
+** for a large block of common text near the middle of the changes.
+** "myers" finds a minimal set of changes in O(ND) time and linear
+** space, and settles for a near-minimal one when the files are very
+** different.  "histogram" builds the diff around lines that are rare
+** in both files, which keeps moved and repeated code together.
+*/
+/*
 ** SETTING: diff-binary     boolean default=on
 ** If enabled, permit files that may be binary
 ** or that match the "binary-glob" setting to be used with
@@ -3994,6 +4101,38 @@ struct Setting {
 ** and Fossil repositories both require manifests.
 */
 /*
+** SETTING: manifest-index   width=25 default=10000
+** Check-ins with at least this many files get a compact binary index
+** of their file list, so that files can be found without parsing the
+** whole manifest.  The index is kept in the web-page cache file (see
+** the "fossil cache init" command) if it exists.  Zero disables the
+** index.
+*/
+/*
+** SETTING: max-artifact-cache width=25 default=0
+** If the web-page cache file exists (see the "fossil cache init"
+** command) and this value is greater than zero, then artifacts that
+** are built from long delta chains are stored fully expanded in the
+** cache file, using no more than this many bytes in total.
+*/
+/*
+** SETTING: max-annotate-cache width=25 default=1000
+** If the web-page cache file exists (see the "fossil cache init"
+** command), the results of annotating files are kept in the cache
+** file so that later annotations of the same file, or of a newer
+** version of it, need little or no work.  This is the maximum number
+** of annotations kept.  Zero disables the annotation cache.
+*/
+/*
+** SETTING: max-clone-pack-cache width=25 default=1000
+** If the web-page cache file exists (see the "fossil cache init"
+** command), the packs of artifacts that are sent to clients during a
+** clone are kept in the cache file so that later clones can send them
+** without reading every artifact again.  Each pack holds 1000
+** artifacts.  This is the maximum number of packs kept.  Zero disables
+** the clone pack cache.
+*/
+/*
 ** SETTING: max-loadavg      width=25 default=0.0
 ** Some CPU-intensive web pages (ex: /zip, /tarball, /blame)
 ** are disallowed if the system load average goes above this
@@ -4122,6 +4261,22 @@ struct Setting {
 ** authenticate this client, in addition to the normal
 ** password authentication.
 */
+/*
+** SETTING: sync-pipeline    width=8 default=4
+** The largest number of requests that "fossil sync", "pull" and
+** "clone" send to a server at once without waiting for the replies.
+** This saves round-trips on slow links.  It is only done with servers
+** that say that they accept it.  Set to 1 to send one request at a time.
+*/
+/*
+** SETTING: sync-reconcile   boolean default=off
+** If enabled, "fossil sync", "pull" and "push" describe the artifacts
+** that the remote side might not know about with a small summary table
+** rather than with one "igot" card per artifact.  The server works out
+** from the table which artifacts differ between the two repositories.
+** This saves bytes when the repositories are nearly in sync.  If the
+** summary cannot be decoded, the usual "igot" cards are sent instead.
+*/
 #ifdef FOSSIL_ENABLE_TCL
 /*
 ** SETTING: tcl              boolean default=off sensitive
@@ -4470,9 +4625,8 @@ void test_without_rowid(void){
 ** Make sure the adminlog table exists.  Create it if it does not
 */
 void create_admin_log_table(void){
-  static int once = 0;
-  if( once ) return;
-  once = 1;
+  static DbSeen seen;
+  if( !db_is_new_connection(g.db, &seen) ) return;
   db_multi_exec(
     "CREATE TABLE IF NOT EXISTS repository.admin_log(\n"
     " id INTEGER PRIMARY KEY,\n"
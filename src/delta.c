@@ -29,6 +29,28 @@
 #include <string.h>
 #include "delta.h"
 
+#ifdef __GNUC__
+# define GCC_VERSION (__GNUC__*1000000+__GNUC_MINOR__*1000+__GNUC_PATCHLEVEL__)
+#else
+# define GCC_VERSION 0
+#endif
+
+/*
+** Select the fastest available method for comparing runs of bytes
+** in match_length().  Both fast methods need __builtin_ctz().  Clang
+** has it but identifies itself as GCC 4.2.1, so test for it by name.
+*/
+#if GCC_VERSION>=4003000 || defined(__clang__)
+# define DELTA_HAS_CTZ 1
+#endif
+#if defined(__SSE2__) && defined(DELTA_HAS_CTZ)
+# include <emmintrin.h>
+# define DELTA_USE_SSE2 1
+#elif defined(DELTA_HAS_CTZ) && defined(__BYTE_ORDER__) \
+      && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+# define DELTA_USE_WORDS 1
+#endif
+
 /*
 ** Macros for turning debugging printfs on and off
 */
@@ -75,62 +97,131 @@ typedef unsigned short int u16;
 #endif /* INTERFACE */
 
 /*
-** The width of a hash window in bytes.  The algorithm only works if this
-** is a power of 2.
+** The width of a hash window in bytes.  This must be 16, as the rolling
+** hash shifts two bits per character through a 32-bit value.
 */
 #define NHASH 16
 
+/*
+** Random values used by the rolling hash.  There is one entry for
+** each possible byte value.
+*/
+static const u32 aGear[256] = {
+  0xf4e9e169, 0x6c0e1582, 0x5d2803a3, 0x8dffd55b,
+  0x530f3d02, 0x3ee69bb8, 0x576638c0, 0x7ab5270f,
+  0x3d27c2e3, 0x7883a84c, 0x859b7730, 0xf44e7f1c,
+  0xae5679ad, 0xe0bbc122, 0x800db4f6, 0x930f7ddc,
+  0x6fb6406b, 0x704aebe1, 0x6daca36e, 0xd687d1d0,
+  0xddcb0a67, 0x7defc92f, 0x8310d31f, 0x448badfa,
+  0xa08c51f6, 0x6068d4c1, 0x9f4d1a92, 0xc6e112be,
+  0x40ec5f3c, 0xb91f8eec, 0x2df6dd5f, 0x20bf00c1,
+  0x4311705d, 0x5ea012d2, 0x83b14d97, 0x959969da,
+  0xed90e7af, 0x01d964e2, 0xb8f05e15, 0xf756b89e,
+  0x8dacc72d, 0x91e837ec, 0x7ff97cf2, 0x39e11f4a,
+  0x210a50cf, 0x239675af, 0x452c5914, 0xa86c61d0,
+  0xee8ed293, 0xee7890db, 0x324d4588, 0x69f54e9a,
+  0x3226702b, 0x7d454d1b, 0x754c1a88, 0xaf8dd9d7,
+  0x611951bc, 0xed50037a, 0x9cfb19ab, 0x289aa113,
+  0xec18ee10, 0x1c932ac7, 0xc004aeea, 0xc2f21fcb,
+  0x746d6a5b, 0xa9736f37, 0x0c064c99, 0x63870bd5,
+  0x4189601f, 0x1d3c2afc, 0xa7aa0d38, 0x0442db54,
+  0x00be87fa, 0x77098902, 0x8c397d15, 0x5c5b4d26,
+  0xcbe3b37e, 0xcc76dc6e, 0xb1b7fad1, 0xc5cf6672,
+  0xe70ccd28, 0x3ab6a660, 0x28c961bb, 0xa617d2d0,
+  0x270ac73b, 0x002b0d7b, 0x281443f6, 0xbb463102,
+  0xd1768546, 0x20838fc2, 0x6a50c2c9, 0x68c17cb5,
+  0x850e5b13, 0xd1412371, 0x72b57267, 0xd703ea69,
+  0x453e9c0f, 0x4ad23526, 0x32df459d, 0xe929a8a4,
+  0x3b95d91c, 0x72d75080, 0x32b028e8, 0x210f023a,
+  0x2b12eb72, 0xf28c2b5d, 0x3d2e5160, 0x4e4ac49b,
+  0x5324671a, 0x6749c81b, 0x5bb1d1f0, 0x221d15d4,
+  0x964dcbfb, 0xb885b6be, 0xdbc2896d, 0x650a71a8,
+  0xb2fbc1eb, 0x673f78bf, 0x14218023, 0x6fd4f4bd,
+  0x31c69e96, 0x1eba3522, 0x12aeb532, 0xe2776f2f,
+  0xefb75b65, 0x7f58d06e, 0x3ba9a934, 0x117bbc7c,
+  0x89b62e08, 0x3318b331, 0xbf34514f, 0x9f7f0949,
+  0xbb20a290, 0x96104ac1, 0xb2c87f9c, 0x53000d12,
+  0x9031892f, 0x56fd11fa, 0x9154d507, 0x75ecb987,
+  0x032b851b, 0x5f0dc7cf, 0x47f884f3, 0x00e2a3ad,
+  0xc233b173, 0xf7455890, 0x363aa87d, 0xc078a853,
+  0x3a770ed8, 0x6068c82b, 0xe35fb725, 0x565bffde,
+  0x1f9475a3, 0x9021f6b5, 0x3649a563, 0x17a87d0e,
+  0x606f1c65, 0x32f35c04, 0xf6d27209, 0x44e80a48,
+  0xd9a88141, 0x8b28dac9, 0xc8c69d07, 0x9ceebbc9,
+  0x33e2a2d6, 0x0b1ccd3b, 0xc07e7174, 0x71e791dc,
+  0xa40a5112, 0x3bcf7ecf, 0x6634955f, 0xc4a03b72,
+  0x2c57852e, 0x48bd4e53, 0x1d0c40c8, 0xfbf66129,
+  0x5d54e685, 0xbf214abc, 0x74052b2d, 0x0a3c22dc,
+  0x0604eed0, 0x0abc5ae1, 0x18380564, 0xd3a4ef76,
+  0x85d1229f, 0x657cfe1f, 0xed30c8ab, 0xbab7755d,
+  0x391beea6, 0x8a2862b0, 0x90d502a9, 0xdbc39e16,
+  0xd78f42cb, 0x2b37c3fd, 0x5c445c41, 0x40b3b922,
+  0xe09b3a12, 0xdcf084d4, 0xe037bd5c, 0xe319f783,
+  0xd89165aa, 0x4c2e6569, 0x12594f07, 0xfd4f0e7b,
+  0x6efc6188, 0x41c888d7, 0x6aa50aff, 0x5e0a86f6,
+  0xe5d16db8, 0xb4a85cbb, 0x0360a8f5, 0xdad40565,
+  0x6a0ea345, 0xa3ee5955, 0x56464181, 0x6d1e9ec6,
+  0x77db4849, 0x9570971e, 0x50f92ffc, 0x1983a691,
+  0x4e90884d, 0xdb656bff, 0x4c47fe8c, 0x0d203c49,
+  0x910f2db2, 0x02079dab, 0xb3033483, 0x617f4f1b,
+  0x81c25098, 0x2a7fdece, 0x914904f6, 0x8c0ab149,
+  0x3985bec8, 0x9906228a, 0x6eff9200, 0x5e8337d3,
+  0x04bb6dfb, 0xe0fe167a, 0xfc916026, 0x060c4703,
+  0xaf4cbaaa, 0xe46f6b39, 0x63dc8cb4, 0xb8fba9f8,
+  0x54943591, 0x3587bd85, 0x28cc1134, 0x06d5fdfa,
+  0x50102aea, 0xdc7d5139, 0xf72055fa, 0x93239ab3,
+  0x80c12873, 0x4cb81841, 0x0d70dd89, 0x621e8f18,
+};
+
 /*
 ** The current state of the rolling hash.
 **
-** z[] holds the values that have been hashed.  z[] is a circular buffer.
-** z[i] is the first entry and z[(i+NHASH-1)%NHASH] is the last entry of
-** the window.
-**
-** Hash.a is the sum of all elements of hash.z[].  Hash.b is a weighted
-** sum.  Hash.b is z[i]*NHASH + z[i+1]*(NHASH-1) + ... + z[i+NHASH-1]*1.
-** (Each index for z[] should be module NHASH, of course.  The %NHASH operator
-** is omitted in the prior expression for brevity.)
+** This is a "gear" hash.  Each new character shifts the hash left by
+** two bits and adds in the random value aGear[] for that character.  A
+** 32-bit hash thus depends on exactly the last 16 (NHASH) characters,
+** since older characters have been shifted out entirely, and there is
+** no need to remember the window contents in order to remove the
+** oldest character.
 */
 typedef struct hash hash;
 struct hash {
-  u16 a, b;         /* Hash values */
-  u16 i;            /* Start of the hash window */
-  char z[NHASH];    /* The values that have been hashed */
+  u32 h;            /* Hash value */
 };
 
 /*
 ** Initialize the rolling hash using the first NHASH characters of z[]
 */
 static void hash_init(hash *pHash, const char *z){
-  u16 a, b, i;
-  a = b = z[0];
-  for(i=1; i<NHASH; i++){
-    a += z[i];
-    b += a;
+  u32 h = 0;
+  int i;
+  for(i=0; i<NHASH; i++){
+    h = (h<<2) + aGear[(unsigned char)z[i]];
   }
-  memcpy(pHash->z, z, NHASH);
-  pHash->a = a & 0xffff;
-  pHash->b = b & 0xffff;
-  pHash->i = 0;
+  pHash->h = h;
 }
 
 /*
 ** Advance the rolling hash by a single character "c"
 */
 static void hash_next(hash *pHash, int c){
-  u16 old = pHash->z[pHash->i];
-  pHash->z[pHash->i] = c;
-  pHash->i = (pHash->i+1)&(NHASH-1);
-  pHash->a = pHash->a - old + c;
-  pHash->b = pHash->b - NHASH*old + pHash->a;
+  pHash->h = (pHash->h<<2) + aGear[(unsigned char)c];
 }
 
 /*
-** Return a 32-bit hash value
+** Return a 32-bit hash value.
+**
+** The low-order bits of the rolling hash depend only on the last few
+** characters, since each character shifts the earlier ones toward the
+** high end.  The value is used modulo the hash table size, so fold the
+** high-order bits into the low-order bits first so that every
+** character of the window counts.
 */
 static u32 hash_32bit(hash *pHash){
-  return (pHash->a & 0xffff) | (((u32)(pHash->b & 0xffff))<<16);
+  u32 h = pHash->h;
+  h ^= h>>16;
+  h *= 0x85ebca6b;
+  h ^= h>>13;
+  return h;
 }
 
 /*
@@ -142,13 +233,41 @@ static u32 hash_32bit(hash *pHash){
 **    return hash_32bit(&h);
 */
 static u32 hash_once(const char *z){
-  u16 a, b, i;
-  a = b = z[0];
-  for(i=1; i<NHASH; i++){
-    a += z[i];
-    b += a;
+  hash h;
+  hash_init(&h, z);
+  return hash_32bit(&h);
+}
+
+/*
+** Return the number of bytes at the beginning of z1[] and z2[] that are
+** identical, up to a maximum of N.
+**
+** This is the inner loop of the match extension in delta_create().
+** Sixteen bytes are compared at a time using SSE2 where available (it
+** is part of the baseline instruction set on x86-64, so no runtime check
+** is needed) and eight bytes at a time on other little-endian machines.
+*/
+static int match_length(const char *z1, const char *z2, int N){
+  int n = 0;
+#if defined(DELTA_USE_SSE2)
+  while( n+16<=N ){
+    __m128i a = _mm_loadu_si128((const __m128i*)&z1[n]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&z2[n]);
+    unsigned m = 0xffff ^ (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+    if( m ) return n + __builtin_ctz(m);
+    n += 16;
+  }
+#elif defined(DELTA_USE_WORDS)
+  while( n+8<=N ){
+    unsigned long long a, b;
+    memcpy(&a, &z1[n], 8);
+    memcpy(&b, &z2[n], 8);
+    if( a!=b ) return n + (__builtin_ctzll(a^b)>>3);
+    n += 8;
   }
-  return a | (((u32)b)<<16);
+#endif
+  while( n<N && z1[n]==z2[n] ) n++;
+  return n;
 }
 
 /*
@@ -211,12 +330,6 @@ static int digit_count(int v){
   return i;
 }
 
-#ifdef __GNUC__
-# define GCC_VERSION (__GNUC__*1000000+__GNUC_MINOR__*1000+__GNUC_PATCHLEVEL__)
-#else
-# define GCC_VERSION 0
-#endif
-
 /*
 ** Compute a 32-bit big-endian checksum on the N-byte buffer.  If the
 ** buffer is not a multiple of 4 bytes length, compute the sum that would
@@ -430,9 +543,7 @@ int delta_create(
         iSrc = iBlock*NHASH;
         y = base+i;
         limitX = ( lenSrc-iSrc <= lenOut-y ) ? lenSrc : iSrc + lenOut - y;
-        for(x=iSrc; x<limitX; x++, y++){
-          if( zSrc[x]!=zOut[y] ) break;
-        }
+        x = iSrc + match_length(&zSrc[iSrc], &zOut[y], limitX-iSrc);
         j = x - iSrc - 1;
 
         /* Beginning at iSrc-1, match backwards as far as we can.  k counts
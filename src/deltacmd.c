@@ -195,3 +195,114 @@ void cmd_test_delta(void){
   }
   fossil_print("ok\n");
 }
+
+/*
+** Create a delta from pSrc to pTarget, apply it, and verify that the
+** target is recovered.  Accumulate CPU times (in microseconds) and the
+** size of the delta into the three counters.
+*/
+static void delta_bench_one(
+  Blob *pSrc,                /* Source of the delta */
+  Blob *pTarget,             /* Target of the delta */
+  int nRepeat,               /* Number of times to repeat each step */
+  sqlite3_uint64 *pCreate,   /* Add delta_create() time here */
+  sqlite3_uint64 *pApply,    /* Add delta_apply() time here */
+  i64 *pDeltaSize            /* Add the size of the delta here */
+){
+  Blob delta, out;
+  int i;
+  int timerId = fossil_timer_start();
+  for(i=0; i<nRepeat; i++){
+    if( i ) blob_reset(&delta);
+    blob_delta_create(pSrc, pTarget, &delta);
+  }
+  *pCreate += fossil_timer_reset(timerId);
+  for(i=0; i<nRepeat; i++){
+    if( i ) blob_reset(&out);
+    blob_delta_apply(pSrc, &delta, &out);
+  }
+  *pApply += fossil_timer_stop(timerId);
+  if( blob_compare(pTarget, &out) ){
+    fossil_fatal("delta round-trip failed");
+  }
+  *pDeltaSize += blob_size(&delta);
+  blob_reset(&delta);
+  blob_reset(&out);
+}
+
+/*
+** COMMAND: test-delta-bench
+**
+** Usage: %fossil test-delta-bench ?FILE ...? ?OPTIONS?
+**
+** Measure the speed of delta_create() and delta_apply() over a corpus
+** and verify that every delta round-trips.  If files are named on the
+** command line, each file is used as the target of a delta whose source
+** is the file named before it.  Otherwise the corpus is every delta
+** stored in the repository: each such artifact is a target and its
+** delta source is the source.
+**
+** Options:
+**    --limit N              Use at most N pairs from the repository
+**    --repeat N             Repeat each measurement N times.  Default: 1
+**    -R|--repository FILE   Use deltas from repository FILE
+*/
+void delta_bench_cmd(void){
+  const char *zLimit = find_option("limit",0,1);
+  const char *zRepeat = find_option("repeat",0,1);
+  int nRepeat = zRepeat ? atoi(zRepeat) : 1;
+  int nPair = 0;
+  i64 szSrc = 0, szTarget = 0, szDelta = 0;
+  sqlite3_uint64 tmCreate = 0, tmApply = 0;
+  Blob src, target;
+
+  find_repository_option();
+  if( nRepeat<1 ) nRepeat = 1;
+  if( g.argc>=3 ){
+    int i;
+    verify_all_options();
+    if( g.argc<4 ) usage("FILE1 FILE2 ?FILE ...?");
+    blob_read_from_file(&src, g.argv[2], ExtFILE);
+    for(i=3; i<g.argc; i++){
+      blob_read_from_file(&target, g.argv[i], ExtFILE);
+      delta_bench_one(&src, &target, nRepeat, &tmCreate, &tmApply, &szDelta);
+      szSrc += blob_size(&src);
+      szTarget += blob_size(&target);
+      nPair++;
+      blob_reset(&src);
+      src = target;
+    }
+    blob_reset(&src);
+  }else{
+    Stmt q;
+    db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+    verify_all_options();
+    db_prepare(&q, "SELECT rid, srcid FROM delta ORDER BY rid LIMIT %d",
+               zLimit ? atoi(zLimit) : -1);
+    while( db_step(&q)==SQLITE_ROW ){
+      if( !content_get(db_column_int(&q,1), &src) ) continue;
+      if( content_get(db_column_int(&q,0), &target) ){
+        delta_bench_one(&src, &target, nRepeat, &tmCreate, &tmApply,
+                        &szDelta);
+        szSrc += blob_size(&src);
+        szTarget += blob_size(&target);
+        nPair++;
+      }
+      blob_reset(&src);
+      blob_reset(&target);
+    }
+    db_finalize(&q);
+  }
+  fossil_print("pairs:           %d\n", nPair);
+  fossil_print("source-bytes:    %lld\n", szSrc);
+  fossil_print("target-bytes:    %lld\n", szTarget);
+  fossil_print("delta-bytes:     %lld (%.2f%% of target)\n", szDelta,
+               szTarget ? 100.0*szDelta/szTarget : 0.0);
+  szTarget *= nRepeat;
+  fossil_print("create:          %.3f seconds, %.1f MB/s\n",
+               tmCreate/1000000.0,
+               tmCreate ? szTarget/(double)tmCreate : 0.0);
+  fossil_print("apply:           %.3f seconds, %.1f MB/s\n",
+               tmApply/1000000.0,
+               tmApply ? szTarget/(double)tmApply : 0.0);
+}
@@ -44,6 +44,10 @@
 #define DIFF_NOTTOOBIG    (((u64)0x08)<<32) /* Only display if not too big */
 #define DIFF_STRIP_EOLCR  (((u64)0x10)<<32) /* Strip trailing CR */
 #define DIFF_SLOW_SBS     (((u64)0x20)<<32) /* Better but slower side-by-side */
+#define DIFF_ALG_MASK     (((u64)0xc0)<<32) /* Algorithm. 0: "diff-algorithm" */
+#define DIFF_ALG_FOSSIL   (((u64)0x40)<<32) /* The original Fossil algorithm */
+#define DIFF_ALG_MYERS    (((u64)0x80)<<32) /* Myers O(ND) algorithm */
+#define DIFF_ALG_HISTOGRAM (((u64)0xc0)<<32) /* Histogram algorithm */
 
 /*
 ** These error messages are shared in multiple locations.  They are defined
@@ -332,6 +336,31 @@ static void appendDiffLineno(Blob *pOut, int lnA, int lnB, int html){
   if( html ) blob_append(pOut, "</span>", -1);
 }
 
+/*
+** Number of chunks of HTML diff output seen so far, for context diffs
+** and side-by-side diffs respectively.  These number the "chunkN"
+** anchors uniquely across all diffs on the same page.
+*/
+static int nContextChunk = 0;
+static int nSbsChunk = 0;
+
+/*
+** The algorithm chosen by the "diff-algorithm" setting, or 0 if the
+** setting has not been read yet.
+*/
+static u64 dfltDiffAlg = 0;
+
+/*
+** Restart the chunk numbering, so that a server process numbers the
+** diff chunks of each page from the beginning, and read the
+** "diff-algorithm" setting again.
+*/
+void diff_reset_request(void){
+  nContextChunk = 0;
+  nSbsChunk = 0;
+  dfltDiffAlg = 0;
+}
+
 /*
 ** Given a raw diff p[] in which the p->aEdit[] array has been filled
 ** in, compute a context diff into pOut.
@@ -354,7 +383,6 @@ static void contextDiff(
   int i, j;     /* Loop counters */
   int m;        /* Number of lines to output */
   int skip;     /* Number of lines to skip */
-  static int nChunk = 0;  /* Number of diff chunks seen so far */
   int nContext;    /* Number of lines of context */
   int showLn;      /* Show line numbers */
   int html;        /* Render as HTML */
@@ -428,7 +456,7 @@ static void contextDiff(
     ** context diff that contains line numbers, show the separator from
     ** the previous block.
     */
-    nChunk++;
+    nContextChunk++;
     if( showLn ){
       if( !showDivider ){
         /* Do not show a top divider */
@@ -438,7 +466,9 @@ static void contextDiff(
       }else{
         blob_appendf(pOut, "%.80c\n", '.');
       }
-      if( html ) blob_appendf(pOut, "<span id=\"chunk%d\"></span>", nChunk);
+      if( html ){
+        blob_appendf(pOut, "<span id=\"chunk%d\"></span>", nContextChunk);
+      }
     }else{
       if( html ) blob_appendf(pOut, "<span class=\"diffln\">");
       /*
@@ -1197,7 +1227,6 @@ static void sbsDiff(
   int i, j;     /* Loop counters */
   int m, ma, mb;/* Number of lines to output */
   int skip;     /* Number of lines to skip */
-  static int nChunk = 0; /* Number of chunks of diff output seen so far */
   SbsLine s;    /* Output line buffer */
   int nContext; /* Lines of context above and below each change */
   int showDivider = 0;  /* True to show the divider */
@@ -1299,9 +1328,10 @@ static void sbsDiff(
       }
     }
     showDivider = 1;
-    nChunk++;
+    nSbsChunk++;
     if( s.escHtml ){
-      blob_appendf(s.apCols[SBS_LNA], "<span id=\"chunk%d\"></span>", nChunk);
+      blob_appendf(s.apCols[SBS_LNA], "<span id=\"chunk%d\"></span>",
+                   nSbsChunk);
     }
 
     /* Show the initial common area */
@@ -1713,6 +1743,354 @@ static void diff_all(DContext *p){
   }
 }
 
+/*
+** The "myers" and "histogram" diff algorithms work on the following
+** object.  Each line is replaced by the number of its equivalence
+** class, so that lines are compared as integers, and the result is a
+** set of flags that mark the lines deleted from aFrom[] and the lines
+** inserted into aTo[].
+*/
+typedef struct DiffEngine DiffEngine;
+struct DiffEngine {
+  const int *aA;       /* Class of each line in aFrom[] */
+  const int *aB;       /* Class of each line in aTo[] */
+  char *aChgA;         /* True for lines deleted from aFrom[] */
+  char *aChgB;         /* True for lines inserted into aTo[] */
+  int *aFwd;           /* Forward furthest-reaching x on each diagonal */
+  int *aBwd;           /* Backward furthest-reaching x on each diagonal */
+  int mxCost;          /* Give up on a minimal diff after this many edits */
+  int *aCnt;           /* Histogram: occurrences of each class in range */
+  int *aHead;          /* Histogram: first line of each class in range */
+  int *aNext;          /* Histogram: next line of aFrom[] of the same class */
+};
+
+/*
+** Anchor lines that occur more often than this in the histogram diff
+** are not used.  Regions where every common line is that frequent are
+** handed to the Myers algorithm.
+*/
+#define DIFF_HISTOGRAM_MAX_CHAIN 64
+
+/*
+** Assign each line of both files to a class of identical lines,
+** according to p->xDiffer.  Return an array that holds the class
+** of each line of p->aFrom[] followed by the class of each line of
+** p->aTo[], and write the number of classes into *pnClass.
+*/
+static int *diff_line_classes(DContext *p, int *pnClass){
+  int nLine = p->nFrom + p->nTo;
+  int nSlot = 64;
+  int *aSlot;          /* Hash table holding 1+(one line of each class) */
+  int *aClass;         /* The result */
+  int nClass = 0;
+  int i, j;
+  while( nSlot<nLine*2 ) nSlot *= 2;
+  aSlot = fossil_malloc( sizeof(aSlot[0])*nSlot );
+  memset(aSlot, 0, sizeof(aSlot[0])*nSlot);
+  aClass = fossil_malloc( sizeof(aClass[0])*(nLine+1) );
+  for(i=0; i<nLine; i++){
+    const DLine *pLine = i<p->nFrom ? &p->aFrom[i] : &p->aTo[i-p->nFrom];
+    j = (int)((pLine->h ^ (pLine->h>>29)) & (nSlot-1));
+    while( aSlot[j] ){
+      int k = aSlot[j]-1;
+      const DLine *pRep = k<p->nFrom ? &p->aFrom[k] : &p->aTo[k-p->nFrom];
+      if( p->xDiffer(pRep, pLine)==0 ) break;
+      j = (j+1) & (nSlot-1);
+    }
+    if( aSlot[j]==0 ){
+      aSlot[j] = i+1;
+      aClass[i] = nClass++;
+    }else{
+      aClass[i] = aClass[aSlot[j]-1];
+    }
+  }
+  fossil_free(aSlot);
+  *pnClass = nClass;
+  return aClass;
+}
+
+/*
+** Find a point (*pX,*pY) on a shortest edit path from (iS1,iS2) to
+** (iE1,iE2), using the linear space "middle snake" search from
+** Eugene Myers' paper "An O(ND) Difference Algorithm and Its
+** Variations".  If the path needs more than e->mxCost edits, settle
+** for the point that the forward or the reverse search has carried
+** furthest.
+**
+** Return false if there is no usable point, which only happens if the
+** two ranges have no line in common.  The ranges must be non-empty and
+** must not begin or end with a common line.
+*/
+static int myersSplit(
+  DiffEngine *e,
+  int iS1, int iE1,          /* Range of lines in aFrom[] */
+  int iS2, int iE2,          /* Range of lines in aTo[] */
+  int *pX, int *pY           /* Write the split point here */
+){
+  const int *a = &e->aA[iS1];
+  const int *b = &e->aB[iS2];
+  int n = iE1 - iS1;
+  int m = iE2 - iS2;
+  int mxD = (n + m + 1)/2;
+  int delta = n - m;
+  int bFront = (delta & 1)!=0;
+  int k1Start = 0, k1End = 0, k2Start = 0, k2End = 0;
+  int *v1 = e->aFwd, *v2 = e->aBwd;
+  int d, k1, k2, x1, y1, x2, y2, i;
+  int nBest;                 /* Distance covered by the best split so far */
+  if( mxD>e->mxCost ) mxD = e->mxCost;
+  for(i=0; i<2*mxD+2; i++){ v1[i] = v2[i] = -1; }
+  v1[mxD+1] = v2[mxD+1] = 0;
+  for(d=0; d<mxD; d++){
+    /* Walk the forward path one step */
+    for(k1=k1Start-d; k1<=d-k1End; k1+=2){
+      int i1 = mxD + k1;
+      if( k1==-d || (k1!=d && v1[i1-1]<v1[i1+1]) ){
+        x1 = v1[i1+1];
+      }else{
+        x1 = v1[i1-1]+1;
+      }
+      y1 = x1 - k1;
+      while( x1<n && y1<m && a[x1]==b[y1] ){ x1++; y1++; }
+      v1[i1] = x1;
+      if( x1>n ){
+        k1End += 2;             /* Ran off the right of the graph */
+      }else if( y1>m ){
+        k1Start += 2;           /* Ran off the bottom of the graph */
+      }else if( bFront ){
+        int i2 = mxD + delta - k1;
+        if( i2>=0 && i2<2*mxD+2 && v2[i2]!=-1 && x1>=n-v2[i2] ){
+          *pX = iS1 + x1;
+          *pY = iS2 + y1;
+          return 1;
+        }
+      }
+    }
+    /* Walk the reverse path one step */
+    for(k2=k2Start-d; k2<=d-k2End; k2+=2){
+      int i2 = mxD + k2;
+      if( k2==-d || (k2!=d && v2[i2-1]<v2[i2+1]) ){
+        x2 = v2[i2+1];
+      }else{
+        x2 = v2[i2-1]+1;
+      }
+      y2 = x2 - k2;
+      while( x2<n && y2<m && a[n-x2-1]==b[m-y2-1] ){ x2++; y2++; }
+      v2[i2] = x2;
+      if( x2>n ){
+        k2End += 2;
+      }else if( y2>m ){
+        k2Start += 2;
+      }else if( !bFront ){
+        int i1 = mxD + delta - k2;
+        if( i1>=0 && i1<2*mxD+2 && v1[i1]!=-1 && v1[i1]>=n-x2 ){
+          *pX = iS1 + v1[i1];
+          *pY = iS2 + v1[i1] - (i1 - mxD);
+          return 1;
+        }
+      }
+    }
+  }
+
+  /* Too expensive, or nothing in common.  As GNU diff does, split at
+  ** the point that either search carried furthest from where it started,
+  ** provided that it matched something on the way.  A point at the far
+  ** end of the range would split nothing off. */
+  nBest = mxD-1;
+  for(k1=k1Start-mxD+1; k1<=mxD-1-k1End; k1++){
+    x1 = v1[mxD+k1];
+    y1 = x1 - k1;
+    if( x1<0 || x1>n || y1<0 || y1>m || x1+y1==n+m ) continue;
+    if( x1+y1>nBest ){ nBest = x1+y1;  *pX = iS1 + x1;  *pY = iS2 + y1; }
+  }
+  for(k2=k2Start-mxD+1; k2<=mxD-1-k2End; k2++){
+    x2 = v2[mxD+k2];
+    y2 = x2 - k2;
+    if( x2<0 || x2>n || y2<0 || y2>m || x2+y2==n+m ) continue;
+    if( x2+y2>nBest ){ nBest = x2+y2;  *pX = iE1 - x2;  *pY = iE2 - y2; }
+  }
+  return nBest>=mxD;
+}
+
+/*
+** Mark lines iS1 through iE1-1 of aFrom[] as deleted and lines iS2
+** through iE2-1 of aTo[] as inserted.
+*/
+static void diffMarkChanged(DiffEngine *e, int iS1, int iE1, int iS2, int iE2){
+  if( iE1>iS1 ) memset(&e->aChgA[iS1], 1, iE1-iS1);
+  if( iE2>iS2 ) memset(&e->aChgB[iS2], 1, iE2-iS2);
+}
+
+/*
+** Compute the difference between lines iS1 through iE1-1 of aFrom[]
+** and lines iS2 through iE2-1 of aTo[] using the Myers algorithm.
+*/
+static void myersDiff(DiffEngine *e, int iS1, int iE1, int iS2, int iE2){
+  int x = 0, y = 0;
+  while( iS1<iE1 && iS2<iE2 && e->aA[iS1]==e->aB[iS2] ){ iS1++; iS2++; }
+  while( iS1<iE1 && iS2<iE2 && e->aA[iE1-1]==e->aB[iE2-1] ){ iE1--; iE2--; }
+  if( iS1==iE1 || iS2==iE2
+   || !myersSplit(e, iS1, iE1, iS2, iE2, &x, &y)
+  ){
+    diffMarkChanged(e, iS1, iE1, iS2, iE2);
+    return;
+  }
+  myersDiff(e, iS1, x, iS2, y);
+  myersDiff(e, x, iE1, y, iE2);
+}
+
+/*
+** Compute the difference between lines iS1 through iE1-1 of aFrom[]
+** and lines iS2 through iE2-1 of aTo[] using the histogram algorithm
+** (as in JGit).  The region is split around the longest run of common
+** lines that contains the line that is least frequent in aFrom[], and
+** the parts before and after are diffed recursively.
+*/
+static void histogramDiff(
+  DiffEngine *e,
+  int iS1, int iE1,          /* Range of lines in aFrom[] */
+  int iS2, int iE2,          /* Range of lines in aTo[] */
+  int nDepth                 /* Depth of recursion */
+){
+  const int *a = e->aA;
+  const int *b = e->aB;
+  int bS1 = 0, bE1 = 0, bS2 = 0, bE2 = 0;    /* Best run so far */
+  int nBest = DIFF_HISTOGRAM_MAX_CHAIN;      /* Its lowest line count */
+  int hasCommon = 0;                         /* True if any line matches */
+  int i, j, jNext;
+
+  while( iS1<iE1 && iS2<iE2 && a[iS1]==b[iS2] ){ iS1++; iS2++; }
+  while( iS1<iE1 && iS2<iE2 && a[iE1-1]==b[iE2-1] ){ iE1--; iE2--; }
+  if( iS1==iE1 || iS2==iE2 ){
+    diffMarkChanged(e, iS1, iE1, iS2, iE2);
+    return;
+  }
+  if( nDepth>64 ){
+    myersDiff(e, iS1, iE1, iS2, iE2);
+    return;
+  }
+
+  for(i=iE1-1; i>=iS1; i--){
+    e->aNext[i] = e->aHead[a[i]];
+    e->aHead[a[i]] = i;
+    e->aCnt[a[i]]++;
+  }
+  for(j=iS2; j<iE2; j=jNext){
+    int c = b[j];
+    jNext = j+1;
+    if( e->aCnt[c]==0 ) continue;
+    hasCommon = 1;
+    if( e->aCnt[c]>nBest ) continue;
+    for(i=e->aHead[c]; i>=0; ){
+      int s1 = i, s2 = j, t1 = i+1, t2 = j+1;
+      int nCnt = e->aCnt[c];
+      while( s1>iS1 && s2>iS2 && a[s1-1]==b[s2-1] ){
+        s1--;
+        s2--;
+        if( e->aCnt[a[s1]]<nCnt ) nCnt = e->aCnt[a[s1]];
+      }
+      while( t1<iE1 && t2<iE2 && a[t1]==b[t2] ){
+        if( e->aCnt[a[t1]]<nCnt ) nCnt = e->aCnt[a[t1]];
+        t1++;
+        t2++;
+      }
+      if( t2>jNext ) jNext = t2;
+      if( t1-s1>bE1-bS1 || nCnt<nBest ){
+        bS1 = s1;  bE1 = t1;
+        bS2 = s2;  bE2 = t2;
+        nBest = nCnt;
+      }
+      /* Other occurrences inside this run give nothing new */
+      for(i=e->aNext[i]; i>=0 && i<t1; i=e->aNext[i]){}
+    }
+  }
+  for(i=iS1; i<iE1; i++){
+    e->aHead[a[i]] = -1;
+    e->aCnt[a[i]] = 0;
+  }
+
+  if( bE1>bS1 ){
+    histogramDiff(e, iS1, bS1, iS2, bS2, nDepth+1);
+    histogramDiff(e, bE1, iE1, bE2, iE2, nDepth+1);
+  }else if( hasCommon ){
+    /* Every common line is too frequent to be a good anchor */
+    myersDiff(e, iS1, iE1, iS2, iE2);
+  }else{
+    diffMarkChanged(e, iS1, iE1, iS2, iE2);
+  }
+}
+
+/*
+** Compute the differences between two files already loaded into the
+** DContext structure, using the "myers" or the "histogram" algorithm
+** as selected by eAlg.  The result is the same COPY/DELETE/INSERT
+** triples that diff_all() computes.
+*/
+static void diff_all_engine(DContext *p, u64 eAlg){
+  DiffEngine e;
+  int *aClass;
+  int nClass;
+  int i, j, nDiag;
+
+  memset(&e, 0, sizeof(e));
+  aClass = diff_line_classes(p, &nClass);
+  e.aA = aClass;
+  e.aB = &aClass[p->nFrom];
+  e.aChgA = fossil_malloc( p->nFrom + p->nTo + 1 );
+  memset(e.aChgA, 0, p->nFrom + p->nTo + 1);
+  e.aChgB = &e.aChgA[p->nFrom];
+  /* About the square root of the number of lines, but at least 4096,
+  ** as in GNU diff */
+  for(e.mxCost=1, nDiag=p->nFrom+p->nTo; nDiag>0; nDiag>>=2) e.mxCost <<= 1;
+  if( e.mxCost<4096 ) e.mxCost = 4096;
+  nDiag = (p->nFrom + p->nTo + 1)/2;
+  if( nDiag>e.mxCost ) nDiag = e.mxCost;
+  e.aFwd = fossil_malloc( sizeof(int)*(2*nDiag+2)*2 );
+  e.aBwd = &e.aFwd[2*nDiag+2];
+  if( eAlg==DIFF_ALG_HISTOGRAM ){
+    e.aCnt = fossil_malloc( sizeof(int)*(nClass*2 + p->nFrom + 1) );
+    e.aHead = &e.aCnt[nClass];
+    e.aNext = &e.aHead[nClass];
+    memset(e.aCnt, 0, sizeof(int)*nClass);
+    for(i=0; i<nClass; i++) e.aHead[i] = -1;
+    histogramDiff(&e, 0, p->nFrom, 0, p->nTo, 0);
+  }else{
+    myersDiff(&e, 0, p->nFrom, 0, p->nTo);
+  }
+
+  /* Convert the change flags into COPY/DELETE/INSERT triples */
+  i = j = 0;
+  while( i<p->nFrom || j<p->nTo ){
+    int nCopy = 0, nDel = 0, nIns = 0;
+    while( i<p->nFrom && j<p->nTo && !e.aChgA[i] && !e.aChgB[j] ){
+      nCopy++;  i++;  j++;
+    }
+    while( i<p->nFrom && e.aChgA[i] ){ nDel++;  i++; }
+    while( j<p->nTo && e.aChgB[j] ){ nIns++;  j++; }
+    if( nCopy+nDel+nIns==0 ){
+      /* Cannot happen: unchanged lines always come in pairs */
+      assert( 0 );
+      nDel = p->nFrom - i;
+      nIns = p->nTo - j;
+      i = p->nFrom;
+      j = p->nTo;
+    }
+    appendTriple(p, nCopy, nDel, nIns);
+  }
+  fossil_free(aClass);
+  fossil_free(e.aChgA);
+  fossil_free(e.aFwd);
+  fossil_free(e.aCnt);
+
+  /* Terminate the COPY/DELETE/INSERT triples with three zeros */
+  expandEdit(p, p->nEdit+3);
+  if( p->aEdit ){
+    p->aEdit[p->nEdit++] = 0;
+    p->aEdit[p->nEdit++] = 0;
+    p->aEdit[p->nEdit++] = 0;
+  }
+}
+
 /*
 ** Attempt to shift insertion or deletion blocks so that they begin and
 ** end on lines that are pure whitespace.  In other words, try to transform
@@ -1871,6 +2249,47 @@ void diff_errmsg(Blob *pOut, const char *msg, int diffFlags){
   }
 }
 
+/*
+** Return the DIFF_ALG_* value for the diff algorithm named zName, or
+** 0 if zName is not the name of a diff algorithm.
+*/
+u64 diff_algorithm_from_name(const char *zName){
+  if( fossil_strcmp(zName, "fossil")==0 ) return DIFF_ALG_FOSSIL;
+  if( fossil_strcmp(zName, "myers")==0 ) return DIFF_ALG_MYERS;
+  if( fossil_strcmp(zName, "histogram")==0 ) return DIFF_ALG_HISTOGRAM;
+  return 0;
+}
+
+/*
+** Return the DIFF_ALG_* value for the algorithm chosen by the
+** "diff-algorithm" setting.
+*/
+static u64 diff_default_algorithm(void){
+  if( dfltDiffAlg==0 ){
+    char *z = db_get("diff-algorithm", "fossil");
+    dfltDiffAlg = diff_algorithm_from_name(z);
+    if( dfltDiffAlg==0 ) dfltDiffAlg = DIFF_ALG_FOSSIL;
+    fossil_free(z);
+  }
+  return dfltDiffAlg;
+}
+
+/*
+** Compute the differences between two files already loaded into the
+** DContext structure, using the algorithm selected by the DIFF_ALG_*
+** bits of diffFlags or, if there are none, by the "diff-algorithm"
+** setting.
+*/
+static void diff_compute(DContext *p, u64 diffFlags){
+  u64 eAlg = diffFlags & DIFF_ALG_MASK;
+  if( eAlg==0 ) eAlg = diff_default_algorithm();
+  if( eAlg==DIFF_ALG_FOSSIL ){
+    diff_all(p);
+  }else{
+    diff_all_engine(p, eAlg);
+  }
+}
+
 /*
 ** Generate a report of the differences between files pA and pB.
 ** If pOut is not NULL then a unified diff is appended there.  It
@@ -1925,7 +2344,7 @@ int *text_diff(
   }
 
   /* Compute the difference */
-  diff_all(&c);
+  diff_compute(&c, diffFlags);
   if( ignoreWs && c.nEdit==6 && c.aEdit[1]==0 && c.aEdit[2]==0 ){
     fossil_free(c.aFrom);
     fossil_free(c.aTo);
@@ -1981,6 +2400,7 @@ int *text_diff(
 ** Process diff-related command-line options and return an appropriate
 ** "diffFlags" integer.
 **
+**   --algorithm NAME           Diff algorithm         DIFF_ALG_MASK
 **   --brief                    Show filenames only    DIFF_BRIEF
 **   -c|--context N             N lines of context.    DIFF_CONTEXT_MASK
 **   --html                     Format for HTML        DIFF_HTML
@@ -2028,6 +2448,14 @@ u64 diff_options(void){
   if( find_option("numstat",0,0)!=0 ) diffFlags |= DIFF_NUMSTAT;
   if( find_option("invert",0,0)!=0 ) diffFlags |= DIFF_INVERT;
   if( find_option("brief",0,0)!=0 ) diffFlags |= DIFF_BRIEF;
+  if( (z = find_option("algorithm",0,1))!=0 ){
+    u64 eAlg = diff_algorithm_from_name(z);
+    if( eAlg==0 ){
+      fossil_fatal("unknown diff algorithm \"%s\": "
+                   "should be fossil, myers or histogram", z);
+    }
+    diffFlags |= eAlg;
+  }
   return diffFlags;
 }
 
@@ -2096,6 +2524,136 @@ void test_diff_cmd(void){
   re_free(pRe);
 }
 
+/*
+** Accumulated results of one diff algorithm for test-diff-bench
+*/
+struct DiffBenchAlg {
+  const char *zName;         /* Name of the algorithm */
+  u64 eAlg;                  /* DIFF_ALG_* value */
+  sqlite3_uint64 tm;         /* CPU time in microseconds */
+  i64 nDel;                  /* Lines deleted */
+  i64 nIns;                  /* Lines inserted */
+  i64 nBlock;                /* Blocks of changed lines */
+};
+
+/*
+** Diff pA against pB with every algorithm in aAlg[] and add the results
+** to aAlg[].  Fail if the algorithms do not agree on the number of lines
+** in the two files.  Return false if the files cannot be diffed.
+*/
+static int diff_bench_one(
+  Blob *pA, Blob *pB,        /* The two files */
+  int nRepeat,               /* Number of times to repeat each diff */
+  struct DiffBenchAlg *aAlg, /* The algorithms */
+  int nAlg                   /* Number of entries in aAlg[] */
+){
+  int k, i, r;
+  int nA = -1, nB = -1;
+  for(k=0; k<nAlg; k++){
+    int *R = 0;
+    int timerId = fossil_timer_start();
+    int nLineA = 0, nLineB = 0;
+    for(i=0; i<nRepeat; i++){
+      fossil_free(R);
+      R = text_diff(pA, pB, 0, 0, aAlg[k].eAlg);
+      if( R==0 ){
+        fossil_timer_stop(timerId);
+        return 0;
+      }
+    }
+    aAlg[k].tm += fossil_timer_stop(timerId);
+    for(r=0; R[r] || R[r+1] || R[r+2]; r += 3){
+      nLineA += R[r] + R[r+1];
+      nLineB += R[r] + R[r+2];
+      aAlg[k].nDel += R[r+1];
+      aAlg[k].nIns += R[r+2];
+      if( R[r+1] || R[r+2] ) aAlg[k].nBlock++;
+    }
+    fossil_free(R);
+    if( k==0 ){
+      nA = nLineA;
+      nB = nLineB;
+    }else if( nLineA!=nA || nLineB!=nB ){
+      fossil_fatal("the %s algorithm produced an invalid edit script",
+                   aAlg[k].zName);
+    }
+  }
+  return 1;
+}
+
+/*
+** COMMAND: test-diff-bench
+**
+** Usage: %fossil test-diff-bench ?FILE ...? ?OPTIONS?
+**
+** Compare the speed of the diff algorithms and the size of the edit
+** scripts that they produce.  If files are named on the command line,
+** each file is diffed against the file named before it.  Otherwise the
+** corpus is every pair of file versions related by a check-in in the
+** repository.  The size of an edit script is the number of lines that
+** it deletes and inserts, and the number of blocks of changed lines.
+**
+** Options:
+**    --limit N              Use at most N pairs from the repository
+**    --repeat N             Repeat each diff N times.  Default: 1
+**    -R|--repository FILE   Use file versions from repository FILE
+*/
+void test_diff_bench_cmd(void){
+  const char *zLimit = find_option("limit",0,1);
+  const char *zRepeat = find_option("repeat",0,1);
+  int nRepeat = zRepeat ? atoi(zRepeat) : 1;
+  int nPair = 0;
+  int k;
+  Blob a, b;
+  struct DiffBenchAlg aAlg[] = {
+    { "fossil",    DIFF_ALG_FOSSIL,    0, 0, 0, 0 },
+    { "myers",     DIFF_ALG_MYERS,     0, 0, 0, 0 },
+    { "histogram", DIFF_ALG_HISTOGRAM, 0, 0, 0, 0 },
+  };
+
+  find_repository_option();
+  if( nRepeat<1 ) nRepeat = 1;
+  if( g.argc>=3 ){
+    int i;
+    verify_all_options();
+    if( g.argc<4 ) usage("FILE1 FILE2 ?FILE ...?");
+    blob_read_from_file(&a, g.argv[2], ExtFILE);
+    for(i=3; i<g.argc; i++){
+      blob_read_from_file(&b, g.argv[i], ExtFILE);
+      nPair += diff_bench_one(&a, &b, nRepeat, aAlg, count(aAlg));
+      blob_reset(&a);
+      a = b;
+    }
+    blob_reset(&a);
+  }else{
+    Stmt q;
+    db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+    verify_all_options();
+    db_prepare(&q,
+      "SELECT DISTINCT pid, fid FROM mlink"
+      " WHERE pid>0 AND fid>0 AND pid<>fid ORDER BY fid LIMIT %d",
+      zLimit ? atoi(zLimit) : -1
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      if( !content_get(db_column_int(&q,0), &a) ) continue;
+      if( content_get(db_column_int(&q,1), &b) ){
+        nPair += diff_bench_one(&a, &b, nRepeat, aAlg, count(aAlg));
+      }
+      blob_reset(&a);
+      blob_reset(&b);
+    }
+    db_finalize(&q);
+  }
+  fossil_print("pairs: %d\n", nPair);
+  fossil_print("%-10s %10s %10s %10s %10s\n",
+               "algorithm", "seconds", "deleted", "inserted", "blocks");
+  for(k=0; k<count(aAlg); k++){
+    fossil_print("%-10s %10.3f %10lld %10lld %10lld\n",
+                 aAlg[k].zName, aAlg[k].tm/1000000.0,
+                 aAlg[k].nDel, aAlg[k].nIns, aAlg[k].nBlock);
+  }
+}
+
 /**************************************************************************
 ** The basic difference engine is above.  What follows is the annotation
 ** engine.  Both are in the same file since they share many components.
@@ -2181,7 +2739,7 @@ static int annotation_step(
 
   /* Compute the differences going from pParent to the file being
   ** annotated. */
-  diff_all(&p->c);
+  diff_compute(&p->c, diffFlags);
 
   /* Where new lines are inserted on this difference, record the
   ** iVers as the source of the new line.
@@ -2210,19 +2768,216 @@ static int annotation_step(
   return 0;
 }
 
-/* Return the current time as milliseconds since the Julian epoch */
-static sqlite3_int64 current_time_in_milliseconds(void){
-  static sqlite3_vfs *clockVfs = 0;
-  sqlite3_int64 t;
-  if( clockVfs==0 ) clockVfs = sqlite3_vfs_find(0);
-  if( clockVfs->iVersion>=2 && clockVfs->xCurrentTimeInt64!=0 ){
-    clockVfs->xCurrentTimeInt64(clockVfs, &t);
-  }else{
-    double r;
-    clockVfs->xCurrentTime(clockVfs, &r);
-    t = (sqlite3_int64)(r*86400000.0);
+/*
+** The annotation of a file is saved in the annotation cache (see
+** cache.c) under a key made from the check-in in which that version of
+** the file appeared, the annotation flags, the diff algorithm and the
+** filename.  The data is a header line
+**
+**     NVERS LAST-FILE-HASH NLINE
+**
+** followed by one line for each of the NLINE lines of the file that
+** holds one more than the index (counting the version being annotated as
+** 0) of the version that added the line, or 0 if the line is older than
+** the NVERS versions analyzed.  LAST-FILE-HASH is the hash of the
+** oldest version analyzed, which serves as a check that the history is
+** unchanged.
+**
+** Set annNoCache to bypass the cache, for benchmarking.
+*/
+static int annNoCache = 0;
+
+/*
+** An annotation need not be computed from scratch if the annotation of
+** one of the ANN_CACHE_SEARCH most recent earlier versions of the file
+** is in the cache.
+*/
+#define ANN_CACHE_SEARCH 25
+
+/*
+** Return the annotation cache key for a file that is zFilename in
+** check-in zMUuid.  The caller must free the result.
+*/
+static char *annotation_cache_key(
+  const char *zMUuid,
+  const char *zFilename,
+  u64 annFlags
+){
+  annFlags &= DIFF_IGNORE_ALLWS|DIFF_STRIP_EOLCR;
+  annFlags |= diff_default_algorithm();
+  return mprintf("%s/%llx/%s", zMUuid, annFlags, zFilename);
+}
+
+/*
+** Given aTag[] which holds the version index of each of the nFrom lines
+** in aFrom[], compute the version index of each line of a newer version
+** aTo[] of the same file, by diffing the two.  Lines that aTo[] inherits
+** keep their index and new lines get iVers.  Return an array of nTo
+** integers obtained from fossil_malloc().
+*/
+static int *annotation_forward_step(
+  const int *aTag,           /* Version of each line of aFrom[] */
+  DLine *aFrom, int nFrom,   /* The older version of the file */
+  DLine *aTo, int nTo,       /* The newer version of the file */
+  int iVers,                 /* Index of the newer version */
+  int (*xDiffer)(const DLine*,const DLine*),
+  u64 diffFlags
+){
+  DContext c;
+  int *aNew;
+  int i, j, lnFrom, lnTo;
+  memset(&c, 0, sizeof(c));
+  c.aFrom = aFrom;
+  c.nFrom = nFrom;
+  c.aTo = aTo;
+  c.nTo = nTo;
+  c.xDiffer = xDiffer;
+  diff_compute(&c, diffFlags);
+  aNew = fossil_malloc( sizeof(aNew[0])*(nTo+1) );
+  for(i=lnFrom=lnTo=0; i<c.nEdit; i+=3){
+    for(j=0; j<c.aEdit[i]; j++) aNew[lnTo++] = aTag[lnFrom++];
+    lnFrom += c.aEdit[i+1];
+    for(j=0; j<c.aEdit[i+2]; j++) aNew[lnTo++] = iVers;
+  }
+  assert( lnFrom==nFrom && lnTo==nTo );
+  fossil_free(c.aEdit);
+  return aNew;
+}
+
+/*
+** Fill in the annotation p from the annotation cache, using one of the
+** first nRow versions in p->aVers[], whose artifact IDs are in aFid[].
+** If the annotation of p->aVers[0] itself is cached, just load it.
+** Otherwise, if the annotation of a recent earlier version is cached,
+** carry it forward one version at a time.
+**
+** Set p->nVers to the number of versions that the annotation covers.
+** Return that number if the annotation came straight from the cache,
+** or 0 if it did not.
+*/
+static int annotation_cache_restore(
+  Annotator *p,              /* The annotation to fill in */
+  const int *aFid,           /* Artifact ID of each version */
+  int nRow,                  /* Number of versions in p->aVers[] */
+  const char *zFilename,     /* Name of the file */
+  u64 annFlags               /* Annotation flags */
+){
+  char *azKey[ANN_CACHE_SEARCH];
+  int nKey = nRow<ANN_CACHE_SEARCH ? nRow : ANN_CACHE_SEARCH;
+  Blob data, line, token;
+  Blob content;              /* Text of p->aVers[k] */
+  DLine *aFrom = 0;          /* Lines of p->aVers[k] */
+  int nFrom = 0;             /* Number of lines in aFrom[] */
+  int *aTag;                 /* Version index of each line of aFrom[] */
+  int nTag = 0;              /* Number of entries in aTag[] */
+  int nVers = 0;             /* Versions covered by the cached annotation */
+  int i, k, kFound, iTag;
+
+  for(k=0; k<nKey; k++){
+    azKey[k] = annotation_cache_key(p->aVers[k].zMUuid, zFilename, annFlags);
+  }
+  blob_init(&data, 0, 0);
+  kFound = k = cache_annotation_read(nKey, azKey, &data);
+  for(i=0; i<nKey; i++) fossil_free(azKey[i]);
+  if( k<0 ) return 0;
+
+  /* Decode the cached annotation of p->aVers[k] */
+  blob_line(&data, &line);
+  if( !blob_token(&line, &token) || !blob_is_int(&token, &nVers)
+   || nVers<1 || k+nVers>nRow
+   || !blob_token(&line, &token)
+   || !blob_eq_str(&token, p->aVers[k+nVers-1].zFUuid, -1)
+   || !blob_token(&line, &token) || !blob_is_int(&token, &nTag) || nTag<0
+  ){
+    blob_reset(&data);
+    return 0;
+  }
+  aTag = fossil_malloc( sizeof(aTag[0])*(nTag+1) );
+  for(i=0; i<nTag; i++){
+    if( !blob_line(&data, &line) || !blob_token(&line, &token)
+     || !blob_is_int(&token, &iTag)
+    ){
+      break;
+    }
+    aTag[i] = iTag==0 ? -1 : iTag-1+k;
+  }
+  blob_reset(&data);
+  if( i<nTag ){
+    fossil_free(aTag);
+    return 0;
   }
-  return t;
+
+  /* Carry the annotation forward one version at a time */
+  blob_zero(&content);
+  if( k==0 ){
+    aFrom = p->c.aTo;
+    nFrom = p->c.nTo;
+  }else if( content_get(aFid[k], &content) ){
+    blob_to_utf8_no_bom(&content, 0);
+    aFrom = break_into_lines(blob_str(&content), blob_size(&content),
+                             &nFrom, annFlags);
+  }
+  while( k>0 && aFrom!=0 && nFrom==nTag ){
+    Blob next;               /* Text of p->aVers[k-1] */
+    DLine *aTo;              /* Lines of p->aVers[k-1] */
+    int nTo;                 /* Number of lines in aTo[] */
+    int *aNew;               /* Version index of each line of aTo[] */
+    blob_zero(&next);
+    if( k>1 ){
+      if( !content_get(aFid[k-1], &next) ) break;
+      blob_to_utf8_no_bom(&next, 0);
+      aTo = break_into_lines(blob_str(&next), blob_size(&next), &nTo,
+                             annFlags);
+      if( aTo==0 ){
+        blob_reset(&next);
+        break;
+      }
+    }else{
+      aTo = p->c.aTo;
+      nTo = p->c.nTo;
+    }
+    aNew = annotation_forward_step(aTag, aFrom, nFrom, aTo, nTo, k-1,
+                                   p->c.xDiffer, annFlags);
+    fossil_free(aTag);
+    fossil_free(aFrom);
+    blob_reset(&content);
+    aTag = aNew;
+    aFrom = aTo;
+    nFrom = nTag = nTo;
+    content = next;
+    k--;
+  }
+  if( k==0 && nTag==p->nOrig ){
+    for(i=0; i<nTag; i++) p->aOrig[i].iVers = aTag[i];
+    p->nVers = kFound + nVers;
+  }
+  if( aFrom!=p->c.aTo ) fossil_free(aFrom);
+  blob_reset(&content);
+  fossil_free(aTag);
+  return kFound==0 ? p->nVers : 0;
+}
+
+/*
+** Save the annotation p in the annotation cache.
+*/
+static void annotation_cache_save(
+  Annotator *p,              /* The annotation */
+  const char *zFilename,     /* Name of the file */
+  u64 annFlags               /* Annotation flags */
+){
+  Blob data;
+  char *zKey;
+  int i;
+  blob_init(&data, 0, 0);
+  blob_appendf(&data, "%d %s %d\n",
+               p->nVers, p->aVers[p->nVers-1].zFUuid, p->nOrig);
+  for(i=0; i<p->nOrig; i++){
+    blob_appendf(&data, "%d\n", p->aOrig[i].iVers+1);
+  }
+  zKey = annotation_cache_key(p->aVers[0].zMUuid, zFilename, annFlags);
+  cache_annotation_write(zKey, &data);
+  fossil_free(zKey);
+  blob_reset(&data);
 }
 
 /*
@@ -2241,12 +2996,18 @@ static void annotate_file(
   Blob step;             /* Text of previous revision */
   int cid;               /* Selected check-in ID */
   int origid = 0;        /* The origin ID or zero */
-  int rid;               /* Artifact ID of the file being annotated */
   int fnid;              /* Filename ID */
   Stmt q;                /* Query returning all ancestor versions */
-  int cnt = 0;           /* Number of versions analyzed */
+  int cnt;               /* Number of versions analyzed */
   int iLimit;            /* Maximum number of versions to analyze */
   sqlite3_int64 mxTime;  /* Halt at this time if not already complete */
+  struct AnnVers *aVers = 0;  /* Each ancestor version */
+  int *aFid = 0;         /* Artifact ID of each ancestor version */
+  int nRow = 0;          /* Number of ancestor versions */
+  int nAlloc = 0;        /* Space allocated for aFid[] and p->aVers[] */
+  int bCache;            /* True to use the annotation cache */
+  int nCached = 0;       /* Versions analyzed by the cached annotation */
+  int i;
 
   memset(p, 0, sizeof(*p));
 
@@ -2277,6 +3038,7 @@ static void annotate_file(
     cid = db_lget_int("checkout", 0);
   }
   origid = zOrigin ? name_to_typed_rid(zOrigin, "ci") : 0;
+  bCache = origid==0 && !annNoCache && cache_is_enabled();
 
   /* Compute all direct ancestors of the check-in being analyzed into
   ** the "ancestor" table. */
@@ -2309,49 +3071,72 @@ static void annotate_file(
   );
 
   while( db_step(&q)==SQLITE_ROW ){
+    if( nRow>=nAlloc ){
+      nAlloc = nAlloc*2 + 20;
+      aVers = fossil_realloc(aVers, nAlloc*sizeof(aVers[0]));
+      aFid = fossil_realloc(aFid, nAlloc*sizeof(aFid[0]));
+    }
+    memset(&aVers[nRow], 0, sizeof(aVers[0]));
+    aVers[nRow].zFUuid = fossil_strdup(db_column_text(&q, 0));
+    aVers[nRow].zMUuid = fossil_strdup(db_column_text(&q, 1));
+    aVers[nRow].zDate = fossil_strdup(db_column_text(&q, 2));
+    aVers[nRow].zUser = fossil_strdup(db_column_text(&q, 3));
+    aFid[nRow] = db_column_int(&q, 4);
+    nRow++;
+  }
+  db_finalize(&q);
+
+  if( nRow==0 ){
+    if( zRevision ){
+      fossil_fatal("file %s does not exist in check-in %s", zFilename, zRevision);
+    }else{
+      fossil_fatal("no history for file: %s", zFilename);
+    }
+  }
+
+  if( !content_get(aFid[0], &toAnnotate) ){
+    fossil_fatal("unable to retrieve content of artifact #%d", aFid[0]);
+  }
+  blob_to_utf8_no_bom(&toAnnotate, 0);
+  annotation_start(p, &toAnnotate, annFlags);
+  p->origId = origid;
+  p->showId = cid;
+  p->aVers = aVers;
+  p->nVers = 1;
+  if( bCache && p->c.aTo ){
+    nCached = annotation_cache_restore(p, aFid, nRow, zFilename, annFlags);
+  }
+
+  for(cnt=p->nVers; cnt<nRow; cnt++){
     if( cnt>=3 ){  /* Process at least 3 rows before imposing limits */
       if( (iLimit>0 && cnt>=iLimit)
        || (cnt>0 && mxTime>0 && current_time_in_milliseconds()>mxTime)
       ){
-        p->bMoreToDo = 1;
         break;
       }
     }
-    rid = db_column_int(&q, 4);
-    if( cnt==0 ){
-      if( !content_get(rid, &toAnnotate) ){
-        fossil_fatal("unable to retrieve content of artifact #%d", rid);
-      }
-      blob_to_utf8_no_bom(&toAnnotate, 0);
-      annotation_start(p, &toAnnotate, annFlags);
-      p->bMoreToDo = origid!=0;
-      p->origId = origid;
-      p->showId = cid;
-    }
-    p->aVers = fossil_realloc(p->aVers, (p->nVers+1)*sizeof(p->aVers[0]));
-    p->aVers[p->nVers].zFUuid = fossil_strdup(db_column_text(&q, 0));
-    p->aVers[p->nVers].zMUuid = fossil_strdup(db_column_text(&q, 1));
-    p->aVers[p->nVers].zDate = fossil_strdup(db_column_text(&q, 2));
-    p->aVers[p->nVers].zUser = fossil_strdup(db_column_text(&q, 3));
-    if( cnt>0 ){
-      content_get(rid, &step);
-      blob_to_utf8_no_bom(&step, 0);
-      annotation_step(p, &step, p->nVers-1, annFlags);
-      blob_reset(&step);
-    }
+    content_get(aFid[cnt], &step);
+    blob_to_utf8_no_bom(&step, 0);
+    annotation_step(p, &step, p->nVers-1, annFlags);
+    blob_reset(&step);
     p->nVers++;
-    cnt++;
+  }
+  p->bMoreToDo = origid!=0 || p->nVers<nRow;
+  if( bCache && p->c.aTo && p->nVers>nCached ){
+    annotation_cache_save(p, zFilename, annFlags);
   }
 
-  if( p->nVers==0 ){
-    if( zRevision ){
-      fossil_fatal("file %s does not exist in check-in %s", zFilename, zRevision);
-    }else{
-      fossil_fatal("no history for file: %s", zFilename);
+  /* A cached annotation might go further back than requested.  Only
+  ** the first iLimit-1 versions can be credited with lines, since the
+  ** oldest version analyzed is not compared against its parent. */
+  if( iLimit>0 && p->nVers>iLimit ){
+    for(i=0; i<p->nOrig; i++){
+      if( p->aOrig[i].iVers>=iLimit-1 ) p->aOrig[i].iVers = -1;
     }
+    p->nVers = iLimit;
+    p->bMoreToDo = 1;
   }
-
-  db_finalize(&q);
+  fossil_free(aFid);
   db_end_transaction(0);
 }
 
@@ -2673,3 +3458,117 @@ void annotate_cmd(void){
     }
   }
 }
+
+/*
+** Annotate file zFilename in check-in zCheckin with its complete history
+** and return the elapsed time in milliseconds.  Write the number of
+** versions analyzed into *pnVers and the check-in of the previous
+** version of the file, if there is one, into *pzPrev.
+*/
+static sqlite3_int64 annotate_bench_one(
+  const char *zFilename,
+  const char *zCheckin,
+  int *pnVers,
+  char **pzPrev
+){
+  Annotator ann;
+  sqlite3_int64 tm = current_time_in_milliseconds();
+  annotate_file(&ann, zFilename, zCheckin, "none", 0, DIFF_STRIP_EOLCR);
+  tm = current_time_in_milliseconds() - tm;
+  if( pnVers ) *pnVers = ann.nVers;
+  if( pzPrev ){
+    *pzPrev = ann.nVers>1 ? fossil_strdup(ann.aVers[1].zMUuid) : 0;
+  }
+  return tm;
+}
+
+/*
+** COMMAND: test-annotate-bench
+**
+** Usage: %fossil test-annotate-bench ?OPTIONS?
+**
+** Measure the time needed to annotate the files that have been changed
+** most often, each with its complete history and as of the most recent
+** check-in that changed it.  Each file is annotated four ways:
+**
+**    nocache     Without the annotation cache
+**    cold        With an empty annotation cache
+**    warm        With the annotation already in the cache
+**    step        With only the annotation of the previous version of
+**                the file in the cache, as after a new check-in
+**
+** The cache file must exist (see "fossil cache init").  This command
+** removes all entries from the annotation cache.
+**
+** Options:
+**    --count N              Annotate the N most-changed files.  Default: 10
+**    -R|--repository FILE   Use repository FILE
+*/
+void test_annotate_bench_cmd(void){
+  const char *zCount = find_option("count",0,1);
+  int nFile = zCount ? atoi(zCount) : 10;
+  sqlite3_int64 tmNoCache = 0, tmCold = 0, tmWarm = 0, tmStep = 0;
+  char **azName = 0;         /* Files to annotate */
+  char **azCkin = 0;         /* Check-in in which to annotate each file */
+  int n = 0, i;
+  Stmt q;
+
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( !cache_is_enabled() ){
+    fossil_fatal("no cache file: run \"%s cache init\" first", g.argv[0]);
+  }
+  fossil_print("%-40s %5s %8s %8s %8s %8s\n",
+               "file", "vers", "nocache", "cold", "warm", "step");
+  db_prepare(&q,
+    "SELECT filename.name,"
+    "       (SELECT uuid FROM blob, event"
+    "         WHERE blob.rid=event.objid"
+    "           AND event.objid IN (SELECT mid FROM mlink AS m2"
+    "                                WHERE m2.fnid=mlink.fnid)"
+    "         ORDER BY event.mtime DESC LIMIT 1)"
+    "  FROM mlink, filename"
+    " WHERE mlink.fnid=filename.fnid AND mlink.fid>0"
+    " GROUP BY mlink.fnid"
+    " ORDER BY count(*) DESC, filename.name LIMIT %d", nFile
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    if( db_column_type(&q, 1)==SQLITE_NULL ) continue;
+    azName = fossil_realloc(azName, sizeof(azName[0])*(n+1));
+    azCkin = fossil_realloc(azCkin, sizeof(azCkin[0])*(n+1));
+    azName[n] = fossil_strdup(db_column_text(&q, 0));
+    azCkin[n] = fossil_strdup(db_column_text(&q, 1));
+    n++;
+  }
+  db_finalize(&q);
+  for(i=0; i<n; i++){
+    const char *zName = azName[i];
+    const char *zCkin = azCkin[i];
+    char *zPrev = 0;
+    int nVers = 0;
+    sqlite3_int64 aTm[4];
+    annNoCache = 1;
+    aTm[0] = annotate_bench_one(zName, zCkin, &nVers, &zPrev);
+    annNoCache = 0;
+    cache_annotation_clear();
+    aTm[1] = annotate_bench_one(zName, zCkin, 0, 0);
+    aTm[2] = annotate_bench_one(zName, zCkin, 0, 0);
+    cache_annotation_clear();
+    if( zPrev ) annotate_bench_one(zName, zPrev, 0, 0);
+    aTm[3] = annotate_bench_one(zName, zCkin, 0, 0);
+    cache_annotation_clear();
+    fossil_free(zPrev);
+    fossil_print("%-40.40s %5d %8lld %8lld %8lld %8lld\n",
+                 zName, nVers, aTm[0], aTm[1], aTm[2], aTm[3]);
+    tmNoCache += aTm[0];
+    tmCold += aTm[1];
+    tmWarm += aTm[2];
+    tmStep += aTm[3];
+    fossil_free(azName[i]);
+    fossil_free(azCkin[i]);
+  }
+  fossil_free(azName);
+  fossil_free(azCkin);
+  fossil_print("%-40s %5s %8lld %8lld %8lld %8lld  (milliseconds)\n",
+               "total", "", tmNoCache, tmCold, tmWarm, tmStep);
+}
@@ -817,6 +817,8 @@ const char *diff_get_binary_glob(void){
 ** This option overrides the "binary-glob" setting.
 **
 ** Options:
+**   --algorithm NAME            Internal diff algorithm: fossil, myers or
+**                               histogram.  Overrides "diff-algorithm"
 **   --binary PATTERN            Treat files that match the glob PATTERN
 **                               as binary
 **   --branch BRANCH             Show diff of all changes on BRANCH
@@ -401,6 +401,11 @@ static const char *mimetype_from_name_custom(const char *zSuffix){
   return 0;
 }
 
+/*
+** True if document_emit_js() has been called for the current page
+*/
+static int docJsEmitted = 0;
+
 /*
 ** Emit Javascript which applies (or optionally can apply) to both the
 ** /doc and /wiki pages. None of this implements required
@@ -408,8 +413,7 @@ static const char *mimetype_from_name_custom(const char *zSuffix){
 ** no-ops.
 */
 void document_emit_js(void){
-  static int once = 0;
-  if(0==once++){
+  if(0==docJsEmitted++){
     builtin_fossil_js_bundle_or("pikchr", 0);
     style_script_begin(__FILE__,__LINE__);
     CX("window.addEventListener('load', "
@@ -419,6 +423,14 @@ void document_emit_js(void){
   }
 }
 
+/*
+** Forget that document_emit_js() has been called, so that a server
+** process can generate another page.
+*/
+void document_reset_request(void){
+  docJsEmitted = 0;
+}
+
 /*
 ** Guess the mime-type of a document based on its name.
 */
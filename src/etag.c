@@ -262,3 +262,14 @@ void etag_cancel(void){
   etagCancelled = 1;
   zETag[0] = 0;
 }
+
+/*
+** Forget the ETag of the previous page, so that a server process can
+** generate another.
+*/
+void etag_reset_request(void){
+  etagCancelled = 0;
+  zETag[0] = 0;
+  iMaxAge = 0;
+  iEtagMtime = 0;
+}
@@ -81,8 +81,11 @@ struct FociTable {
 struct FociCursor {
   sqlite3_vtab_cursor base; /* Base class - must be first */
   Manifest *pMan;           /* Current manifest */
+  ManifestIndex *pIndex;    /* File index used instead of pMan, or NULL */
   ManifestFile *pFile;      /* Current file */
+  ManifestFile sFile;       /* Current file, when using pIndex */
   int iFile;                /* File index */
+  int rid;                  /* RID of the check-in */
 };
 #endif /* INTERFACE */
 
@@ -162,17 +165,34 @@ static int fociOpen(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor){
 static int fociClose(sqlite3_vtab_cursor *pCursor){
   FociCursor *pCsr = (FociCursor *)pCursor;
   manifest_destroy(pCsr->pMan);
+  manifest_index_free(pCsr->pIndex);
   sqlite3_free(pCsr);
   return SQLITE_OK;
 }
 
+/*
+** Load the file at position pCsr->iFile of the file index.
+*/
+static void fociIndexFile(FociCursor *pCsr){
+  if( pCsr->iFile<manifest_index_count(pCsr->pIndex) ){
+    manifest_index_entry(pCsr->pIndex, pCsr->iFile, &pCsr->sFile);
+    pCsr->pFile = &pCsr->sFile;
+  }else{
+    pCsr->pFile = 0;
+  }
+}
+
 /*
 ** Move a focivfs cursor to the next entry in the file.
 */
 static int fociNext(sqlite3_vtab_cursor *pCursor){
   FociCursor *pCsr = (FociCursor *)pCursor;
-  pCsr->pFile = manifest_file_next(pCsr->pMan, 0);
   pCsr->iFile++;
+  if( pCsr->pIndex ){
+    fociIndexFile(pCsr);
+  }else{
+    pCsr->pFile = manifest_file_next(pCsr->pMan, 0);
+  }
   return SQLITE_OK;
 }
 
@@ -188,6 +208,11 @@ static int fociFilter(
 ){
   FociCursor *pCur = (FociCursor *)pCursor;
   manifest_destroy(pCur->pMan);
+  pCur->pMan = 0;
+  manifest_index_free(pCur->pIndex);
+  pCur->pIndex = 0;
+  pCur->pFile = 0;
+  pCur->iFile = 0;
   if( idxNum ){
     int rid;
     if( idxNum==1 ){
@@ -195,15 +220,22 @@ static int fociFilter(
     }else{
       rid = symbolic_name_to_rid((const char*)sqlite3_value_text(argv[0]),"ci");
     }
+    pCur->rid = rid;
+    /* Large check-ins have a file index that is much quicker to read
+    ** than the manifest.  The manifest_index_for() call builds the
+    ** index for next time if it does not yet exist. */
+    pCur->pIndex = manifest_index_get(rid);
+    if( pCur->pIndex ){
+      fociIndexFile(pCur);
+      return SQLITE_OK;
+    }
     pCur->pMan = manifest_get(rid, CFTYPE_MANIFEST, 0);
     if( pCur->pMan ){
+      manifest_index_for(pCur->pMan);
       manifest_file_rewind(pCur->pMan);
       pCur->pFile = manifest_file_next(pCur->pMan, 0);
     }
-  }else{
-    pCur->pMan = 0;
   }
-  pCur->iFile = 0;
   return SQLITE_OK;
 }
 
@@ -215,7 +247,7 @@ static int fociColumn(
   FociCursor *pCsr = (FociCursor *)pCursor;
   switch( i ){
     case FOCI_CHECKINID:
-      sqlite3_result_int(ctx, pCsr->pMan->rid);
+      sqlite3_result_int(ctx, pCsr->rid);
       break;
     case FOCI_FILENAME:
       sqlite3_result_text(ctx, pCsr->pFile->zName, -1,
@@ -55,7 +55,7 @@
 */
 typedef sqlite3_int64 GraphRowId;
 
-#define GR_MAX_RAIL   40      /* Max number of "rails" to display */
+#define GR_MAX_RAIL   64      /* Max "rails".  No more than bits in a u64 */
 
 /* The graph appears vertically beside a timeline.  Each row in the
 ** timeline corresponds to a row in the graph.  GraphRow.idx is 0 for
@@ -112,6 +112,8 @@ struct GraphContext {
   int nRow;                  /* Number of rows */
   int nHash;                 /* Number of slots in apHash[] */
   GraphRow **apHash;         /* Hash table of GraphRow objects.  Key: rid */
+  GraphRow **apRow;          /* All rows.  apRow[i] has idx==pFirst->idx+i */
+  int aiRailBtm[GR_MAX_RAIL]; /* Rail is in use from this row to the bottom */
   u8 aiRailMap[GR_MAX_RAIL]; /* Mapping of rails to actually columns */
 };
 
@@ -158,6 +160,7 @@ static void graph_clear(GraphContext *p){
   for(i=0; i<p->nBranch; i++) free(p->azBranch[i]);
   free(p->azBranch);
   free(p->apHash);
+  free(p->apRow);
   memset(p, 0, sizeof(*p));
   p->nErr = 1;
 }
@@ -221,6 +224,20 @@ static char *persistBranchName(GraphContext *p, const char *zBranch){
   return p->azBranch[p->nBranch-1];
 }
 
+/*
+** Number of graph rows created so far by this process.  Row numbers
+** are unique across all graphs on the same page.
+*/
+static int nGraphRow = 0;
+
+/*
+** Restart the row numbering, so that a server process numbers the
+** rows of each page from the beginning.
+*/
+void graph_reset_request(void){
+  nGraphRow = 0;
+}
+
 /*
 ** Add a new row to the graph context.  Rows are added from top to bottom.
 */
@@ -237,7 +254,6 @@ int graph_add_row(
 ){
   GraphRow *pRow;
   int nByte;
-  static int nRow = 0;
 
   if( p->nErr ) return 0;
   nByte = sizeof(GraphRow);
@@ -266,7 +282,7 @@ int graph_add_row(
   }
   p->pLast = pRow;
   p->nRow++;
-  pRow->idx = pRow->idxTop = ++nRow;
+  pRow->idx = pRow->idxTop = ++nGraphRow;
   return pRow->idx;
 }
 
@@ -284,11 +300,19 @@ static int findFreeRail(
   int iBest = 0;
   int iBestDist = 9999;
   u64 inUseMask = 0;
-  for(pRow=p->pFirst; pRow && pRow->idx<top; pRow=pRow->pNext){}
+  if( p->apRow ){
+    if( top<p->pFirst->idx ) top = p->pFirst->idx;
+    pRow = top<=p->pLast->idx ? p->apRow[top - p->pFirst->idx] : 0;
+  }else{
+    for(pRow=p->pFirst; pRow && pRow->idx<top; pRow=pRow->pNext){}
+  }
   while( pRow && pRow->idx<=btm ){
     inUseMask |= pRow->railInUse;
     pRow = pRow->pNext;
   }
+  for(i=0; i<GR_MAX_RAIL; i++){
+    if( p->aiRailBtm[i]>0 && p->aiRailBtm[i]<=btm ) inUseMask |= BIT(i);
+  }
   for(i=0; i<GR_MAX_RAIL; i++){
     if( (inUseMask & BIT(i))==0 ){
       int dist;
@@ -401,8 +425,8 @@ static void find_max_rail(GraphContext *p){
   for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
     if( pRow->iRail>p->mxRail ) p->mxRail = pRow->iRail;
     if( pRow->mergeOut>p->mxRail ) p->mxRail = pRow->mergeOut;
-    while( p->mxRail<GR_MAX_RAIL
-        && (pRow->mergeDown|pRow->cherrypickDown)>(BIT(p->mxRail+1)-1)
+    while( p->mxRail<GR_MAX_RAIL-1
+        && ((pRow->mergeDown|pRow->cherrypickDown)>>(p->mxRail+1))!=0
     ){
       p->mxRail++;
     }
@@ -462,8 +486,16 @@ void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
   /* Initialize all rows */
   p->nHash = p->nRow*2 + 1;
   p->apHash = safeMalloc( sizeof(p->apHash[0])*p->nHash );
+  p->apRow = safeMalloc( sizeof(p->apRow[0])*p->nRow );
+  i = 0;
   for(pRow=p->pFirst; pRow; pRow=pRow->pNext){
     if( pRow->pNext ) pRow->pNext->pPrev = pRow;
+    if( p->apRow && pRow->idx!=p->pFirst->idx+i ){
+      /* Row numbers are not consecutive.  Do without the index. */
+      free(p->apRow);
+      p->apRow = 0;
+    }
+    if( p->apRow ) p->apRow[i++] = pRow;
     pRow->iRail = -1;
     pRow->mergeOut = -1;
     if( (pDup = hashFind(p, pRow->rid))!=0 ){
@@ -777,8 +809,10 @@ void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
           pRow->mergeIn[iMrail] = 1;
           pRow->mergeDown |= mask;
         }
-        for(pLoop=pRow->pNext; pLoop; pLoop=pLoop->pNext){
-          pLoop->railInUse |= mask;
+        if( pRow->pNext
+         && (p->aiRailBtm[iMrail]==0 || p->aiRailBtm[iMrail]>pRow->idx)
+        ){
+          p->aiRailBtm[iMrail] = pRow->pNext->idx;
         }
       }else{
         /* The merge parent node does exist on this graph */
@@ -864,3 +898,104 @@ void graph_finish(GraphContext *p, const char *zLeftBranch, u32 tmFlags){
 
   p->nErr = 0;
 }
+
+/*
+** COMMAND: test-graph-bench
+**
+** Usage: %fossil test-graph-bench ?OPTIONS?
+**
+** Lay out the graph for the most recent check-ins, in the same way as
+** the /timeline page, and report how long that takes.
+**
+** Options:
+**    -n|--limit N       Number of check-ins to graph.  Default: 1000
+**    --count K          Repeat the layout K times.  Default: 10
+**    --left BRANCH      Try to put BRANCH on the left-most rail
+*/
+void test_graph_bench_cmd(void){
+  const char *zLimit = find_option("limit","n",1);
+  const char *zCount = find_option("count",0,1);
+  const char *zLeft = find_option("left",0,1);
+  int nLimit = zLimit ? atoi(zLimit) : 1000;
+  int nCount = zCount ? atoi(zCount) : 10;
+  int nRow = 0, nAlloc = 0;
+  int nParentTotal = 0;
+  struct BenchRow {
+    GraphRowId rid;
+    int isLeaf;
+    char *zBranch;
+    char *zUuid;
+    int nParent;
+    GraphRowId aParent[GR_MAX_RAIL];
+  } *aRow = 0;
+  Stmt q, qparent;
+  sqlite3_int64 tmStart, tmAdd = 0, tmFinish = 0;
+  int i, k, mxRail = 0, nErr = 0;
+
+  db_find_and_open_repository(0,0);
+  verify_all_options();
+  if( nCount<1 ) nCount = 1;
+  db_prepare(&q,
+    "SELECT objid, blob.uuid, objid IN leaf,"
+    "       coalesce((SELECT value FROM tagxref"
+    "                  WHERE tagid=%d AND tagtype>0 AND rid=objid),'trunk')"
+    "  FROM event, blob"
+    " WHERE event.type='ci' AND blob.rid=event.objid"
+    " ORDER BY event.mtime DESC LIMIT %d",
+    TAG_BRANCH, nLimit
+  );
+  db_prepare(&qparent,
+    "SELECT pid FROM plink"
+    " WHERE cid=:rid AND pid NOT IN phantom"
+    " ORDER BY isprim DESC /*sort*/"
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    struct BenchRow *pRow;
+    if( nRow>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aRow = fossil_realloc(aRow, sizeof(aRow[0])*nAlloc);
+    }
+    pRow = &aRow[nRow++];
+    pRow->rid = db_column_int(&q, 0);
+    pRow->zUuid = fossil_strdup(db_column_text(&q, 1));
+    pRow->isLeaf = db_column_int(&q, 2);
+    pRow->zBranch = fossil_strdup(db_column_text(&q, 3));
+    pRow->nParent = 0;
+    db_bind_int(&qparent, ":rid", (int)pRow->rid);
+    while( db_step(&qparent)==SQLITE_ROW && pRow->nParent<GR_MAX_RAIL ){
+      pRow->aParent[pRow->nParent++] = db_column_int(&qparent, 0);
+    }
+    db_reset(&qparent);
+    nParentTotal += pRow->nParent;
+  }
+  db_finalize(&qparent);
+  db_finalize(&q);
+
+  for(k=0; k<nCount; k++){
+    GraphContext *pGraph;
+    graph_reset_request();
+    tmStart = current_time_in_milliseconds();
+    pGraph = graph_init();
+    for(i=0; i<nRow; i++){
+      graph_add_row(pGraph, aRow[i].rid, aRow[i].nParent, 0, aRow[i].aParent,
+                    aRow[i].zBranch, 0, aRow[i].zUuid, aRow[i].isLeaf);
+    }
+    tmAdd += current_time_in_milliseconds() - tmStart;
+    tmStart = current_time_in_milliseconds();
+    graph_finish(pGraph, zLeft, 0);
+    tmFinish += current_time_in_milliseconds() - tmStart;
+    mxRail = pGraph->mxRail;
+    nErr = pGraph->nErr;
+    graph_free(pGraph);
+  }
+  fossil_print("%d check-ins, %d parents, %d rails%s\n",
+               nRow, nParentTotal, mxRail+1,
+               nErr ? " (too many rails, graph omitted)" : "");
+  fossil_print("add rows: %.3f ms   layout: %.3f ms   (average of %d)\n",
+               tmAdd/(double)nCount, tmFinish/(double)nCount, nCount);
+  for(i=0; i<nRow; i++){
+    fossil_free(aRow[i].zUuid);
+    fossil_free(aRow[i].zBranch);
+  }
+  fossil_free(aRow);
+}
@@ -20,6 +20,13 @@
 **
 ** State information is stored in static variables, so this implementation
 ** can only be building up a single GZIP file at a time.
+**
+** A GZIP file can also be compressed on helper threads, in the manner of
+** pigz.  The input is then cut into blocks that are deflated separately,
+** each primed with the last 32KiB of the block before it, and the pieces
+** are joined into a single deflate stream.  The result is a valid GZIP
+** file that is a little larger than, and different from, the one that
+** serial compression gives.
 */
 #include "config.h"
 #include <assert.h>
@@ -39,8 +46,35 @@ struct gzip_state {
   int iCRC;             /* The checksum */
   z_stream stream;      /* The working compressor */
   Blob out;             /* Results stored here */
+  WorkPipe *pPipe;      /* Helper threads, for parallel compression */
+  Blob block;           /* Input not yet handed to a helper thread */
+  Blob dict;            /* The last 32KiB of input handed to a thread */
+  sqlite3_int64 nIn;    /* Total input so far, for parallel compression */
 } gzip;
 
+/*
+** Size of the blocks compressed by each helper thread, and the
+** amount of preceding input used to prime the compressor for a block
+*/
+#define GZIP_BLOCK_SZ  131072
+#define GZIP_DICT_SZ    32768
+
+/*
+** Size of the output buffer used by the compressors
+*/
+#define GZIP_BUFSZ     100000
+
+/*
+** One block of input for a helper thread to compress
+*/
+typedef struct GzipBlock GzipBlock;
+struct GzipBlock {
+  Blob in;              /* Input to be compressed */
+  Blob dict;            /* Input that comes just before this block */
+  Blob out;             /* The compressed block */
+  int isLast;           /* True for the last block of the file */
+};
+
 /*
 ** Write a 32-bit integer as little-endian into the given buffer.
 */
@@ -73,14 +107,118 @@ void gzip_begin(sqlite3_int64 now){
   gzip.eState = 1;
 }
 
+/*
+** Compress a single block.  This runs on a helper thread.
+**
+** Every block but the last ends with a sync flush, which leaves the
+** output on a byte boundary so that the next block can simply be
+** appended to it.
+*/
+static void gzip_compress_block(void *pArg){
+  GzipBlock *p = (GzipBlock*)pArg;
+  z_stream stream;
+  char *zOutBuf = fossil_malloc(GZIP_BUFSZ);
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+#if !defined(FOSSIL_ENABLE_MINIZ)
+  /* miniz cannot prime the compressor, so blocks start afresh there */
+  if( blob_size(&p->dict)>0 ){
+    deflateSetDictionary(&stream, (unsigned char*)blob_buffer(&p->dict),
+                         blob_size(&p->dict));
+  }
+#endif
+  stream.avail_in = blob_size(&p->in);
+  stream.next_in = (unsigned char*)blob_buffer(&p->in);
+  do{
+    stream.avail_out = GZIP_BUFSZ;
+    stream.next_out = (unsigned char*)zOutBuf;
+    deflate(&stream, p->isLast ? Z_FINISH : Z_SYNC_FLUSH);
+    blob_append(&p->out, zOutBuf, GZIP_BUFSZ - stream.avail_out);
+  }while( stream.avail_out==0 );
+  deflateEnd(&stream);
+  fossil_free(zOutBuf);
+}
+
+/*
+** Append a compressed block to the output and free it.
+*/
+static void gzip_block_done(GzipBlock *p){
+  blob_append(&gzip.out, blob_buffer(&p->out), blob_size(&p->out));
+  blob_reset(&p->in);
+  blob_reset(&p->dict);
+  blob_reset(&p->out);
+  fossil_free(p);
+}
+
+/*
+** Append to the output the blocks that the helper threads have
+** finished, in order.  If bWait is true, wait for all of them.
+*/
+static void gzip_collect_blocks(int bWait){
+  GzipBlock *p;
+  while( (p = (GzipBlock*)workpipe_pop(gzip.pPipe, bWait))!=0 ){
+    gzip_block_done(p);
+  }
+}
+
+/*
+** Hand the pending input to a helper thread to compress.
+*/
+static void gzip_submit_block(int isLast){
+  GzipBlock *p = fossil_malloc( sizeof(*p) );
+  int n;
+  p->in = gzip.block;
+  p->dict = gzip.dict;
+  blob_zero(&p->out);
+  p->isLast = isLast;
+  n = blob_size(&p->in);
+  blob_zero(&gzip.block);
+  blob_zero(&gzip.dict);
+  if( n>GZIP_DICT_SZ ){
+    blob_append(&gzip.dict, blob_buffer(&p->in)+n-GZIP_DICT_SZ, GZIP_DICT_SZ);
+  }else{
+    int nOld = blob_size(&p->dict);
+    int nKeep = nOld+n>GZIP_DICT_SZ ? GZIP_DICT_SZ-n : nOld;
+    blob_append(&gzip.dict, blob_buffer(&p->dict)+nOld-nKeep, nKeep);
+    blob_append(&gzip.dict, blob_buffer(&p->in), n);
+  }
+  if( workpipe_full(gzip.pPipe) ){
+    gzip_block_done((GzipBlock*)workpipe_pop(gzip.pPipe, 1));
+  }
+  workpipe_push(gzip.pPipe, p);
+  gzip_collect_blocks(0);
+}
+
+/*
+** Compress the gzip file under construction on nJob helper threads.
+** This must be called right after gzip_begin().  Nothing changes if
+** nJob is 1 or if threads are not available.
+*/
+void gzip_start_threads(int nJob){
+  assert( gzip.eState==1 && gzip.pPipe==0 );
+  if( nJob<=1 ) return;
+  gzip.pPipe = workpipe_new(nJob, nJob*2, gzip_compress_block);
+  if( gzip.pPipe==0 ) return;
+  blob_zero(&gzip.block);
+  blob_zero(&gzip.dict);
+  gzip.nIn = 0;
+  gzip.eState = 2;
+}
+
 /*
 ** Add nIn bytes of content from pIn to the gzip file.
 */
-#define GZIP_BUFSZ 100000
 void gzip_step(const char *pIn, int nIn){
   char *zOutBuf;
   int nOut;
 
+  if( gzip.pPipe ){
+    gzip.iCRC = crc32(gzip.iCRC, (unsigned char*)pIn, nIn);
+    gzip.nIn += nIn;
+    blob_append(&gzip.block, pIn, nIn);
+    if( blob_size(&gzip.block)>=GZIP_BLOCK_SZ ) gzip_submit_block(0);
+    return;
+  }
   nOut = nIn + nIn/10 + 100;
   if( nOut<100000 ) nOut = 100000;
   zOutBuf = fossil_malloc(nOut);
@@ -105,16 +243,39 @@ void gzip_step(const char *pIn, int nIn){
   fossil_free(zOutBuf);
 }
 
+/*
+** Append the compressed output generated so far to pOut and remove it
+** from the gzip file under construction.  This allows a large gzip file
+** to be sent in pieces while it is being built.  The last piece comes
+** from gzip_finish().
+*/
+void gzip_drain(Blob *pOut){
+  assert( gzip.eState>0 );
+  if( gzip.pPipe ) gzip_collect_blocks(0);
+  blob_append(pOut, blob_buffer(&gzip.out), blob_size(&gzip.out));
+  blob_truncate(&gzip.out, 0);
+}
+
 /*
 ** Finish the gzip file and put the content in *pOut
 */
 void gzip_finish(Blob *pOut){
   char aTrailer[8];
   assert( gzip.eState>0 );
-  gzip_step("", 0);
-  deflateEnd(&gzip.stream);
+  if( gzip.pPipe ){
+    gzip_submit_block(1);
+    gzip_collect_blocks(1);
+    workpipe_free(gzip.pPipe);
+    gzip.pPipe = 0;
+    blob_reset(&gzip.block);
+    blob_reset(&gzip.dict);
+    put32(&aTrailer[4], (int)gzip.nIn);
+  }else{
+    gzip_step("", 0);
+    deflateEnd(&gzip.stream);
+    put32(&aTrailer[4], gzip.stream.total_in);
+  }
   put32(aTrailer, gzip.iCRC);
-  put32(&aTrailer[4], gzip.stream.total_in);
   blob_append(&gzip.out, aTrailer, 8);
   *pOut = gzip.out;
   blob_zero(&gzip.out);
@@ -97,6 +97,12 @@ int hname_validate(const char *zHash, int nHash){
 ** corresponding to the hash that matched if the hash is correct.
 ** (Examples: HNAME_SHA1 or HNAME_K256).  And the return is HNAME_ERROR
 ** if the hash does not match.
+**
+** SHA1 hashes are checked with collision detection, so this routine is
+** safe to use on content and hashes that come from other machines.
+**
+** This routine does not use any global state and so may be called
+** from helper threads.
 */
 int hname_verify_hash(Blob *pContent, const char *zHash, int nHash){
   int id = HNAME_ERROR;
@@ -109,15 +115,86 @@ int hname_verify_hash(Blob *pContent, const char *zHash, int nHash){
       break;
     }
     case HNAME_LEN_K256: {
-      sha3sum_init(256);
-      sha3sum_step_blob(pContent);
-      if( memcmp(sha3sum_finish(0),zHash,64)==0 ) id = HNAME_K256;
+      Blob hash;
+      sha3sum_blob(pContent, 256, &hash);
+      if( memcmp(blob_buffer(&hash),zHash,64)==0 ) id = HNAME_K256;
+      blob_reset(&hash);
       break;
     }
   }
   return id;
 }
 
+/*
+** Like hname_verify_hash(), but SHA1 hashes are first checked using
+** sha1sum_blob_fast(), which may use the SHA1 instructions of the CPU
+** and which does not do collision detection.  Only when the fast hash
+** disagrees is the hardened SHA1 consulted to make the final decision.
+**
+** This is only safe when zHash was computed by this repository, with
+** collision detection, when the content was first stored.  If that
+** content was one half of a collision attack, then zHash is the "safe"
+** hash that the hardened SHA1 substitutes and the fast hash does not
+** match it.  A hash claimed by another machine might be the plain SHA1
+** of a colliding blob, so content received over the network must be
+** checked with hname_verify_hash() instead.  This routine is meant for
+** local integrity checks such as "fossil test-integrity" and for the
+** check that verify_before_commit_local() arranges.
+*/
+int hname_verify_hash_local(Blob *pContent, const char *zHash, int nHash){
+  if( nHash==HNAME_LEN_SHA1 ){
+    Blob hash;
+    int id = HNAME_ERROR;
+    sha1sum_blob_fast(pContent, &hash);
+    if( memcmp(blob_buffer(&hash),zHash,HNAME_LEN_SHA1)==0 ) id = HNAME_SHA1;
+    blob_reset(&hash);
+    if( id!=HNAME_ERROR ) return id;
+  }
+  return hname_verify_hash(pContent, zHash, nHash);
+}
+
+/*
+** Run hname_verify_hash_local() on each of the n blobs in apContent[]
+** with the corresponding hash in azHash[], and store the results in
+** aId[].  SHA3 hashes are computed several at a time, when the CPU
+** allows it.  As with hname_verify_hash_local(), the hashes must be
+** the ones that this repository computed when the content was stored.
+**
+** Like hname_verify_hash(), this routine may be called from helper
+** threads.
+*/
+void hname_verify_hash_multi(
+  int n,                     /* Number of blobs to check */
+  Blob **apContent,          /* The blobs */
+  const char **azHash,       /* Expected hash for each blob */
+  int *aId                   /* OUT: HNAME_ERROR, HNAME_SHA1 or HNAME_K256 */
+){
+  Blob **apSha3 = fossil_malloc( (sizeof(Blob*)+sizeof(Blob)+sizeof(int))*n );
+  Blob *aHash = (Blob*)&apSha3[n];
+  int *aiSha3 = (int*)&aHash[n];
+  int i, nSha3 = 0;
+  for(i=0; i<n; i++){
+    if( strlen(azHash[i])==HNAME_LEN_K256 ){
+      aiSha3[nSha3] = i;
+      apSha3[nSha3++] = apContent[i];
+    }else{
+      aId[i] = hname_verify_hash_local(apContent[i], azHash[i],
+                                       (int)strlen(azHash[i]));
+    }
+  }
+  sha3sum_blob_multi(nSha3, apSha3, 256, aHash);
+  for(i=0; i<nSha3; i++){
+    int k = aiSha3[i];
+    if( memcmp(blob_buffer(&aHash[i]),azHash[k],HNAME_LEN_K256)==0 ){
+      aId[k] = HNAME_K256;
+    }else{
+      aId[k] = HNAME_ERROR;
+    }
+    blob_reset(&aHash[i]);
+  }
+  fossil_free(apSha3);
+}
+
 /*
 ** Verify that zHash is a valid hash for the content of a file on
 ** disk named zFile.
@@ -151,6 +228,28 @@ int hname_verify_file_hash(const char *zFile, const char *zHash, int nHash){
   return id;
 }
 
+/*
+** Like hname_verify_file_hash(), but SHA1 hashes are first checked using
+** sha1sum_file_fast().  See hname_verify_hash_local() for when this is
+** safe.  The hashes that vfile_check_signature() compares against come
+** from check-ins in the repository, so it can use this routine.
+*/
+int hname_verify_file_hash_local(
+  const char *zFile,
+  const char *zHash,
+  int nHash
+){
+  if( nHash==HNAME_LEN_SHA1 ){
+    Blob hash;
+    int id = HNAME_ERROR;
+    if( sha1sum_file_fast(zFile, RepoFILE, &hash) ) return HNAME_ERROR;
+    if( memcmp(blob_buffer(&hash),zHash,HNAME_LEN_SHA1)==0 ) id = HNAME_SHA1;
+    blob_reset(&hash);
+    if( id!=HNAME_ERROR ) return id;
+  }
+  return hname_verify_file_hash(zFile, zHash, nHash);
+}
+
 /*
 ** Compute a hash on blob pContent.  Write the hash into blob pHashOut.
 ** This routine assumes that pHashOut is uninitialized.
@@ -282,3 +381,122 @@ void hash_policy_command(void){
   fossil_fatal("unknown hash policy \"%s\" - should be one of: sha1 auto"
                " sha3 sha3-only shun-sha1", g.argv[2]);
 }
+
+/*
+** COMMAND: test-hash-bench
+**
+** Usage: %fossil test-hash-bench ?FILE ...? ?OPTIONS?
+**
+** Measure the speed of each available SHA1 and SHA3 implementation and
+** verify that they all agree.  The input is the files named on the
+** command line or, if there are none, the artifacts of the repository.
+** The implementations are:
+**
+**    sha1        The hardened SHA1 with collision detection
+**    sha1-hw     SHA1 using the SHA instructions of the CPU
+**    sha3        SHA3-256, one input at a time
+**    sha3-x4     SHA3-256, four inputs at a time
+**
+** Options:
+**    --backend NAME         Only measure implementation NAME
+**    --limit N              Use at most N artifacts from the repository
+**    --repeat N             Hash each input N times.  Default: 1
+**    -R|--repository FILE   Use artifacts from repository FILE
+*/
+void hash_bench_cmd(void){
+  static const char *const azBackend[] = {
+    "sha1", "sha1-hw", "sha3", "sha3-x4"
+  };
+  const char *zBackend = find_option("backend",0,1);
+  const char *zLimit = find_option("limit",0,1);
+  const char *zRepeat = find_option("repeat",0,1);
+  int nRepeat = zRepeat ? atoi(zRepeat) : 1;
+  int nIn = 0, nAlloc = 0, nHash, nFound = 0;
+  Blob *aIn = 0;             /* The inputs */
+  Blob **apHash;             /* Inputs to hash, each repeated nRepeat times */
+  Blob *aRef1, *aRef3;       /* Reference results */
+  Blob *aOut;                /* Results of the implementation under test */
+  i64 szTotal = 0;
+  int i, j, k;
+
+  find_repository_option();
+  if( nRepeat<1 ) nRepeat = 1;
+  if( g.argc>=3 ){
+    verify_all_options();
+    nAlloc = g.argc-2;
+    aIn = fossil_malloc( sizeof(aIn[0])*nAlloc );
+    for(i=2; i<g.argc; i++){
+      blob_read_from_file(&aIn[nIn++], g.argv[i], ExtFILE);
+    }
+  }else{
+    Stmt q;
+    db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
+    verify_all_options();
+    db_prepare(&q, "SELECT rid FROM blob WHERE size>=0 ORDER BY rid LIMIT %d",
+               zLimit ? atoi(zLimit) : -1);
+    while( db_step(&q)==SQLITE_ROW ){
+      if( nIn>=nAlloc ){
+        nAlloc = nAlloc*2 + 100;
+        aIn = fossil_realloc(aIn, sizeof(aIn[0])*nAlloc);
+      }
+      if( content_get(db_column_int(&q,0), &aIn[nIn]) ) nIn++;
+    }
+    db_finalize(&q);
+  }
+  nHash = nIn*nRepeat;
+  apHash = fossil_malloc( sizeof(apHash[0])*nHash );
+  aRef1 = fossil_malloc( sizeof(Blob)*nHash*3 );
+  aRef3 = &aRef1[nHash];
+  aOut = &aRef3[nHash];
+  for(i=k=0; i<nIn; i++){
+    szTotal += blob_size(&aIn[i]);
+    for(j=0; j<nRepeat; j++) apHash[k++] = &aIn[i];
+  }
+  for(i=0; i<nHash; i++){
+    sha1sum_blob(apHash[i], &aRef1[i]);
+    sha3sum_blob(apHash[i], 256, &aRef3[i]);
+  }
+  szTotal *= nRepeat;
+  fossil_print("inputs:    %d\n", nIn);
+  fossil_print("bytes:     %lld\n", szTotal);
+  for(i=0; i<count(azBackend); i++){
+    const char *zName = azBackend[i];
+    int isSha3 = zName[3]=='3';
+    int nErr = 0;
+    int timerId;
+    sqlite3_uint64 tm;
+    if( zBackend && fossil_strcmp(zBackend, zName)!=0 ) continue;
+    nFound++;
+    if( isSha3 ? sha3_set_backend(zName) : sha1_set_backend(zName) ){
+      fossil_print("%-10s not available\n", zName);
+      continue;
+    }
+    timerId = fossil_timer_start();
+    if( isSha3 ){
+      sha3sum_blob_multi(nHash, apHash, 256, aOut);
+    }else{
+      for(j=0; j<nHash; j++) sha1sum_blob_fast(apHash[j], &aOut[j]);
+    }
+    tm = fossil_timer_stop(timerId);
+    for(j=0; j<nHash; j++){
+      if( blob_compare(&aOut[j], isSha3 ? &aRef3[j] : &aRef1[j]) ) nErr++;
+      blob_reset(&aOut[j]);
+    }
+    fossil_print("%-10s %.3f seconds, %.1f MB/s", zName, tm/1000000.0,
+                 tm ? szTotal/(double)tm : 0.0);
+    if( nErr ) fossil_print(", %d WRONG HASHES", nErr);
+    fossil_print("\n");
+  }
+  if( nFound==0 ){
+    fossil_fatal("unknown backend \"%s\" - should be one of: sha1 sha1-hw"
+                 " sha3 sha3-x4", zBackend);
+  }
+  for(i=0; i<nHash; i++){
+    blob_reset(&aRef1[i]);
+    blob_reset(&aRef3[i]);
+  }
+  for(i=0; i<nIn; i++) blob_reset(&aIn[i]);
+  fossil_free(aRef1);
+  fossil_free(apHash);
+  fossil_free(aIn);
+}
@@ -41,6 +41,7 @@
 #define HTTP_VERBOSE     0x00004     /* HTTP status messages */
 #define HTTP_QUIET       0x00008     /* No surplus output */
 #define HTTP_NOCOMPRESS  0x00010     /* Omit payload compression */
+#define HTTP_ZSTD        0x00020     /* Compress the payload with zstd */
 #endif
 
 /* Maximum number of HTTP Authorization attempts */
@@ -114,7 +115,8 @@ static void http_build_login_card(Blob *pPayload, Blob *pLogin){
 static void http_build_header(
   Blob *pPayload,              /* the payload that will be sent */
   Blob *pHdr,                  /* construct the header here */
-  const char *zAltMimetype     /* Alternative mimetype */
+  const char *zAltMimetype,    /* Alternative mimetype */
+  int bKeepAlive               /* Ask for a persistent connection */
 ){
   int nPayload = pPayload ? blob_size(pPayload) : 0;
 
@@ -134,6 +136,7 @@ static void http_build_header(
   blob_appendf(pHdr, "Host: %s\r\n", g.url.hostname);
   blob_appendf(pHdr, "User-Agent: %s\r\n", get_user_agent());
   if( g.url.isSsh ) blob_appendf(pHdr, "X-Fossil-Transport: SSH\r\n");
+  if( bKeepAlive ) blob_appendf(pHdr, "Connection: keep-alive\r\n");
   if( nPayload ){
     if( zAltMimetype ){
       blob_appendf(pHdr, "Content-Type: %s\r\n", zAltMimetype);
@@ -208,40 +211,52 @@ char *prompt_for_httpauth_creds(void){
   return zHttpAuth;
 }
 
+#if INTERFACE
+/*
+** Time spent on HTTP exchanges, for "fossil sync --stats".  All times
+** are in milliseconds.
+*/
+struct HttpStats {
+  int nExchange;        /* Number of times requests were sent and answered */
+  int nRequest;         /* Number of HTTP requests */
+  int nPipelined;       /* Requests sent without waiting for a reply */
+  i64 msSend;           /* Time spent sending requests */
+  i64 msWait;           /* Time spent waiting for the start of replies */
+  i64 msRecv;           /* Time spent receiving replies */
+  i64 msMinWait;        /* Shortest wait for the first reply of an exchange */
+};
+#endif
+
+/* Statistics for all HTTP exchanges so far */
+static HttpStats httpStats;
+static i64 tmHttpMark;          /* When the wait for a reply began */
+static int bHttpFirstReply;     /* Next reply is the first of an exchange */
+
+/*
+** Copy the HTTP exchange statistics into *pStats, if pStats is not
+** NULL.  Then reset the statistics if resetFlag is true.
+*/
+void http_stats(HttpStats *pStats, int resetFlag){
+  if( pStats ) *pStats = httpStats;
+  if( resetFlag ) memset(&httpStats, 0, sizeof(httpStats));
+}
+
 /*
 ** Sign the content in pSend, compress it, and send it to the server
-** via HTTP or HTTPS.  Get a reply, uncompress the reply, and store the reply
-** in pRecv.  pRecv is assumed to be uninitialized when
-** this routine is called - this routine will initialize it.
-**
-** The server address is contain in the "g" global structure.  The
-** url_parse() routine should have been called prior to this routine
-** in order to fill this structure appropriately.
+** as a single HTTP request.  If bKeepAlive is true, ask the server to
+** keep the connection open after it replies.  The transport must
+** already be open.
 */
-int http_exchange(
+static void http_send_request(
   Blob *pSend,                /* Message to be sent */
-  Blob *pReply,               /* Write the reply here */
   int mHttpFlags,             /* Flags.  See above */
-  int maxRedirect,            /* Max number of redirects */
-  const char *zAltMimetype    /* Alternative mimetype if not NULL */
+  const char *zAltMimetype,   /* Alternative mimetype if not NULL */
+  int bKeepAlive              /* Ask for a persistent connection */
 ){
   Blob login;           /* The login card */
   Blob payload;         /* The complete payload including login card */
   Blob hdr;             /* The HTTP request header */
-  int closeConnection;  /* True to close the connection when done */
-  int iLength;          /* Expected length of the reply payload */
-  int iRecvLen;         /* Received length of the reply payload */
-  int rc = 0;           /* Result code */
-  int iHttpVersion;     /* Which version of HTTP protocol server uses */
-  char *zLine;          /* A single line of the reply header */
-  int i;                /* Loop counter */
-  int isError = 0;      /* True if the reply is an error message */
-  int isCompressed = 1; /* True if the reply is compressed */
-
-  if( transport_open(&g.url) ){
-    fossil_warning("%s", transport_errmsg(&g.url));
-    return 1;
-  }
+  i64 tmStart = current_time_in_milliseconds();
 
   /* Construct the login card and prepare the complete payload */
   if( blob_size(pSend)==0 ){
@@ -252,6 +267,13 @@ int http_exchange(
     if( g.fHttpTrace || (mHttpFlags & HTTP_NOCOMPRESS)!=0 ){
       payload = login;
       blob_append(&payload, blob_buffer(pSend), blob_size(pSend));
+#if defined(FOSSIL_ENABLE_ZSTD)
+    }else if( (mHttpFlags & HTTP_ZSTD)!=0 && zAltMimetype==0 ){
+      payload = login;
+      blob_append(&payload, blob_buffer(pSend), blob_size(pSend));
+      blob_compress_zstd(&payload, &payload);
+      zAltMimetype = "application/x-fossil-zstd";
+#endif
     }else{
       blob_compress2(&login, pSend, &payload);
       blob_reset(&login);
@@ -259,7 +281,7 @@ int http_exchange(
   }
 
   /* Construct the HTTP request header */
-  http_build_header(&payload, &hdr, zAltMimetype);
+  http_build_header(&payload, &hdr, zAltMimetype, bKeepAlive);
 
   /* When tracing, write the transmitted HTTP message both to standard
   ** output and into a file.  The file can then be used to drive the
@@ -298,26 +320,76 @@ int http_exchange(
   transport_send(&g.url, &payload);
   blob_reset(&hdr);
   blob_reset(&payload);
-  transport_flip(&g.url);
+  tmHttpMark = current_time_in_milliseconds();
+  httpStats.nRequest++;
+  httpStats.msSend += tmHttpMark - tmStart;
+  bHttpFirstReply = 1;
+}
+
+/*
+** Read and interpret one reply from the server.  Uncompress the
+** reply payload and store it in pReply.
+**
+** Return 0 on success.  *pCloseConn is then set to true if the server
+** is going to close the connection, or to -1 if the request was sent
+** again on a new connection and that exchange is already complete.
+** Return non-zero on an error, after closing the connection.
+**
+** If pSend is NULL, the request cannot be sent again, and so redirects
+** and requests for HTTP authorization are errors.
+*/
+static int http_read_reply(
+  Blob *pSend,                /* Message that was sent, or NULL */
+  Blob *pReply,               /* Write the reply here */
+  int mHttpFlags,             /* Flags.  See above */
+  int maxRedirect,            /* Max number of redirects */
+  const char *zAltMimetype,   /* Alternative mimetype if not NULL */
+  int *pCloseConn             /* OUT: True if the connection will close */
+){
+  int closeConnection;  /* True to close the connection when done */
+  int iLength;          /* Expected length of the reply payload */
+  int iRecvLen;         /* Received length of the reply payload */
+  int rc = 0;           /* Result code */
+  int iHttpVersion;     /* Which version of HTTP protocol server uses */
+  char *zLine;          /* A single line of the reply header */
+  int i;                /* Loop counter */
+  int isError = 0;      /* True if the reply is an error message */
+  int isCompressed = 1; /* 1: compressed with zlib.  2: with zstd */
+  i64 tmStart;          /* When the first line of the reply arrived */
 
   /*
   ** Read and interpret the server reply
   */
   closeConnection = 1;
   iLength = -1;
+  tmStart = 0;
   while( (zLine = transport_receive_line(&g.url))!=0 && zLine[0]!=0 ){
+    if( tmStart==0 ){
+      i64 msWait;
+      tmStart = current_time_in_milliseconds();
+      msWait = tmStart - tmHttpMark;
+      httpStats.msWait += msWait;
+      if( bHttpFirstReply ){
+        httpStats.nExchange++;
+        if( httpStats.nExchange==1 || msWait<httpStats.msMinWait ){
+          httpStats.msMinWait = msWait;
+        }
+        bHttpFirstReply = 0;
+      }
+    }
     if( mHttpFlags & HTTP_VERBOSE ){
       fossil_print("Read: [%s]\n", zLine);
     }
     if( fossil_strnicmp(zLine, "http/1.", 7)==0 ){
       if( sscanf(zLine, "HTTP/1.%d %d", &iHttpVersion, &rc)!=2 ) goto write_err;
-      if( rc==401 ){
+      if( rc==401 && pSend ){
         if( fSeenHttpAuth++ < MAX_HTTP_AUTH ){
           if( g.zHttpAuth ){
             if( g.zHttpAuth ) free(g.zHttpAuth);
           }
           g.zHttpAuth = prompt_for_httpauth_creds();
           transport_close(&g.url);
+          *pCloseConn = -1;
           return http_exchange(pSend, pReply, mHttpFlags,
                                maxRedirect, zAltMimetype);
         }
@@ -361,6 +433,7 @@ int http_exchange(
       int i, j;
       int wasHttps;
 
+      if( pSend==0 ) goto write_err;
       if ( --maxRedirect == 0){
         fossil_warning("redirect limit exceeded");
         goto write_err;
@@ -399,6 +472,7 @@ int http_exchange(
       if( g.zHttpAuth ) free(g.zHttpAuth);
       g.zHttpAuth = get_httpauth();
       if( rc==301 || rc==308 ) url_remember();
+      *pCloseConn = -1;
       return http_exchange(pSend, pReply, mHttpFlags,
                            maxRedirect, zAltMimetype);
     }else if( fossil_strnicmp(zLine, "content-type: ", 14)==0 ){
@@ -407,6 +481,11 @@ int http_exchange(
       }else if( fossil_strnicmp(&zLine[14],
                           "application/x-fossil-uncompressed", -1)==0 ){
         isCompressed = 0;
+#if defined(FOSSIL_ENABLE_ZSTD)
+      }else if( fossil_strnicmp(&zLine[14],
+                          "application/x-fossil-zstd", -1)==0 ){
+        isCompressed = 2;
+#endif
       }else{
         if( (mHttpFlags & HTTP_GENERIC)==0
          && fossil_strnicmp(&zLine[14], "application/x-fossil", -1)!=0
@@ -436,6 +515,8 @@ int http_exchange(
     goto write_err;
   }
   blob_resize(pReply, iLength);
+  tmHttpMark = current_time_in_milliseconds();
+  httpStats.msRecv += tmHttpMark - tmStart;
   if( isError ){
     char *z;
     int i, j;
@@ -451,7 +532,53 @@ int http_exchange(
     fossil_warning("server sends error: %s", z);
     goto write_err;
   }
+#if defined(FOSSIL_ENABLE_ZSTD)
+  if( isCompressed==2 ){
+    blob_uncompress_zstd(pReply, pReply);
+  }else
+#endif
   if( isCompressed ) blob_uncompress(pReply, pReply);
+  *pCloseConn = closeConnection;
+  return 0;
+
+  /*
+  ** Jump to here if an error is seen.
+  */
+write_err:
+  transport_close(&g.url);
+  return 1;
+}
+
+/*
+** Sign the content in pSend, compress it, and send it to the server
+** via HTTP or HTTPS.  Get a reply, uncompress the reply, and store the reply
+** in pRecv.  pRecv is assumed to be uninitialized when
+** this routine is called - this routine will initialize it.
+**
+** The server address is contain in the "g" global structure.  The
+** url_parse() routine should have been called prior to this routine
+** in order to fill this structure appropriately.
+*/
+int http_exchange(
+  Blob *pSend,                /* Message to be sent */
+  Blob *pReply,               /* Write the reply here */
+  int mHttpFlags,             /* Flags.  See above */
+  int maxRedirect,            /* Max number of redirects */
+  const char *zAltMimetype    /* Alternative mimetype if not NULL */
+){
+  int closeConnection;  /* True to close the connection when done */
+
+  if( transport_open(&g.url) ){
+    fossil_warning("%s", transport_errmsg(&g.url));
+    return 1;
+  }
+  http_send_request(pSend, mHttpFlags, zAltMimetype, 0);
+  transport_flip(&g.url);
+  if( http_read_reply(pSend, pReply, mHttpFlags, maxRedirect, zAltMimetype,
+                      &closeConnection) ){
+    return 1;
+  }
+  if( closeConnection<0 ) return 0;
 
   /*
   ** Close the connection to the server if appropriate.
@@ -469,13 +596,56 @@ int http_exchange(
     transport_rewind(&g.url);
   }
   return 0;
+}
 
-  /*
-  ** Jump to here if an error is seen.
-  */
-write_err:
-  transport_close(&g.url);
-  return 1;
+/*
+** Send nReq requests, aSend[0] through aSend[nReq-1], to the server one
+** after another over a single connection without waiting for the
+** replies, then read the replies in the same order into aReply[].
+** This saves a round-trip for every request after the first.
+**
+** Only use this with a server that has said that it accepts pipelined
+** requests, and keep all but the first request small.  The server does
+** not read the next request while it is sending a reply, so the later
+** requests must fit in the socket buffers.
+**
+** Return the number of replies received.  The remaining requests were
+** not answered, because of an error or because the server closed the
+** connection, and should be sent again using http_exchange().
+*/
+int http_exchange_pipelined(
+  Blob *aSend,                /* Messages to be sent */
+  Blob *aReply,               /* Write the replies here */
+  int nReq,                   /* Number of messages */
+  int mHttpFlags              /* Flags.  See above */
+){
+  int closeConnection = 0;
+  int nReply = 0;
+  int i;
+
+  if( g.url.isFile || nReq<1 ) return 0;
+  if( transport_open(&g.url) ) return 0;
+  for(i=0; i<nReq; i++){
+    http_send_request(&aSend[i], mHttpFlags, 0, 1);
+  }
+  httpStats.nPipelined += nReq-1;
+  transport_flip(&g.url);
+  transport_keep_alive(1);
+  for(i=0; i<nReq && !closeConnection; i++){
+    if( http_read_reply(0, &aReply[i], mHttpFlags, 0, 0, &closeConnection) ){
+      closeConnection = 1;
+      break;
+    }
+    nReply++;
+  }
+  transport_keep_alive(0);
+  if( ! g.url.isSsh ) closeConnection = 1;
+  if( closeConnection ){
+    transport_close(&g.url);
+  }else{
+    transport_rewind(&g.url);
+  }
+  return nReply;
 }
 
 /*
@@ -38,8 +38,9 @@ static struct {
   char *zOutFile;         /* Name of outbound file for FILE: */
   char *zInFile;          /* Name of inbound file for FILE: */
   FILE *pLog;             /* Log output here */
+  int bKeepAlive;         /* Connection stays open after the reply */
 } transport = {
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
 /*
@@ -204,6 +205,7 @@ void transport_close(UrlData *pUrlData){
     transport.nAlloc = 0;
     transport.nUsed = 0;
     transport.iCursor = 0;
+    transport.bKeepAlive = 0;
     if( transport.pLog ){
       fclose(transport.pLog);
       transport.pLog = 0;
@@ -293,6 +295,16 @@ void transport_log(FILE *pLog){
   transport.pLog = pLog;
 }
 
+/*
+** Tell the transport whether or not the server will keep the connection
+** open after the reply that is about to be read.  If it will, reply
+** header lines are read one byte at a time, since asking for more
+** could wait for bytes that the server is never going to send.
+*/
+void transport_keep_alive(int bKeepAlive){
+  transport.bKeepAlive = bKeepAlive;
+}
+
 /*
 ** This routine is called when the inbound message has been received
 ** and it is time to start sending again.
@@ -426,7 +438,8 @@ char *transport_receive_line(UrlData *pUrlData){
   i = iStart = transport.iCursor;
   while(1){
     if( i >= transport.nUsed ){
-      transport_load_buffer(pUrlData, pUrlData->isSsh ? 2 : 1000);
+      transport_load_buffer(pUrlData,
+                 transport.bKeepAlive ? 1 : pUrlData->isSsh ? 2 : 1000);
       i -= iStart;
       iStart = 0;
       if( i >= transport.nUsed ){
@@ -696,20 +696,8 @@ void ci_page(void){
 
     /* The Download: line */
     if( g.perm.Zip  ){
-      char *zPJ = db_get("short-project-name", 0);
+      char *zPJ = archive_project_name();
       char *zUrl;
-      Blob projName;
-      int jj;
-      if( zPJ==0 ) zPJ = db_get("project-name", "unnamed");
-      blob_zero(&projName);
-      blob_append(&projName, zPJ, -1);
-      blob_trim(&projName);
-      zPJ = blob_str(&projName);
-      for(jj=0; zPJ[jj]; jj++){
-        if( (zPJ[jj]>0 && zPJ[jj]<' ') || strchr("\"*/:<>?\\|", zPJ[jj]) ){
-          zPJ[jj] = '_';
-        }
-      }
       zUrl = mprintf("%R/tarball/%S/%t-%S.tar.gz", zUuid, zPJ, zUuid);
       @ <tr><th>Downloads:</th><td>
       @ %z(href("%s",zUrl))Tarball</a>
@@ -717,7 +705,7 @@ void ci_page(void){
       @ | %z(href("%R/sqlar/%S/%t-%S.sqlar",zUuid,zPJ,zUuid))\
       @ SQL archive</a></td></tr>
       fossil_free(zUrl);
-      blob_reset(&projName);
+      fossil_free(zPJ);
     }
 
     @ <tr><th>Timelines:</th><td>
@@ -1863,7 +1851,7 @@ void deliver_artifact(int rid, const char *zMime){
   if( zAttachName ){
     cgi_content_disposition_filename(zAttachName);
   }
-  cgi_set_content(&content);
+  cgi_set_large_content(&content);
 }
 
 /*
@@ -1986,8 +1974,9 @@ int artifact_from_ci_and_filename(const char *zNameParam){
   const char *zFilename;
   const char *zCI;
   int cirid;
-  Manifest *pManifest;
-  ManifestFile *pFile;
+  Manifest *pManifest = 0;
+  ManifestIndex *pIdx;
+  ManifestFile *pFile, sFile;
   int rid = 0;
 
   if( zNameParam ){
@@ -2006,19 +1995,41 @@ int artifact_from_ci_and_filename(const char *zNameParam){
   zCI = PD("ci", "tip");
   cirid = name_to_typed_rid(zCI, "ci");
   if( cirid<=0 ) return 0;
-  pManifest = manifest_get(cirid, CFTYPE_MANIFEST, 0);
-  if( pManifest==0 ) return 0;
-  manifest_file_rewind(pManifest);
-  while( (pFile = manifest_file_next(pManifest,0))!=0 ){
-    if( fossil_strcmp(zFilename, pFile->zName)==0 ){
-      rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%Q", pFile->zUuid);
-      break;
+  pIdx = manifest_index_get(cirid);
+  if( pIdx==0 ){
+    pManifest = manifest_get(cirid, CFTYPE_MANIFEST, 0);
+    if( pManifest==0 ) return 0;
+    pFile = manifest_file_seek(pManifest, zFilename, 0);
+  }else{
+    int i = manifest_index_search(pIdx, zFilename, 0);
+    pFile = 0;
+    if( i>=0 ){
+      manifest_index_entry(pIdx, i, &sFile);
+      pFile = &sFile;
     }
   }
+  if( pFile ){
+    rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%Q", pFile->zUuid);
+  }
   manifest_destroy(pManifest);
+  manifest_index_free(pIdx);
   return rid;
 }
 
+/*
+** True if output_text_with_line_numbers() has emitted its javascript
+** for the current page
+*/
+static int lineNumJsEmitted = 0;
+
+/*
+** Forget that the line-numbering javascript has been emitted, so that
+** a server process can generate another page.
+*/
+void info_reset_request(void){
+  lineNumJsEmitted = 0;
+}
+
 /*
 ** The "z" argument is a string that contains the text of a source
 ** code file and nZ is its length in bytes. This routine appends that
@@ -2055,7 +2066,6 @@ void output_text_with_line_numbers(
   int nLine = 0;       /* content line count */
   int nSpans = 0;      /* number of distinct zLn spans */
   const char *zExt = file_extension(zName);
-  static int emittedJS = 0; /* emitted shared JS yet? */
   Stmt q;
 
   iStart = iEnd = atoi(zLn);
@@ -2133,8 +2143,8 @@ void output_text_with_line_numbers(
   }
   cgi_printf("%z", htmlize(z, nZ));
   CX("</code></pre></td></tr></tbody></table>\n");
-  if(includeJS && !emittedJS){
-    emittedJS = 1;
+  if(includeJS && !lineNumJsEmitted){
+    lineNumJsEmitted = 1;
     if( db_int(0, "SELECT EXISTS(SELECT 1 FROM lnos)") ){
       builtin_request_js("scroll.js");
     }
@@ -1296,6 +1296,14 @@ void login_set_capabilities(const char *zCap, unsigned flags){
   }
 }
 
+/*
+** Forget the capabilities of the previous request, which were held in
+** g.perm, so that a server process can handle another.
+*/
+void login_reset_request(void){
+  login_anon_once = 1;
+}
+
 /*
 ** Zeroes out g.perm and calls login_set_capabilities(zCap,flags).
 */
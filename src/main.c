@@ -48,6 +48,9 @@
 #else
 #  include <zlib.h>
 #endif
+#if defined(FOSSIL_ENABLE_ZSTD)
+#  include <zstd.h>
+#endif
 #if INTERFACE
 #ifdef FOSSIL_ENABLE_TCL
 #  include "tcl.h"
@@ -69,6 +72,19 @@
 # define FOSSIL_DEFAULT_TIMEOUT 600  /* 10 minutes */
 #endif
 
+/*
+** Default number of seconds that an idle persistent HTTP connection is
+** kept open, and default number of HTTP requests that a single server
+** process handles before it exits.  Changable using the "--keepalive N"
+** and "--max-requests N" command-line options.
+*/
+#ifndef FOSSIL_DEFAULT_KEEPALIVE
+# define FOSSIL_DEFAULT_KEEPALIVE 5
+#endif
+#ifndef FOSSIL_DEFAULT_MAXREQUEST
+# define FOSSIL_DEFAULT_MAXREQUEST 1000
+#endif
+
 /*
 ** Maximum number of auxiliary parameters on reports
 */
@@ -375,6 +391,7 @@ static void fossil_atexit(void) {
     db_close(0);
   }
   manifest_clear_cache();
+  manifest_cache_clear();
   content_clear_cache(1);
   rebuild_clear_cache();
   /*
@@ -1173,6 +1190,10 @@ void fossil_version_blob(
 #else
   blob_appendf(pOut, "zlib %s, loaded %s\n", ZLIB_VERSION, zlibVersion());
 #endif
+#if defined(FOSSIL_ENABLE_ZSTD)
+  blob_appendf(pOut, "zstd %s, loaded %s\n", ZSTD_VERSION_STRING,
+               ZSTD_versionString());
+#endif
 #if FOSSIL_HARDENED_SHA1
   blob_appendf(pOut, "hardened-SHA1 by Marc Stevens and Dan Shumow\n");
 #endif
@@ -2444,6 +2465,280 @@ void test_pid_page(void){
   @ %d(GETPID())
 }
 
+#if !defined(_WIN32)
+/*
+** State of a process that handles more than one HTTP request, either
+** over a persistent connection or as a "fossil server --workers" worker:
+** the value of g before the first request, the JS delivery mode, and
+** the CONFIG and USER settings that were in effect at that time.  Only
+** the fields of g restored by web_request_reset_globals() are read
+** back out of gRequestBase.
+*/
+static Global gRequestBase;
+static int eRequestJsMode = 0;
+static char *zRequestConfig = 0;
+
+/*
+** Return text that changes whenever any setting or any user capability
+** changes.  Space to hold the result comes from fossil_malloc().
+**
+** CONFIG entries that record state rather than settings, such as the
+** backoffice lease and the time of the last email digest, are left
+** out.  They change all the time and none of them is cached by a
+** process that handles more than one request.
+*/
+static char *web_request_config(void){
+  return db_text("",
+    "SELECT (SELECT group_concat(name||'='||quote(value), char(10))"
+    "          FROM config"
+    "         WHERE name NOT IN ('backoffice','email-last-digest',"
+    "                            'hook-last-rcvid','hook-embargo','uv-hash')"
+    "           AND name NOT GLOB 'last-sync-*'"
+    "           AND name NOT GLOB 'peer-name-*'"
+    "           AND name NOT GLOB 'peer-repo-*'"
+    "           AND name NOT GLOB 'baseurl:*')"
+    "    || (SELECT group_concat(login||'='||cap, char(10)) FROM user)"
+  );
+}
+
+/*
+** The repository might have been changed by another process.  Discard
+** cached content and return non-zero if the settings are no longer the
+** ones that were in effect before the first request.
+*/
+static int web_request_refresh(void){
+  char *z;
+  int rc;
+  content_clear_cache(0);
+  manifest_cache_clear();
+  sqlite3_file_control(g.db, "repository", SQLITE_FCNTL_DATA_VERSION,
+                       &g.iRepoDataVers);
+  z = web_request_config();
+  rc = fossil_strcmp(z, zRequestConfig)!=0;
+  fossil_free(z);
+  return rc;
+}
+
+/*
+** Check to see whether this process can handle another request.
+** Discard cached content if the repository has changed.  Return
+** non-zero if the process should exit instead because the settings
+** have changed.  Many settings are read only once per process.
+*/
+static int web_request_stale(void){
+  /* A read transaction lets the pager notice changes by other processes */
+  db_int(0, "PRAGMA repository.data_version");
+  if( !db_repository_has_changed() ) return 0;
+  return web_request_refresh();
+}
+
+/*
+** Prepare to handle more than one HTTP request in this process, by
+** opening the repository and remembering the state that every request
+** should start from.  Return non-zero if that is not possible because
+** the server is not for a single repository.
+*/
+static int web_request_baseline(void){
+  if( g.db==0 ){
+    if( g.zRepositoryName==0 || file_isfile(g.zRepositoryName, ExtFILE)!=1 ){
+      return 1;
+    }
+    db_open_repository(g.zRepositoryName);
+  }
+  eRequestJsMode = builtin_get_js_delivery_mode();
+  zRequestConfig = web_request_config();
+  blob_zero(&g.cgiIn);
+  blob_zero(&g.httpHeader);
+  blob_zero(&g.thLog);
+  cgi_save_baseline();
+  memcpy(&gRequestBase, &g, sizeof(g));
+  return 0;
+}
+
+/*
+** Put the fields of g that an HTTP request may change back to the values
+** they had before the first request.  Fields that are not listed here
+** are either fixed for the life of the process, such as the repository
+** name and the command-line options, or are reset by the module that
+** owns them.  The JSON state is not touched because a JSON request
+** always ends the process.
+*/
+static void web_request_reset_globals(void){
+  g.isConst = 0;
+  g.zPath = 0;
+  g.zExtra = 0;
+  g.zBaseURL = gRequestBase.zBaseURL;
+  g.zHttpsURL = gRequestBase.zHttpsURL;
+  g.zTop = gRequestBase.zTop;
+  g.zContentType = 0;
+  g.iErrPriority = 0;
+  g.zErrMsg = 0;
+  blob_reset(&g.cgiIn);
+  g.cgiOutput = gRequestBase.cgiOutput;
+  g.xferPanic = 0;
+  g.fullHttpReply = gRequestBase.fullHttpReply;
+  g.th1Flags = gRequestBase.th1Flags;
+  g.xlinkClusterOnly = 0;
+  g.aCommitFile = 0;
+  g.markPrivate = 0;
+  g.ckinLockFail = 0;
+  g.clockSkewSeen = 0;
+  g.fTimeFormat = gRequestBase.fTimeFormat;
+  g.wikiFlags = 0;
+  g.javascriptHyperlink = gRequestBase.javascriptHyperlink;
+  blob_reset(&g.httpHeader);
+  g.zLogin = gRequestBase.zLogin;
+  g.noPswd = 0;
+  g.userUid = 0;
+  g.isHuman = 0;
+  g.rcvid = 0;
+  g.zIpAddr = gRequestBase.zIpAddr;
+  g.zNonce = 0;
+  g.perm = gRequestBase.perm;
+  g.anon = gRequestBase.anon;
+  memset(g.zCsrfToken, 0, sizeof(g.zCsrfToken));
+  g.okCsrf = 0;
+  g.thTrace = 0;
+  blob_reset(&g.thLog);
+  g.isHome = 0;
+  g.nAux = 0;
+  g.bAvoidDeltaManifests = 0;
+}
+
+/*
+** Reset the state left behind by an HTTP request back to what
+** web_request_baseline() saved, so that another request can be handled
+** by the same process and the same database connection.  The current
+** connection is kept.  Return non-zero if the process should exit
+** instead, because the request left behind state that cannot be reset.
+**
+** Pending backoffice work does not prevent another request on the same
+** connection.  See web_request_backoffice() for when it is started.
+*/
+static int web_request_reset(void){
+  if( db_request_cleanup() ) return 1;
+  if( skin_draft_in_use() ) return 1;
+#ifdef FOSSIL_ENABLE_JSON
+  if( g.json.isJsonMode ) return 1;
+#endif
+  if( web_request_stale() ) return 1;
+  Th_FossilReset();
+  cgi_reset_request();
+  style_reset_request();
+  builtin_reset_request(eRequestJsMode);
+  etag_reset_request();
+  cookie_reset_request();
+  login_reset_request();
+  document_reset_request();
+  info_reset_request();
+  wiki_reset_request();
+  timeline_reset_request();
+  graph_reset_request();
+  diff_reset_request();
+  stats_report_reset_request();
+  web_request_reset_globals();
+  return 0;
+}
+
+/*
+** Start backoffice work that an earlier request found to be pending.
+** The backoffice is forked off when the repository is closed, so close
+** the repository and open it again, keeping everything else, including
+** the in-memory caches.  Prepared statements are prepared again as they
+** are needed.  Return non-zero if the process should exit instead.
+*/
+static int web_request_backoffice(void){
+  char *zRepo = fossil_strdup(g.zRepositoryName);
+  db_close(1);
+  if( file_isfile(zRepo, ExtFILE)!=1 ){
+    fossil_free(zRepo);
+    return 1;
+  }
+  db_open_repository(zRepo);
+  fossil_free(zRepo);
+  return web_request_refresh();
+}
+
+/*
+** Handle HTTP requests arriving on g.httpIn, one after another, for as
+** long as the client keeps the connection open.  An idle connection is
+** closed after nKeepAlive seconds, and no more than *pnBudget requests
+** are handled, if *pnBudget is positive.  *pnBudget is decreased by the
+** number of requests handled.
+**
+** Return non-zero if the process should exit when the connection is
+** closed.  web_request_baseline() must have been called first.
+*/
+static int web_serve_connection(
+  const char *zIpAddr,        /* Remote IP address, or NULL to look it up */
+  const char *zNotFound,      /* Redirect here on a 404 if not NULL */
+  Glob *pFileGlob,            /* Deliver static files matching */
+  int allowRepoList,          /* Send repo list for "/" URL */
+  int nTimeout,               /* Maximum seconds for each request */
+  int nKeepAlive,             /* Seconds to wait for another request */
+  int *pnBudget               /* Requests left before the process exits */
+){
+  while( 1 ){
+    int bLast = *pnBudget==1;
+    if( *pnBudget>0 ) (*pnBudget)--;
+    cgi_keep_alive(bLast ? 0 : nKeepAlive);
+    fossil_set_timeout(nTimeout);
+    cgi_handle_http_request(zIpAddr);
+    process_one_web_page(zNotFound, pFileGlob, allowRepoList);
+    fossil_set_timeout(0);
+    if( web_request_reset() || bLast ) return 1;
+    if( !cgi_is_keep_alive() ) return 0;
+    if( !cgi_wait_for_request() ) return 0;
+    if( web_request_stale() ) return 1;
+  }
+}
+
+/*
+** Handle HTTP requests in a pre-forked worker process of "fossil server
+** --workers".  The repository stays open, with its prepared statements
+** and caches, from one request to the next.  State left behind by each
+** request is reset before the next one is read.
+**
+** The worker exits after mxRequest requests, if mxRequest is positive.
+** Requests that end by calling fossil_exit(), such as redirects and
+** fatal errors, end the worker early, as does a request that leaves
+** behind state that cannot be reset.  Pending backoffice work is started
+** once the current connection is closed, and the worker carries on.  The
+** parent process starts a replacement for every worker that exits.
+*/
+static void webserver_worker(
+  const char *zNotFound,      /* Redirect here on a 404 if not NULL */
+  Glob *pFileGlob,            /* Deliver static files matching */
+  int allowRepoList,          /* Send repo list for "/" URL */
+  int flags,                  /* HTTP_SERVER_* flags */
+  int nTimeout,               /* Maximum seconds for each request */
+  int nKeepAlive,             /* Seconds to wait for another request */
+  int mxRequest               /* Exit after this many requests */
+){
+  int nBudget = mxRequest>0 ? mxRequest : -1;
+  if( web_request_baseline() ) return;
+  while( nBudget!=0 ){
+    int rc;
+    if( cgi_http_worker_accept(web_request_stale) ) break;
+    g.nRequest++;
+    if( flags & HTTP_SERVER_SCGI ){
+      if( nBudget>0 ) nBudget--;
+      fossil_set_timeout(nTimeout);
+      cgi_handle_scgi_request();
+      process_one_web_page(zNotFound, pFileGlob, allowRepoList);
+      fossil_set_timeout(0);
+      rc = web_request_reset();
+    }else{
+      rc = web_serve_connection(0, zNotFound, pFileGlob, allowRepoList,
+                                nTimeout, nKeepAlive, &nBudget);
+    }
+    cgi_http_worker_close();
+    if( rc ) break;
+    if( backoffice_is_pending() && web_request_backoffice() ) break;
+  }
+}
+#endif /* !_WIN32 */
+
 /*
 ** COMMAND: http*
 **
@@ -2454,6 +2749,11 @@ void test_pid_page(void){
 ** handler from inetd, for example.  The argument is the name of the
 ** repository.
 **
+** If the client asks for a persistent connection and REPOSITORY is a
+** single repository, further requests on the same connection are handled
+** by the same process, until the client closes the connection or leaves
+** it idle for longer than the --keepalive timeout.
+**
 ** If REPOSITORY is a directory that contains one or more repositories,
 ** either directly in REPOSITORY itself or in subdirectories, and
 ** with names of the form "*.fossil" then a prefix of the URL pathname
@@ -2497,7 +2797,10 @@ void test_pid_page(void){
 **                       and bundled modes might result in a single
 **                       amalgamated script or several, but both approaches
 **                       result in fewer HTTP requests than the separate mode.
+**   --keepalive N    keep an idle persistent connection open for N seconds.
+**                    0 closes the connection after every reply.  Default: 5
 **   --localauth      enable automatic login for local connections
+**   --max-requests N handle at most N requests on one connection
 **   --nocompress     do not compress HTTP replies
 **   --nodelay        omit backoffice processing if it would delay process exit
 **   --nojail         drop root privilege but do not enter the chroot jail
@@ -2524,6 +2827,9 @@ void cmd_http(void){
   int useSCGI;
   int noJail;
   int allowRepoList;
+  const char *zKeepAlive;
+  const char *zMaxRequest;
+  int nKeepAlive;
 
   Th_InitTraceLog();
   builtin_set_js_delivery_mode(find_option("jsmode",0,1),0);
@@ -2574,11 +2880,15 @@ void cmd_http(void){
   }
   zHost = find_option("host", 0, 1);
   if( zHost ) cgi_replace_parameter("HTTP_HOST",zHost);
+  zKeepAlive = find_option("keepalive",0,1);
+  zMaxRequest = find_option("max-requests",0,1);
 
   /* We should be done with options.. */
   verify_all_options();
 
   if( g.argc!=2 && g.argc!=3 ) usage("?REPOSITORY?");
+  nKeepAlive = zKeepAlive ? atoi(zKeepAlive) : FOSSIL_DEFAULT_KEEPALIVE;
+  if( zInFile || zOutFile ) nKeepAlive = 0;
   g.cgiOutput = 1;
   g.fullHttpReply = 1;
   find_server_repository(2, 0);
@@ -2593,6 +2903,14 @@ void cmd_http(void){
     cgi_handle_scgi_request();
   }else if( g.fSshClient & CGI_SSH_CLIENT ){
     ssh_request_loop(zIpAddr, glob_create(zFileGlob));
+#if !defined(_WIN32)
+  }else if( nKeepAlive>0 && web_request_baseline()==0 ){
+    int nBudget = zMaxRequest ? atoi(zMaxRequest) : FOSSIL_DEFAULT_MAXREQUEST;
+    if( nBudget<=0 ) nBudget = -1;
+    web_serve_connection(zIpAddr, zNotFound, glob_create(zFileGlob),
+                         allowRepoList, 0, nKeepAlive, &nBudget);
+    return;
+#endif
   }else{
     cgi_handle_http_request(zIpAddr);
   }
@@ -2772,6 +3090,12 @@ void fossil_set_timeout(int N){
 **                       result in fewer HTTP requests than the separate mode.
 **   --max-latency N     Do not let any single HTTP request run for more than N
 **                       seconds (only works on unix)
+**   --keepalive N       Keep an idle persistent connection open for N
+**                       seconds.  0 closes every connection after one reply.
+**                       Default: 5
+**   --max-requests N    A process exits after handling N requests, over one
+**                       connection or, with --workers, over many.
+**                       Default: 1000
 **   --nocompress        Do not compress HTTP replies
 **   --nojail            Drop root privileges but do not enter the chroot jail
 **   --nossl             signal that no SSL connections are available (Always
@@ -2785,6 +3109,10 @@ void fossil_set_timeout(int N){
 **   --skin LABEL        Use override skin LABEL
 **   --usepidkey         Use saved encryption key from parent process.  This is
 **                       only necessary when using SEE on Windows.
+**   --workers N         Start N worker processes up front, each of which keeps
+**                       the repository open and handles many requests, rather
+**                       than a new process for every connection.  Only for a
+**                       single REPOSITORY and only on unix.
 **
 ** See also: [[cgi]], [[http]], [[winsrv]]
 */
@@ -2799,6 +3127,12 @@ void cmd_webserver(void){
 #if !defined(_WIN32)
   int noJail;               /* Do not enter the chroot jail */
   const char *zTimeout = 0; /* Max runtime of any single HTTP request */
+  const char *zWorkers;     /* Value of the --workers option */
+  const char *zMaxRequest;  /* Value of the --max-requests option */
+  const char *zKeepAlive;   /* Value of the --keepalive option */
+  int nTimeout;             /* Maximum seconds for each request */
+  int nKeepAlive;           /* Seconds to keep an idle connection open */
+  int mxRequest;            /* Maximum requests handled by one process */
 #endif
   int allowRepoList;         /* List repositories on URL "/" */
   const char *zAltBase;      /* Argument to the --baseurl option */
@@ -2829,6 +3163,9 @@ void cmd_webserver(void){
 #if !defined(_WIN32)
   noJail = find_option("nojail",0,0)!=0;
   zTimeout = find_option("max-latency",0,1);
+  zWorkers = find_option("workers",0,1);
+  zMaxRequest = find_option("max-requests",0,1);
+  zKeepAlive = find_option("keepalive",0,1);
 #endif
   g.useLocalauth = find_option("localauth", 0, 0)!=0;
   Th_InitTraceLog();
@@ -2922,6 +3259,9 @@ void cmd_webserver(void){
   }
   if( g.repositoryOpen ) flags |= HTTP_SERVER_HAD_REPOSITORY;
   if( g.localOpen ) flags |= HTTP_SERVER_HAD_CHECKOUT;
+  if( zWorkers && g.repositoryOpen ){
+    cgi_http_server_workers(atoi(zWorkers));
+  }
   db_close(1);
   if( cgi_http_server(iPort, mxPort, zBrowserCmd, zIpAddr, flags) ){
     fossil_fatal("unable to listen on TCP socket %d", iPort);
@@ -2934,14 +3274,19 @@ void cmd_webserver(void){
   ** So, when control reaches this point, we are running as a
   ** child process, the HTTP or SCGI request is pending on file
   ** descriptor 0 and the reply should be written to file descriptor 1.
+  **
+  ** Or, with --workers, we are running as a worker process that
+  ** accepts its own connections.
   */
-  if( zTimeout ){
-    fossil_set_timeout(atoi(zTimeout));
-  }else{
-    fossil_set_timeout(FOSSIL_DEFAULT_TIMEOUT);
+  if( !cgi_http_is_worker() ){
+    if( zTimeout ){
+      fossil_set_timeout(atoi(zTimeout));
+    }else{
+      fossil_set_timeout(FOSSIL_DEFAULT_TIMEOUT);
+    }
+    g.httpIn = stdin;
+    g.httpOut = stdout;
   }
-  g.httpIn = stdin;
-  g.httpOut = stdout;
 
 #if !defined(_WIN32)
   signal(SIGSEGV, sigsegv_handler);
@@ -2958,12 +3303,27 @@ void cmd_webserver(void){
   }else{
     g.zRepositoryName = enter_chroot_jail(g.zRepositoryName, noJail);
   }
-  if( flags & HTTP_SERVER_SCGI ){
-    cgi_handle_scgi_request();
+  nTimeout = zTimeout ? atoi(zTimeout) : FOSSIL_DEFAULT_TIMEOUT;
+  nKeepAlive = zKeepAlive ? atoi(zKeepAlive) : FOSSIL_DEFAULT_KEEPALIVE;
+  mxRequest = zMaxRequest ? atoi(zMaxRequest) : FOSSIL_DEFAULT_MAXREQUEST;
+  if( cgi_http_is_worker() ){
+    webserver_worker(zNotFound, glob_create(zFileGlob), allowRepoList, flags,
+                     nTimeout, nKeepAlive, mxRequest);
+  }else if( (flags & HTTP_SERVER_SCGI)==0
+         && nKeepAlive>0
+         && web_request_baseline()==0
+  ){
+    int nBudget = mxRequest>0 ? mxRequest : -1;
+    web_serve_connection(0, zNotFound, glob_create(zFileGlob), allowRepoList,
+                         nTimeout, nKeepAlive, &nBudget);
   }else{
-    cgi_handle_http_request(0);
+    if( flags & HTTP_SERVER_SCGI ){
+      cgi_handle_scgi_request();
+    }else{
+      cgi_handle_http_request(0);
+    }
+    process_one_web_page(zNotFound, glob_create(zFileGlob), allowRepoList);
   }
-  process_one_web_page(zNotFound, glob_create(zFileGlob), allowRepoList);
   if( g.fAnyTrace ){
     fprintf(stderr, "/***** Webpage finished in subprocess %d *****/\n",
             getpid());
@@ -159,6 +159,7 @@ SRC = \
   $(SRCDIR)/wikiformat.c \
   $(SRCDIR)/winfile.c \
   $(SRCDIR)/winhttp.c \
+  $(SRCDIR)/workpool.c \
   $(SRCDIR)/xfer.c \
   $(SRCDIR)/xfersetup.c \
   $(SRCDIR)/zip.c
@@ -417,6 +418,7 @@ TRANS_SRC = \
   $(OBJDIR)/wikiformat_.c \
   $(OBJDIR)/winfile_.c \
   $(OBJDIR)/winhttp_.c \
+  $(OBJDIR)/workpool_.c \
   $(OBJDIR)/xfer_.c \
   $(OBJDIR)/xfersetup_.c \
   $(OBJDIR)/zip_.c
@@ -565,6 +567,7 @@ OBJ = \
  $(OBJDIR)/wikiformat.o \
  $(OBJDIR)/winfile.o \
  $(OBJDIR)/winhttp.o \
+ $(OBJDIR)/workpool.o \
  $(OBJDIR)/xfer.o \
  $(OBJDIR)/xfersetup.o \
  $(OBJDIR)/zip.o
@@ -903,6 +906,7 @@ $(OBJDIR)/headers:	$(OBJDIR)/page_index.h $(OBJDIR)/builtin_data.h $(OBJDIR)/mak
 	$(OBJDIR)/wikiformat_.c:$(OBJDIR)/wikiformat.h \
 	$(OBJDIR)/winfile_.c:$(OBJDIR)/winfile.h \
 	$(OBJDIR)/winhttp_.c:$(OBJDIR)/winhttp.h \
+	$(OBJDIR)/workpool_.c:$(OBJDIR)/workpool.h \
 	$(OBJDIR)/xfer_.c:$(OBJDIR)/xfer.h \
 	$(OBJDIR)/xfersetup_.c:$(OBJDIR)/xfersetup.h \
 	$(OBJDIR)/zip_.c:$(OBJDIR)/zip.h \
@@ -2057,6 +2061,14 @@ $(OBJDIR)/winhttp.o:	$(OBJDIR)/winhttp_.c $(OBJDIR)/winhttp.h $(SRCDIR)/config.h
 
 $(OBJDIR)/winhttp.h:	$(OBJDIR)/headers
 
+$(OBJDIR)/workpool_.c:	$(SRCDIR)/workpool.c $(OBJDIR)/translate
+	$(OBJDIR)/translate $(SRCDIR)/workpool.c >$@
+
+$(OBJDIR)/workpool.o:	$(OBJDIR)/workpool_.c $(OBJDIR)/workpool.h $(SRCDIR)/config.h
+	$(XTCC) -o $(OBJDIR)/workpool.o -c $(OBJDIR)/workpool_.c
+
+$(OBJDIR)/workpool.h:	$(OBJDIR)/headers
+
 $(OBJDIR)/xfer_.c:	$(SRCDIR)/xfer.c $(OBJDIR)/translate
 	$(OBJDIR)/translate $(SRCDIR)/xfer.c >$@
 
@@ -169,6 +169,7 @@ set src {
   wikiformat
   winfile
   winhttp
+  workpool
   xfer
   xfersetup
   zip
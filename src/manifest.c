@@ -91,6 +91,7 @@ struct Manifest {
   int nFile;            /* Number of F cards */
   int nFileAlloc;       /* Slots allocated in aFile[] */
   int iFile;            /* Index of current file in iterator */
+  int iBaseFile;        /* Index of current baseline file in iterator */
   ManifestFile *aFile;  /* One entry for each F-card */
   int nParent;          /* Number of parents. */
   int nParentAlloc;     /* Slots allocated in azParent[] */
@@ -116,6 +117,15 @@ struct Manifest {
     char *zName;           /* Key or field name */
     char *zValue;          /* Value of the field */
   } *aField;            /* One for each J card */
+  ManifestIndex *pIndex;  /* Binary file index.  See manifest_index_for() */
+  /* Bookkeeping for the manifest cache.  See manifest_cache_find() */
+  int nRef;             /* Number of references to this object */
+  u8 bCached;           /* True if one reference is held by the cache */
+  u8 bInUse;            /* True if one reference is held by a caller */
+  i64 szCache;          /* Memory charged to the cache for this object */
+  Manifest *pHashNext;  /* Next cached manifest on the same hash chain */
+  Manifest *pNewer;     /* Next more recently used cached manifest */
+  Manifest *pOlder;     /* Next less recently used cached manifest */
 };
 #endif
 
@@ -154,14 +164,34 @@ static const char *const azNameOfMType[] = {
 };
 
 /*
-** A cache of parsed manifests.  This reduces the number of
-** calls to manifest_parse() when doing a rebuild.
+** Default limit on the memory used by the manifest cache
+*/
+#ifndef MANIFEST_CACHE_MX_BYTES
+# define MANIFEST_CACHE_MX_BYTES 20000000
+#endif
+
+/*
+** A cache of parsed manifests, indexed by rid through a hash table and
+** kept on a doubly-linked list from most to least recently used.  This
+** reduces the number of calls to manifest_parse() when doing a rebuild,
+** or when a web page or command looks at the same check-ins repeatedly.
+** The memory used by the cached manifests is bounded by szMax bytes.
 */
-#define MX_MANIFEST_CACHE 6
 static struct {
-  int nxAge;
-  int aAge[MX_MANIFEST_CACHE];
-  Manifest *apManifest[MX_MANIFEST_CACHE];
+  i64 szTotal;          /* Memory charged for all cached manifests */
+  i64 szMax;            /* Maximum value for szTotal.  0 means default */
+  int n;                /* Number of cached manifests */
+  int nHash;            /* Number of slots in apHash[] */
+  Manifest **apHash;    /* Hash table of cached manifests, keyed by rid */
+  Manifest *pNewest;    /* Most recently used */
+  Manifest *pOldest;    /* Least recently used.  Evicted first */
+  char *zRepo;          /* Repository that the manifests came from */
+
+  /* Statistics, used by test-parse-all-blobs */
+  int nHit;             /* Lookups satisfied from the cache */
+  int nMiss;            /* Lookups that missed */
+  int nShare;           /* Cached baselines reused by a delta-manifest */
+  int nEvict;           /* Manifests evicted to make room */
 } manifestCache;
 
 /*
@@ -171,20 +201,33 @@ static struct {
 static int manifest_crosslink_busy = 0;
 
 /*
-** Clear the memory allocated in a manifest object
+** Drop one reference to a manifest object and free it if that was the
+** last reference.
+*/
+static void manifest_release(Manifest *p){
+  if( --p->nRef>0 ) return;
+  blob_reset(&p->content);
+  fossil_free(p->aFile);
+  fossil_free(p->azParent);
+  fossil_free(p->azCChild);
+  fossil_free(p->aTag);
+  fossil_free(p->aField);
+  fossil_free(p->aCherrypick);
+  manifest_index_free(p->pIndex);
+  if( p->pBaseline ) manifest_release(p->pBaseline);
+  memset(p, 0, sizeof(*p));
+  fossil_free(p);
+}
+
+/*
+** The caller is finished with manifest p.  Free it, unless the manifest
+** cache or a delta manifest still refers to it.
 */
 void manifest_destroy(Manifest *p){
   if( p ){
-    blob_reset(&p->content);
-    fossil_free(p->aFile);
-    fossil_free(p->azParent);
-    fossil_free(p->azCChild);
-    fossil_free(p->aTag);
-    fossil_free(p->aField);
-    fossil_free(p->aCherrypick);
-    if( p->pBaseline ) manifest_destroy(p->pBaseline);
-    memset(p, 0, sizeof(*p));
-    fossil_free(p);
+    assert( p->bInUse );
+    p->bInUse = 0;
+    manifest_release(p);
   }
 }
 
@@ -214,62 +257,186 @@ static char maskToType(unsigned int x){
 }
 
 /*
-** Add an element to the manifest cache using LRU replacement.
+** The hash function for the manifest cache
 */
-void manifest_cache_insert(Manifest *p){
-  while( p ){
-    int i;
-    Manifest *pBaseline = p->pBaseline;
-    p->pBaseline = 0;
-    for(i=0; i<MX_MANIFEST_CACHE; i++){
-      if( manifestCache.apManifest[i]==0 ) break;
-    }
-    if( i>=MX_MANIFEST_CACHE ){
-      int oldest = 0;
-      int oldestAge = manifestCache.aAge[0];
-      for(i=1; i<MX_MANIFEST_CACHE; i++){
-        if( manifestCache.aAge[i]<oldestAge ){
-          oldest = i;
-          oldestAge = manifestCache.aAge[i];
-        }
-      }
-      manifest_destroy(manifestCache.apManifest[oldest]);
-      i = oldest;
-    }
-    manifestCache.aAge[i] = ++manifestCache.nxAge;
-    manifestCache.apManifest[i] = p;
-    p = pBaseline;
+#define manifest_cache_hash(rid)  (((unsigned)(rid)*101)%manifestCache.nHash)
+
+/*
+** Return the cached manifest for rid, or NULL if there is none.
+*/
+static Manifest *manifest_cache_lookup(int rid){
+  Manifest *p;
+  if( manifestCache.zRepo
+   && fossil_strcmp(manifestCache.zRepo, g.zRepositoryName)!=0
+  ){
+    manifest_cache_clear();
+  }
+  if( manifestCache.nHash==0 ) return 0;
+  for(p=manifestCache.apHash[manifest_cache_hash(rid)]; p; p=p->pHashNext){
+    if( p->rid==rid ) return p;
   }
+  return 0;
 }
 
 /*
-** Try to extract a line from the manifest cache. Return 1 if found.
-** Return 0 if not found.
+** Unlink cached manifest p from the LRU list.
 */
-static Manifest *manifest_cache_find(int rid){
-  int i;
+static void manifest_cache_unlink(Manifest *p){
+  if( p->pNewer ){
+    p->pNewer->pOlder = p->pOlder;
+  }else{
+    manifestCache.pNewest = p->pOlder;
+  }
+  if( p->pOlder ){
+    p->pOlder->pNewer = p->pNewer;
+  }else{
+    manifestCache.pOldest = p->pNewer;
+  }
+  p->pNewer = p->pOlder = 0;
+}
+
+/*
+** Make cached manifest p the most recently used.  p must not currently
+** be on the LRU list.
+*/
+static void manifest_cache_link_newest(Manifest *p){
+  p->pOlder = manifestCache.pNewest;
+  p->pNewer = 0;
+  if( manifestCache.pNewest ){
+    manifestCache.pNewest->pNewer = p;
+  }else{
+    manifestCache.pOldest = p;
+  }
+  manifestCache.pNewest = p;
+}
+
+/*
+** Resize the hash table of the manifest cache to nNew slots.
+*/
+static void manifest_cache_rehash(int nNew){
   Manifest *p;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] && manifestCache.apManifest[i]->rid==rid ){
-      p = manifestCache.apManifest[i];
-      manifestCache.apManifest[i] = 0;
-      return p;
-    }
+  fossil_free(manifestCache.apHash);
+  manifestCache.apHash = fossil_malloc( sizeof(Manifest*)*nNew );
+  memset(manifestCache.apHash, 0, sizeof(Manifest*)*nNew);
+  manifestCache.nHash = nNew;
+  for(p=manifestCache.pNewest; p; p=p->pOlder){
+    unsigned h = manifest_cache_hash(p->rid);
+    p->pHashNext = manifestCache.apHash[h];
+    manifestCache.apHash[h] = p;
   }
-  return 0;
 }
 
 /*
-** Clear the manifest cache.
+** Remove the least recently used manifest from the cache.  The manifest
+** itself survives for as long as something else refers to it.
 */
-void manifest_cache_clear(void){
-  int i;
-  for(i=0; i<MX_MANIFEST_CACHE; i++){
-    if( manifestCache.apManifest[i] ){
-      manifest_destroy(manifestCache.apManifest[i]);
-    }
+static void manifest_cache_expire_oldest(void){
+  Manifest *p = manifestCache.pOldest;
+  Manifest **pp;
+  if( p==0 ) return;
+  for(pp=&manifestCache.apHash[manifest_cache_hash(p->rid)]; *pp!=p;
+      pp=&(*pp)->pHashNext){}
+  *pp = p->pHashNext;
+  p->pHashNext = 0;
+  manifest_cache_unlink(p);
+  manifestCache.szTotal -= p->szCache;
+  manifestCache.n--;
+  p->bCached = 0;
+  manifest_release(p);
+}
+
+/*
+** Set the maximum amount of memory used by the manifest cache.  Zero
+** selects the built-in default.
+*/
+void manifest_cache_set_limit(i64 szMax){
+  manifestCache.szMax = szMax;
+}
+
+/*
+** Add manifest p to the cache, unless the cache already holds a
+** manifest for the same artifact.  The cache takes a reference of its
+** own, so the caller still holds the reference it had.
+*/
+static void manifest_cache_add(Manifest *p){
+  i64 szMax = manifestCache.szMax>0 ? manifestCache.szMax
+                                     : MANIFEST_CACHE_MX_BYTES;
+  unsigned h;
+  if( p->bCached || p->rid<=0 || manifest_cache_lookup(p->rid)!=0 ) return;
+  p->szCache = sizeof(*p) + blob_size(&p->content)
+             + p->nFileAlloc*sizeof(p->aFile[0]);
+  if( p->szCache>szMax/4 ) return;
+  while( manifestCache.n>0 && manifestCache.szTotal+p->szCache>szMax ){
+    manifest_cache_expire_oldest();
+    manifestCache.nEvict++;
+  }
+  if( manifestCache.n>=manifestCache.nHash ){
+    manifest_cache_rehash(manifestCache.nHash*2 + 61);
+  }
+  if( manifestCache.zRepo==0 && g.zRepositoryName ){
+    manifestCache.zRepo = fossil_strdup(g.zRepositoryName);
+  }
+  h = manifest_cache_hash(p->rid);
+  p->pHashNext = manifestCache.apHash[h];
+  manifestCache.apHash[h] = p;
+  manifest_cache_link_newest(p);
+  manifestCache.szTotal += p->szCache;
+  manifestCache.n++;
+  p->bCached = 1;
+  p->nRef++;
+}
+
+/*
+** The caller is finished with manifest p, which was returned by
+** manifest_cache_find(), manifest_get() or manifest_parse().  Keep it
+** in the manifest cache for reuse.
+*/
+void manifest_cache_insert(Manifest *p){
+  if( p ){
+    manifest_cache_add(p);
+    manifest_destroy(p);
   }
-  memset(&manifestCache, 0, sizeof(manifestCache));
+}
+
+/*
+** Return the cached manifest for rid, or NULL if it is not cached.
+** The caller must hand the manifest back with manifest_destroy() or
+** manifest_cache_insert().
+**
+** A manifest has a little mutable state, namely the positions of the
+** manifest_file_next() iterator and the manifest_file_seek() hint, so
+** only one caller at a time may use it.  Other callers get NULL and
+** must parse a private copy.  Delta manifests that use a cached
+** manifest as their baseline do not touch its mutable state, so any
+** number of them may share it.  See fetch_baseline().
+*/
+Manifest *manifest_cache_find(int rid){
+  Manifest *p = manifest_cache_lookup(rid);
+  if( p==0 || p->bInUse ){
+    manifestCache.nMiss++;
+    return 0;
+  }
+  manifestCache.nHit++;
+  manifest_cache_unlink(p);
+  manifest_cache_link_newest(p);
+  p->bInUse = 1;
+  p->nRef++;
+  return p;
+}
+
+/*
+** Clear the manifest cache.  Manifests that are still in use survive
+** until they are destroyed.
+*/
+void manifest_cache_clear(void){
+  while( manifestCache.pOldest ){
+    manifest_cache_expire_oldest();
+  }
+  fossil_free(manifestCache.apHash);
+  manifestCache.apHash = 0;
+  manifestCache.nHash = 0;
+  fossil_free(manifestCache.zRepo);
+  manifestCache.zRepo = 0;
 }
 
 #ifdef FOSSIL_DONT_VERIFY_MANIFEST_MD5SUM
@@ -503,6 +670,8 @@ Manifest *manifest_parse(Blob *pContent, int rid, Blob *pErr){
   memset(p, 0, sizeof(*p));
   memcpy(&p->content, pContent, sizeof(p->content));
   p->rid = rid;
+  p->nRef = 1;
+  p->bInUse = 1;
   blob_zero(pContent);
   pContent = &p->content;
 
@@ -1122,6 +1291,7 @@ Manifest *manifest_get(int rid, int cfType, Blob *pErr){
     manifest_destroy(p);
     p = 0;
   }
+  if( p ) manifest_cache_add(p);
   return p;
 }
 
@@ -1245,6 +1415,10 @@ void manifest_test_parse_cmd(void){
 **
 ** Options:
 **
+**   --cache-size BYTES   Limit the manifest cache to BYTES bytes
+**   --files              Also walk the complete file list of every
+**                        check-in, which exercises the sharing of
+**                        baseline manifests between delta-manifests
 **   --limit N            Parse no more than N artifacts before stopping.
 **   --wellformed         Use all BLOB table entries as input, not just
 **                        those entries that are believed to be valid
@@ -1260,11 +1434,16 @@ void manifest_test_parse_all_blobs_cmd(void){
   int nErr = 0;
   int N = 1000000000;
   int bWellFormed;
+  int bFiles;
+  int nFile = 0;
   const char *z;
   db_find_and_open_repository(0, 0);
   z = find_option("limit", 0, 1);
   if( z ) N = atoi(z);
+  z = find_option("cache-size", 0, 1);
+  if( z ) manifest_cache_set_limit(strtoll(z, 0, 10));
   bWellFormed = find_option("wellformed",0,0)!=0;
+  bFiles = find_option("files",0,0)!=0;
   verify_all_options();
   if( bWellFormed ){
     db_prepare(&q, "SELECT rid FROM blob ORDER BY rid");
@@ -1298,6 +1477,9 @@ void manifest_test_parse_all_blobs_cmd(void){
       if( p==0 ){
         fossil_print("%d ERROR: %s\n", id, blob_str(&err));
         nErr++;
+      }else if( bFiles && p->type==CFTYPE_MANIFEST ){
+        manifest_file_rewind(p);
+        while( manifest_file_next(p, 0) ) nFile++;
       }
     }
     blob_reset(&err);
@@ -1305,6 +1487,45 @@ void manifest_test_parse_all_blobs_cmd(void){
   }
   db_finalize(&q);
   fossil_print("%d tests with %d errors\n", nTest, nErr);
+  if( bFiles ) fossil_print("%d files in all check-ins\n", nFile);
+  fossil_print("manifest cache: %d hits, %d misses, %d baselines shared, "
+               "%d evictions, %d entries using %lld bytes\n",
+               manifestCache.nHit, manifestCache.nMiss, manifestCache.nShare,
+               manifestCache.nEvict, manifestCache.n, manifestCache.szTotal);
+}
+
+/*
+** Return the baseline manifest rid for use by a delta-manifest, or NULL
+** if rid is not a baseline manifest.  The result is shared with the
+** manifest cache and with every other delta-manifest that uses the
+** same baseline, so it must be treated as read-only.  It is released
+** when the delta-manifest is destroyed.
+*/
+static Manifest *manifest_get_baseline(int rid){
+  Manifest *p;
+  Blob content;
+  if( rid==0 ) return 0;
+  p = manifest_cache_lookup(rid);
+  if( p ){
+    if( p->type!=CFTYPE_MANIFEST ) return 0;
+    manifestCache.nHit++;
+    manifestCache.nShare++;
+    manifest_cache_unlink(p);
+    manifest_cache_link_newest(p);
+    p->nRef++;
+    return p;
+  }
+  manifestCache.nMiss++;
+  content_get(rid, &content);
+  p = manifest_parse(&content, rid, 0);
+  if( p==0 ) return 0;
+  if( p->type!=CFTYPE_MANIFEST ){
+    manifest_destroy(p);
+    return 0;
+  }
+  manifest_cache_add(p);
+  p->bInUse = 0;
+  return p;
 }
 
 /*
@@ -1317,7 +1538,8 @@ void manifest_test_parse_all_blobs_cmd(void){
 static int fetch_baseline(Manifest *p, int throwError){
   if( p->zBaseline!=0 && p->pBaseline==0 ){
     int rid = uuid_to_rid(p->zBaseline, 1);
-    p->pBaseline = manifest_get(rid, CFTYPE_MANIFEST, 0);
+    p->pBaseline = manifest_get_baseline(rid);
+    p->iBaseFile = 0;
     if( p->pBaseline==0 ){
       if( !throwError ){
         db_multi_exec(
@@ -1337,10 +1559,8 @@ static int fetch_baseline(Manifest *p, int throwError){
 */
 void manifest_file_rewind(Manifest *p){
   p->iFile = 0;
+  p->iBaseFile = 0;
   fetch_baseline(p, 1);
-  if( p->pBaseline ){
-    p->pBaseline->iFile = 0;
-  }
 }
 
 /*
@@ -1361,12 +1581,15 @@ ManifestFile *manifest_file_next(
     if( p->iFile<p->nFile ) pOut = &p->aFile[p->iFile++];
   }else{
     /* Manifest p is a delta-manifest.  Scan the baseline but amend the
-    ** file list in the baseline with changes described by p.
+    ** file list in the baseline with changes described by p.  The
+    ** position within the baseline is kept in p->iBaseFile, not in the
+    ** baseline itself, since the baseline might be shared with other
+    ** delta-manifests.
     */
     Manifest *pB = p->pBaseline;
     int cmp;
     while(1){
-      if( pB->iFile>=pB->nFile ){
+      if( p->iBaseFile>=pB->nFile ){
         /* We have used all entries out of the baseline.  Return the next
         ** entry from the delta. */
         if( p->iFile<p->nFile ) pOut = &p->aFile[p->iFile++];
@@ -1374,13 +1597,13 @@ ManifestFile *manifest_file_next(
       }else if( p->iFile>=p->nFile ){
         /* We have used all entries from the delta.  Return the next
         ** entry from the baseline. */
-        if( pB->iFile<pB->nFile ) pOut = &pB->aFile[pB->iFile++];
+        if( p->iBaseFile<pB->nFile ) pOut = &pB->aFile[p->iBaseFile++];
         break;
-      }else if( (cmp = fossil_strcmp(pB->aFile[pB->iFile].zName,
+      }else if( (cmp = fossil_strcmp(pB->aFile[p->iBaseFile].zName,
                               p->aFile[p->iFile].zName)) < 0 ){
         /* The next baseline entry comes before the next delta entry.
         ** So return the baseline entry. */
-        pOut = &pB->aFile[pB->iFile++];
+        pOut = &pB->aFile[p->iBaseFile++];
         break;
       }else if( cmp>0 ){
         /* The next delta entry comes before the next baseline
@@ -1390,14 +1613,14 @@ ManifestFile *manifest_file_next(
       }else if( p->aFile[p->iFile].zUuid ){
         /* The next delta entry is a replacement for the next baseline
         ** entry.  Skip the baseline entry and return the delta entry */
-        pB->iFile++;
+        p->iBaseFile++;
         pOut = &p->aFile[p->iFile++];
         break;
       }else{
         /* The next delta entry is a delete of the next baseline
         ** entry.  Skip them both.  Repeat the loop to find the next
         ** non-delete entry. */
-        pB->iFile++;
+        p->iBaseFile++;
         p->iFile++;
         continue;
       }
@@ -1520,14 +1743,15 @@ static void add_one_mlink(
 /*
 ** Do a binary search to find a file in the p->aFile[] array.
 **
-** As an optimization, guess that the file we seek is at index p->iFile.
+** As an optimization, guess that the file we seek is at index *piHint.
 ** That will usually be the case.  If it is not found there, then do the
 ** actual binary search.
 **
-** Update p->iFile to be the index of the file that is found.
+** Update *piHint to be the index of the file that is found.
 */
 static ManifestFile *manifest_file_seek_base(
   Manifest *p,             /* Manifest to search */
+  int *piHint,             /* Where to start looking */
   const char *zName,       /* Name of the file we are looking for */
   int bBest                /* 0: exact match only.  1: closest match */
 ){
@@ -1539,14 +1763,14 @@ static ManifestFile *manifest_file_seek_base(
   }
   lwr = 0;
   upr = p->nFile - 1;
-  if( p->iFile>=lwr && p->iFile<upr ){
-    c = fossil_strcmp(p->aFile[p->iFile+1].zName, zName);
+  if( *piHint>=lwr && *piHint<upr ){
+    c = fossil_strcmp(p->aFile[*piHint+1].zName, zName);
     if( c==0 ){
-      return &p->aFile[++p->iFile];
+      return &p->aFile[++*piHint];
     }else if( c>0 ){
-      upr = p->iFile;
+      upr = *piHint;
     }else{
-      lwr = p->iFile+1;
+      lwr = *piHint+1;
     }
   }
   while( lwr<=upr ){
@@ -1557,7 +1781,7 @@ static ManifestFile *manifest_file_seek_base(
     }else if( c>0 ){
       upr = i-1;
     }else{
-      p->iFile = i;
+      *piHint = i;
       return &p->aFile[i];
     }
   }
@@ -1582,11 +1806,12 @@ static ManifestFile *manifest_file_seek_base(
 ManifestFile *manifest_file_seek(Manifest *p, const char *zName, int bBest){
   ManifestFile *pFile;
 
-  pFile = manifest_file_seek_base(p, zName, p->zBaseline ? 0 : bBest);
+  pFile = manifest_file_seek_base(p, &p->iFile, zName,
+                                  p->zBaseline ? 0 : bBest);
   if( pFile && pFile->zUuid==0 ) return 0;
   if( pFile==0 && p->zBaseline ){
     fetch_baseline(p, 1);
-    pFile = manifest_file_seek_base(p->pBaseline, zName,bBest);
+    pFile = manifest_file_seek_base(p->pBaseline, &p->iBaseFile, zName,bBest);
   }
   return pFile;
 }
@@ -1602,6 +1827,11 @@ ManifestFile *manifest_file_find(Manifest *p, const char *zName){
   if( filenames_are_case_sensitive() ){
     return manifest_file_seek(p, zName, 0);
   }
+  if( manifest_index_for(p) ){
+    i = manifest_index_search(p->pIndex, zName, 1);
+    if( i<0 ) return 0;
+    return manifest_file_seek(p, manifest_index_name(p->pIndex, i), 0);
+  }
   for(i=0; i<p->nFile; i++){
     if( fossil_stricmp(zName, p->aFile[i].zName)==0 ){
       return &p->aFile[i];
@@ -1619,6 +1849,373 @@ ManifestFile *manifest_file_find(Manifest *p, const char *zName){
   return 0;
 }
 
+/*
+** A binary file index for a check-in.
+**
+** Parsing the manifest of a check-in with a very large number of files
+** means reading and checksumming all of its F-cards, and those of its
+** baseline, even when only one file is wanted.  For check-ins with at
+** least manifest-index files, a compact binary index of the complete
+** file list is kept in the "mindex" table of the cache file (see the
+** "fossil cache init" command), keyed by the hash of the check-in.  It
+** is derived data and is built the first time it is needed.
+**
+** The index is position-independent so that it can be used directly
+** from the buffer that holds it.  All integers are 32-bit big-endian.
+**
+**     "FMX1"                     Magic number
+**     N                          Number of files
+**     N x (name, uuid, perm, prior)
+**                                Offsets into the string pool of each
+**                                file, in the order of manifest_file_next().
+**                                Offset 0 means NULL.
+**     N x index                  Files sorted by fossil_stricmp() order
+**     string pool                Zero-terminated strings.  The first
+**                                byte is a zero.
+*/
+#if INTERFACE
+struct ManifestIndex {
+  Blob data;                /* The encoded index */
+  int nFile;                /* Number of files */
+  const unsigned char *aEntry;  /* Four offsets for each file */
+  const unsigned char *aFold;   /* Case-insensitive sort order */
+  const char *zPool;        /* The string pool */
+};
+#endif
+
+/* Size of the header and of a single file entry in the index */
+#define MINDEX_HDR     8
+#define MINDEX_ENTRY   16
+
+/* Fewest bytes in an F-card: "F", a one-byte name and a SHA1 hash */
+#define MINDEX_FCARD_MIN  (5+HNAME_LEN_SHA1)
+
+static unsigned int mindex_get32(const unsigned char *a){
+  return ((unsigned)a[0]<<24) | (a[1]<<16) | (a[2]<<8) | a[3];
+}
+static void mindex_put32(Blob *pOut, unsigned int v){
+  char a[4];
+  a[0] = (v>>24) & 0xff;
+  a[1] = (v>>16) & 0xff;
+  a[2] = (v>>8) & 0xff;
+  a[3] = v & 0xff;
+  blob_append(pOut, a, 4);
+}
+
+/*
+** A file and its position in the file list, for sorting
+*/
+struct mindex_sort {
+  const char *zName;        /* Name of the file */
+  int i;                    /* Position in the file list */
+};
+
+/*
+** Comparison function used to sort files into case-insensitive order
+*/
+static int mindex_fold_cmp(const void *pA, const void *pB){
+  const struct mindex_sort *a = (const struct mindex_sort*)pA;
+  const struct mindex_sort *b = (const struct mindex_sort*)pB;
+  int c = fossil_stricmp(a->zName, b->zName);
+  return c ? c : a->i - b->i;
+}
+
+/*
+** Store the four strings of file pFile that go into the index in az[].
+*/
+static void mindex_strings(const ManifestFile *pFile, const char **az){
+  az[0] = pFile->zName;
+  az[1] = pFile->zUuid;
+  az[2] = pFile->zPerm && pFile->zPerm[0] ? pFile->zPerm : 0;
+  az[3] = pFile->zPrior;
+}
+
+/*
+** Encode the complete file list of check-in p as a binary index and
+** write it into pOut.
+*/
+static void manifest_index_encode(Manifest *p, Blob *pOut){
+  ManifestFile *pFile;
+  ManifestFile **apFile = 0;
+  struct mindex_sort *aFold;
+  const char *az[4];
+  int i, j, n = 0, nAlloc = 0;
+  int iFile = p->iFile, iBaseFile = p->iBaseFile;
+  unsigned int iPool = 1;
+
+  manifest_file_rewind(p);
+  while( (pFile = manifest_file_next(p, 0))!=0 ){
+    if( n>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      apFile = fossil_realloc(apFile, sizeof(apFile[0])*nAlloc);
+    }
+    apFile[n++] = pFile;
+  }
+  p->iFile = iFile;
+  p->iBaseFile = iBaseFile;
+  blob_zero(pOut);
+  blob_append(pOut, "FMX1", 4);
+  mindex_put32(pOut, n);
+  for(i=0; i<n; i++){
+    mindex_strings(apFile[i], az);
+    for(j=0; j<4; j++){
+      mindex_put32(pOut, az[j] ? iPool : 0);
+      if( az[j] ) iPool += strlen(az[j]) + 1;
+    }
+  }
+  aFold = fossil_malloc( sizeof(aFold[0])*(n+1) );
+  for(i=0; i<n; i++){
+    aFold[i].zName = apFile[i]->zName;
+    aFold[i].i = i;
+  }
+  qsort(aFold, n, sizeof(aFold[0]), mindex_fold_cmp);
+  for(i=0; i<n; i++) mindex_put32(pOut, aFold[i].i);
+  fossil_free(aFold);
+  blob_append(pOut, "", 1);
+  for(i=0; i<n; i++){
+    mindex_strings(apFile[i], az);
+    for(j=0; j<4; j++){
+      if( az[j] ) blob_append(pOut, az[j], (int)strlen(az[j])+1);
+    }
+  }
+  fossil_free(apFile);
+}
+
+/*
+** Take ownership of the encoded index in pData and return a
+** ManifestIndex object for it.  Return NULL, and free pData, if it is
+** not a well-formed index.
+*/
+static ManifestIndex *manifest_index_open(Blob *pData){
+  const unsigned char *a = (const unsigned char*)blob_buffer(pData);
+  unsigned int n, sz = blob_size(pData), szPool, i;
+  ManifestIndex *pIdx;
+  if( sz<MINDEX_HDR+1 || memcmp(a, "FMX1", 4)!=0 ) goto bad_index;
+  n = mindex_get32(a+4);
+  if( n>(sz-MINDEX_HDR-1)/(MINDEX_ENTRY+4) ) goto bad_index;
+  szPool = sz - MINDEX_HDR - n*(MINDEX_ENTRY+4);
+  if( a[sz-1]!=0 || a[sz-szPool]!=0 ) goto bad_index;
+  for(i=0; i<n*4; i++){
+    if( mindex_get32(a+MINDEX_HDR+i*4)>=szPool ) goto bad_index;
+  }
+  for(i=0; i<n; i++){
+    unsigned int k = MINDEX_HDR + n*MINDEX_ENTRY + i*4;
+    if( mindex_get32(a+k)>=n ) goto bad_index;
+  }
+  pIdx = fossil_malloc( sizeof(*pIdx) );
+  pIdx->data = *pData;
+  blob_zero(pData);
+  pIdx->nFile = (int)n;
+  pIdx->aEntry = a + MINDEX_HDR;
+  pIdx->aFold = a + MINDEX_HDR + n*MINDEX_ENTRY;
+  pIdx->zPool = (const char*)a + sz - szPool;
+  return pIdx;
+
+bad_index:
+  blob_reset(pData);
+  return 0;
+}
+
+/*
+** Free a ManifestIndex object
+*/
+void manifest_index_free(ManifestIndex *pIdx){
+  if( pIdx ){
+    blob_reset(&pIdx->data);
+    fossil_free(pIdx);
+  }
+}
+
+/*
+** Return the number of files in the index
+*/
+int manifest_index_count(ManifestIndex *pIdx){
+  return pIdx->nFile;
+}
+
+/*
+** Return the name of the i-th file in the index
+*/
+const char *manifest_index_name(ManifestIndex *pIdx, int i){
+  return pIdx->zPool + mindex_get32(pIdx->aEntry + i*MINDEX_ENTRY);
+}
+
+/*
+** Fill in *pOut with the i-th file of the index.  The strings remain
+** valid until the index is freed.
+*/
+void manifest_index_entry(ManifestIndex *pIdx, int i, ManifestFile *pOut){
+  char **az[4];
+  int j;
+  az[0] = &pOut->zName;
+  az[1] = &pOut->zUuid;
+  az[2] = &pOut->zPerm;
+  az[3] = &pOut->zPrior;
+  for(j=0; j<4; j++){
+    unsigned int iOfst = mindex_get32(pIdx->aEntry + i*MINDEX_ENTRY + j*4);
+    *az[j] = iOfst ? (char*)pIdx->zPool + iOfst : 0;
+  }
+}
+
+/*
+** Fill in *pOut with file *piFile of the index, advance *piFile, and
+** return pOut.  Return NULL if there are no more files.
+*/
+ManifestFile *manifest_index_next(
+  ManifestIndex *pIdx,
+  int *piFile,
+  ManifestFile *pOut
+){
+  if( *piFile>=pIdx->nFile ) return 0;
+  manifest_index_entry(pIdx, (*piFile)++, pOut);
+  return pOut;
+}
+
+/*
+** Return the position of file zName within the index, or -1 if it is
+** not there.  If bNoCase is true, the first file whose name matches
+** zName ignoring case is found.
+*/
+int manifest_index_search(ManifestIndex *pIdx, const char *zName, int bNoCase){
+  int lwr = 0, upr = pIdx->nFile-1, found = -1;
+  while( lwr<=upr ){
+    int mid = (lwr+upr)/2;
+    int i = bNoCase ? (int)mindex_get32(pIdx->aFold + mid*4) : mid;
+    int c = bNoCase ? fossil_stricmp(manifest_index_name(pIdx, i), zName)
+                    : fossil_strcmp(manifest_index_name(pIdx, i), zName);
+    if( c<0 ){
+      lwr = mid+1;
+    }else if( c>0 ){
+      upr = mid-1;
+    }else if( bNoCase ){
+      found = i;
+      upr = mid-1;
+    }else{
+      return i;
+    }
+  }
+  return found;
+}
+
+/*
+** Return the index for check-in rid from the cache file, or NULL if
+** there is none.
+*/
+static ManifestIndex *manifest_index_load(int rid){
+  ManifestIndex *pIdx = 0;
+  char *zUuid;
+  Blob data;
+  zUuid = rid_to_uuid(rid);
+  if( zUuid==0 ) return 0;
+  blob_zero(&data);
+  if( cache_mindex_read(zUuid, &data) ){
+    pIdx = manifest_index_open(&data);
+  }
+  blob_reset(&data);
+  fossil_free(zUuid);
+  return pIdx;
+}
+
+/*
+** Return the index for check-in rid, or NULL if it is not in the cache
+** file.  The caller must free the index.
+**
+** The cache file is only consulted if the manifest of the check-in is
+** large enough to hold manifest-index F-cards, judging by its size in
+** the BLOB table, so that smaller check-ins do not pay for opening it.
+** A delta-manifest is small even if its baseline is large.  Its index
+** is found by manifest_index_for() once the manifest has been parsed.
+*/
+ManifestIndex *manifest_index_get(int rid){
+  int nMin = db_get_int("manifest-index", 10000);
+  i64 sz;
+  if( nMin<=0 ) return 0;
+  sz = db_int64(0, "SELECT size FROM blob WHERE rid=%d", rid);
+  if( sz<(i64)nMin*MINDEX_FCARD_MIN ) return 0;
+  return manifest_index_load(rid);
+}
+
+/*
+** Attach an index to check-in p, if it is large enough to deserve one.
+** Return true if p has an index.  The index is read from the cache file
+** if it is there.  Otherwise it is built, and also saved in the cache
+** file if there is one.
+*/
+int manifest_index_for(Manifest *p){
+  int nMin;
+  if( p->pIndex ) return 1;
+  if( p->type!=CFTYPE_MANIFEST ) return 0;
+  nMin = db_get_int("manifest-index", 10000);
+  if( nMin<=0 ) return 0;
+  fetch_baseline(p, 1);
+  if( p->nFile + (p->pBaseline ? p->pBaseline->nFile : 0) < nMin ) return 0;
+  p->pIndex = manifest_index_load(p->rid);
+  if( p->pIndex==0 ){
+    Blob data;
+    char *zUuid = rid_to_uuid(p->rid);
+    manifest_index_encode(p, &data);
+    if( zUuid ) cache_mindex_write(zUuid, &data);
+    fossil_free(zUuid);
+    p->pIndex = manifest_index_open(&data);
+  }
+  return p->pIndex!=0;
+}
+
+/*
+** COMMAND: test-manifest-index
+**
+** Usage: %fossil test-manifest-index CHECKIN ?FILENAME ...?
+**
+** Build the binary file index for CHECKIN, ignoring the manifest-index
+** setting, and check that it agrees with the manifest.  Then look up
+** each FILENAME in the index, ignoring case, and show what is found.
+*/
+void test_manifest_index_cmd(void){
+  Manifest *p;
+  ManifestFile *pFile;
+  ManifestIndex *pIdx;
+  ManifestFile x;
+  Blob data;
+  int rid, i, nErr = 0;
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( g.argc<3 ) usage("CHECKIN ?FILENAME ...?");
+  p = manifest_get_by_name(g.argv[2], &rid);
+  if( p==0 ) fossil_fatal("not a check-in: %s", g.argv[2]);
+  manifest_index_encode(p, &data);
+  fossil_print("%d bytes for %d bytes of manifest\n",
+               blob_size(&data), blob_size(&p->content));
+  pIdx = manifest_index_open(&data);
+  if( pIdx==0 ) fossil_fatal("malformed index");
+  manifest_file_rewind(p);
+  for(i=0; (pFile = manifest_file_next(p, 0))!=0; i++){
+    if( i>=pIdx->nFile ){ nErr++; break; }
+    manifest_index_entry(pIdx, i, &x);
+    if( fossil_strcmp(x.zName, pFile->zName)
+     || fossil_strcmp(x.zUuid, pFile->zUuid)
+     || fossil_strcmp(x.zPrior, pFile->zPrior)
+     || manifest_file_mperm(&x)!=manifest_file_mperm(pFile)
+     || manifest_index_search(pIdx, pFile->zName, 0)!=i
+    ){
+      fossil_print("mismatch at %d: %s\n", i, pFile->zName);
+      nErr++;
+    }
+  }
+  if( i!=pIdx->nFile ) nErr++;
+  fossil_print("%d files, %d errors\n", pIdx->nFile, nErr);
+  for(i=3; i<g.argc; i++){
+    int k = manifest_index_search(pIdx, g.argv[i], 1);
+    if( k<0 ){
+      fossil_print("%s: not found\n", g.argv[i]);
+    }else{
+      manifest_index_entry(pIdx, k, &x);
+      fossil_print("%s: %s %s\n", g.argv[i], x.zName, x.zUuid);
+    }
+  }
+  manifest_index_free(pIdx);
+  manifest_destroy(p);
+}
+
 /*
 ** Add mlink table entries associated with manifest cid, pChild.  The
 ** parent manifest is pid, pParent.  One of either pChild or pParent
@@ -1763,7 +2360,8 @@ static void add_mlink(
     ** in the child. */
     for(i=0, pParentFile=pParent->aFile; i<pParent->nFile; i++, pParentFile++){
       if( pParentFile->zUuid ){
-        pChildFile = manifest_file_seek_base(pChild, pParentFile->zName, 0);
+        pChildFile = manifest_file_seek_base(pChild, &pChild->iFile,
+                                             pParentFile->zName, 0);
         if( pChildFile==0 ){
           /* The child file reverts to baseline.  Show this as a change */
           pChildFile = manifest_file_seek(pChild, pParentFile->zName, 0);
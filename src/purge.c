@@ -177,6 +177,13 @@ int purge_artifact_list(
 
   /* Remove the artifacts being purged.  Also remove all references to those
   ** artifacts from the secondary tables. */
+  if( cache_artifact_enabled() ){
+    db_prepare(&q, "SELECT rid FROM \"%w\"", zTab);
+    while( db_step(&q)==SQLITE_ROW ){
+      content_forget_materialized(db_column_int(&q, 0));
+    }
+    db_finalize(&q);
+  }
   db_multi_exec("DELETE FROM blob WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM delta WHERE rid IN \"%w\"", zTab);
   db_multi_exec("DELETE FROM delta WHERE srcid IN \"%w\"", zTab);
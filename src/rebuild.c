@@ -192,6 +192,7 @@ static int cchFNamePrefix;  /* Length of directory prefix in zFNameFormat */
 static const char *zDestDir;/* Destination directory on deconstruct */
 static int prefixLength;    /* Length of directory prefix for deconstruct */
 static int fKeepRid1;       /* Flag to preserve RID=1 on de- and reconstruct */
+static int nJob = 1;        /* Number of helper threads for rebuild_db() */
 
 
 /*
@@ -229,6 +230,50 @@ static void rebuild_step_done(int rid){
   }
 }
 
+/*
+** Process a single artifact rid whose complete content is in
+** pContent.  For "fossil rebuild", rebuild the cross-referencing
+** information for rid.  If the zFNameFormat variable is set, then
+** we are running "fossil deconstruct" and so the content is written
+** out to the appropriate file instead.
+**
+** This routine clears the content buffer before returning.
+*/
+static void rebuild_one(int rid, int size, Blob *pContent){
+  /* Fix up the "blob.size" field if needed. */
+  if( size!=blob_size(pContent) ){
+    db_multi_exec(
+       "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pContent), rid
+    );
+  }
+  if( zFNameFormat==0 ){
+    /* We are doing "fossil rebuild" */
+    manifest_crosslink(rid, pContent, MC_NONE);
+  }else{
+    /* We are doing "fossil deconstruct" */
+    char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+    char *zFile = mprintf(zFNameFormat /*works-like:"%s:%s"*/,
+                          zUuid, zUuid+prefixLength);
+    blob_write_to_file(pContent,zFile);
+    if( rid==1 && fKeepRid1!=0 ){
+      char *zFnDotRid1 = mprintf("%s/.rid1", zDestDir);
+      char *zFnRid1 = zFile + cchFNamePrefix + 1; /* Skip directory slash */
+      Blob bFileContents = empty_blob;
+      blob_appendf(&bFileContents,
+        "# The file holding the artifact with RID=1\n"
+        "%s\n", zFnRid1);
+      blob_write_to_file(&bFileContents, zFnDotRid1);
+      blob_reset(&bFileContents);
+      free(zFnDotRid1);
+    }
+    free(zFile);
+    free(zUuid);
+    blob_reset(pContent);
+  }
+  assert( blob_is_reset(pContent) );
+  rebuild_step_done(rid);
+}
+
 /*
 ** Rebuild cross-referencing information for the artifact
 ** rid with content pBase and all of its descendants.  This
@@ -254,13 +299,6 @@ static void rebuild_step(int rid, int size, Blob *pBase){
 
   while( rid>0 ){
 
-    /* Fix up the "blob.size" field if needed. */
-    if( size!=blob_size(pBase) ){
-      db_multi_exec(
-         "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pBase), rid
-      );
-    }
-
     /* Find all children of artifact rid */
     db_static_prepare(&q1, "SELECT rid FROM delta WHERE srcid=:rid");
     db_bind_int(&q1, ":rid", rid);
@@ -281,32 +319,7 @@ static void rebuild_step(int rid, int size, Blob *pBase){
       blob_copy(&copy, pBase);
       pUse = &copy;
     }
-    if( zFNameFormat==0 ){
-      /* We are doing "fossil rebuild" */
-      manifest_crosslink(rid, pUse, MC_NONE);
-    }else{
-      /* We are doing "fossil deconstruct" */
-      char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
-      char *zFile = mprintf(zFNameFormat /*works-like:"%s:%s"*/,
-                            zUuid, zUuid+prefixLength);
-      blob_write_to_file(pUse,zFile);
-      if( rid==1 && fKeepRid1!=0 ){
-        char *zFnDotRid1 = mprintf("%s/.rid1", zDestDir);
-        char *zFnRid1 = zFile + cchFNamePrefix + 1; /* Skip directory slash */
-        Blob bFileContents = empty_blob;
-        blob_appendf(&bFileContents,
-          "# The file holding the artifact with RID=1\n"
-          "%s\n", zFnRid1);
-        blob_write_to_file(&bFileContents, zFnDotRid1);
-        blob_reset(&bFileContents);
-        free(zFnDotRid1);
-      }
-      free(zFile);
-      free(zUuid);
-      blob_reset(pUse);
-    }
-    assert( blob_is_reset(pUse) );
-    rebuild_step_done(rid);
+    rebuild_one(rid, size, pUse);
 
     /* Call all children recursively */
     rid = 0;
@@ -340,6 +353,126 @@ static void rebuild_step(int rid, int size, Blob *pBase){
   }
 }
 
+/*
+** One fully expanded artifact, ready to be crosslinked
+*/
+typedef struct RebuildItem RebuildItem;
+struct RebuildItem {
+  int rid;                   /* Artifact id */
+  int size;                  /* Value of blob.size */
+  Blob content;              /* Expanded content */
+};
+
+/*
+** Queues shared between the main thread and rebuild helper threads
+*/
+typedef struct RebuildPool RebuildPool;
+struct RebuildPool {
+  WorkQueue *pTodo;          /* ContentTree objects waiting to be expanded */
+  WorkQueue *pDone;          /* RebuildItem objects waiting to be crosslinked */
+};
+
+/*
+** Callback from content_tree_expand().  Put an expanded artifact on
+** the pDone queue.
+*/
+static void rebuild_expanded(
+  void *pArg,
+  ContentTreeNode *pNode,
+  Blob *pContent
+){
+  RebuildPool *pPool = (RebuildPool*)pArg;
+  RebuildItem *pItem = fossil_malloc( sizeof(*pItem) );
+  pItem->rid = pNode->rid;
+  pItem->size = pNode->size;
+  if( pContent ){
+    pItem->content = *pContent;
+  }else{
+    blob_zero(&pItem->content);
+  }
+  workqueue_push(pPool->pDone, pItem, blob_size(&pItem->content));
+}
+
+/*
+** Body of a rebuild helper thread.  Take delta trees off of the
+** pTodo queue, expand every artifact in each tree, and put the
+** expanded artifacts on the pDone queue in preorder.
+**
+** This routine runs in a helper thread and so must not use the
+** database.
+*/
+static void rebuild_worker(void *pArg){
+  RebuildPool *pPool = (RebuildPool*)pArg;
+  ContentTree *p;
+  while( (p = workqueue_pop(pPool->pTodo))!=0 ){
+    content_tree_expand(p, rebuild_expanded, pPool);
+    content_tree_free(p);
+  }
+}
+
+/*
+** Crosslink an artifact that was expanded by a helper thread
+*/
+static void rebuild_finish_item(RebuildItem *pItem){
+  rebuild_one(pItem->rid, pItem->size, &pItem->content);
+  fossil_free(pItem);
+}
+
+/*
+** Rebuild every delta tree whose root is returned by pQuery, using
+** nWorker helper threads to decompress and apply deltas.  The main
+** thread reads the database and crosslinks artifacts, in the same order
+** as rebuild_step() within each tree.  Return the number of helper
+** threads actually started.  If that number is zero, nothing has been
+** done and the caller should fall back to rebuild_step().
+*/
+static int rebuild_trees_parallel(Stmt *pQuery, int nWorker){
+  RebuildPool pool;
+  FossilThread **apThread;
+  RebuildItem *pItem;
+  i64 nPending = 0;          /* Artifacts expanded but not yet crosslinked */
+  int nThread = 0;
+  int i;
+
+  pool.pTodo = workqueue_new(nWorker*2, 0);
+  pool.pDone = workqueue_new(nWorker*64, (i64)nWorker*32*1024*1024);
+  apThread = fossil_malloc( sizeof(apThread[0])*nWorker );
+  for(i=0; i<nWorker; i++){
+    apThread[nThread] = fossil_thread_start(rebuild_worker, &pool);
+    if( apThread[nThread] ) nThread++;
+  }
+  if( nThread>0 ){
+    while( db_step(pQuery)==SQLITE_ROW ){
+      int rid = db_column_int(pQuery, 0);
+      int size = db_column_int(pQuery, 1);
+      ContentTree *p;
+      if( size<0 ) continue;
+      p = content_tree_load(rid, &bagDone);
+      if( p==0 ) continue;
+      nPending += p->n;
+      while( !workqueue_try_push(pool.pTodo, p, 0) ){
+        rebuild_finish_item(workqueue_pop(pool.pDone));
+        nPending--;
+      }
+      while( (pItem = workqueue_try_pop(pool.pDone))!=0 ){
+        rebuild_finish_item(pItem);
+        nPending--;
+      }
+    }
+    workqueue_close(pool.pTodo);
+    while( nPending>0 ){
+      rebuild_finish_item(workqueue_pop(pool.pDone));
+      nPending--;
+    }
+  }
+  workqueue_close(pool.pTodo);
+  for(i=0; i<nThread; i++) fossil_thread_join(apThread[i]);
+  fossil_free(apThread);
+  workqueue_free(pool.pTodo);
+  workqueue_free(pool.pDone);
+  return nThread;
+}
+
 /*
 ** Check to see if the "sym-trunk" tag exists.  If not, create it
 ** and attach it to the very first check-in.
@@ -361,6 +494,14 @@ static void rebuild_tag_trunk(void){
   tag_add_artifact("", "branch", zUuid, "trunk", 2, 0, 0);
 }
 
+/*
+** Set the number of helper threads that rebuild_db() uses to
+** decompress and apply deltas.
+*/
+void rebuild_set_jobs(int n){
+  nJob = n;
+}
+
 /*
 ** Core function to rebuild the information in the derived tables of a
 ** fossil repository from the blobs. This function is shared between
@@ -396,7 +537,8 @@ int rebuild_db(int randomize, int doOut, int doClustering){
                        "'config','shun','private','reportfmt',"
                        "'concealed','accesslog','modreq',"
                        "'purgeevent','purgeitem','unversioned',"
-                       "'subscriber','pending_alert','alert_bounce')"
+                       "'subscriber','pending_alert','alert_bounce',"
+                       "'ftsstext')"
      " AND name NOT GLOB 'sqlite_*'"
      " AND name NOT GLOB 'fx_*'"
   );
@@ -437,13 +579,15 @@ int rebuild_db(int randomize, int doOut, int doClustering){
      "   AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid)"
   );
   manifest_crosslink_begin();
-  while( db_step(&s)==SQLITE_ROW ){
-    int rid = db_column_int(&s, 0);
-    int size = db_column_int(&s, 1);
-    if( size>=0 ){
-      Blob content;
-      content_get(rid, &content);
-      rebuild_step(rid, size, &content);
+  if( nJob<=1 || rebuild_trees_parallel(&s, nJob)==0 ){
+    while( db_step(&s)==SQLITE_ROW ){
+      int rid = db_column_int(&s, 0);
+      int size = db_column_int(&s, 1);
+      if( size>=0 ){
+        Blob content;
+        content_get(rid, &content);
+        rebuild_step(rid, size, &content);
+      }
     }
   }
   db_finalize(&s);
@@ -601,6 +745,8 @@ static void reconstruct_private_table(void){
 **   --force           Force the rebuild to complete even if errors are seen
 **   --ifneeded        Only do the rebuild if it would change the schema version
 **   --index           Always add in the full-text search index
+**   --jobs N          Use N helper threads to decompress and apply deltas.
+**                     "auto" means one per CPU.  Default: 1
 **   --noverify        Skip the verification of changes to the BLOB table
 **   --noindex         Always omit the full-text search index
 **   --pagesize N      Set the database pagesize to N. (512..65536 and power of 2)
@@ -644,6 +790,7 @@ void rebuild_database(void){
   optNoIndex = find_option("noindex",0,0)!=0;
   optIfNeeded = find_option("ifneeded",0,0)!=0;
   compressOnlyFlag = find_option("compress-only",0,0)!=0;
+  nJob = fossil_thread_count(find_option("jobs",0,1), 1);
   if( compressOnlyFlag ) runCompress = runVacuum = 1;
   if( zPagesize ){
     newPagesize = atoi(zPagesize);
@@ -728,7 +875,11 @@ void rebuild_database(void){
       db_multi_exec("PRAGMA journal_mode=WAL;");
     }
   }
-  if( runReindex ) search_rebuild_index();
+  if( runReindex ){
+    search_rebuild_index();
+  }else if( !search_index_exists() ){
+    search_drop_stext();
+  }
   db_protect_pop();
   if( showStats ){
     static const struct { int idx; const char *zLabel; } aStat[] = {
@@ -541,9 +541,9 @@ static void search_urlencode_sqlfunc(
 ** full-scan search.
 */
 void search_sql_setup(sqlite3 *db){
-  static int once = 0;
+  static DbSeen seen;
   static const int enc = SQLITE_UTF8|SQLITE_INNOCUOUS;
-  if( once++ ) return;
+  if( !db_is_new_connection(db, &seen) ) return;
   sqlite3_create_function(db, "search_match", -1, enc, 0,
      search_match_sqlfunc, 0, 0);
   sqlite3_create_function(db, "search_score", 0, enc, 0,
@@ -902,50 +902,118 @@ static void search_rank_sqlfunc(
 #endif
 }
 
+/*
+** Convert a search pattern into a query for the FTS4 or FTS5 MATCH
+** operator.  Space obtained from fossil_malloc().
+**
+** For FTS4, "-" and '"' characters are simply removed.  FTS5 has a
+** stricter syntax, so there every word is quoted.  The AND, OR and NOT
+** operators between words and a "*" at the end of a word, for a prefix
+** search, are kept.
+*/
+static char *search_match_pattern(const char *zPattern, int bFts5){
+  char *zPat = mprintf("%s",zPattern);
+  Blob x;
+  int i, n;
+  for(i=0; zPat[i]; i++){
+    if( zPat[i]=='-' || zPat[i]=='"' ) zPat[i] = ' ';
+  }
+  if( !bFts5 ) return zPat;
+  blob_init(&x, 0, 0);
+  for(i=0; zPat[i]; i+=n){
+    const char *zWord;
+    int nWord;
+    for(n=0; zPat[i+n] && !fossil_isspace(zPat[i+n]); n++){}
+    if( n==0 ){
+      n = 1;
+      continue;
+    }
+    zWord = &zPat[i];
+    nWord = n;
+    if( blob_size(&x)>0 && zPat[i+n]!=0
+     && ((n==2 && strncmp(zWord,"OR",2)==0)
+         || (n==3 && strncmp(zWord,"AND",3)==0)
+         || (n==3 && strncmp(zWord,"NOT",3)==0))
+    ){
+      blob_appendf(&x, " %.*s", nWord, zWord);
+      continue;
+    }
+    if( blob_size(&x)>0 ) blob_append(&x, " ", 1);
+    if( nWord>1 && zWord[nWord-1]=='*' ){
+      blob_appendf(&x, "\"%.*s\"*", nWord-1, zWord);
+    }else{
+      blob_appendf(&x, "\"%.*s\"", nWord, zWord);
+    }
+  }
+  fossil_free(zPat);
+  return blob_str(&x);
+}
+
+/*
+** Return the SQL expression that ranks a match of the full-text index
+** called zTab.  Higher is better.  Matches in the title count for
+** more than matches in the body.
+*/
+static char *search_rank_expr(const char *zTab, int bFts5){
+  if( bFts5 ){
+    return mprintf("-bm25(%s,10.0,1.0)", zTab);
+  }
+  return mprintf("rank(matchinfo(%s,'pcsx'))", zTab);
+}
+
 /*
 ** When this routine is called, there already exists a table
 **
-**       x(label,url,score,id,snip).
+**       x(label,url,score,id,snip,docid).
 **
 ** label:  The "name" of the document containing the match
 ** url:    A URL for the document
 ** score:  How well the document matched
 ** id:     The document id.  Format: xNNNNN, x: type, N: number
 ** snip:   A snippet for the match
+** docid:  The FTSDOCS.ROWID for the document
 **
 ** And the srchFlags parameter has been validated.  This routine
 ** fills the X table with search results using FTS indexed search.
+** If nLimit is positive, only the nLimit best matches are kept.
+** Snippets are only made for the matches that are kept, as making
+** a snippet means reading the whole document.
 **
 ** The companion full-scan search routine is search_fullscan().
 */
 static void search_indexed(
   const char *zPattern,       /* The query pattern */
-  unsigned int srchFlags      /* What to search over */
+  unsigned int srchFlags,     /* What to search over */
+  int nLimit                  /* Number of matches wanted, or 0 for all */
 ){
   Blob sql;
-  char *zPat = mprintf("%s",zPattern);
-  int i;
+  int bFts5 = search_index_is_fts5();
+  char *zPat;
+  char *zRank;
   if( srchFlags==0 ) return;
   sqlite3_create_function(g.db, "rank", 1, SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
      search_rank_sqlfunc, 0, 0);
-  for(i=0; zPat[i]; i++){
-    if( zPat[i]=='-' || zPat[i]=='"' ) zPat[i] = ' ';
+  zPat = search_match_pattern(zPattern, bFts5);
+  if( zPat[0]==0 ){
+    fossil_free(zPat);
+    return;
   }
+  zRank = search_rank_expr("ftsidx", bFts5);
   blob_init(&sql, 0, 0);
   blob_appendf(&sql,
-    "INSERT INTO x(label,url,score,id,date,snip) "
+    "INSERT INTO x(label,url,score,id,date,docid) "
     " SELECT ftsdocs.label,"
     "        ftsdocs.url,"
-    "        rank(matchinfo(ftsidx,'pcsx')),"
+    "        %s,"
     "        ftsdocs.type || ftsdocs.rid,"
     "        datetime(ftsdocs.mtime),"
-    "        snippet(ftsidx,'<mark>','</mark>',' ... ',-1,35)"
+    "        ftsdocs.rowid"
     "   FROM ftsidx CROSS JOIN ftsdocs"
     "  WHERE ftsidx MATCH %Q"
-    "    AND ftsdocs.rowid=ftsidx.docid",
-    zPat
+    "    AND ftsdocs.rowid=ftsidx.rowid",
+    zRank/*safe-for-%s*/, zPat
   );
-  fossil_free(zPat);
+  fossil_free(zRank);
   if( srchFlags!=SRCH_ALL ){
     const char *zSep = " AND (";
     static const struct { unsigned m; char c; } aMask[] = {
@@ -965,7 +1033,27 @@ static void search_indexed(
     }
     blob_append(&sql,")",1);
   }
+  if( nLimit>0 ){
+    blob_appendf(&sql, " ORDER BY 3 DESC, 5 DESC LIMIT %d", nLimit);
+  }
   db_multi_exec("%s",blob_str(&sql)/*safe-for-%s*/);
+  blob_reset(&sql);
+  if( bFts5 ){
+    db_multi_exec(
+      "UPDATE x SET snip=(SELECT"
+      "   snippet(ftsidx,-1,'<mark>','</mark>',' ... ',35)"
+      "   FROM ftsidx WHERE ftsidx MATCH %Q AND ftsidx.rowid=x.docid)",
+      zPat
+    );
+  }else{
+    db_multi_exec(
+      "UPDATE x SET snip=(SELECT"
+      "   snippet(ftsidx,'<mark>','</mark>',' ... ',-1,35)"
+      "   FROM ftsidx WHERE ftsidx MATCH %Q AND ftsidx.rowid=x.docid)",
+      zPat
+    );
+  }
+  fossil_free(zPat);
 #if SEARCH_DEBUG_RANK
   db_multi_exec("UPDATE x SET label=printf('%%s (score=%%s)',label,score)");
 #endif
@@ -1049,13 +1137,13 @@ int search_run_and_output(
   search_sql_setup(g.db);
   add_content_sql_commands(g.db);
   db_multi_exec(
-    "CREATE TEMP TABLE x(label,url,score,id,date,snip);"
+    "CREATE TEMP TABLE x(label,url,score,id,date,snip,docid);"
   );
   if( !search_index_exists() ){
     search_fullscan(zPattern, srchFlags);  /* Full-scan search */
   }else{
     search_update_index(srchFlags);        /* Update the index, if necessary */
-    search_indexed(zPattern, srchFlags);   /* Indexed search */
+    search_indexed(zPattern, srchFlags, nLimit);  /* Indexed search */
   }
   db_prepare(&q, "SELECT url, snip, label, score, id, substr(date,1,10)"
                  "  FROM x"
@@ -1426,6 +1514,101 @@ void search_stext(
   }
 }
 
+/*
+** The search text for embedded documents, wiki pages, tech notes and
+** forum posts depends only on the artifact, so once it has been computed
+** it is saved in the FTSSTEXT table.  That table outlives the full-text
+** index itself, so rebuilding the index does not have to render every
+** document again.  Check-in comments and tickets change over time and
+** are always recomputed.
+**
+** The artifact hash is stored alongside the text so that a RID that is
+** reused after a purge does not pick up stale text.
+*/
+static int searchStextExists = -1;   /* True if FTSSTEXT exists */
+static int searchStextSave = 0;      /* True to save new text in FTSSTEXT */
+
+/*
+** Return true if the FTSSTEXT table exists
+*/
+static int search_stext_exists(void){
+  if( searchStextExists<0 ){
+    searchStextExists = db_table_exists("repository","ftsstext");
+  }
+  return searchStextExists;
+}
+
+/*
+** Return the mimetype under which the search text for cType,rid,zName
+** is kept in FTSSTEXT, or NULL.  The mimetype for a document comes from
+** its name, which can differ for the same RID.
+*/
+static const char *search_stext_mimetype(char cType, const char *zName){
+  return cType=='d' ? mimetype_from_name(zName) : 0;
+}
+
+/*
+** If the search text for the document is in FTSSTEXT, write it into
+** pOut and return true.  Otherwise return false.
+*/
+static int search_stext_load(
+  char cType,            /* Type of document */
+  int rid,               /* BLOB.RID for the document */
+  const char *zName,     /* Auxiliary information, for mimetype */
+  Blob *pOut             /* OUT: The search text */
+){
+  static Stmt q;
+  char zType[2];
+  int rc = 0;
+  if( cType!='d' && cType!='w' && cType!='e' && cType!='f' ) return 0;
+  if( !search_stext_exists() ) return 0;
+  zType[0] = cType;
+  zType[1] = 0;
+  db_static_prepare(&q,
+    "SELECT stext FROM ftsstext, blob"
+    " WHERE ftsstext.type=:t AND ftsstext.rid=:r"
+    "   AND ftsstext.mimetype IS :m"
+    "   AND blob.rid=ftsstext.rid AND blob.uuid=ftsstext.hash"
+  );
+  db_bind_text(&q, ":t", zType);
+  db_bind_int(&q, ":r", rid);
+  db_bind_text(&q, ":m", search_stext_mimetype(cType, zName));
+  if( db_step(&q)==SQLITE_ROW ){
+    db_column_blob(&q, 0, pOut);
+    rc = 1;
+  }
+  db_reset(&q);
+  return rc;
+}
+
+/*
+** Save the search text for a document in FTSSTEXT, if that is enabled
+** and the document is of a type that is kept there.
+*/
+static void search_stext_save(
+  char cType,            /* Type of document */
+  int rid,               /* BLOB.RID for the document */
+  const char *zName,     /* Auxiliary information, for mimetype */
+  Blob *pStext           /* The search text */
+){
+  static Stmt q;
+  char zType[2];
+  if( !searchStextSave || searchStextExists<=0 ) return;
+  if( cType!='d' && cType!='w' && cType!='e' && cType!='f' ) return;
+  zType[0] = cType;
+  zType[1] = 0;
+  db_static_prepare(&q,
+    "REPLACE INTO ftsstext(type,rid,hash,mimetype,stext)"
+    " SELECT :t, rid, uuid, :m, :s FROM blob WHERE rid=:r"
+  );
+  db_bind_text(&q, ":t", zType);
+  db_bind_int(&q, ":r", rid);
+  db_bind_text(&q, ":m", search_stext_mimetype(cType, zName));
+  db_bind_str(&q, ":s", pStext);
+  db_step(&q);
+  db_reset(&q);
+}
+
 /*
 ** This routine is a wrapper around search_stext().
 **
@@ -1434,6 +1617,10 @@ void search_stext(
 ** for the same document return the same pointer.  The returned pointer
 ** is valid until the next invocation of this routine.  Call this routine
 ** with an eType of 0 to clear the cache.
+**
+** Search text that has been saved in the FTSSTEXT table is used from
+** there, and while the index is being updated newly computed text is
+** saved into that table.
 */
 char *search_stext_cached(
   char cType,            /* Type of document */
@@ -1458,7 +1645,10 @@ char *search_stext_cached(
     cache.cType = cType;
     cache.rid = rid;
     if( cType==0 ) return 0;
-    search_stext(cType, rid, zName, &cache.stext);
+    if( !search_stext_load(cType, rid, zName, &cache.stext) ){
+      search_stext(cType, rid, zName, &cache.stext);
+      search_stext_save(cType, rid, zName, &cache.stext);
+    }
     z  = blob_str(&cache.stext);
     for(i=0; z[i] && z[i]!='\n'; i++){}
     cache.nTitle = i;
@@ -1511,7 +1701,7 @@ void test_convert_stext(void){
 static const char zFtsSchema[] =
 @ -- One entry for each possible search result
 @ CREATE TABLE IF NOT EXISTS repository.ftsdocs(
-@   rowid INTEGER PRIMARY KEY, -- Maps to the ftsidx.docid
+@   rowid INTEGER PRIMARY KEY, -- Maps to the ftsidx.rowid
 @   type CHAR(1),              -- Type of document
 @   rid INTEGER,               -- BLOB.RID or TAG.TAGID for the document
 @   name TEXT,                 -- Additional document description
@@ -1528,8 +1718,18 @@ static const char zFtsSchema[] =
 @   SELECT rowid, type, rid, name, idxed, label, url, mtime,
 @          title(type,rid,name) AS 'title', body(type,rid,name) AS 'body'
 @     FROM ftsdocs;
-@ CREATE VIRTUAL TABLE IF NOT EXISTS repository.ftsidx
-@   USING fts4(content="ftscontent", title, body%s);
+@ CREATE VIRTUAL TABLE IF NOT EXISTS repository.ftsidx USING %s;
+;
+static const char zFtsStextSchema[] =
+@ -- Search text of documents, kept when the index is rebuilt
+@ CREATE TABLE IF NOT EXISTS repository.ftsstext(
+@   type CHAR(1),              -- Type of document
+@   rid INTEGER,               -- BLOB.RID for the document
+@   hash TEXT,                 -- BLOB.UUID for the document
+@   mimetype TEXT,             -- Mimetype used, for embedded documents
+@   stext TEXT,                -- The search text
+@   PRIMARY KEY(type,rid)
+@ );
 ;
 static const char zFtsDrop[] =
 @ DROP TABLE IF EXISTS repository.ftsidx;
@@ -1541,16 +1741,47 @@ static const char zFtsDrop[] =
 ** Create or drop the tables associated with a full-text index.
 */
 static int searchIdxExists = -1;
+static int searchIdxFts5 = -1;
 void search_create_index(void){
   int useStemmer = db_get_boolean("search-stemmer",0);
-  const char *zExtra = useStemmer ? ",tokenize=porter" : "";
+  char *zUsing;
+  if( db_get_boolean("search-fts5",0) ){
+    const char *zExtra;
+    if( db_get_boolean("search-trigram",0) ){
+      zExtra = "tokenize=trigram";
+    }else if( useStemmer ){
+      zExtra = "tokenize='porter unicode61', prefix='2 3'";
+    }else{
+      zExtra = "prefix='2 3'";
+    }
+    zUsing = mprintf("fts5(title, body, content=\"ftscontent\", %s)", zExtra);
+    searchIdxFts5 = 1;
+  }else{
+    const char *zExtra = useStemmer ? ",tokenize=porter" : "";
+    zUsing = mprintf("fts4(content=\"ftscontent\", title, body%s)", zExtra);
+    searchIdxFts5 = 0;
+  }
   search_sql_setup(g.db);
-  db_multi_exec(zFtsSchema/*works-like:"%s"*/, zExtra/*safe-for-%s*/);
+  db_multi_exec(zFtsSchema/*works-like:"%s"*/, zUsing/*safe-for-%s*/);
+  db_multi_exec(zFtsStextSchema/*works-like:""*/);
+  fossil_free(zUsing);
   searchIdxExists = 1;
+  searchStextExists = 1;
 }
 void search_drop_index(void){
   db_multi_exec(zFtsDrop/*works-like:""*/);
   searchIdxExists = 0;
+  searchIdxFts5 = 0;
+}
+
+/*
+** Discard the saved search text.  search_drop_index() keeps it so
+** that the index can be rebuilt quickly.  This routine is for when
+** the index is turned off altogether.
+*/
+void search_drop_stext(void){
+  db_multi_exec("DROP TABLE IF EXISTS repository.ftsstext");
+  searchStextExists = 0;
 }
 
 /*
@@ -1563,6 +1794,21 @@ int search_index_exists(void){
   return searchIdxExists;
 }
 
+/*
+** Return true if the full-text search index exists and uses FTS5
+** rather than FTS4.  This goes by the index itself and not by the
+** "search-fts5" setting, which only takes effect on a reindex.
+*/
+int search_index_is_fts5(void){
+  if( searchIdxFts5<0 ){
+    searchIdxFts5 = search_index_exists() && db_exists(
+      "SELECT 1 FROM repository.sqlite_master"
+      " WHERE name='ftsidx' AND sql LIKE '%%fts5%%'"
+    );
+  }
+  return searchIdxFts5;
+}
+
 /*
 ** Fill the FTSDOCS table with unindexed entries for everything
 ** in the repository.  This uses INSERT OR IGNORE so entries already
@@ -1609,7 +1855,7 @@ void search_doc_touch(char cType, int rid, const char *zName){
     zType[1] = 0;
     search_sql_setup(g.db);
     db_multi_exec(
-       "DELETE FROM ftsidx WHERE docid IN"
+       "DELETE FROM ftsidx WHERE rowid IN"
        "    (SELECT rowid FROM ftsdocs WHERE type=%Q AND rid=%d AND idxed)",
        zType, rid
     );
@@ -1620,7 +1866,7 @@ void search_doc_touch(char cType, int rid, const char *zName){
     );
     if( cType=='w' || cType=='e' ){
       db_multi_exec(
-        "DELETE FROM ftsidx WHERE docid IN"
+        "DELETE FROM ftsidx WHERE rowid IN"
         "    (SELECT rowid FROM ftsdocs WHERE type='%c' AND name=%Q AND idxed)",
         cType, zName
       );
@@ -1660,7 +1906,7 @@ static void search_update_doc_index(void){
     ckid, glob_expr("foci.filename", db_get("doc-glob",""))
   );
   db_multi_exec(
-    "DELETE FROM ftsidx WHERE docid IN"
+    "DELETE FROM ftsidx WHERE rowid IN"
     "  (SELECT rowid FROM ftsdocs WHERE type='d'"
     "      AND rid NOT IN (SELECT rid FROM current_docs))"
   );
@@ -1679,7 +1925,7 @@ static void search_update_doc_index(void){
     zDocBr, rTime
   );
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     "  SELECT rowid, label, bx FROM ftsdocs WHERE type='d' AND NOT idxed"
   );
   db_multi_exec(
@@ -1696,7 +1942,7 @@ static void search_update_doc_index(void){
 */
 static void search_update_checkin_index(void){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, '', body('c',rid,NULL) FROM ftsdocs"
     "  WHERE type='c' AND NOT idxed;"
   );
@@ -1719,7 +1965,7 @@ static void search_update_checkin_index(void){
 */
 static void search_update_ticket_index(void){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('t',rid,NULL), body('t',rid,NULL) FROM ftsdocs"
     "  WHERE type='t' AND NOT idxed;"
   );
@@ -1742,7 +1988,7 @@ static void search_update_ticket_index(void){
 */
 static void search_update_wiki_index(void){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('w',rid,NULL),body('w',rid,NULL) FROM ftsdocs"
     "  WHERE type='w' AND NOT idxed;"
   );
@@ -1764,7 +2010,7 @@ static void search_update_wiki_index(void){
 */
 static void search_update_forum_index(void){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('f',rid,NULL),body('f',rid,NULL) FROM ftsdocs"
     "  WHERE type='f' AND NOT idxed;"
   );
@@ -1787,7 +2033,7 @@ static void search_update_forum_index(void){
 */
 static void search_update_technote_index(void){
   db_multi_exec(
-    "INSERT INTO ftsidx(docid,title,body)"
+    "INSERT INTO ftsidx(rowid,title,body)"
     " SELECT rowid, title('e',rid,NULL),body('e',rid,NULL) FROM ftsdocs"
     "  WHERE type='e' AND NOT idxed;"
   );
@@ -1815,6 +2061,12 @@ void search_update_index(unsigned int srchFlags){
   if( !search_index_exists() ) return;
   if( !db_exists("SELECT 1 FROM ftsdocs WHERE NOT idxed") ) return;
   search_sql_setup(g.db);
+  if( !search_stext_exists() ){
+    /* The index was built before there was an FTSSTEXT table */
+    db_multi_exec(zFtsStextSchema/*works-like:""*/);
+    searchStextExists = 1;
+  }
+  searchStextSave = 1;
   if( srchFlags & (SRCH_CKIN|SRCH_DOC) ){
     search_update_doc_index();
     search_update_checkin_index();
@@ -1831,6 +2083,7 @@ void search_update_index(unsigned int srchFlags){
   if( srchFlags & SRCH_FORUM ){
     search_update_forum_index();
   }
+  searchStextSave = 0;
 }
 
 /*
@@ -1866,6 +2119,17 @@ void search_rebuild_index(void){
 **     stemmer (on|off)   Turn the Porter stemmer on or off for indexed
 **                        search.  (Unindexed search is never stemmed.)
 **
+**     fts5 (on|off)      Use an SQLite FTS5 index, ranked by BM25, rather
+**                        than FTS4.  FTS5 also indexes short prefixes so
+**                        that searches for "abc*" are fast.
+**
+**     trigram (on|off)   Use the trigram tokenizer, which matches any
+**                        part of a word, with an FTS5 index.  This
+**                        overrides the stemmer.
+**
+** Changes to the stemmer, fts5 and trigram settings take effect when
+** the index is next rebuilt, for example with "reindex".
+**
 ** The current search settings are displayed after any changes are applied.
 ** Run this command with no arguments to simply see the settings.
 */
@@ -1879,6 +2143,8 @@ void fts_config_cmd(void){
      { 3,  "disable"  },
      { 4,  "enable"   },
      { 5,  "stemmer"  },
+     { 6,  "fts5"     },
+     { 7,  "trigram"  },
   };
   static const struct {
     const char *zSetting;
@@ -1940,12 +2206,23 @@ void fts_config_cmd(void){
     if( g.argc<4 ) usage("porter ON/OFF");
     db_set_int("search-stemmer", is_truth(g.argv[3]), 0);
   }
+  if( iCmd==6 ){
+    if( g.argc<4 ) usage("fts5 ON/OFF");
+    db_set_int("search-fts5", is_truth(g.argv[3]), 0);
+  }
+  if( iCmd==7 ){
+    if( g.argc<4 ) usage("trigram ON/OFF");
+    db_set_int("search-trigram", is_truth(g.argv[3]), 0);
+  }
 
 
   /* destroy or rebuild the index, if requested */
   if( iAction>=1 ){
     search_drop_index();
   }
+  if( iAction==1 ){
+    search_drop_stext();
+  }
   if( iAction>=2 ){
     search_rebuild_index();
   }
@@ -1957,8 +2234,13 @@ void fts_config_cmd(void){
   }
   fossil_print("%-17s %s\n", "Porter stemmer:",
        db_get_boolean("search-stemmer",0) ? "on" : "off");
+  fossil_print("%-17s %s\n", "FTS5:",
+       db_get_boolean("search-fts5",0) ? "on" : "off");
+  fossil_print("%-17s %s\n", "trigram:",
+       db_get_boolean("search-trigram",0) ? "on" : "off");
   if( search_index_exists() ){
-    fossil_print("%-17s enabled\n", "full-text index:");
+    fossil_print("%-17s enabled (%s)\n", "full-text index:",
+       search_index_is_fts5() ? "FTS5" : "FTS4");
     fossil_print("%-17s %d\n", "documents:",
        db_int(0, "SELECT count(*) FROM ftsdocs"));
   }else{
@@ -1967,6 +2249,92 @@ void fts_config_cmd(void){
   db_end_transaction(0);
 }
 
+/*
+** COMMAND: test-fts-bench
+**
+** Usage: %fossil test-fts-bench ?OPTIONS? PATTERN ...
+**
+** Compare the speed of FTS4 and FTS5 for indexed search.  The text of
+** every document in the full-text index is copied into temporary FTS4
+** and FTS5 tables, using the default tokenizer of each.  Then each
+** PATTERN is looked up in both and the matches are ranked and cut down
+** to the best ones, as on the /search page.  The full-text index must
+** be enabled.
+**
+** Options:
+**    -n|--count N       Run each query N times.  Default: 10
+**    --limit N          Keep the N best matches.  Default: 100
+*/
+void test_fts_bench_cmd(void){
+  const char *zCount = find_option("count","n",1);
+  const char *zLimit = find_option("limit",0,1);
+  int nRep = zCount ? atoi(zCount) : 10;
+  int nLimit = zLimit ? atoi(zLimit) : 100;
+  sqlite3_int64 tmStart;
+  int i, j, bFts5;
+  db_find_and_open_repository(0,0);
+  verify_all_options();
+  if( g.argc<3 ) usage("?OPTIONS? PATTERN ...");
+  if( !search_index_exists() ){
+    fossil_fatal("the full-text index is not enabled");
+  }
+  if( nRep<1 ) nRep = 1;
+  search_sql_setup(g.db);
+  sqlite3_create_function(g.db, "rank", 1, SQLITE_UTF8|SQLITE_INNOCUOUS, 0,
+     search_rank_sqlfunc, 0, 0);
+  tmStart = current_time_in_milliseconds();
+  db_multi_exec(
+    "CREATE TEMP TABLE benchdoc AS SELECT rowid, title, body FROM ftscontent"
+  );
+  fossil_print("%d documents read in %lld ms\n",
+     db_int(0, "SELECT count(*) FROM benchdoc"),
+     current_time_in_milliseconds() - tmStart);
+  for(bFts5=0; bFts5<2; bFts5++){
+    const char *zTab = bFts5 ? "bench5" : "bench4";
+    tmStart = current_time_in_milliseconds();
+    db_multi_exec(
+      "CREATE VIRTUAL TABLE temp.%s USING %s(title,body);"
+      "INSERT INTO %s(rowid,title,body) SELECT rowid, title, body"
+      "  FROM benchdoc;",
+      zTab/*safe-for-%s*/, bFts5 ? "fts5" : "fts4",
+      zTab/*safe-for-%s*/
+    );
+    fossil_print("%s index built in %lld ms\n", bFts5 ? "FTS5" : "FTS4",
+       current_time_in_milliseconds() - tmStart);
+  }
+  for(i=2; i<g.argc; i++){
+    fossil_print("%s:\n", g.argv[i]);
+    for(bFts5=0; bFts5<2; bFts5++){
+      const char *zTab = bFts5 ? "bench5" : "bench4";
+      char *zPat = search_match_pattern(g.argv[i], bFts5);
+      char *zRank = search_rank_expr(zTab, bFts5);
+      Stmt q;
+      int nRow = 0;
+      if( zPat[0] ){
+        db_prepare(&q,
+          "SELECT rowid FROM %s WHERE %s MATCH %Q ORDER BY %s DESC LIMIT %d",
+          zTab/*safe-for-%s*/, zTab/*safe-for-%s*/, zPat,
+          zRank/*safe-for-%s*/, nLimit
+        );
+        tmStart = current_time_in_milliseconds();
+        for(j=0; j<nRep; j++){
+          nRow = 0;
+          while( db_step(&q)==SQLITE_ROW ) nRow++;
+          db_reset(&q);
+        }
+        fossil_print("  %s  %9.3f ms per query, %d of %d matches\n",
+           bFts5 ? "FTS5" : "FTS4",
+           (current_time_in_milliseconds() - tmStart)/(double)nRep, nRow,
+           db_int(0, "SELECT count(*) FROM %s WHERE %s MATCH %Q",
+                  zTab/*safe-for-%s*/, zTab/*safe-for-%s*/, zPat));
+        db_finalize(&q);
+      }
+      fossil_free(zPat);
+      fossil_free(zRank);
+    }
+  }
+}
+
 /*
 ** WEBPAGE: test-ftsdocs
 **
@@ -2010,12 +2378,12 @@ void search_data_page(void){
       @ <tr><td align='right'>url:<td><td>
       @ <a href='%R%s(zUrl)'>%h(zUrl)</a>
       @ <tr><td align='right'>mtime:<td><td>%s(db_column_text(&q,5))
-      z = db_text(0, "SELECT title FROM ftsidx WHERE docid=%d",id);
+      z = db_text(0, "SELECT title FROM ftsidx WHERE rowid=%d",id);
       if( z && z[0] ){
         @ <tr><td align="right">title:<td><td>%h(z)
         fossil_free(z);
       }
-      z = db_text(0, "SELECT body FROM ftsidx WHERE docid=%d",id);
+      z = db_text(0, "SELECT body FROM ftsidx WHERE rowid=%d",id);
       if( z && z[0] ){
         @ <tr><td align="right" valign="top">body:<td><td>%h(z)
         fossil_free(z);
@@ -1771,6 +1771,7 @@ void page_srchsetup(){
   @ <hr />
   if( P("fts0") ){
     search_drop_index();
+    search_drop_stext();
   }else if( P("fts1") ){
     search_drop_index();
     search_create_index();
@@ -1778,9 +1779,16 @@ void page_srchsetup(){
     search_update_index(search_restrict(SRCH_ALL));
   }
   if( search_index_exists() ){
-    @ <p>Currently using an SQLite FTS4 search index. This makes search
-    @ run faster, especially on large repositories, but takes up space.</p>
+    @ <p>Currently using an SQLite %s(search_index_is_fts5()?"FTS5":"FTS4")
+    @ search index. This makes search run faster, especially on large
+    @ repositories, but takes up space.</p>
     onoff_attribute("Use Porter Stemmer","search-stemmer","ss",0,0);
+    @ <br />
+    onoff_attribute("Use FTS5 and BM25 ranking","search-fts5","s5",0,0);
+    @ <br />
+    onoff_attribute("Use Trigram Tokenizer (FTS5 only)","search-trigram",
+                    "s3",0,0);
+    @ <p>Changes to these take effect when the index is rebuilt.</p>
     @ <p><input type="submit" name="fts0" value="Delete The Full-Text Index">
     @ <input type="submit" name="fts1" value="Rebuild The Full-Text Index">
     style_submenu_element("FTS Index Debugging","%R/test-ftsdocs");
@@ -1789,6 +1797,11 @@ void page_srchsetup(){
     @ a full-text scan.  This usually works fine, but can be slow for
     @ larger repositories.</p>
     onoff_attribute("Use Porter Stemmer","search-stemmer","ss",0,0);
+    @ <br />
+    onoff_attribute("Use FTS5 and BM25 ranking","search-fts5","s5",0,0);
+    @ <br />
+    onoff_attribute("Use Trigram Tokenizer (FTS5 only)","search-trigram",
+                    "s3",0,0);
     @ <p><input type="submit" name="fts1" value="Create A Full-Text Index">
   }
   @ </div></form>
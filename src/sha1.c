@@ -19,6 +19,7 @@
 */
 #include "config.h"
 #include <sys/types.h>
+#include <assert.h>
 #include "sha1.h"
 
 
@@ -260,6 +261,265 @@ static void SHA1Final(unsigned char *digest, SHA1Context *context){
 }
 #endif /* Built-in SHA1 implemenation */
 
+/*
+** SHA1 using the SHA instructions of the CPU.
+**
+** The x86 SHA extensions and the ARMv8 cryptography extensions both
+** provide instructions that compute the SHA1 compression function
+** several times faster than portable C code.  These instructions
+** compute plain SHA1, without the collision detection of the hardened
+** implementation above.  So they are only ever used to confirm that
+** content matches a hash that is already known.  See
+** hname_verify_hash() for the details.
+**
+** The x86 code is compiled whenever the compiler understands the
+** target attribute and is enabled at run-time if the CPU supports it.
+** The ARM code is only compiled if the build targets a CPU that has the
+** cryptography extensions.
+*/
+#if (defined(__x86_64__) || defined(__i386__)) \
+ && ((defined(__GNUC__) && __GNUC__>=5) || defined(__clang__))
+# define SHA1_HW_X86 1
+# include <immintrin.h>
+# include <cpuid.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+# define SHA1_HW_ARM 1
+# include <arm_neon.h>
+#endif
+
+#if defined(SHA1_HW_X86)
+/*
+** Four rounds of SHA1 using the x86 SHA extensions.  Round group g
+** (0 through 19) first computes the message schedule words it needs,
+** then updates the state.  The f argument selects the round function
+** and must be a compile-time constant.
+*/
+#define SHA1_X86_ROUNDS(g,f) \
+  if( (g)<4 ){ \
+    W[(g)&3] = _mm_shuffle_epi8( \
+        _mm_loadu_si128((const __m128i*)&aData[16*(g)]), mask); \
+  }else{ \
+    W[(g)&3] = _mm_sha1msg2_epu32(_mm_xor_si128( \
+        _mm_sha1msg1_epu32(W[(g)&3], W[((g)+1)&3]), W[((g)+2)&3]), \
+        W[((g)+3)&3]); \
+  } \
+  e = (g)==0 ? _mm_add_epi32(e0, W[0]) : _mm_sha1nexte_epu32(prev, W[(g)&3]); \
+  prev = abcd; \
+  abcd = _mm_sha1rnds4_epu32(abcd, e, f);
+
+/*
+** Apply the SHA1 compression function to nBlock consecutive 64-byte
+** blocks of aData.
+*/
+__attribute__((target("sha,sse4.1")))
+static void sha1_hw_compress(
+  unsigned int *aState,
+  const unsigned char *aData,
+  size_t nBlock
+){
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+                                      0x08090a0b0c0d0e0fULL);
+  __m128i abcd, abcdSave, e0, e, prev;
+  __m128i W[4];
+  abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)aState), 0x1b);
+  e0 = _mm_set_epi32((int)aState[4], 0, 0, 0);
+  for(; nBlock>0; nBlock--, aData+=64){
+    abcdSave = abcd;
+    SHA1_X86_ROUNDS( 0,0)  SHA1_X86_ROUNDS( 1,0)  SHA1_X86_ROUNDS( 2,0)
+    SHA1_X86_ROUNDS( 3,0)  SHA1_X86_ROUNDS( 4,0)  SHA1_X86_ROUNDS( 5,1)
+    SHA1_X86_ROUNDS( 6,1)  SHA1_X86_ROUNDS( 7,1)  SHA1_X86_ROUNDS( 8,1)
+    SHA1_X86_ROUNDS( 9,1)  SHA1_X86_ROUNDS(10,2)  SHA1_X86_ROUNDS(11,2)
+    SHA1_X86_ROUNDS(12,2)  SHA1_X86_ROUNDS(13,2)  SHA1_X86_ROUNDS(14,2)
+    SHA1_X86_ROUNDS(15,3)  SHA1_X86_ROUNDS(16,3)  SHA1_X86_ROUNDS(17,3)
+    SHA1_X86_ROUNDS(18,3)  SHA1_X86_ROUNDS(19,3)
+    e0 = _mm_sha1nexte_epu32(prev, e0);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+  }
+  _mm_storeu_si128((__m128i*)aState, _mm_shuffle_epi32(abcd, 0x1b));
+  aState[4] = (unsigned int)_mm_extract_epi32(e0, 3);
+}
+
+/*
+** Return true if the CPU supports the x86 SHA extensions.
+*/
+static int sha1_hw_detect(void){
+  unsigned int a, b, c, d;
+  if( !__get_cpuid(1, &a, &b, &c, &d) ) return 0;
+  if( (c & bit_SSE4_1)==0 ) return 0;
+  if( __get_cpuid_max(0, 0)<7 ) return 0;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & (1<<29))!=0;
+}
+#endif /* SHA1_HW_X86 */
+
+#if defined(SHA1_HW_ARM)
+/*
+** Apply the SHA1 compression function to nBlock consecutive 64-byte
+** blocks of aData, using the ARMv8 cryptography extensions.
+*/
+static void sha1_hw_compress(
+  unsigned int *aState,
+  const unsigned char *aData,
+  size_t nBlock
+){
+  static const unsigned int aK[4] = {
+    0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+  };
+  uint32x4_t abcd = vld1q_u32(aState);
+  uint32_t e0 = aState[4];
+  for(; nBlock>0; nBlock--, aData+=64){
+    uint32x4_t abcdSave = abcd;
+    uint32x4_t W[4];
+    uint32_t e = e0, eNext;
+    int g;
+    for(g=0; g<20; g++){
+      uint32x4_t wk;
+      if( g<4 ){
+        W[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&aData[16*g])));
+      }else{
+        W[g&3] = vsha1su1q_u32(
+            vsha1su0q_u32(W[g&3], W[(g+1)&3], W[(g+2)&3]), W[(g+3)&3]);
+      }
+      wk = vaddq_u32(W[g&3], vdupq_n_u32(aK[g/5]));
+      eNext = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      if( g<5 ){
+        abcd = vsha1cq_u32(abcd, e, wk);
+      }else if( g<10 || g>=15 ){
+        abcd = vsha1pq_u32(abcd, e, wk);
+      }else{
+        abcd = vsha1mq_u32(abcd, e, wk);
+      }
+      e = eNext;
+    }
+    e0 += e;
+    abcd = vaddq_u32(abcd, abcdSave);
+  }
+  vst1q_u32(aState, abcd);
+  aState[4] = e0;
+}
+
+/*
+** The build targets a CPU with the cryptography extensions.
+*/
+static int sha1_hw_detect(void){
+  return 1;
+}
+#endif /* SHA1_HW_ARM */
+
+/*
+** Whether or not the SHA1 instructions are used:  -1 means not yet
+** determined, 0 means no and 1 means yes.
+*/
+static int sha1HwState = -1;
+
+/*
+** Return the name of the SHA1 implementation that will be used by
+** sha1sum_blob_fast() and sha1sum_file_fast().
+*/
+const char *sha1_backend(void){
+  if( sha1HwState<0 ){
+#if defined(SHA1_HW_X86) || defined(SHA1_HW_ARM)
+    sha1HwState = sha1_hw_detect();
+#else
+    sha1HwState = 0;
+#endif
+  }
+  if( sha1HwState ) return "sha1-hw";
+  return "sha1";
+}
+
+/*
+** Select the SHA1 implementation used by sha1sum_blob_fast() and
+** sha1sum_file_fast().  zName is "sha1" for the implementation that is
+** used for everything else, or "sha1-hw" for the CPU's SHA1
+** instructions.  Return 0 on success or 1
+** if zName is not available.
+*/
+int sha1_set_backend(const char *zName){
+  if( fossil_strcmp(zName, "sha1")==0 ){
+    sha1_backend();
+    sha1HwState = 0;
+    return 0;
+  }
+  if( fossil_strcmp(zName, "sha1-hw")==0 ){
+    sha1HwState = -1;
+    return fossil_strcmp(sha1_backend(), "sha1-hw")!=0;
+  }
+  return 1;
+}
+
+/*
+** State of a SHA1 computation that uses the CPU's SHA1 instructions
+*/
+typedef struct Sha1HwContext Sha1HwContext;
+struct Sha1HwContext {
+  unsigned int state[5];     /* Hash state */
+  u64 nByte;                 /* Total number of bytes hashed so far */
+  unsigned char buf[64];     /* Partial block waiting to be hashed */
+};
+
+#if !defined(SHA1_HW_X86) && !defined(SHA1_HW_ARM)
+/*
+** There are no SHA1 instructions on this platform.  sha1_backend()
+** never selects "sha1-hw" and so this is never called.
+*/
+static void sha1_hw_compress(
+  unsigned int *aState,
+  const unsigned char *aData,
+  size_t nBlock
+){
+  assert( 0 );
+}
+#endif
+
+/*
+** Routines for computing SHA1 using sha1_hw_compress()
+*/
+static void sha1_hw_init(Sha1HwContext *p){
+  p->state[0] = 0x67452301;
+  p->state[1] = 0xefcdab89;
+  p->state[2] = 0x98badcfe;
+  p->state[3] = 0x10325476;
+  p->state[4] = 0xc3d2e1f0;
+  p->nByte = 0;
+}
+static void sha1_hw_update(
+  Sha1HwContext *p,
+  const unsigned char *aData,
+  size_t nData
+){
+  unsigned int nBuf = (unsigned int)(p->nByte & 63);
+  p->nByte += nData;
+  if( nBuf ){
+    unsigned int n = 64 - nBuf;
+    if( n>nData ) n = (unsigned int)nData;
+    memcpy(&p->buf[nBuf], aData, n);
+    aData += n;
+    nData -= n;
+    if( nBuf+n<64 ) return;
+    sha1_hw_compress(p->state, p->buf, 1);
+  }
+  if( nData>=64 ){
+    sha1_hw_compress(p->state, aData, nData/64);
+    aData += nData & ~(size_t)63;
+    nData &= 63;
+  }
+  memcpy(p->buf, aData, nData);
+}
+static void sha1_hw_final(Sha1HwContext *p, unsigned char *digest){
+  u64 nBit = p->nByte*8;
+  unsigned char aPad[72];
+  unsigned int nPad = 64 - (unsigned int)((p->nByte+8) & 63);
+  int i;
+  memset(aPad, 0, sizeof(aPad));
+  aPad[0] = 0x80;
+  for(i=0; i<8; i++) aPad[nPad+i] = (unsigned char)(nBit>>(56-8*i));
+  sha1_hw_update(p, aPad, nPad+8);
+  for(i=0; i<20; i++){
+    digest[i] = (unsigned char)(p->state[i>>2] >> ((3-(i&3))*8));
+  }
+}
+
 /*
 ** Convert a digest into base-16.  digest should be declared as
 ** "unsigned char digest[20]" in the calling function.  The SHA1
@@ -329,15 +589,31 @@ char *sha1sum_finish(Blob *pOut){
 }
 
 
+/*
+** Return true if sha1sum_blob_fast() and sha1sum_file_fast() should use
+** the CPU's SHA1 instructions.
+*/
+static int sha1_use_hw(void){
+  if( sha1HwState<0 ) sha1_backend();
+  return sha1HwState;
+}
+
 /*
 ** Compute the SHA1 checksum of a file on disk.  Store the resulting
 ** checksum in the blob pCksum.  pCksum is assumed to be initialized.
+** Use the CPU's SHA1 instructions if useHw is true.
 **
 ** Return the number of errors.
 */
-int sha1sum_file(const char *zFilename, int eFType, Blob *pCksum){
+static int sha1sum_file_impl(
+  const char *zFilename,
+  int eFType,
+  Blob *pCksum,
+  int useHw
+){
   FILE *in;
   SHA1Context ctx;
+  Sha1HwContext hw;
   unsigned char zResult[20];
   char zBuf[10240];
 
@@ -347,7 +623,11 @@ int sha1sum_file(const char *zFilename, int eFType, Blob *pCksum){
     int rc;
 
     blob_read_link(&destinationPath, zFilename);
-    rc = sha1sum_blob(&destinationPath, pCksum);
+    if( useHw ){
+      rc = sha1sum_blob_fast(&destinationPath, pCksum);
+    }else{
+      rc = sha1sum_blob(&destinationPath, pCksum);
+    }
     blob_reset(&destinationPath);
     return rc;
   }
@@ -356,21 +636,43 @@ int sha1sum_file(const char *zFilename, int eFType, Blob *pCksum){
   if( in==0 ){
     return 1;
   }
-  SHA1Init(&ctx);
+  if( useHw ){
+    sha1_hw_init(&hw);
+  }else{
+    SHA1Init(&ctx);
+  }
   for(;;){
     int n;
     n = fread(zBuf, 1, sizeof(zBuf), in);
     if( n<=0 ) break;
-    SHA1Update(&ctx, (unsigned char*)zBuf, (unsigned)n);
+    if( useHw ){
+      sha1_hw_update(&hw, (unsigned char*)zBuf, (size_t)n);
+    }else{
+      SHA1Update(&ctx, (unsigned char*)zBuf, (unsigned)n);
+    }
   }
   fclose(in);
   blob_zero(pCksum);
   blob_resize(pCksum, 40);
-  SHA1Final(zResult, &ctx);
+  if( useHw ){
+    sha1_hw_final(&hw, zResult);
+  }else{
+    SHA1Final(zResult, &ctx);
+  }
   DigestToBase16(zResult, blob_buffer(pCksum));
   return 0;
 }
 
+/*
+** Compute the SHA1 checksum of a file on disk.  Store the resulting
+** checksum in the blob pCksum.  pCksum is assumed to be initialized.
+**
+** Return the number of errors.
+*/
+int sha1sum_file(const char *zFilename, int eFType, Blob *pCksum){
+  return sha1sum_file_impl(zFilename, eFType, pCksum, 0);
+}
+
 /*
 ** Compute the SHA1 checksum of a blob in memory.  Store the resulting
 ** checksum in the blob pCksum.  pCksum is assumed to be either
@@ -395,6 +697,33 @@ int sha1sum_blob(const Blob *pIn, Blob *pCksum){
   return 0;
 }
 
+/*
+** These work like sha1sum_file() and sha1sum_blob() except that they use
+** the CPU's SHA1 instructions when those are available.  The result is
+** plain SHA1, without collision detection, so these routines must only
+** be used to confirm that local content matches a hash that the
+** repository computed itself.
+*/
+int sha1sum_file_fast(const char *zFilename, int eFType, Blob *pCksum){
+  return sha1sum_file_impl(zFilename, eFType, pCksum, sha1_use_hw());
+}
+int sha1sum_blob_fast(const Blob *pIn, Blob *pCksum){
+  Sha1HwContext hw;
+  unsigned char zResult[20];
+  if( !sha1_use_hw() ) return sha1sum_blob(pIn, pCksum);
+  sha1_hw_init(&hw);
+  sha1_hw_update(&hw, (unsigned char*)blob_buffer(pIn), blob_size(pIn));
+  sha1_hw_final(&hw, zResult);
+  if( pIn==pCksum ){
+    blob_reset(pCksum);
+  }else{
+    blob_zero(pCksum);
+  }
+  blob_resize(pCksum, 40);
+  DigestToBase16(zResult, blob_buffer(pCksum));
+  return 0;
+}
+
 /*
 ** Compute the SHA1 checksum of a zero-terminated string.  The
 ** result is held in memory obtained from mprintf().
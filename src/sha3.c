@@ -602,6 +602,253 @@ int sha3sum_blob(const Blob *pIn, int iSize, Blob *pCksum){
   return 0;
 }
 
+/*
+** Hashing several blobs at once.
+**
+** On x86 CPUs that have AVX2, each 256-bit register holds four 64-bit
+** Keccak lanes, one from each of four independent states.  Running
+** four hashes in lockstep this way is considerably faster than running
+** them one after another.  The blocks that are common to all four
+** inputs are absorbed together, and then each hash is finished on its
+** own using the ordinary code above.
+*/
+#if SHA3_BYTEORDER==1234 && (defined(__x86_64__) || defined(__i386__)) \
+ && ((defined(__GNUC__) && __GNUC__>=5) || defined(__clang__))
+# define SHA3_USE_X4 1
+#endif
+
+#ifdef SHA3_USE_X4
+typedef u64 Sha3Lane4 __attribute__((vector_size(32)));
+#define SHA3_ROL4(v,n) (((v)<<(n))|((v)>>(64-(n))))
+
+/*
+** Absorb nBlock blocks of nRate bytes each from aData[0] through
+** aData[3] into the four Keccak states p[0] through p[3].
+*/
+__attribute__((target("avx2")))
+static void sha3_absorb_x4(
+  SHA3Context *p,
+  const unsigned char **aData,
+  size_t nBlock
+){
+  static const u64 aRC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL,
+    0x8000000080008000ULL, 0x000000000000808BULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008AULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800AULL, 0x800000008000000AULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+  };
+  Sha3Lane4 A[25], B[25];
+  Sha3Lane4 C0, C1, C2, C3, C4, D0, D1, D2, D3, D4;
+  unsigned nLane = p[0].nRate/8;
+  size_t iOfst = 0;
+  unsigned i;
+  int r;
+
+  for(i=0; i<25; i++){
+    A[i] = (Sha3Lane4){ p[0].u.s[i], p[1].u.s[i], p[2].u.s[i], p[3].u.s[i] };
+  }
+  for(; nBlock>0; nBlock--, iOfst+=p[0].nRate){
+    for(i=0; i<nLane; i++){
+      u64 w0, w1, w2, w3;
+      memcpy(&w0, &aData[0][iOfst+i*8], 8);
+      memcpy(&w1, &aData[1][iOfst+i*8], 8);
+      memcpy(&w2, &aData[2][iOfst+i*8], 8);
+      memcpy(&w3, &aData[3][iOfst+i*8], 8);
+      A[i] ^= (Sha3Lane4){ w0, w1, w2, w3 };
+    }
+    for(r=0; r<24; r++){
+      /* Theta */
+      C0 = A[0]^A[5]^A[10]^A[15]^A[20];
+      C1 = A[1]^A[6]^A[11]^A[16]^A[21];
+      C2 = A[2]^A[7]^A[12]^A[17]^A[22];
+      C3 = A[3]^A[8]^A[13]^A[18]^A[23];
+      C4 = A[4]^A[9]^A[14]^A[19]^A[24];
+      D0 = C4^SHA3_ROL4(C1, 1);
+      D1 = C0^SHA3_ROL4(C2, 1);
+      D2 = C1^SHA3_ROL4(C3, 1);
+      D3 = C2^SHA3_ROL4(C4, 1);
+      D4 = C3^SHA3_ROL4(C0, 1);
+      /* Rho and Pi */
+      B[0] = A[0]^D0;
+      B[10] = SHA3_ROL4(A[1]^D1, 1);
+      B[20] = SHA3_ROL4(A[2]^D2, 62);
+      B[5] = SHA3_ROL4(A[3]^D3, 28);
+      B[15] = SHA3_ROL4(A[4]^D4, 27);
+      B[16] = SHA3_ROL4(A[5]^D0, 36);
+      B[1] = SHA3_ROL4(A[6]^D1, 44);
+      B[11] = SHA3_ROL4(A[7]^D2, 6);
+      B[21] = SHA3_ROL4(A[8]^D3, 55);
+      B[6] = SHA3_ROL4(A[9]^D4, 20);
+      B[7] = SHA3_ROL4(A[10]^D0, 3);
+      B[17] = SHA3_ROL4(A[11]^D1, 10);
+      B[2] = SHA3_ROL4(A[12]^D2, 43);
+      B[12] = SHA3_ROL4(A[13]^D3, 25);
+      B[22] = SHA3_ROL4(A[14]^D4, 39);
+      B[23] = SHA3_ROL4(A[15]^D0, 41);
+      B[8] = SHA3_ROL4(A[16]^D1, 45);
+      B[18] = SHA3_ROL4(A[17]^D2, 15);
+      B[3] = SHA3_ROL4(A[18]^D3, 21);
+      B[13] = SHA3_ROL4(A[19]^D4, 8);
+      B[14] = SHA3_ROL4(A[20]^D0, 18);
+      B[24] = SHA3_ROL4(A[21]^D1, 2);
+      B[9] = SHA3_ROL4(A[22]^D2, 61);
+      B[19] = SHA3_ROL4(A[23]^D3, 56);
+      B[4] = SHA3_ROL4(A[24]^D4, 14);
+      /* Chi */
+      A[0] = B[0]^(~B[1]&B[2]);
+      A[1] = B[1]^(~B[2]&B[3]);
+      A[2] = B[2]^(~B[3]&B[4]);
+      A[3] = B[3]^(~B[4]&B[0]);
+      A[4] = B[4]^(~B[0]&B[1]);
+      A[5] = B[5]^(~B[6]&B[7]);
+      A[6] = B[6]^(~B[7]&B[8]);
+      A[7] = B[7]^(~B[8]&B[9]);
+      A[8] = B[8]^(~B[9]&B[5]);
+      A[9] = B[9]^(~B[5]&B[6]);
+      A[10] = B[10]^(~B[11]&B[12]);
+      A[11] = B[11]^(~B[12]&B[13]);
+      A[12] = B[12]^(~B[13]&B[14]);
+      A[13] = B[13]^(~B[14]&B[10]);
+      A[14] = B[14]^(~B[10]&B[11]);
+      A[15] = B[15]^(~B[16]&B[17]);
+      A[16] = B[16]^(~B[17]&B[18]);
+      A[17] = B[17]^(~B[18]&B[19]);
+      A[18] = B[18]^(~B[19]&B[15]);
+      A[19] = B[19]^(~B[15]&B[16]);
+      A[20] = B[20]^(~B[21]&B[22]);
+      A[21] = B[21]^(~B[22]&B[23]);
+      A[22] = B[22]^(~B[23]&B[24]);
+      A[23] = B[23]^(~B[24]&B[20]);
+      A[24] = B[24]^(~B[20]&B[21]);
+      /* Iota */
+      A[0] ^= (Sha3Lane4){ aRC[r], aRC[r], aRC[r], aRC[r] };
+    }
+  }
+  for(i=0; i<25; i++){
+    p[0].u.s[i] = A[i][0];
+    p[1].u.s[i] = A[i][1];
+    p[2].u.s[i] = A[i][2];
+    p[3].u.s[i] = A[i][3];
+  }
+}
+#endif /* SHA3_USE_X4 */
+
+/*
+** Whether or not sha3sum_blob_multi() hashes four blobs at a time:
+** -1 means not yet determined, 0 means no and 1 means yes.
+*/
+static int sha3X4State = -1;
+
+/*
+** Return the name of the implementation used by sha3sum_blob_multi().
+*/
+const char *sha3_backend(void){
+  if( sha3X4State<0 ){
+#ifdef SHA3_USE_X4
+    sha3X4State = __builtin_cpu_supports("avx2")!=0;
+#else
+    sha3X4State = 0;
+#endif
+  }
+  return sha3X4State ? "sha3-x4" : "sha3";
+}
+
+/*
+** Select the implementation used by sha3sum_blob_multi():  "sha3" to
+** hash one blob at a time or "sha3-x4" to hash four at a time.  Return
+** 0 on success or 1 if zName is not available.
+*/
+int sha3_set_backend(const char *zName){
+  if( fossil_strcmp(zName, "sha3")==0 ){
+    sha3_backend();
+    sha3X4State = 0;
+    return 0;
+  }
+  if( fossil_strcmp(zName, "sha3-x4")==0 ){
+    sha3X4State = -1;
+    return fossil_strcmp(sha3_backend(), "sha3-x4")!=0;
+  }
+  return 1;
+}
+
+#ifdef SHA3_USE_X4
+/*
+** An input to sha3sum_blob_multi() and its position in the input array
+*/
+struct Sha3Input {
+  Blob *pIn;                 /* The blob to be hashed */
+  int iIn;                   /* Its index in apIn[] */
+};
+
+/*
+** Comparison function for sorting inputs by decreasing size
+*/
+static int sha3_cmp_size(const void *a, const void *b){
+  int szA = blob_size(((const struct Sha3Input*)a)->pIn);
+  int szB = blob_size(((const struct Sha3Input*)b)->pIn);
+  return szB - szA;
+}
+#endif
+
+/*
+** Compute the SHA3 checksum of each of the n blobs in apIn[] and store
+** the results in aCksum[].  The blobs in aCksum[] are assumed to be
+** uninitialized.
+**
+** When four-way hashing is available, the inputs are sorted by size
+** and hashed in groups of four, so that blobs of similar size share a
+** group.  Otherwise this is the same as calling sha3sum_blob() on each
+** input in turn.
+*/
+void sha3sum_blob_multi(int n, Blob **apIn, int iSize, Blob *aCksum){
+  int i;
+#ifdef SHA3_USE_X4
+  if( n>=2 && fossil_strcmp(sha3_backend(), "sha3-x4")==0 ){
+    struct Sha3Input *aSort = fossil_malloc( sizeof(aSort[0])*n );
+    int j;
+    for(i=0; i<n; i++){
+      aSort[i].pIn = apIn[i];
+      aSort[i].iIn = i;
+    }
+    qsort(aSort, n, sizeof(aSort[0]), sha3_cmp_size);
+    for(i=0; i<n; i+=4){
+      SHA3Context ctx[4];
+      const unsigned char *aData[4];
+      int nGroup = n-i<4 ? n-i : 4;
+      size_t nBlock;
+      SHA3Init(&ctx[0], iSize);
+      nBlock = blob_size(aSort[i+nGroup-1].pIn)/ctx[0].nRate;
+      if( nGroup<2 ) nBlock = 0;
+      for(j=0; j<4; j++){
+        /* Unused lanes repeat the last input and are then ignored */
+        ctx[j] = ctx[0];
+        aData[j] = (const unsigned char*)
+                     blob_buffer(aSort[i + (j<nGroup ? j : nGroup-1)].pIn);
+      }
+      if( nBlock>0 ) sha3_absorb_x4(ctx, aData, nBlock);
+      for(j=0; j<nGroup; j++){
+        unsigned iDone = (unsigned)nBlock*ctx[j].nRate;
+        Blob *pOut = &aCksum[aSort[i+j].iIn];
+        SHA3Update(&ctx[j], aData[j]+iDone,
+                   blob_size(aSort[i+j].pIn)-iDone);
+        blob_zero(pOut);
+        blob_resize(pOut, iSize/4);
+        DigestToBase16(SHA3Final(&ctx[j]), blob_buffer(pOut), iSize/8);
+      }
+    }
+    fossil_free(aSort);
+    return;
+  }
+#endif
+  for(i=0; i<n; i++){
+    sha3sum_blob(apIn[i], iSize, &aCksum[i]);
+  }
+}
+
 #if 0 /* NOT USED */
 /*
 ** Compute the SHA3 checksum of a zero-terminated string.  The
@@ -286,6 +286,13 @@ void shun_artifacts(void){
     content_undelta(srcid);
   }
   db_finalize(&q);
+  if( cache_artifact_enabled() ){
+    db_prepare(&q, "SELECT rid FROM toshun");
+    while( db_step(&q)==SQLITE_ROW ){
+      content_forget_materialized(db_column_int(&q, 0));
+    }
+    db_finalize(&q);
+  }
   db_multi_exec(
      "DELETE FROM delta WHERE rid IN toshun;"
      "DELETE FROM blob WHERE rid IN toshun;"
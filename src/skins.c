@@ -149,6 +149,13 @@ void skin_use_draft(int i){
   iDraftSkin = i;
 }
 
+/*
+** Return the number of the draft skin in use, or 0 if none.
+*/
+int skin_draft_in_use(void){
+  return iDraftSkin;
+}
+
 /*
 ** The following routines return the various components of the skin
 ** that should be used for the current run.
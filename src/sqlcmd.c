@@ -193,6 +193,16 @@ static void sqlcmd_db_protect_pop(
 
 
 
+/*
+** Trace callback for the database connection of the shell.  Forget
+** the connection when the shell closes it.
+*/
+static int sqlcmd_trace(unsigned m, void *notUsed, void *pP, void *pX){
+  int rc = db_sql_trace(m, notUsed, pP, pX);
+  if( (m & SQLITE_TRACE_CLOSE)!=0 && (sqlite3*)pP==g.db ) g.db = 0;
+  return rc;
+}
+
 /*
 ** This is the "automatic extension" initializer that runs right after
 ** the connection to the repository database is opened.  Set up the
@@ -204,6 +214,12 @@ static int sqlcmd_autoinit(
   const void *notUsed
 ){
   int mTrace = SQLITE_TRACE_CLOSE;
+  if( g.db!=0 && g.db!=db ){
+    /* This is a connection that Fossil itself opened while running a
+    ** statement for the shell, such as to the cache file.  Leave it
+    ** alone. */
+    return SQLITE_OK;
+  }
   add_content_sql_commands(db);
   db_add_aux_functions(db);
   re_add_sql_func(db);
@@ -231,7 +247,7 @@ static int sqlcmd_autoinit(
   /* Arrange to trace close operations so that static prepared statements
   ** will get cleaned up when the shell closes the database connection */
   if( g.fSqlTrace ) mTrace |= SQLITE_TRACE_PROFILE;
-  sqlite3_trace_v2(db, mTrace, db_sql_trace, 0);
+  sqlite3_trace_v2(db, mTrace, sqlcmd_trace, 0);
   db_protect_only(PROTECT_NONE);
   sqlite3_set_authorizer(db, db_top_authorizer, db);
   sqlite3_create_function(db, "db_protect", 1, SQLITE_UTF8, 0,
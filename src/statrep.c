@@ -37,6 +37,15 @@ static int statsReportType = 0;
 */
 static const char *statsReportTimelineYFlag = NULL;
 
+/*
+** Forget the report type of the previous page, so that a server
+** process can generate another report.
+*/
+void stats_report_reset_request(void){
+  statsReportType = 0;
+  statsReportTimelineYFlag = NULL;
+}
+
 
 /*
 ** Creates a TEMP VIEW named v_reports which is a wrapper around the
@@ -96,6 +96,11 @@ static int needHrefJs = 0;      /* href.js */
 */
 static Blob blobOnLoad = BLOB_INITIALIZER;
 
+/*
+** The nonce returned by style_nonce()
+*/
+static char zPageNonce[52];
+
 /*
 ** Generate and return a anchor tag like this:
 **
@@ -346,6 +351,26 @@ static int submenuCompare(const void *a, const void *b){
 */
 static char *local_zCurrentPage = 0;
 
+/*
+** Forget everything about the page that was most recently generated,
+** including its nonce, so that a server process can generate another.
+*/
+void style_reset_request(void){
+  nSubmenu = 0;
+  nSubmenuCtrl = 0;
+  memset(aSubmenu, 0, sizeof(aSubmenu));
+  memset(aSubmenuCtrl, 0, sizeof(aSubmenuCtrl));
+  headerHasBeenGenerated = 0;
+  sideboxUsed = 0;
+  adUnitFlags = 0;
+  submenuEnable = 1;
+  needHrefJs = 0;
+  blob_reset(&blobOnLoad);
+  fossil_free(local_zCurrentPage);
+  local_zCurrentPage = 0;
+  zPageNonce[0] = 0;
+}
+
 /*
 ** Set the desired $current_page to something other than g.zPath
 */
@@ -494,13 +519,12 @@ char *style_copy_button(
 ** run, the same nonce is always returned.
 */
 char *style_nonce(void){
-  static char zNonce[52];
-  if( zNonce[0]==0 ){
+  if( zPageNonce[0]==0 ){
     unsigned char zSeed[24];
     sqlite3_randomness(24, zSeed);
-    encode16(zSeed,(unsigned char*)zNonce,24);
+    encode16(zSeed,(unsigned char*)zPageNonce,24);
   }
-  return zNonce;
+  return zPageNonce;
 }
 
 /*
@@ -148,6 +148,9 @@ static void process_sync_args(
   if( find_option("verbose","v",0)!=0 ){
     *pSyncFlags |= SYNC_VERBOSE;
   }
+  if( find_option("stats",0,0)!=0 ){
+    *pSyncFlags |= SYNC_STATS;
+  }
   url_proxy_options();
   clone_ssh_find_options();
   if( !uvOnly ) db_find_and_open_repository(0, 0);
@@ -215,6 +218,7 @@ static void process_sync_args(
 **   -R|--repository REPO       Local repository to pull into
 **   --ssl-identity FILE        Local SSL credentials, if requested by remote
 **   --ssh-command SSH          Use SSH as the "ssh" command
+**   --stats                    Show how the time was spent on the network
 **   -v|--verbose               Additional (debugging) output
 **   --verily                   Exchange extra information with the remote
 **                              to ensure no content is overlooked
@@ -235,7 +239,7 @@ void pull_cmd(void){
   /* We should be done with options.. */
   verify_all_options();
 
-  client_sync(syncFlags, configFlags, 0, zAltPCode);
+  if( client_sync(syncFlags, configFlags, 0, zAltPCode) ) fossil_exit(1);
 }
 
 /*
@@ -264,6 +268,7 @@ void pull_cmd(void){
 **   -R|--repository REPO       Local repository to push from
 **   --ssl-identity FILE        Local SSL credentials, if requested by remote
 **   --ssh-command SSH          Use SSH as the "ssh" command
+**   --stats                    Show how the time was spent on the network
 **   -v|--verbose               Additional (debugging) output
 **   --verily                   Exchange extra information with the remote
 **                              to ensure no content is overlooked
@@ -281,10 +286,58 @@ void push_cmd(void){
   if( db_get_boolean("dont-push",0) ){
     fossil_fatal("pushing is prohibited: the 'dont-push' option is set");
   }
-  client_sync(syncFlags, 0, 0, 0);
+  if( client_sync(syncFlags, 0, 0, 0) ) fossil_exit(1);
 }
 
 
+/*
+** Sync with every remote: the default remote and each one named by
+** "fossil remote add".  Each sync is a separate "fossil sync" process.
+** They run one after another, since each one holds the write lock on
+** the repository for most of its round-trips.
+*/
+static void sync_all_remotes(unsigned syncFlags){
+  Blob extra;
+  AllRunner run;
+  Stmt q;
+  char **azName = 0;
+  int nName = 0;
+  int bTiming = find_option("timing",0,0)!=0;
+  int i;
+  blob_zero(&extra);
+  if( syncFlags & SYNC_UNVERSIONED ) blob_append(&extra, " -u", -1);
+  if( find_option("private",0,0)!=0 ) blob_append(&extra, " --private", -1);
+  if( find_option("verbose","v",0)!=0 ) blob_append(&extra, " -v", -1);
+  if( find_option("verily",0,0)!=0 ) blob_append(&extra, " --verily", -1);
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( g.argc!=2 ) usage("--all ?OPTIONS?");
+  db_prepare(&q,
+    "SELECT substr(name,10) FROM config WHERE name GLOB 'sync-url:*'"
+    " UNION ALL "
+    "SELECT 'default' FROM config WHERE name='last-sync-url'"
+    "   AND value NOT IN (SELECT value FROM config"
+    "                      WHERE name GLOB 'sync-url:*')"
+    " ORDER BY 1"
+  );
+  while( db_step(&q)==SQLITE_ROW ){
+    azName = fossil_realloc(azName, sizeof(azName[0])*(nName+1));
+    azName[nName++] = fossil_strdup(db_column_text(&q, 0));
+  }
+  db_finalize(&q);
+  all_runner_begin(&run, 1, bTiming);
+  for(i=0; i<nName; i++){
+    char *zCmd = mprintf("%$ sync -R %$ --once %$%s", g.nameOfExe,
+                         g.zRepositoryName, azName[i], blob_str(&extra));
+    all_runner_run(&run, azName[i], "", zCmd);
+    fossil_free(zCmd);
+    fossil_free(azName[i]);
+  }
+  fossil_free(azName);
+  blob_reset(&extra);
+  if( all_runner_end(&run) ) fossil_exit(1);
+}
+
 /*
 ** COMMAND: sync
 **
@@ -309,29 +362,44 @@ void push_cmd(void){
 **   -R|--repository REPO       Local repository to sync with
 **   --ssl-identity FILE        Local SSL credentials, if requested by remote
 **   --ssh-command SSH          Use SSH as the "ssh" command
+**   --stats                    Show how the time was spent on the network
 **   -u|--unversioned           Also sync unversioned content
 **   -v|--verbose               Additional (debugging) output
 **   --verily                   Exchange extra information with the remote
 **                              to ensure no content is overlooked
 **
+** Use "fossil sync --all" to sync with every remote that "fossil remote
+** list" shows, in place of the URL.  Only the --private, --unversioned,
+** --verbose and --verily options above are passed along.  Failures are
+** listed at the end.  With --timing, also show how long the sync with
+** each remote took.
+**
+** The exit status is non-zero if the sync fails.
+**
 ** See also: [[clone]], [[pull]], [[push]], [[remote]]
 */
 void sync_cmd(void){
   unsigned configFlags = 0;
   unsigned syncFlags = SYNC_PUSH|SYNC_PULL;
+  int nErr;
   if( find_option("unversioned","u",0)!=0 ){
     syncFlags |= SYNC_UNVERSIONED;
   }
+  if( find_option("all",0,0)!=0 ){
+    sync_all_remotes(syncFlags);
+    return;
+  }
   process_sync_args(&configFlags, &syncFlags, 0, 0);
 
   /* We should be done with options.. */
   verify_all_options();
 
   if( db_get_boolean("dont-push",0) ) syncFlags &= ~SYNC_PUSH;
-  client_sync(syncFlags, configFlags, 0, 0);
+  nErr = client_sync(syncFlags, configFlags, 0, 0);
   if( (syncFlags & SYNC_PUSH)==0 ){
     fossil_warning("pull only: the 'dont-push' option is set");
   }
+  if( nErr ) fossil_exit(1);
 }
 
 /*
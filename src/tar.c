@@ -36,6 +36,8 @@ static struct tarball_t {
   char *zPrevDir;           /* Name of directory for previous entry */
   int nPrevDirAlloc;        /* size of zPrevDir */
   Blob pax;                 /* PAX data */
+  int bStream;              /* Send output to the CGI reply as it is made */
+  Blob out;                 /* Compressed output that is being sent */
 } tball;
 
 
@@ -50,8 +52,10 @@ static struct tarball_t {
 ** Begin the process of generating a tarball.
 **
 ** Initialize the GZIP compressor and the table of directory names.
+** The tarball is compressed on nJob helper threads if nJob is more
+** than 1.
 */
-static void tar_begin(sqlite3_int64 mTime){
+static void tar_begin(sqlite3_int64 mTime, int nJob){
   assert( tball.aHdr==0 );
   tball.aHdr = fossil_malloc(512+512);
   memset(tball.aHdr, 0, 512+512);
@@ -61,6 +65,7 @@ static void tar_begin(sqlite3_int64 mTime){
   tball.nPrevDirAlloc = 0;
   /* scratch buffer init */
   blob_zero(&tball.pax);
+  blob_zero(&tball.out);
 
   memcpy(&tball.aHdr[108], "0000000", 8);  /* Owner ID */
   memcpy(&tball.aHdr[116], "0000000", 8);  /* Group ID */
@@ -68,6 +73,7 @@ static void tar_begin(sqlite3_int64 mTime){
   memcpy(&tball.aHdr[265], "nobody", 7);   /* Owner name */
   memcpy(&tball.aHdr[297], "nobody", 7);   /* Group name */
   gzip_begin(mTime);
+  gzip_start_threads(nJob);
   db_multi_exec(
     "CREATE TEMP TABLE dir(name UNIQUE);"
   );
@@ -401,17 +407,31 @@ static void tar_add_file(
       gzip_step(tball.zSpaces, 512 - lastPage);
     }
   }
+  if( tball.bStream ){
+    gzip_drain(&tball.out);
+    cgi_append_content(blob_buffer(&tball.out), blob_size(&tball.out));
+    blob_truncate(&tball.out, 0);
+  }
 }
 
 /*
 ** Finish constructing the tarball.  Put the content of the tarball
-** in Blob pOut.
+** in Blob pOut, or append what remains of it to the CGI reply if
+** pOut is NULL.
 */
 static void tar_finish(Blob *pOut){
   db_multi_exec("DROP TABLE dir");
   gzip_step(tball.zSpaces, 512);
   gzip_step(tball.zSpaces, 512);
-  gzip_finish(pOut);
+  if( pOut ){
+    gzip_finish(pOut);
+  }else{
+    blob_reset(&tball.out);
+    gzip_finish(&tball.out);
+    cgi_append_content(blob_buffer(&tball.out), blob_size(&tball.out));
+  }
+  blob_reset(&tball.out);
+  tball.bStream = 0;
   fossil_free(tball.aHdr);
   tball.aHdr = 0;
   fossil_free(tball.zPrevDir);
@@ -440,7 +460,7 @@ void test_tarball_cmd(void){
     eFType = ExtFILE;
   }
   sqlite3_open(":memory:", &g.db);
-  tar_begin(-1);
+  tar_begin(-1, 1);
   for(i=3; i<g.argc; i++){
     Blob file;
     blob_zero(&file);
@@ -464,23 +484,34 @@ void test_tarball_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pTar is zeroed.
 **
+** If pTar is NULL, the tarball is appended to the CGI reply, in
+** pieces as it is generated, so that a streamed reply (see
+** cgi_stream_begin()) can be sent without holding the whole tarball
+** in memory.
+**
 ** zDir is a "synthetic" subdirectory which all files get
 ** added to as part of the tarball. It may be 0 or an empty string, in
 ** which case it is ignored. The intention is to create a tarball which
 ** politely expands into a subdir instead of filling your current dir
 ** with source files. For example, pass an artifact hash or "ProjectName".
 **
+** The tarball is compressed on nJob helper threads if nJob is more
+** than 1.
 */
 void tarball_of_checkin(
   int rid,             /* The RID of the checkin from which to form a tarball */
   Blob *pTar,          /* Write the tarball into this blob */
   const char *zDir,    /* Directory prefix for all file added to tarball */
   Glob *pInclude,      /* Only add files matching this pattern */
-  Glob *pExclude       /* Exclude files matching this pattern */
+  Glob *pExclude,      /* Exclude files matching this pattern */
+  int nJob             /* Number of helper threads for compression */
 ){
   Blob mfile, hash, file;
   Manifest *pManifest;
   ManifestFile *pFile;
+  ManifestFile **apFile = 0;   /* Files to put in the archive */
+  int nFile = 0, nFileAlloc = 0, i;
+  ContentBatch files;          /* Content of the files in apFile[] */
   Blob filename;
   int nPrefix;
   char *zName = 0;
@@ -488,11 +519,12 @@ void tarball_of_checkin(
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pTar);
+    if( pTar ) blob_zero(pTar);
     return;
   }
   blob_set_dynamic(&hash, rid_to_uuid(rid));
   blob_zero(&filename);
+  tball.bStream = pTar==0;
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -503,7 +535,7 @@ void tarball_of_checkin(
   if( pManifest ){
     int flg, eflg = 0;
     mTime = (pManifest->rDate - 2440587.5)*86400.0;
-    tar_begin(mTime);
+    tar_begin(mTime, nJob);
     flg = db_get_manifest_setting();
     if( flg ){
       /* eflg is the effective flags, taking include/exclude into account */
@@ -553,25 +585,39 @@ void tarball_of_checkin(
       }
     }
     manifest_file_rewind(pManifest);
+    /* Fetch the file content in batches, so that delta bases that the
+    ** files have in common are only expanded once */
+    content_batch_init(&files);
     while( (pFile = manifest_file_next(pManifest,0))!=0 ){
       int fid;
       if( pInclude!=0 && !glob_match(pInclude, pFile->zName) ) continue;
       if( glob_match(pExclude, pFile->zName) ) continue;
       fid = uuid_to_rid(pFile->zUuid, 0);
       if( fid ){
-        content_get(fid, &file);
-        blob_resize(&filename, nPrefix);
-        blob_append(&filename, pFile->zName, -1);
-        zName = blob_str(&filename);
-        tar_add_file(zName, &file, manifest_file_mperm(pFile), mTime);
-        blob_reset(&file);
+        if( nFile>=nFileAlloc ){
+          nFileAlloc = nFileAlloc*2 + 100;
+          apFile = fossil_realloc(apFile, sizeof(apFile[0])*nFileAlloc);
+        }
+        apFile[nFile++] = pFile;
+        content_batch_add(&files, fid);
       }
     }
+    for(i=0; i<nFile; i++){
+      pFile = apFile[i];
+      content_batch_next(&files, &file);
+      blob_resize(&filename, nPrefix);
+      blob_append(&filename, pFile->zName, -1);
+      zName = blob_str(&filename);
+      tar_add_file(zName, &file, manifest_file_mperm(pFile), mTime);
+      blob_reset(&file);
+    }
+    content_batch_reset(&files);
+    fossil_free(apFile);
   }else{
     blob_append(&filename, blob_str(&hash), 16);
     zName = blob_str(&filename);
     mTime = db_int64(0, "SELECT (julianday('now') -  2440587.5)*86400.0;");
-    tar_begin(mTime);
+    tar_begin(mTime, nJob);
     tar_add_file(zName, &mfile, 0, mTime);
   }
   manifest_destroy(pManifest);
@@ -600,6 +646,8 @@ void tarball_of_checkin(
 ** Options:
 **   -X|--exclude GLOBLIST   Comma-separated list of GLOBs of files to exclude
 **   --include GLOBLIST      Comma-separated list of GLOBs of files to include
+**   --jobs N                Compress on N helper threads.  "auto" means
+**                           one per CPU.  Default: the archive-jobs setting
 **   --name DIRECTORYNAME    The name of the top-level directory in the archive
 **   -R REPOSITORY           Specify a Fossil repository
 */
@@ -611,12 +659,16 @@ void tarball_cmd(void){
   Glob *pExclude = 0;
   const char *zInclude;
   const char *zExclude;
+  const char *zJobs;
+  int nJob;
   zName = find_option("name", 0, 1);
   zExclude = find_option("exclude", "X", 1);
   if( zExclude ) pExclude = glob_create(zExclude);
   zInclude = find_option("include", 0, 1);
   if( zInclude ) pInclude = glob_create(zInclude);
+  zJobs = find_option("jobs", 0, 1);
   db_find_and_open_repository(0, 0);
+  nJob = archive_thread_count(zJobs);
 
   /* We should be done with options.. */
   verify_all_options();
@@ -642,7 +694,7 @@ void tarball_cmd(void){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude);
+  tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude, nJob);
   glob_free(pInclude);
   glob_free(pExclude);
   blob_write_to_file(&tarball, g.argv[3]);
@@ -802,9 +854,20 @@ void tarball_page(void){
     return;
   }
   blob_zero(&tarball);
+  cgi_set_content_type("application/x-compressed");
   if( cache_read(&tarball, zKey)==0 ){
-    tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude);
-    cache_write(&tarball, zKey);
+    i64 tmStart = current_time_in_milliseconds();
+    /* Send the tarball while it is being built, keeping a copy only
+    ** if it is going into the cache */
+    if( cgi_stream_begin(cache_is_enabled() ? &tarball : 0) ){
+      tarball_of_checkin(rid, 0, zName, pInclude, pExclude,
+                         archive_thread_count(0));
+      cgi_stream_flush();
+    }else{
+      tarball_of_checkin(rid, &tarball, zName, pInclude, pExclude,
+                         archive_thread_count(0));
+    }
+    cache_write(&tarball, zKey, current_time_in_milliseconds()-tmStart);
   }
   glob_free(pInclude);
   glob_free(pExclude);
@@ -812,6 +875,9 @@ void tarball_page(void){
   fossil_free(zRid);
   g.zOpenRevision = 0;
   blob_reset(&cacheKey);
-  cgi_set_content(&tarball);
-  cgi_set_content_type("application/x-compressed");
+  if( cgi_is_streaming() ){
+    blob_reset(&tarball);
+  }else{
+    cgi_set_content(&tarball);
+  }
 }
@@ -2343,6 +2343,19 @@ void Th_FossilInit(u32 flags){
   g.th1Flags |= (flags & TH_INIT_MASK);
 }
 
+/*
+** Delete the TH1 interpreter and forget the TH1 output settings of the
+** previous page, so that a server process can generate another.
+*/
+void Th_FossilReset(void){
+  if( g.interp ){
+    Th_DeleteInterp(g.interp);
+    g.interp = 0;
+  }
+  enableOutput = 1;
+  pThOut = 0;
+}
+
 /*
 ** Store a string value in a variable in the interpreter if the variable
 ** does not already exist.
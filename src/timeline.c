@@ -222,9 +222,16 @@ void test_hash_color_page(void){
 /*
 ** Return a new timelineTable id.
 */
+static int nTimelineTable = 0;
 int timeline_tableid(void){
-  static int id = 0;
-  return id++;
+  return nTimelineTable++;
+}
+
+/*
+** Restart the timelineTable ids for a new page.
+*/
+void timeline_reset_request(void){
+  nTimelineTable = 0;
 }
 
 /*
@@ -1129,9 +1136,11 @@ const char *timeline_query_for_www(void){
     @   blob.rid IN leaf AS leaf,
     @   bgcolor AS bgColor,
     @   event.type AS eventType,
-    @   (SELECT group_concat(substr(tagname,5), ', ') FROM tag, tagxref
-    @     WHERE tagname GLOB 'sym-*' AND tag.tagid=tagxref.tagid
-    @       AND tagxref.rid=blob.rid AND tagxref.tagtype>0) AS tags,
+    @   (SELECT group_concat(substr(tagname,5), ', ')
+    @      FROM (SELECT tagname FROM tagxref CROSS JOIN tag
+    @             WHERE tagxref.rid=blob.rid AND tagxref.tagtype>0
+    @               AND tag.tagid=tagxref.tagid AND tagname GLOB 'sym-*'
+    @             ORDER BY tagname)) AS tags,
     @   tagid AS tagid,
     @   brief AS brief,
     @   event.mtime AS mtime
@@ -1225,38 +1234,36 @@ char *names_of_file(const char *zUuid){
 ** on the timeline.
 */
 static void timeline_y_submenu(int isDisabled){
-  static int i = 0;
+  int i;
   static const char *az[16];
-  if( i==0 ){
-    az[0] = "all";
-    az[1] = "Any Type";
-    i = 2;
-    if( g.perm.Read ){
-      az[i++] = "ci";
-      az[i++] = "Check-ins";
-      az[i++] = "g";
-      az[i++] = "Tags";
-    }
-    if( g.perm.RdWiki ){
-      az[i++] = "e";
-      az[i++] = "Tech Notes";
-    }
-    if( g.perm.RdTkt ){
-      az[i++] = "t";
-      az[i++] = "Tickets";
-      az[i++] = "n";
-      az[i++] = "New Tickets";
-    }
-    if( g.perm.RdWiki ){
-      az[i++] = "w";
-      az[i++] = "Wiki";
-    }
-    if( g.perm.RdForum ){
-      az[i++] = "f";
-      az[i++] = "Forum";
-    }
-    assert( i<=count(az) );
-  }
+  az[0] = "all";
+  az[1] = "Any Type";
+  i = 2;
+  if( g.perm.Read ){
+    az[i++] = "ci";
+    az[i++] = "Check-ins";
+    az[i++] = "g";
+    az[i++] = "Tags";
+  }
+  if( g.perm.RdWiki ){
+    az[i++] = "e";
+    az[i++] = "Tech Notes";
+  }
+  if( g.perm.RdTkt ){
+    az[i++] = "t";
+    az[i++] = "Tickets";
+    az[i++] = "n";
+    az[i++] = "New Tickets";
+  }
+  if( g.perm.RdWiki ){
+    az[i++] = "w";
+    az[i++] = "Wiki";
+  }
+  if( g.perm.RdForum ){
+    az[i++] = "f";
+    az[i++] = "Forum";
+  }
+  assert( i<=count(az) );
   if( i>2 ){
     style_submenu_multichoice("y", i/2, az, isDisabled);
   }
@@ -2781,9 +2788,12 @@ const char *timeline_query_for_tty(void){
     @     || ' (user: ' || coalesce(euser,user,'?')
     @     || (SELECT case when length(x)>0 then ' tags: ' || x else '' end
     @           FROM (SELECT group_concat(substr(tagname,5), ', ') AS x
-    @                   FROM tag, tagxref
-    @                  WHERE tagname GLOB 'sym-*' AND tag.tagid=tagxref.tagid
-    @                    AND tagxref.rid=blob.rid AND tagxref.tagtype>0))
+    @                   FROM (SELECT tagname FROM tagxref CROSS JOIN tag
+    @                          WHERE tagxref.rid=blob.rid
+    @                            AND tagxref.tagtype>0
+    @                            AND tag.tagid=tagxref.tagid
+    @                            AND tagname GLOB 'sym-*'
+    @                          ORDER BY tagname)))
     @     || ')' as comment,
     @   (SELECT count(*) FROM plink WHERE pid=blob.rid AND isprim)
     @        AS primPlinkCount,
@@ -488,6 +488,7 @@ void update_cmd(void){
     }else if( idt>0 && idv>0 && ridt!=ridv && chnged ){
       /* Merge the changes in the current tree into the target version */
       Blob r, t, v;
+      ContentBatch pair;
       int rc;
       if( nameChng ){
         fossil_print("MERGE %s -> %s\n", zName, zNewName);
@@ -501,8 +502,13 @@ void update_cmd(void){
         unsigned mergeFlags = dryRunFlag ? MERGE_DRYRUN : 0;
         if(keepMergeFlag!=0) mergeFlags |= MERGE_KEEP_FILES;
         if( !dryRunFlag && !internalUpdate ) undo_save(zName);
-        content_get(ridt, &t);
-        content_get(ridv, &v);
+        /* The two versions usually share most of their delta chain */
+        content_batch_init(&pair);
+        content_batch_add(&pair, ridt);
+        content_batch_add(&pair, ridv);
+        content_batch_next(&pair, &t);
+        content_batch_next(&pair, &v);
+        content_batch_reset(&pair);
         rc = merge_3way(&v, zFullPath, &t, &r, mergeFlags);
         if( rc>=0 ){
           if( !dryRunFlag ){
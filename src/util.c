@@ -183,7 +183,7 @@ static int safeCmdStrTest = 0;
 ** If an unsafe string is seen, either abort (default) or print
 ** a warning message (if safeCmdStrTest is true).
 */
-static void fossil_assert_safe_command_string(const char *z){
+void fossil_assert_safe_command_string(const char *z){
   int unsafe = 0;
 #ifndef _WIN32
   /* Unix */
@@ -427,6 +427,24 @@ void fossil_cpu_times(sqlite3_uint64 *piUser, sqlite3_uint64 *piKernel){
 #endif
 }
 
+/*
+** Return the current wall-clock time as milliseconds since the
+** Julian epoch.
+*/
+sqlite3_int64 current_time_in_milliseconds(void){
+  static sqlite3_vfs *clockVfs = 0;
+  sqlite3_int64 t;
+  if( clockVfs==0 ) clockVfs = sqlite3_vfs_find(0);
+  if( clockVfs->iVersion>=2 && clockVfs->xCurrentTimeInt64!=0 ){
+    clockVfs->xCurrentTimeInt64(clockVfs, &t);
+  }else{
+    double r;
+    clockVfs->xCurrentTime(clockVfs, &r);
+    t = (sqlite3_int64)(r*86400000.0);
+  }
+  return t;
+}
+
 /*
 ** Internal helper type for fossil_timer_xxx().
  */
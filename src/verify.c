@@ -34,8 +34,14 @@
 **
 ** Panic if anything goes wrong.  If this procedure returns it means
 ** that everything is OK.
+**
+** If isLocal is true, the hash of the record was computed by this
+** repository and the faster hname_verify_hash_local() is enough.
+** Otherwise the hash may have been claimed by another machine, as
+** happens during a clone, and this is the only check it gets, so it
+** must be done with collision detection.
 */
-static void verify_rid(int rid){
+static void verify_rid(int rid, int isLocal){
   Blob uuid, content;
   if( content_size(rid, 0)<0 ){
     return;  /* No way to verify phantoms */
@@ -46,7 +52,13 @@ static void verify_rid(int rid){
     fossil_fatal("not a valid rid: %d", rid);
   }
   if( content_get(rid, &content) ){
-    if( !hname_verify_hash(&content, blob_buffer(&uuid), blob_size(&uuid)) ){
+    int id;
+    if( isLocal ){
+      id = hname_verify_hash_local(&content, blob_str(&uuid), blob_size(&uuid));
+    }else{
+      id = hname_verify_hash(&content, blob_str(&uuid), blob_size(&uuid));
+    }
+    if( !id ){
       fossil_panic("hash of rid %d does not match its uuid (%b)",
                     rid, &uuid);
     }
@@ -57,9 +69,11 @@ static void verify_rid(int rid){
 
 /*
 ** The following bag holds the rid for every record that needs
-** to be verified.
+** to be verified.  The localHash bag holds those among them whose hash
+** was computed by this repository.
 */
 static Bag toVerify;
+static Bag localHash;
 static int inFinalVerify = 0;
 
 /*
@@ -74,10 +88,11 @@ static int verify_at_commit(void){
   inFinalVerify = 1;
   rid = bag_first(&toVerify);
   while( rid>0 ){
-    verify_rid(rid);
+    verify_rid(rid, bag_find(&localHash, rid));
     rid = bag_next(&toVerify, rid);
   }
   bag_clear(&toVerify);
+  bag_clear(&localHash);
   inFinalVerify = 0;
   return 0;
 }
@@ -101,30 +116,257 @@ void verify_before_commit(int rid){
   }
 }
 
+/*
+** Like verify_before_commit(), but the hash of rid was just computed by
+** content_put() rather than received from somewhere else.
+*/
+void verify_before_commit_local(int rid){
+  verify_before_commit(rid);
+  if( rid>0 ){
+    bag_insert(&localHash, rid);
+  }
+}
+
 /*
 ** Cancel all pending verification operations.
 */
 void verify_cancel(void){
   bag_clear(&toVerify);
+  bag_clear(&localHash);
+}
+
+#if INTERFACE
+/*
+** The outcome of checking a single artifact using verify_all_parallel()
+*/
+struct VerifyResult {
+  int sz;                     /* Size of the reconstructed content */
+  u8 eStatus;                 /* One of the VERIFY_* values below */
+  u8 isControl;               /* True if it looks like a control artifact */
+};
+#define VERIFY_UNCHECKED  0   /* Not checked.  Use content_get() instead */
+#define VERIFY_OK         1   /* The content matches its hash */
+#define VERIFY_BADHASH    2   /* The content does not match its hash */
+#endif
+
+/*
+** Queues and results shared by verify_all_parallel() and its
+** helper threads
+*/
+typedef struct VerifyPool VerifyPool;
+struct VerifyPool {
+  WorkQueue *pTodo;           /* ContentTree objects waiting to be checked */
+  WorkQueue *pDone;           /* ContentTree objects that have been checked */
+  VerifyResult *aRes;         /* Results indexed by rid */
+};
+
+/*
+** Number of artifacts that a helper thread hashes together
+*/
+#define VERIFY_BATCH 8
+
+/*
+** Artifacts that have been expanded by a helper thread and are waiting
+** to be hashed.  Hashing several at once lets hname_verify_hash_multi()
+** compute more than one SHA3 hash at a time.
+*/
+typedef struct VerifyBatch VerifyBatch;
+struct VerifyBatch {
+  VerifyPool *pPool;          /* Where to record the results */
+  int n;                      /* Number of artifacts in the batch */
+  ContentTreeNode *apNode[VERIFY_BATCH];  /* The artifacts */
+  Blob aContent[VERIFY_BATCH];            /* Their content */
+};
+
+/*
+** Check the hashes of all artifacts in a batch and record the
+** outcomes.  Each rid belongs to only one delta tree, so no two threads
+** ever write the same aRes[] entry.
+*/
+static void verify_batch_flush(VerifyBatch *pBatch){
+  Blob *apContent[VERIFY_BATCH];
+  const char *azHash[VERIFY_BATCH];
+  int aId[VERIFY_BATCH];
+  int i;
+  for(i=0; i<pBatch->n; i++){
+    apContent[i] = &pBatch->aContent[i];
+    azHash[i] = pBatch->apNode[i]->zUuid;
+  }
+  hname_verify_hash_multi(pBatch->n, apContent, azHash, aId);
+  for(i=0; i<pBatch->n; i++){
+    VerifyResult *pRes = &pBatch->pPool->aRes[pBatch->apNode[i]->rid];
+    pRes->sz = blob_size(&pBatch->aContent[i]);
+    pRes->eStatus = aId[i]!=HNAME_ERROR ? VERIFY_OK : VERIFY_BADHASH;
+    pRes->isControl = looks_like_control_artifact(&pBatch->aContent[i]);
+    blob_reset(&pBatch->aContent[i]);
+  }
+  pBatch->n = 0;
+}
+
+/*
+** Callback from content_tree_expand().  Add one artifact to the batch.
+*/
+static void verify_expanded(
+  void *pArg,
+  ContentTreeNode *pNode,
+  Blob *pContent
+){
+  VerifyBatch *pBatch = (VerifyBatch*)pArg;
+  if( pContent==0 ) return;
+  pBatch->apNode[pBatch->n] = pNode;
+  pBatch->aContent[pBatch->n] = *pContent;
+  if( ++pBatch->n==VERIFY_BATCH ) verify_batch_flush(pBatch);
+}
+
+/*
+** Body of a verify helper thread.  This runs in a helper thread and
+** so must not use the database.
+*/
+static void verify_worker(void *pArg){
+  VerifyBatch batch;
+  ContentTree *p;
+  batch.pPool = (VerifyPool*)pArg;
+  batch.n = 0;
+  while( (p = workqueue_pop(batch.pPool->pTodo))!=0 ){
+    content_tree_expand(p, verify_expanded, &batch);
+    verify_batch_flush(&batch);
+    workqueue_push(batch.pPool->pDone, p, 0);
+  }
+}
+
+/*
+** Finish with a delta tree that has come back from a helper thread.
+** Return the number of artifacts that it held.
+*/
+static int verify_tree_done(ContentTree *p){
+  int n = p->n;
+  content_tree_free(p);
+  return n;
+}
+
+/*
+** Reconstruct every artifact in the repository and check its hash,
+** using nWorker helper threads to decompress, apply deltas and hash.
+** The main thread only reads the database.  Each delta tree is
+** handled by a single thread, so the speedup is limited when most of
+** the content is in a few very long delta chains.
+**
+** Return an array of results indexed by rid, with one more entry than
+** the largest rid in the repository.  The caller must fossil_free() it.
+** Artifacts that could not be reconstructed this way (phantoms,
+** deltas whose basis is missing and so forth) are left with a status
+** of VERIFY_UNCHECKED so that the caller can deal with them using
+** content_get() in the usual way.
+**
+** If bProgress is true, show progress on standard output.  Return NULL
+** if no helper threads could be started.
+*/
+VerifyResult *verify_all_parallel(int nWorker, int bProgress){
+  VerifyPool pool;
+  FossilThread **apThread;
+  ContentTree *p;
+  Stmt q;
+  int mxRid, nTotal, nThread = 0, nPending = 0, nDone = 0;
+  int i;
+
+  mxRid = db_int(0, "SELECT max(rid) FROM blob");
+  nTotal = db_int(0, "SELECT count(*) FROM blob WHERE size>=0");
+  pool.aRes = fossil_malloc( sizeof(pool.aRes[0])*(mxRid+1) );
+  memset(pool.aRes, 0, sizeof(pool.aRes[0])*(mxRid+1));
+  pool.pTodo = workqueue_new(nWorker*2, 0);
+  pool.pDone = workqueue_new(nWorker*4, 0);
+  apThread = fossil_malloc( sizeof(apThread[0])*nWorker );
+  for(i=0; i<nWorker; i++){
+    apThread[nThread] = fossil_thread_start(verify_worker, &pool);
+    if( apThread[nThread] ) nThread++;
+  }
+  if( nThread>0 ){
+    db_prepare(&q,
+       "SELECT rid FROM blob"
+       " WHERE size>=0 AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid)"
+       " ORDER BY rid"
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      p = content_tree_load(db_column_int(&q, 0), 0);
+      if( p==0 ) continue;
+      nPending++;
+      while( !workqueue_try_push(pool.pTodo, p, 0) ){
+        nDone += verify_tree_done(workqueue_pop(pool.pDone));
+        nPending--;
+      }
+      while( (p = workqueue_try_pop(pool.pDone))!=0 ){
+        nDone += verify_tree_done(p);
+        nPending--;
+      }
+      if( bProgress ){
+        fossil_print("  %d/%d\r", nDone, nTotal);
+        fflush(stdout);
+      }
+    }
+    db_finalize(&q);
+    workqueue_close(pool.pTodo);
+    while( nPending>0 ){
+      nDone += verify_tree_done(workqueue_pop(pool.pDone));
+      nPending--;
+      if( bProgress ){
+        fossil_print("  %d/%d\r", nDone, nTotal);
+        fflush(stdout);
+      }
+    }
+  }
+  workqueue_close(pool.pTodo);
+  for(i=0; i<nThread; i++) fossil_thread_join(apThread[i]);
+  fossil_free(apThread);
+  workqueue_free(pool.pTodo);
+  workqueue_free(pool.pDone);
+  if( nThread==0 ){
+    fossil_free(pool.aRes);
+    return 0;
+  }
+  return pool.aRes;
 }
 
 /*
 ** COMMAND: test-verify-all
 **
 ** Verify all records in the repository.
+**
+** Options:
+**
+**    --jobs N           Use N helper threads to reconstruct and hash
+**                       artifacts.  "auto" means one per CPU.  Default: 1
 */
 void verify_all_cmd(void){
   Stmt q;
   int cnt = 0;
+  int nJob;
+  VerifyResult *aRes = 0;
+  sqlite3_int64 tmStart;
+  double rElapsed;
+  i64 szTotal;
+  nJob = fossil_thread_count(find_option("jobs",0,1), 1);
   db_must_be_within_tree();
-  db_prepare(&q, "SELECT rid FROM blob");
+  tmStart = current_time_in_milliseconds();
+  if( nJob>1 ){
+    aRes = verify_all_parallel(nJob, 1);
+  }
+  db_prepare(&q, "SELECT rid FROM blob ORDER BY rid");
   while( db_step(&q)==SQLITE_ROW ){
     int rid = db_column_int(&q, 0);
-    verify_before_commit(rid);
     cnt++;
-    assert( bag_count(&toVerify)==cnt );
+    if( aRes && aRes[rid].eStatus==VERIFY_OK ) continue;
+    verify_before_commit(rid);
   }
   db_finalize(&q);
   verify_at_commit();
   assert( bag_count(&toVerify)==0 );
+  fossil_free(aRes);
+  rElapsed = (current_time_in_milliseconds() - tmStart)/1000.0;
+  szTotal = db_int64(0, "SELECT sum(size) FROM blob WHERE size>0");
+  fossil_print("%d artifacts, %lld bytes verified in %.3f seconds",
+               cnt, szTotal, rElapsed);
+  if( rElapsed>0.0 ){
+    fossil_print(", %.1f MB/s", szTotal/(rElapsed*1000000.0));
+  }
+  fossil_print("\n");
 }
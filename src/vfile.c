@@ -232,7 +232,7 @@ void vfile_check_signature(int vid, unsigned int cksigFlags){
       const char *zUuid = db_column_text(&q, 5);
       int nUuid = db_column_bytes(&q, 5);
       assert( origSize==currentSize );
-      if( hname_verify_file_hash(zName, zUuid, nUuid) ) chnged = 0;
+      if( hname_verify_file_hash_local(zName, zUuid, nUuid) ) chnged = 0;
     }else if( (chnged==0 || chnged==2 || chnged==4)
            && (useMtime==0 || currentMtime!=oldMtime) ){
       /* For files that were formerly believed to be unchanged or that were
@@ -242,7 +242,7 @@ void vfile_check_signature(int vid, unsigned int cksigFlags){
       const char *zUuid = db_column_text(&q, 5);
       int nUuid = db_column_bytes(&q, 5);
       assert( origSize==currentSize );
-      if( !hname_verify_file_hash(zName, zUuid, nUuid) ) chnged = 1;
+      if( !hname_verify_file_hash_local(zName, zUuid, nUuid) ) chnged = 1;
     }
     if( (cksigFlags & CKSIG_SETMTIME) && (chnged==0 || chnged==2 || chnged==4)){
       i64 desiredMtime;
@@ -292,6 +292,7 @@ void vfile_to_disk(
 ){
   Stmt q;
   Blob content;
+  ContentBatch files;    /* Content of the files to be written */
   int nRepos = strlen(g.zLocalRoot);
 
   if( vid>0 && id==0 ){
@@ -306,19 +307,30 @@ void vfile_to_disk(
                    " WHERE id=%d AND mrid>0",
                    g.zLocalRoot, id);
   }
+
+  /* Queue up the content of every file first, so that it can be
+  ** fetched in batches that share the work of expanding deltas.  Every
+  ** row is queued, and every row takes its content back out below,
+  ** even if the file cannot be written.  Whether or not a file is in
+  ** the way of a path can change as earlier files are written. */
+  content_batch_init(&files);
+  while( db_step(&q)==SQLITE_ROW ){
+    content_batch_add(&files, db_column_int(&q, 2));
+  }
+  db_reset(&q);
   while( db_step(&q)==SQLITE_ROW ){
-    int id, rid, isExe, isLink;
+    int id, isExe, isLink;
     const char *zName;
 
     id = db_column_int(&q, 0);
     zName = db_column_text(&q, 1);
-    rid = db_column_int(&q, 2);
     isExe = db_column_int(&q, 3);
     isLink = db_column_int(&q, 4);
+    content_batch_next(&files, &content);
     if( file_unsafe_in_tree_path(zName) ){
+      blob_reset(&content);
       continue;
     }
-    content_get(rid, &content);
     if( file_is_the_same(&content, zName) ){
       blob_reset(&content);
       if( file_setexe(zName, isExe) ){
@@ -362,6 +374,7 @@ void vfile_to_disk(
                   file_mtime(zName, RepoFILE), id);
   }
   db_finalize(&q);
+  content_batch_reset(&files);
 }
 
 /*
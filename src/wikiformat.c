@@ -2602,13 +2602,14 @@ static void html_tagstack_pop(HtmlTagStack *p, Blob *pBlob, int eEnd){
 ** to allow the Pikchr-generated SVG through, it must be surrounded by
 ** the nonce.
 */
+static char *zSafeNonce = 0;
 const char *safe_html_nonce(int bGenerate){
-  static char *zNonce = 0;
-  if( zNonce==0 && bGenerate ){
-    zNonce = db_text(0, "SELECT '<!--'||hex(randomblob(32))||'-->';");
+  if( zSafeNonce==0 && bGenerate ){
+    zSafeNonce = db_text(0, "SELECT '<!--'||hex(randomblob(32))||'-->';");
   }
-  return zNonce;
+  return zSafeNonce;
 }
+
 #define SAFE_NONCE_SIZE (4+64+3)
 
 /*
@@ -2737,6 +2738,16 @@ void safe_html_context(int eTrust){
   safeHtmlEnable = (strchr(zSafeHtmlSetting,cPerm)==0);
 }
 
+/*
+** Forget the safe-HTML nonce and trust context of the previous page,
+** so that a server process renders each request from a clean state.
+*/
+void wiki_reset_request(void){
+  fossil_free(zSafeNonce);
+  zSafeNonce = 0;
+  safeHtmlEnable = 1;
+}
+
 /*
 ** SETTING: safe-html        width=8
 ** This setting controls whether or not unsafe HTML elements
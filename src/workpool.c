@@ -0,0 +1,463 @@
+/*
+** Copyright (c) 2020 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+**
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a minimal set of primitives for running work on
+** helper threads: starting and joining threads, a bounded, blocking
+** FIFO queue for passing work between threads, and a pipeline that
+** runs jobs on helper threads but hands back the results in order.
+**
+** Fossil itself is single-threaded.  In particular, the SQLite library
+** is compiled with SQLITE_THREADSAFE=0 and so only the main thread may
+** ever touch the database.  Helper threads must confine themselves to
+** pure computation (decompression, delta application, hashing and the
+** like) on memory that the main thread has handed to them through a
+** WorkQueue.
+**
+** Threads are only available on unix builds that have pthreads.  On
+** other builds fossil_thread_start() always fails and callers are
+** expected to fall back to doing the work serially.  A WorkQueue still
+** works without threads, though it never blocks.
+*/
+#include "config.h"
+#include "workpool.h"
+#include <assert.h>
+
+#if !defined(_WIN32) && defined(HAVE_PTHREAD_CREATE)
+# define FOSSIL_HAVE_THREADS 1
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+#if INTERFACE
+/*
+** Opaque objects
+*/
+typedef struct FossilThread FossilThread;
+typedef struct WorkQueue WorkQueue;
+typedef struct WorkPipe WorkPipe;
+#endif
+
+/*
+** A helper thread
+*/
+struct FossilThread {
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_t id;               /* The thread */
+#endif
+  void (*xRun)(void*);        /* Routine run by the thread */
+  void *pArg;                 /* Argument to xRun */
+};
+
+/*
+** A bounded FIFO queue of pointers.
+**
+** The queue holds at most mxEntry entries.  Each entry also has a cost
+** in bytes and the queue will not accept a new entry if that would
+** push the total cost above mxByte, unless the queue is empty.  Hence
+** a single entry that is larger than mxByte can still pass through.
+*/
+struct WorkQueue {
+  int mxEntry;                /* Maximum number of entries */
+  i64 mxByte;                 /* Maximum total cost.  0 means no limit */
+  int nEntry;                 /* Current number of entries */
+  i64 nByte;                  /* Current total cost of all entries */
+  int iHead;                  /* Index of the oldest entry in aEntry[] */
+  int isClosed;               /* True if no more entries will be added */
+  struct WorkQueueEntry {
+    void *p;                    /* The entry */
+    i64 nByte;                  /* Cost of this entry */
+  } *aEntry;                  /* Circular buffer of entries */
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_t mutex;      /* Mutex protecting this object */
+  pthread_cond_t notEmpty;    /* Signaled when an entry is added */
+  pthread_cond_t notFull;     /* Signaled when an entry is removed */
+#endif
+};
+
+/*
+** Return true if this build is able to run helper threads.
+*/
+int fossil_threads_available(void){
+#ifdef FOSSIL_HAVE_THREADS
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/*
+** Return the number of CPUs that are online, or 1 if that cannot be
+** determined.
+*/
+int fossil_cpu_count(void){
+  int n = 1;
+#if defined(FOSSIL_HAVE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if( n<1 ) n = 1;
+#endif
+  return n;
+}
+
+/*
+** Convert the value of a --jobs command-line option (or similar) into
+** the number of helper threads to use.  A NULL or empty value gives
+** nDflt.  The special value "auto" means one thread per CPU.  The result
+** is always 1 if threads are not available.
+*/
+int fossil_thread_count(const char *zJobs, int nDflt){
+  int n = nDflt;
+  if( zJobs && zJobs[0] ){
+    n = fossil_strcmp(zJobs, "auto")==0 ? fossil_cpu_count() : atoi(zJobs);
+  }
+  if( n<1 || !fossil_threads_available() ) n = 1;
+  if( n>256 ) n = 256;
+  return n;
+}
+
+#ifdef FOSSIL_HAVE_THREADS
+/*
+** Entry point for all helper threads.
+*/
+static void *fossil_thread_main(void *pArg){
+  FossilThread *p = (FossilThread*)pArg;
+  p->xRun(p->pArg);
+  return 0;
+}
+#endif
+
+/*
+** Start a new thread running xRun(pArg).  Return a handle for the new
+** thread, which must eventually be passed to fossil_thread_join().
+** Return NULL if the thread could not be started.
+*/
+FossilThread *fossil_thread_start(void (*xRun)(void*), void *pArg){
+#ifdef FOSSIL_HAVE_THREADS
+  FossilThread *p = fossil_malloc( sizeof(*p) );
+  p->xRun = xRun;
+  p->pArg = pArg;
+  if( pthread_create(&p->id, 0, fossil_thread_main, p)==0 ){
+    return p;
+  }
+  fossil_free(p);
+#endif
+  return 0;
+}
+
+/*
+** Wait for a thread to finish and then free its handle.  A NULL
+** argument is a harmless no-op.
+*/
+void fossil_thread_join(FossilThread *p){
+  if( p==0 ) return;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_join(p->id, 0);
+#endif
+  fossil_free(p);
+}
+
+/*
+** Create a new WorkQueue that holds up to mxEntry entries with a total
+** cost of no more than mxByte bytes.
+*/
+WorkQueue *workqueue_new(int mxEntry, i64 mxByte){
+  WorkQueue *q = fossil_malloc( sizeof(*q) );
+  memset(q, 0, sizeof(*q));
+  if( mxEntry<1 ) mxEntry = 1;
+  q->mxEntry = mxEntry;
+  q->mxByte = mxByte;
+  q->aEntry = fossil_malloc( sizeof(q->aEntry[0])*mxEntry );
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_init(&q->mutex, 0);
+  pthread_cond_init(&q->notEmpty, 0);
+  pthread_cond_init(&q->notFull, 0);
+#endif
+  return q;
+}
+
+/*
+** Free a WorkQueue.  No other thread may be using it.
+*/
+void workqueue_free(WorkQueue *q){
+  if( q==0 ) return;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->notEmpty);
+  pthread_cond_destroy(&q->notFull);
+#endif
+  fossil_free(q->aEntry);
+  fossil_free(q);
+}
+
+#ifdef FOSSIL_HAVE_THREADS
+# define workqueue_enter(q)  pthread_mutex_lock(&(q)->mutex)
+# define workqueue_leave(q)  pthread_mutex_unlock(&(q)->mutex)
+#else
+# define workqueue_enter(q)
+# define workqueue_leave(q)
+#endif
+
+/*
+** Return true if q has room for an entry of cost nByte.
+*/
+static int workqueue_has_room(WorkQueue *q, i64 nByte){
+  if( q->nEntry>=q->mxEntry ) return 0;
+  if( q->nEntry>0 && q->mxByte>0 && q->nByte+nByte>q->mxByte ) return 0;
+  return 1;
+}
+
+/*
+** Append p to q.  The caller must hold the mutex and there must
+** be a free slot in q->aEntry[].
+*/
+static void workqueue_append(WorkQueue *q, void *p, i64 nByte){
+  int i = (q->iHead + q->nEntry) % q->mxEntry;
+  assert( q->nEntry<q->mxEntry );
+  q->aEntry[i].p = p;
+  q->aEntry[i].nByte = nByte;
+  q->nEntry++;
+  q->nByte += nByte;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_cond_signal(&q->notEmpty);
+#endif
+}
+
+/*
+** Remove and return the oldest entry of q.  The caller must hold the
+** mutex and q must not be empty.
+*/
+static void *workqueue_remove(WorkQueue *q){
+  void *p;
+  assert( q->nEntry>0 );
+  p = q->aEntry[q->iHead].p;
+  q->nByte -= q->aEntry[q->iHead].nByte;
+  q->iHead = (q->iHead+1) % q->mxEntry;
+  q->nEntry--;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_cond_broadcast(&q->notFull);
+#endif
+  return p;
+}
+
+/*
+** Add entry p with a cost of nByte bytes to the end of q, waiting for
+** room if necessary.  Without threads, the queue simply grows.
+*/
+void workqueue_push(WorkQueue *q, void *p, i64 nByte){
+  workqueue_enter(q);
+#ifdef FOSSIL_HAVE_THREADS
+  while( !workqueue_has_room(q, nByte) ){
+    pthread_cond_wait(&q->notFull, &q->mutex);
+  }
+#else
+  if( q->nEntry>=q->mxEntry ){
+    int i, mxNew = q->mxEntry*2;
+    struct WorkQueueEntry *aNew = fossil_malloc( sizeof(aNew[0])*mxNew );
+    for(i=0; i<q->nEntry; i++){
+      aNew[i] = q->aEntry[(q->iHead+i) % q->mxEntry];
+    }
+    fossil_free(q->aEntry);
+    q->aEntry = aNew;
+    q->mxEntry = mxNew;
+    q->iHead = 0;
+  }
+#endif
+  workqueue_append(q, p, nByte);
+  workqueue_leave(q);
+}
+
+/*
+** Add entry p with a cost of nByte bytes to the end of q if there is
+** room.  Return true on success and false if the queue is full.
+*/
+int workqueue_try_push(WorkQueue *q, void *p, i64 nByte){
+  int rc = 0;
+  workqueue_enter(q);
+  if( workqueue_has_room(q, nByte) ){
+    workqueue_append(q, p, nByte);
+    rc = 1;
+  }
+  workqueue_leave(q);
+  return rc;
+}
+
+/*
+** Remove and return the oldest entry of q, waiting for one to arrive
+** if necessary.  Return NULL if q is empty and has been closed.
+*/
+void *workqueue_pop(WorkQueue *q){
+  void *p = 0;
+  workqueue_enter(q);
+#ifdef FOSSIL_HAVE_THREADS
+  while( q->nEntry==0 && !q->isClosed ){
+    pthread_cond_wait(&q->notEmpty, &q->mutex);
+  }
+#endif
+  if( q->nEntry>0 ) p = workqueue_remove(q);
+  workqueue_leave(q);
+  return p;
+}
+
+/*
+** Remove and return the oldest entry of q, or return NULL at once if
+** q is empty.
+*/
+void *workqueue_try_pop(WorkQueue *q){
+  void *p = 0;
+  workqueue_enter(q);
+  if( q->nEntry>0 ) p = workqueue_remove(q);
+  workqueue_leave(q);
+  return p;
+}
+
+/*
+** Mark q as closed.  Once the remaining entries have been removed,
+** workqueue_pop() returns NULL rather than waiting.
+*/
+void workqueue_close(WorkQueue *q){
+  workqueue_enter(q);
+  q->isClosed = 1;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_cond_broadcast(&q->notEmpty);
+#endif
+  workqueue_leave(q);
+}
+
+/*
+** A WorkPipe runs the same routine on a sequence of jobs using helper
+** threads, and returns the finished jobs to the main thread in the
+** order in which they were submitted.  This suits producing output
+** that is made up of independently computed pieces, such as the
+** compressed entries of a ZIP archive.
+*/
+struct WorkPipe {
+  void (*xWork)(void*);       /* Routine applied to every job */
+  WorkQueue *pTodo;           /* Jobs waiting for a helper thread */
+  WorkQueue *pDone;           /* Finished jobs, in order of completion */
+  int nThread;                /* Number of helper threads */
+  FossilThread **apThread;    /* The helper threads */
+  int mxPending;              /* Most jobs that may be in progress */
+  int nPending;               /* Jobs submitted but not yet returned */
+  int iHead;                  /* Index in aPending[] of the oldest job */
+  struct WorkPipeJob {
+    void *p;                    /* The job */
+    int isDone;                 /* True if it has come back from a thread */
+  } *aPending;                /* Circular buffer of jobs in submit order */
+};
+
+/*
+** Body of a WorkPipe helper thread.
+*/
+static void workpipe_worker(void *pArg){
+  WorkPipe *pPipe = (WorkPipe*)pArg;
+  void *p;
+  while( (p = workqueue_pop(pPipe->pTodo))!=0 ){
+    pPipe->xWork(p);
+    workqueue_push(pPipe->pDone, p, 0);
+  }
+}
+
+/*
+** Start a WorkPipe with nThread helper threads that apply xWork to
+** each job.  No more than mxPending jobs may be submitted and not yet
+** returned at any one time.  Return NULL if no helper thread could be
+** started, in which case the caller should do the work itself.
+*/
+WorkPipe *workpipe_new(int nThread, int mxPending, void (*xWork)(void*)){
+  WorkPipe *p;
+  int i;
+  if( nThread<1 ) return 0;
+  if( mxPending<nThread ) mxPending = nThread;
+  p = fossil_malloc( sizeof(*p) );
+  memset(p, 0, sizeof(*p));
+  p->xWork = xWork;
+  p->mxPending = mxPending;
+  p->pTodo = workqueue_new(mxPending, 0);
+  p->pDone = workqueue_new(mxPending, 0);
+  p->aPending = fossil_malloc( sizeof(p->aPending[0])*mxPending );
+  p->apThread = fossil_malloc( sizeof(p->apThread[0])*nThread );
+  for(i=0; i<nThread; i++){
+    p->apThread[p->nThread] = fossil_thread_start(workpipe_worker, p);
+    if( p->apThread[p->nThread] ) p->nThread++;
+  }
+  if( p->nThread==0 ){
+    workpipe_free(p);
+    return 0;
+  }
+  return p;
+}
+
+/*
+** Return true if no more jobs can be submitted to p until some
+** have been collected with workpipe_pop().
+*/
+int workpipe_full(WorkPipe *p){
+  return p->nPending>=p->mxPending;
+}
+
+/*
+** Submit a job.  p must not be full.
+*/
+void workpipe_push(WorkPipe *p, void *pJob){
+  int i;
+  assert( !workpipe_full(p) );
+  i = (p->iHead + p->nPending) % p->mxPending;
+  p->aPending[i].p = pJob;
+  p->aPending[i].isDone = 0;
+  p->nPending++;
+  workqueue_push(p->pTodo, pJob, 0);
+}
+
+/*
+** Return the oldest job that has been submitted but not yet returned,
+** once it is finished.  If bWait is true, wait for it to finish.
+** Otherwise return NULL if it is still in progress.  Return NULL if
+** there are no jobs left.
+*/
+void *workpipe_pop(WorkPipe *p, int bWait){
+  void *pJob;
+  while( p->nPending>0 && !p->aPending[p->iHead].isDone ){
+    int i;
+    pJob = bWait ? workqueue_pop(p->pDone) : workqueue_try_pop(p->pDone);
+    if( pJob==0 ) return 0;
+    for(i=0; p->aPending[(p->iHead+i) % p->mxPending].p!=pJob; i++){
+      assert( i<p->nPending );
+    }
+    p->aPending[(p->iHead+i) % p->mxPending].isDone = 1;
+  }
+  if( p->nPending==0 ) return 0;
+  pJob = p->aPending[p->iHead].p;
+  p->iHead = (p->iHead+1) % p->mxPending;
+  p->nPending--;
+  return pJob;
+}
+
+/*
+** Stop the helper threads and free p.  Every job that was submitted
+** must have been collected first.
+*/
+void workpipe_free(WorkPipe *p){
+  int i;
+  if( p==0 ) return;
+  assert( p->nPending==0 );
+  workqueue_close(p->pTodo);
+  for(i=0; i<p->nThread; i++) fossil_thread_join(p->apThread[i]);
+  workqueue_free(p->pTodo);
+  workqueue_free(p->pDone);
+  fossil_free(p->apThread);
+  fossil_free(p->aPending);
+  fossil_free(p);
+}
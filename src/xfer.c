@@ -298,6 +298,50 @@ static void xfer_accept_compressed_file(
   blob_reset(&content);
 }
 
+/*
+** The aToken[0..nToken-1] blob array is a parse of a "cpack" line
+** message.  The content of the pack is a sequence of "cfile" cards,
+** each of which is accepted as if it had been sent on its own.
+**
+**      cpack SIZE \n CONTENT
+**
+** Return the number of artifacts received.
+*/
+static int xfer_accept_clone_pack(Xfer *pXfer){
+  Blob *pIn = pXfer->pIn;
+  Blob pack;
+  i64 n;
+  int nRcvd = 0;
+
+  if( pXfer->nToken!=2
+   || !blob_is_int64(&pXfer->aToken[1], &n)
+   || n<0
+   || n>blob_size(pIn)-blob_tell(pIn)
+  ){
+    blob_appendf(&pXfer->err, "malformed cpack line");
+    return 0;
+  }
+  blob_zero(&pack);
+  blob_extract(pIn, (int)n, &pack);
+  pXfer->pIn = &pack;
+  while( blob_size(&pXfer->err)==0 && blob_line(&pack, &pXfer->line) ){
+    pXfer->nToken = blob_tokenize(&pXfer->line, pXfer->aToken,
+                                  count(pXfer->aToken));
+    if( pXfer->nToken>0 ){
+      if( blob_eq(&pXfer->aToken[0], "cfile") ){
+        xfer_accept_compressed_file(pXfer, 0, 0);
+        nRcvd++;
+      }else{
+        blob_appendf(&pXfer->err, "malformed cpack content");
+      }
+    }
+    blobarray_reset(pXfer->aToken, pXfer->nToken);
+    blob_reset(&pXfer->line);
+  }
+  pXfer->pIn = pIn;
+  return nRcvd;
+}
+
 /*
 ** The aToken[0..nToken-1] blob array is a parse of a "uvfile" line
 ** message.  This routine finishes parsing that message and adds the
@@ -687,6 +731,106 @@ static void send_compressed_file(Xfer *pXfer, int rid){
   db_reset(&q1);
 }
 
+/*
+** Return true if the artifacts that the client asks for can be sent to
+** it in packs.  Packs never hold private artifacts.
+*/
+static int clone_pack_ok(Xfer *pXfer){
+  return pXfer->syncPrivate==0 && pXfer->remoteVersion>=20000;
+}
+
+/*
+** Return a summary of the BLOB and DELTA rows for sequence numbers
+** iFirst through iEnd-1.  Space to hold the result comes from
+** fossil_malloc().
+*/
+static char *clone_pack_summary(int iFirst, int iEnd){
+  return db_text(0,
+    "SELECT printf('%%d-%%d-%%d-%%d-%%d-%%d',"
+    "              count(*), sum(size), sum(length(content)),"
+    "              sum(coalesce(srcid,0)),"
+    "              sum(rid IN (SELECT rid FROM private)),"
+    "              sum(uuid IN (SELECT uuid FROM shun)))"
+    "  FROM blob LEFT JOIN delta USING(rid)"
+    " WHERE rid>=%d AND rid<%d",
+    iFirst, iEnd
+  );
+}
+
+/*
+** Send a "cpack" card holding a "cfile" card for every public artifact
+** with a sequence number from iFirst up to at most mxSeqno.  Return the
+** sequence number that follows the last artifact sent, or iFirst if
+** the pack does not fit in this reply and should begin the next one.
+**
+** A pack is closed once it holds at least one quarter of max-download
+** bytes, so that a few whole packs fit in every reply.  Each reply
+** thus ends where a pack ends, and the next reply asks for a pack that
+** begins there.  Every client that clones the repository asks for the
+** same packs, and the packs can be taken from the cache.  A cached pack
+** is only used if a summary of the BLOB and DELTA rows that it was built
+** from still matches, so a pack is built again whenever one of its
+** artifacts is redeltified, shunned, purged or made public.
+**
+** A pack is only started if it fits in what is left of max-download,
+** unless bFirst is true, meaning that this reply does not yet hold any
+** artifacts.  A pack that is cut short by the "max-download-time" is
+** not cached.  One that is cut short by mxSeqno is, because mxSeqno is
+** the end of a range that clients choose the same way every time, or
+** the last artifact in the repository.
+*/
+static int send_clone_pack(Xfer *pXfer, int iFirst, int mxSeqno, int bFirst){
+  i64 mxPack = pXfer->mxSend/4;
+  i64 mxSize = (i64)pXfer->mxSend - blob_size(pXfer->pOut);
+  Blob pack;
+  int rid = iFirst;
+  int bKeep = 0;           /* Keep the cached pack for other clients */
+
+  if( mxPack<1 ) mxPack = 1;
+  blob_zero(&pack);
+  if( cache_clonepack_read(iFirst, clone_pack_summary, &pack, &rid) ){
+    if( rid-1>mxSeqno ){
+      /* Reaches past what the client asked for */
+      blob_reset(&pack);
+      rid = iFirst;
+      bKeep = 1;
+    }else if( (i64)blob_size(&pack)>pXfer->mxSend ){
+      /* Built for a larger max-download */
+      blob_reset(&pack);
+      rid = iFirst;
+    }else if( !bFirst && (i64)blob_size(&pack)>mxSize ){
+      blob_reset(&pack);
+      return iFirst;
+    }
+  }
+  if( blob_size(&pack)==0 ){
+    i64 tmStart = current_time_in_milliseconds();
+    Blob *pOut = pXfer->pOut;
+    int bCut = 0;
+    if( !bFirst && mxSize<mxPack ) return iFirst;
+    pXfer->pOut = &pack;
+    for(rid=iFirst; rid<=mxSeqno && (i64)blob_size(&pack)<mxPack; rid++){
+      if( time(NULL)>=pXfer->maxTime ){ bCut = 1; break; }
+      send_compressed_file(pXfer, rid);
+    }
+    pXfer->pOut = pOut;
+    if( rid==iFirst ){
+      blob_reset(&pack);
+      return iFirst;
+    }
+    if( !bCut && !bKeep ){
+      char *zSummary = clone_pack_summary(iFirst, rid);
+      cache_clonepack_write(iFirst, rid, zSummary, &pack,
+                            current_time_in_milliseconds()-tmStart);
+      fossil_free(zSummary);
+    }
+  }
+  blob_appendf(pXfer->pOut, "cpack %lld\n", (i64)blob_size(&pack));
+  blob_append(pXfer->pOut, blob_buffer(&pack), blob_size(&pack));
+  blob_reset(&pack);
+  return rid;
+}
+
 /*
 ** Send the unversioned file identified by zName by generating the
 ** appropriate "uvfile" card.
@@ -754,13 +898,25 @@ static void send_unversioned_file(
 }
 
 /*
-** Send a gimme message for every phantom.
+** Send a gimme message for every phantom, up to maxReq of them.
 **
 ** Except: do not request shunned artifacts.  And do not request
 ** private artifacts if we are not doing a private transfer.
+**
+** If there are more than maxReq phantoms, put up to maxReq more gimme
+** cards in each of the nExtra messages in aExtra[].  Return the number
+** of those messages that were used.
 */
-static void request_phantoms(Xfer *pXfer, int maxReq){
+static int request_phantoms(
+  Xfer *pXfer,           /* Put the first gimme cards in pXfer->pOut */
+  int maxReq,            /* Maximum number of gimme cards per message */
+  Blob *aExtra,          /* Extra messages to fill with gimme cards */
+  int nExtra             /* Number of entries in aExtra[] */
+){
   Stmt q;
+  Blob *pOut = pXfer->pOut;
+  int nUsed = 0;
+  int n = maxReq;
   db_prepare(&q,
     "SELECT uuid FROM phantom CROSS JOIN blob USING(rid) /*scan*/"
     " WHERE NOT EXISTS(SELECT 1 FROM unk WHERE unk.uuid=blob.uuid)"
@@ -768,12 +924,18 @@ static void request_phantoms(Xfer *pXfer, int maxReq){
     (pXfer->syncPrivate ? "" :
          "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)")
   );
-  while( db_step(&q)==SQLITE_ROW && maxReq-- > 0 ){
+  while( db_step(&q)==SQLITE_ROW ){
     const char *zUuid = db_column_text(&q, 0);
-    blob_appendf(pXfer->pOut, "gimme %s\n", zUuid);
+    if( n-- <= 0 ){
+      if( nUsed>=nExtra ) break;
+      pOut = &aExtra[nUsed++];
+      n = maxReq-1;
+    }
+    blob_appendf(pOut, "gimme %s\n", zUuid);
     pXfer->nGimmeSent++;
   }
   db_finalize(&q);
+  return nUsed;
 }
 
 /*
@@ -1055,6 +1217,283 @@ static void send_all(Xfer *pXfer){
   db_finalize(&q);
 }
 
+/*
+** The artifacts that "igot" cards would announce can instead be
+** described by an invertible Bloom lookup table (IBLT).  The client
+** adds each of its unclustered artifacts to the table and sends it in
+** a "pragma reconcile" card.  The server removes each of its own
+** unclustered artifacts from the table.  What is left is the symmetric
+** difference of the two sets, and it can be listed out of the table
+** provided that it is small enough compared to the size of the table.
+**
+** Each artifact is represented by a 64-bit key taken from the first
+** 16 hexadecimal digits of its hash.  The table is divided into three
+** equal parts and each key is added to one cell in each part.  A cell
+** holds the number of keys added less the number removed, the XOR of
+** all of those keys and the XOR of a check value for each key.  A cell
+** with a count of 1 or -1 whose check value matches its key holds
+** exactly one key, which can then be removed from the other two cells
+** that hold it.  Repeating this lists the whole difference unless the
+** table is too small.
+*/
+typedef struct ReconcileCell ReconcileCell;
+struct ReconcileCell {
+  int n;                /* Number of keys added less the number removed */
+  u32 chk;              /* XOR of reconcile_check() of each key */
+  u64 key;              /* XOR of the keys */
+};
+typedef struct Reconcile Reconcile;
+struct Reconcile {
+  int nCell;            /* Number of cells.  A multiple of 3 */
+  ReconcileCell *a;     /* The cells */
+};
+
+/*
+** Number of cells in the first table that a client sends, the largest
+** table that a server accepts, and the size of a cell on the wire
+*/
+#define RECONCILE_NCELL    48
+#define RECONCILE_MXCELL   100000
+#define RECONCILE_CELL_SZ  16
+
+/*
+** Allocate an empty table of nCell cells
+*/
+static Reconcile *reconcile_new(int nCell){
+  Reconcile *p = fossil_malloc( sizeof(*p) );
+  p->nCell = nCell;
+  p->a = fossil_malloc( sizeof(p->a[0])*nCell );
+  memset(p->a, 0, sizeof(p->a[0])*nCell);
+  return p;
+}
+
+/*
+** Free a table obtained from reconcile_new()
+*/
+static void reconcile_free(Reconcile *p){
+  if( p ){
+    fossil_free(p->a);
+    fossil_free(p);
+  }
+}
+
+/*
+** The check value for a key
+*/
+static u32 reconcile_check(u64 key){
+  return (u32)((key*(u64)0x9e3779b97f4a7c15LL)>>32);
+}
+
+/*
+** Add key to the table if iDir is 1 or remove it if iDir is -1
+*/
+static void reconcile_insert(Reconcile *p, u64 key, int iDir){
+  int m = p->nCell/3;
+  u32 chk = reconcile_check(key);
+  int i;
+  for(i=0; i<3; i++){
+    ReconcileCell *pCell = &p->a[i*m + (int)((key>>(i*21)) % m)];
+    pCell->n += iDir;
+    pCell->chk ^= chk;
+    pCell->key ^= key;
+  }
+}
+
+/*
+** The key for an artifact hash
+*/
+static u64 reconcile_key(const char *zUuid){
+  u64 key = 0;
+  int i;
+  for(i=0; i<16 && zUuid[i]; i++){
+    key = (key<<4) | hex_digit_value(zUuid[i]);
+  }
+  return key;
+}
+
+/*
+** Prepare a query for the artifacts that go into the table: the
+** unclustered artifacts that send_unclustered() would announce.
+*/
+static void reconcile_prepare(Stmt *pQ){
+  db_prepare(pQ,
+    "SELECT uuid FROM unclustered JOIN blob USING(rid) /*scan*/"
+    " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid)"
+    "   AND NOT EXISTS(SELECT 1 FROM phantom WHERE rid=blob.rid)"
+    "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)"
+  );
+}
+
+/*
+** Add every unclustered artifact to the table if iDir is 1, or remove
+** them all if iDir is -1.  Return the number of bytes that "igot" cards
+** for the same artifacts would take.
+*/
+static int reconcile_add_unclustered(Reconcile *p, int iDir){
+  Stmt q;
+  int nByte = 0;
+  reconcile_prepare(&q);
+  while( db_step(&q)==SQLITE_ROW ){
+    const char *zUuid = db_column_text(&q, 0);
+    reconcile_insert(p, reconcile_key(zUuid), iDir);
+    nByte += db_column_bytes(&q, 0) + 6;
+  }
+  db_finalize(&q);
+  return nByte;
+}
+
+/*
+** Append the table to pOut as base-64 text
+*/
+static void reconcile_encode(Reconcile *p, Blob *pOut){
+  unsigned char *aBuf = fossil_malloc( p->nCell*RECONCILE_CELL_SZ );
+  unsigned char *z = aBuf;
+  char *z64;
+  int i, j;
+  for(i=0; i<p->nCell; i++){
+    ReconcileCell *pCell = &p->a[i];
+    for(j=0; j<4; j++) *(z++) = (pCell->n>>(24-j*8)) & 0xff;
+    for(j=0; j<4; j++) *(z++) = (pCell->chk>>(24-j*8)) & 0xff;
+    for(j=0; j<8; j++) *(z++) = (pCell->key>>(56-j*8)) & 0xff;
+  }
+  z64 = encode64((const char*)aBuf, p->nCell*RECONCILE_CELL_SZ);
+  blob_append(pOut, z64, -1);
+  fossil_free(z64);
+  fossil_free(aBuf);
+}
+
+/*
+** Decode a table of nCell cells from base-64 text.  Return NULL if the
+** text is not a table of that size.
+*/
+static Reconcile *reconcile_decode(int nCell, const char *z64){
+  Reconcile *p;
+  unsigned char *aBuf, *z;
+  int n, i, j;
+  if( nCell<3 || nCell>RECONCILE_MXCELL || (nCell%3)!=0 ) return 0;
+  aBuf = (unsigned char*)decode64(z64, &n);
+  if( n!=nCell*RECONCILE_CELL_SZ ){
+    fossil_free(aBuf);
+    return 0;
+  }
+  p = reconcile_new(nCell);
+  z = aBuf;
+  for(i=0; i<nCell; i++){
+    ReconcileCell *pCell = &p->a[i];
+    u32 v = 0;
+    for(j=0; j<4; j++) v = (v<<8) | *(z++);
+    pCell->n = (int)v;
+    for(j=0; j<4; j++) pCell->chk = (pCell->chk<<8) | *(z++);
+    for(j=0; j<8; j++) pCell->key = (pCell->key<<8) | *(z++);
+  }
+  fossil_free(aBuf);
+  return p;
+}
+
+/*
+** List the keys left in the table.  Keys that were added but not
+** removed go into aKey[] with aDir[] set to 1.  Keys that were removed
+** but not added go into aKey[] with aDir[] set to -1.  Both arrays
+** must have room for p->nCell entries.  The table is emptied.
+**
+** Return the number of keys, or -1 if the table holds more than can
+** be listed.
+*/
+static int reconcile_list(Reconcile *p, u64 *aKey, int *aDir){
+  int nKey = 0;
+  int bProgress = 1;
+  int i;
+  while( bProgress ){
+    bProgress = 0;
+    for(i=0; i<p->nCell; i++){
+      ReconcileCell *pCell = &p->a[i];
+      if( (pCell->n==1 || pCell->n==-1)
+       && pCell->chk==reconcile_check(pCell->key)
+      ){
+        if( nKey>=p->nCell ) return -1;
+        aKey[nKey] = pCell->key;
+        aDir[nKey] = pCell->n;
+        reconcile_insert(p, pCell->key, -aDir[nKey]);
+        nKey++;
+        bProgress = 1;
+      }
+    }
+  }
+  for(i=0; i<p->nCell; i++){
+    if( p->a[i].n || p->a[i].chk || p->a[i].key ) return -1;
+  }
+  return nKey;
+}
+
+/*
+** Compare two keys for qsort()
+*/
+static int reconcile_key_cmp(const void *a, const void *b){
+  u64 x = *(const u64*)a;
+  u64 y = *(const u64*)b;
+  return x<y ? -1 : x>y;
+}
+
+/*
+** The server has received the table p from the client in a "pragma
+** reconcile" card.  Work out which unclustered artifacts differ between
+** the two sides.  Send "igot" cards for artifacts that only the server
+** has if isPull is true.  Send "pragma reconcile-need" cards for
+** artifacts that only the client has and that the server lacks if
+** isPush is true.
+**
+** Return false, after sending "pragma reconcile-fail", if the
+** difference could not be worked out.  The caller should then fall
+** back to send_unclustered().
+*/
+static int reconcile_reply(Xfer *pXfer, Reconcile *p, int isPull, int isPush){
+  u64 *aKey = fossil_malloc( sizeof(aKey[0])*p->nCell );
+  int *aDir = fossil_malloc( sizeof(aDir[0])*p->nCell );
+  u64 *aMine = fossil_malloc( sizeof(aMine[0])*p->nCell );
+  int nKey, nMine = 0;
+  int i;
+
+  reconcile_add_unclustered(p, -1);
+  nKey = reconcile_list(p, aKey, aDir);
+  if( nKey<0 ){
+    blob_append(pXfer->pOut, "pragma reconcile-fail\n", -1);
+  }else{
+    blob_append(pXfer->pOut, "pragma reconcile-ok\n", -1);
+    for(i=0; i<nKey; i++){
+      if( aDir[i]<0 ){
+        aMine[nMine++] = aKey[i];
+      }else if( isPush ){
+        char zKey[20];
+        sqlite3_snprintf(sizeof(zKey), zKey, "%016llx", aKey[i]);
+        if( !db_exists("SELECT 1 FROM blob WHERE uuid GLOB '%q*'"
+                       "   AND size>=0", zKey)
+         && !db_exists("SELECT 1 FROM shun WHERE uuid GLOB '%q*'", zKey)
+        ){
+          blob_appendf(pXfer->pOut, "pragma reconcile-need %s\n", zKey);
+        }
+      }
+    }
+    if( isPull && nMine>0 ){
+      Stmt q;
+      qsort(aMine, nMine, sizeof(aMine[0]), reconcile_key_cmp);
+      reconcile_prepare(&q);
+      while( db_step(&q)==SQLITE_ROW ){
+        const char *zUuid = db_column_text(&q, 0);
+        u64 key = reconcile_key(zUuid);
+        if( bsearch(&key, aMine, nMine, sizeof(aMine[0]), reconcile_key_cmp) ){
+          blob_appendf(pXfer->pOut, "igot %s\n", zUuid);
+          pXfer->nIGotSent++;
+        }
+      }
+      db_finalize(&q);
+    }
+  }
+  fossil_free(aKey);
+  fossil_free(aDir);
+  fossil_free(aMine);
+  return nKey>=0;
+}
+
 /*
 ** pXfer is a "pragma uv-hash HASH" card.
 **
@@ -1191,6 +1630,7 @@ void page_xfer(void){
   char **pzUuidList = 0;
   int *pnUuidList = 0;
   int uvCatalogSent = 0;
+  Reconcile *pReconcile = 0;
 
   if( fossil_strcmp(PD("REQUEST_METHOD","POST"),"POST") ){
      fossil_redirect_home();
@@ -1409,9 +1849,16 @@ void page_xfer(void){
       }
     }else
 
-    /*    clone   ?PROTOCOL-VERSION?  ?SEQUENCE-NUMBER?
+    /*    clone   ?PROTOCOL-VERSION?  ?SEQUENCE-NUMBER?  ?END?
     **
     ** The client knows nothing.  Tell all.
+    **
+    ** If END is present, only send artifacts with sequence numbers less
+    ** than END, and reply with "clone_seqno N END".  Clients only use
+    ** this form after the server has sent "pragma pipeline-ok".
+    **
+    ** Protocol 4 is the same as protocol 3 except that whole packs of
+    ** artifacts are sent as "cpack" cards, which can come from the cache.
     */
     if( blob_eq(&xfer.aToken[0], "clone") ){
       int iVers;
@@ -1428,18 +1875,29 @@ void page_xfer(void){
         send_unversioned_catalog(&xfer);
         uvCatalogSent = 1;
       }
-      if( xfer.nToken==3
+      if( (xfer.nToken==3 || xfer.nToken==4)
        && blob_is_int(&xfer.aToken[1], &iVers)
        && iVers>=2
       ){
-        int seqno, max;
+        int seqno, max, iEnd = 0, iFirst;
         if( iVers>=3 ){
           cgi_set_content_type("application/x-fossil-uncompressed");
         }
         blob_is_int(&xfer.aToken[2], &seqno);
         max = db_int(0, "SELECT max(rid) FROM blob");
+        if( xfer.nToken==4 && blob_is_int(&xfer.aToken[3], &iEnd) ){
+          if( iEnd<=max ) max = iEnd-1;
+          else iEnd = 0;
+        }
+        iFirst = seqno;
         while( xfer.mxSend>blob_size(xfer.pOut) && seqno<=max){
           if( time(NULL) >= xfer.maxTime ) break;
+          if( iVers>=4 && clone_pack_ok(&xfer) ){
+            int iNext = send_clone_pack(&xfer, seqno, max, seqno==iFirst);
+            if( iNext==seqno ) break;
+            seqno = iNext;
+            continue;
+          }
           if( iVers>=3 ){
             send_compressed_file(&xfer, seqno);
           }else{
@@ -1447,8 +1905,13 @@ void page_xfer(void){
           }
           seqno++;
         }
-        if( seqno>max ) seqno = 0;
-        @ clone_seqno %d(seqno)
+        if( xfer.nToken==4 ){
+          if( seqno>max && iEnd==0 ) seqno = 0;
+          @ clone_seqno %d(seqno) %F(blob_str(&xfer.aToken[3]))
+        }else{
+          if( seqno>max ) seqno = 0;
+          @ clone_seqno %d(seqno)
+        }
       }else{
         isClone = 1;
         isPull = 1;
@@ -1710,6 +2173,50 @@ void page_xfer(void){
         db_protect_pop();
       }
 
+      /*   pragma pipeline
+      **
+      ** The client is able to send several requests without waiting for
+      ** each reply.  Let it know that this server answers pipelined
+      ** requests in order and that it understands the form of the
+      ** "clone" card that gives a range of sequence numbers.
+      */
+      if( blob_eq(&xfer.aToken[1], "pipeline") ){
+        @ pragma pipeline-ok
+      }
+
+#if defined(FOSSIL_ENABLE_ZSTD)
+      /*   pragma zstd
+      **
+      ** The client is able to read a reply that is compressed with
+      ** Zstandard instead of zlib.  Compress this reply that way, unless
+      ** it is not to be compressed at all, and let the client know that
+      ** it may compress its own requests the same way.
+      */
+      if( blob_eq(&xfer.aToken[1], "zstd") ){
+        if( fossil_strcmp(cgi_content_type(), "application/x-fossil")==0 ){
+          cgi_set_content_type("application/x-fossil-zstd");
+        }
+        @ pragma zstd-ok
+      }
+#endif
+
+      /*   pragma reconcile NCELL TABLE
+      **
+      ** The client describes its unclustered artifacts with a table of
+      ** NCELL cells instead of sending "igot" cards for them.  The
+      ** reply is worked out after all other cards have been processed.
+      */
+      if( blob_eq(&xfer.aToken[1], "reconcile")
+       && xfer.nToken==4
+       && blob_is_int(&xfer.aToken[2], &size)
+      ){
+        reconcile_free(pReconcile);
+        pReconcile = reconcile_decode(size, blob_str(&xfer.aToken[3]));
+        if( pReconcile==0 ){
+          @ pragma reconcile-fail
+        }
+      }
+
     }else
 
     /* Unknown message
@@ -1730,7 +2237,7 @@ void page_xfer(void){
         nErr++;
       }
     }
-    request_phantoms(&xfer, 500);
+    request_phantoms(&xfer, 500, 0, 0);
   }
   if( zUuidList ){
     Th_Free(g.interp, zUuidList);
@@ -1747,9 +2254,14 @@ void page_xfer(void){
     if( xfer.syncPrivate ) send_private(&xfer);
   }else if( isPull ){
     create_cluster();
-    send_unclustered(&xfer);
+    if( pReconcile==0 || !reconcile_reply(&xfer, pReconcile, 1, isPush) ){
+      send_unclustered(&xfer);
+    }
     if( xfer.syncPrivate ) send_private(&xfer);
+  }else if( isPush && pReconcile ){
+    reconcile_reply(&xfer, pReconcile, 0, 1);
   }
+  reconcile_free(pReconcile);
   hook_expecting_more_artifacts(xfer.nGimmeSent?60:0);
   db_multi_exec("DROP TABLE onremote; DROP TABLE unk;");
   manifest_crosslink_end(MC_PERMIT_HOOKS);
@@ -1822,8 +2334,41 @@ static const char zBriefFormat[] =
 #define SYNC_UV_DRYRUN      0x0400    /* Do not actually exchange files */
 #define SYNC_IFABLE         0x0800    /* Inability to sync is not fatal */
 #define SYNC_CKIN_LOCK      0x1000    /* Lock the current check-in */
+#define SYNC_STATS          0x2000    /* Show where the time went */
 #endif
 
+/*
+** Start an extra request for a sync round.  Extra requests are sent
+** right behind the main request of the round, without waiting for its
+** reply, once the server has said that it accepts pipelined requests.
+** They only ask for content, so they carry none of the push, config
+** or unversioned cards of the main request.
+*/
+static void client_extra_request(
+  Blob *p,                 /* Initialize this request */
+  unsigned syncFlags,      /* Mask of SYNC_* flags */
+  const char *zSCode,      /* Server code */
+  const char *zPCode       /* Project code */
+){
+  const char *zCookie = db_get("cookie", 0);
+  blob_zero(p);
+  blob_appendf(p, "pragma client-version %d %d %d\n",
+               RELEASE_VERSION_NUMBER, MANIFEST_NUMERIC_DATE,
+               MANIFEST_NUMERIC_TIME);
+#if defined(FOSSIL_ENABLE_ZSTD)
+  blob_append(p, "pragma zstd\n", -1);
+#endif
+  if( syncFlags & SYNC_PRIVATE ){
+    blob_append(p, "pragma send-private\n", -1);
+  }
+  if( syncFlags & SYNC_PULL ){
+    blob_appendf(p, "pull %s %s\n", zSCode, zPCode);
+  }
+  if( zCookie ){
+    blob_appendf(p, "cookie %s\n", zCookie);
+  }
+}
+
 /*
 ** Floating-point absolute value
 */
@@ -1879,6 +2424,22 @@ int client_sync(
   const char *zCkinLock;  /* Name of check-in to lock.  NULL for none */
   const char *zClientId;  /* A unique identifier for this check-out */
   unsigned int mHttpFlags;/* Flags for the http_exchange() subsystem */
+  int mxPipeline;         /* Most requests to have in flight at once */
+  int nPipeline = 1;      /* Requests in flight.  >1 if the server agrees */
+  int nExtra = 0;         /* Extra requests in this round */
+  Blob *aReq;             /* Requests of one round.  aReq[0] is "send" */
+  Blob *aReply;           /* Replies to aReq[] */
+  int iCloneNext = 0;     /* Next clone sequence number not yet requested */
+  int nCloneRange = 0;    /* Sequence numbers asked for in each request */
+  int bCloneEnd = 0;      /* The end of the clone sequence has been seen */
+  int nCloneHole = 0;     /* Ranges that were not sent in full */
+  int *aCloneHole;        /* Start and end of each such range */
+  int nReconcile;         /* Cells in the next "pragma reconcile".  0: none */
+  int bReconcileSent = 0; /* "pragma reconcile" was sent on this round */
+  int bReconcileAck = 0;  /* The server answered the "pragma reconcile" */
+  int bZstd = 0;          /* The server has sent "pragma zstd-ok" */
+  i64 tmStart = current_time_in_milliseconds();
+  int i;
 
   if( db_get_boolean("dont-push", 0) ) syncFlags &= ~SYNC_PUSH;
   if( (syncFlags & (SYNC_PUSH|SYNC_PULL|SYNC_CLONE|SYNC_UNVERSIONED))==0
@@ -1896,6 +2457,7 @@ int client_sync(
   }
 
   transport_stats(0, 0, 1);
+  http_stats(0, 1);
   socket_global_init();
   memset(&xfer, 0, sizeof(xfer));
   xfer.pIn = &recv;
@@ -1908,6 +2470,14 @@ int client_sync(
     xfer.syncPrivate = 1;
   }
 
+  mxPipeline = db_get_int("sync-pipeline", 4);
+  if( mxPipeline<1 || g.url.isFile ) mxPipeline = 1;
+  if( mxPipeline>100 ) mxPipeline = 100;
+  aReq = fossil_malloc( sizeof(aReq[0])*mxPipeline );
+  aReply = fossil_malloc( sizeof(aReply[0])*mxPipeline );
+  aCloneHole = fossil_malloc( sizeof(aCloneHole[0])*mxPipeline*2 );
+  nReconcile = db_get_boolean("sync-reconcile", 0) ? RECONCILE_NCELL : 0;
+
   blobarray_zero(xfer.aToken, count(xfer.aToken));
   blob_zero(&send);
   blob_zero(&recv);
@@ -1956,8 +2526,14 @@ int client_sync(
   blob_appendf(&send, "pragma client-version %d %d %d\n",
                RELEASE_VERSION_NUMBER, MANIFEST_NUMERIC_DATE,
                MANIFEST_NUMERIC_TIME);
+#if defined(FOSSIL_ENABLE_ZSTD)
+  blob_append(&send, "pragma zstd\n", -1);
+#endif
+  if( mxPipeline>1 ){
+    blob_append(&send, "pragma pipeline\n", -1);
+  }
   if( syncFlags & SYNC_CLONE ){
-    blob_appendf(&send, "clone 3 %d\n", cloneSeqno);
+    blob_appendf(&send, "clone 4 %d\n", cloneSeqno);
     syncFlags &= ~(SYNC_PUSH|SYNC_PULL);
     nCardSent++;
     /* TBD: Request all transferable configuration values */
@@ -2004,16 +2580,75 @@ int client_sync(
       blob_appendf(&send, "cookie %s\n", zCookie);
     }
 
-    /* Client sends gimme cards for phantoms
+    /* Client sends gimme cards for phantoms.  If the server accepts
+    ** pipelined requests, phantoms that do not fit in this request go
+    ** in extra requests.
     */
+    nExtra = 0;
     if( (syncFlags & SYNC_PULL)!=0
      || ((syncFlags & SYNC_CLONE)!=0 && cloneSeqno==1)
     ){
-      request_phantoms(&xfer, mxPhantomReq);
+      int nAvail = (syncFlags & SYNC_PULL)!=0 ? nPipeline-1 : 0;
+      for(i=0; i<nAvail; i++){
+        client_extra_request(&aReq[i+1], syncFlags, zSCode,
+                             zAltPCode ? zAltPCode : zPCode);
+      }
+      nExtra = request_phantoms(&xfer, mxPhantomReq, &aReq[1], nAvail);
+      for(i=nExtra; i<nAvail; i++) blob_reset(&aReq[i+1]);
+    }
+
+    /* When cloning through pipelined requests, ask for the next ranges
+    ** of sequence numbers, beginning with those ranges that the server
+    ** did not send in full on the previous round.
+    */
+    if( iCloneNext>0 ){
+      int nHoleUsed = 0;
+      for(i=0; i<nPipeline; i++){
+        Blob *pReq = i==0 ? &send : &aReq[i];
+        int iFirst, iEnd;
+        if( nHoleUsed<nCloneHole ){
+          iFirst = aCloneHole[nHoleUsed*2];
+          iEnd = aCloneHole[nHoleUsed*2+1];
+          nHoleUsed++;
+        }else if( !bCloneEnd ){
+          iFirst = iCloneNext;
+          iEnd = iCloneNext += nCloneRange;
+        }else{
+          break;
+        }
+        if( i>0 ){
+          client_extra_request(pReq, syncFlags, zSCode, zPCode);
+          nExtra++;
+        }
+        blob_appendf(pReq, "clone 4 %d %d\n", iFirst, iEnd);
+        nCardSent++;
+      }
+      nCloneHole -= nHoleUsed;
+      memmove(aCloneHole, &aCloneHole[nHoleUsed*2],
+              sizeof(aCloneHole[0])*nCloneHole*2);
+    }
+    /* Describe the unclustered artifacts with a "pragma reconcile" card
+    ** if that is smaller than sending "igot" cards for them.
+    */
+    bReconcileSent = 0;
+    bReconcileAck = 0;
+    if( nReconcile>0 && (syncFlags & (SYNC_PUSH|SYNC_PULL))!=0
+     && xfer.resync==0
+    ){
+      Reconcile *p = reconcile_new(nReconcile);
+      int nIGot = reconcile_add_unclustered(p, 1);
+      if( nIGot > nReconcile*RECONCILE_CELL_SZ*4/3 + 30 ){
+        blob_appendf(&send, "pragma reconcile %d ", nReconcile);
+        reconcile_encode(p, &send);
+        blob_append(&send, "\n", 1);
+        nCardSent++;
+        bReconcileSent = 1;
+      }
+      reconcile_free(p);
     }
     if( syncFlags & SYNC_PUSH ){
       send_unsent(&xfer);
-      nCardSent += send_unclustered(&xfer);
+      if( !bReconcileSent ) nCardSent += send_unclustered(&xfer);
       if( syncFlags & SYNC_PRIVATE ) send_private(&xfer);
     }
 
@@ -2112,9 +2747,11 @@ int client_sync(
     ** messages unique so that that the login-card nonce will always
     ** be unique.
     */
-    zRandomness = db_text(0, "SELECT hex(randomblob(20))");
-    blob_appendf(&send, "# %s\n", zRandomness);
-    free(zRandomness);
+    for(i=0; i<=nExtra; i++){
+      zRandomness = db_text(0, "SELECT hex(randomblob(20))");
+      blob_appendf(i==0 ? &send : &aReq[i], "# %s\n", zRandomness);
+      free(zRandomness);
+    }
 
     if( syncFlags & SYNC_VERBOSE ){
       fossil_print("waiting for server...");
@@ -2127,10 +2764,42 @@ int client_sync(
     }else{
       mHttpFlags = HTTP_USE_LOGIN;
     }
-    if( http_exchange(&send, &recv, mHttpFlags, MAX_REDIRECTS, 0) ){
-      nErr++;
-      go = 2;
-      break;
+    if( bZstd ) mHttpFlags |= HTTP_ZSTD;
+    if( nExtra==0 ){
+      if( http_exchange(&send, &recv, mHttpFlags, MAX_REDIRECTS, 0) ){
+        nErr++;
+        go = 2;
+        break;
+      }
+    }else{
+      /* Send all requests of the round before reading any reply.  If
+      ** some replies do not arrive, send the rest of the requests again
+      ** one at a time, and stop pipelining. */
+      int nReply;
+      aReq[0] = send;
+      nReply = http_exchange_pipelined(aReq, aReply, nExtra+1, mHttpFlags);
+      if( nReply<nExtra+1 ) nPipeline = 1;
+      for(i=nReply; i<=nExtra; i++){
+        if( http_exchange(&aReq[i], &aReply[i], mHttpFlags,
+                          MAX_REDIRECTS, 0) ){
+          break;
+        }
+      }
+      nReply = i;
+      if( nReply>0 ) recv = aReply[0];
+      for(i=1; i<=nExtra; i++){
+        if( i<nReply ){
+          blob_append(&recv, blob_buffer(&aReply[i]), blob_size(&aReply[i]));
+          blob_reset(&aReply[i]);
+        }
+        blob_reset(&aReq[i]);
+      }
+      if( nReply<=nExtra ){
+        if( nReply>0 ) blob_reset(&recv);
+        nErr++;
+        go = 2;
+        break;
+      }
     }
 
     /* Output current stats */
@@ -2157,6 +2826,9 @@ int client_sync(
     blob_appendf(&send, "pragma client-version %d %d %d\n",
                  RELEASE_VERSION_NUMBER, MANIFEST_NUMERIC_DATE,
                  MANIFEST_NUMERIC_TIME);
+#if defined(FOSSIL_ENABLE_ZSTD)
+    blob_append(&send, "pragma zstd\n", -1);
+#endif
     rArrivalTime = db_double(0.0, "SELECT julianday('now')");
 
     /* Send the send-private pragma if we are trying to sync private data */
@@ -2230,6 +2902,14 @@ int client_sync(
         nArtifactRcvd++;
       }else
 
+      /*   cpack SIZE \n CONTENT
+      **
+      ** Client accepts a pack of compressed files from the server.
+      */
+      if( blob_eq(&xfer.aToken[0],"cpack") ){
+        nArtifactRcvd += xfer_accept_clone_pack(&xfer);
+      }else
+
       /*   uvfile NAME MTIME HASH SIZE FLAGS \n CONTENT
       **
       ** Client accepts an unversioned file from the server.
@@ -2382,7 +3062,15 @@ int client_sync(
           zPCode = mprintf("%b", &xfer.aToken[2]);
           db_set("project-code", zPCode, 0);
         }
-        if( cloneSeqno>0 ) blob_appendf(&send, "clone 3 %d\n", cloneSeqno);
+        if( cloneSeqno>0 && iCloneNext==0 ){
+          if( nPipeline>1 ){
+            /* Fetch the rest in ranges of about the size of this reply */
+            iCloneNext = cloneSeqno;
+            nCloneRange = cloneSeqno>100 ? cloneSeqno-1 : 100;
+          }else{
+            blob_appendf(&send, "clone 4 %d\n", cloneSeqno);
+          }
+        }
         nCardSent++;
       }else
 
@@ -2443,6 +3131,25 @@ int client_sync(
         blob_is_int(&xfer.aToken[1], &cloneSeqno);
       }else
 
+      /*    clone_seqno N END
+      **
+      ** The reply to "clone 4 SEQNO END".  N is the sequence number of
+      ** the next blob that needs to be sent, N>=END if the range was
+      ** sent in full, or N==0 if the range reaches past the last blob.
+      */
+      if( blob_eq(&xfer.aToken[0], "clone_seqno") && xfer.nToken==3 ){
+        int iNext = 0, iEnd = 0;
+        blob_is_int(&xfer.aToken[1], &iNext);
+        blob_is_int(&xfer.aToken[2], &iEnd);
+        if( iNext<=0 ){
+          bCloneEnd = 1;
+        }else if( iNext<iEnd && nCloneHole<mxPipeline ){
+          aCloneHole[nCloneHole*2] = iNext;
+          aCloneHole[nCloneHole*2+1] = iEnd;
+          nCloneHole++;
+        }
+      }else
+
       /*   message MESSAGE
       **
       ** A message is received from the server.  Print it.
@@ -2536,6 +3243,60 @@ int client_sync(
         else if( blob_eq(&xfer.aToken[1], "avoid-delta-manifests") ){
           g.bAvoidDeltaManifests = 1;
         }
+
+        /*    pragma pipeline-ok
+        **
+        ** The server accepts several requests on one connection without
+        ** waiting for each reply to be read.
+        */
+        else if( blob_eq(&xfer.aToken[1], "pipeline-ok") ){
+          nPipeline = mxPipeline;
+        }
+
+        /*    pragma zstd-ok
+        **
+        ** The server is able to read requests that are compressed with
+        ** Zstandard.
+        */
+        else if( blob_eq(&xfer.aToken[1], "zstd-ok") ){
+          bZstd = 1;
+        }
+
+        /*    pragma reconcile-ok
+        **    pragma reconcile-fail
+        **
+        ** The server was or was not able to work out the difference
+        ** between its unclustered artifacts and those described by
+        ** "pragma reconcile".  On failure, try again with a table eight
+        ** times larger and then give up and send "igot" cards.
+        */
+        else if( blob_eq(&xfer.aToken[1], "reconcile-ok") ){
+          bReconcileAck = 1;
+        }
+        else if( blob_eq(&xfer.aToken[1], "reconcile-fail") ){
+          bReconcileAck = 1;
+          nReconcile = nReconcile<RECONCILE_NCELL*8 ? nReconcile*8 : 0;
+          if( syncFlags & SYNC_PUSH ) go = 1;
+        }
+
+        /*    pragma reconcile-need PREFIX
+        **
+        ** The server lacks the artifact whose hash begins with PREFIX,
+        ** which was described by "pragma reconcile".  Send it.
+        */
+        else if( blob_eq(&xfer.aToken[1], "reconcile-need")
+              && xfer.nToken==3
+              && blob_size(&xfer.aToken[2])==16
+              && validate16(blob_str(&xfer.aToken[2]), 16)
+        ){
+          if( syncFlags & SYNC_PUSH ){
+            int rid = db_int(0,
+              "SELECT rid FROM blob WHERE uuid GLOB '%q*' AND size>=0",
+              blob_str(&xfer.aToken[2])
+            );
+            if( rid ) send_file(&xfer, rid, 0, 0);
+          }
+        }
       }else
 
       /*   error MESSAGE
@@ -2609,7 +3370,7 @@ int client_sync(
     nFileRecv = xfer.nFileRcvd + xfer.nDeltaRcvd + xfer.nDanglingFile;
     if( (nFileRecv>0 || newPhantom) && db_exists("SELECT 1 FROM phantom") ){
       go = 1;
-      mxPhantomReq = nFileRecv*2;
+      mxPhantomReq = nFileRecv*2/(nExtra+1);
       if( mxPhantomReq<200 ) mxPhantomReq = 200;
     }else if( (syncFlags & SYNC_CLONE)!=0 && nFileRecv>0 ){
       go = 1;
@@ -2627,9 +3388,28 @@ int client_sync(
     }
     if( xfer.nPrivIGot>0 && nCycle==1 ) go = 1;
 
+    /* A server that did not answer "pragma reconcile" does not know
+    ** about it.  Send "igot" cards from now on.
+    */
+    if( bReconcileSent && !bReconcileAck ){
+      nReconcile = 0;
+      if( syncFlags & SYNC_PUSH ) go = 1;
+    }
+
     /* If this is a clone, the go at least two rounds */
     if( (syncFlags & SYNC_CLONE)!=0 && nCycle==1 ) go = 1;
 
+    /* A clone through pipelined requests is complete once the end of
+    ** the sequence has been seen and every range has been sent in full.
+    */
+    if( iCloneNext>0 ){
+      if( bCloneEnd && nCloneHole==0 ){
+        cloneSeqno = 0;
+      }else{
+        go = 1;
+      }
+    }
+
     /* Stop the cycle if the server sends a "clone_seqno 0" card and
     ** we have gone at least two rounds.  Always go at least two rounds
     ** on a clone in order to be sure to retrieve the configuration
@@ -2665,6 +3445,22 @@ int client_sync(
   fossil_print(
      "%s done, sent: %lld  received: %lld  ip: %s\n",
      zOpType, nSent, nRcvd, g.zIpAddr);
+  if( syncFlags & SYNC_STATS ){
+    HttpStats st;
+    i64 msTotal = current_time_in_milliseconds() - tmStart;
+    http_stats(&st, 0);
+    fossil_print("Requests:   %d in %d round-trips, %d pipelined\n",
+                 st.nRequest, st.nExchange, st.nPipelined);
+    fossil_print("Sending:    %.3fs\n", st.msSend/1000.0);
+    fossil_print("Waiting:    %.3fs   (shortest wait %.3fs)\n",
+                 st.msWait/1000.0, st.msMinWait/1000.0);
+    fossil_print("Receiving:  %.3fs\n", st.msRecv/1000.0);
+    fossil_print("Local work: %.3fs\n",
+                 (msTotal - st.msSend - st.msWait - st.msRecv)/1000.0);
+  }
+  fossil_free(aReq);
+  fossil_free(aReply);
+  fossil_free(aCloneHole);
   transport_close(&g.url);
   transport_global_shutdown(&g.url);
   if( nErr && go==2 ){
@@ -51,6 +51,7 @@ static void put32(char *z, int v){
 ** Variables in which to accumulate a growing ZIP archive.
 */
 static Blob body;    /* The body of the ZIP archive */
+static int iBodyOfst;/* Archive offset of the first byte in body */
 static Blob toc;     /* The table of contents */
 static int nEntry;   /* Number of files */
 static int dosTime;  /* DOS-format time */
@@ -62,8 +63,8 @@ static char **azDir; /* Directory names already added to the archive */
 typedef struct Archive Archive;
 struct Archive {
   int eType;                      /* Type of archive (SQLAR or ZIP) */
-  Blob *pBlob;                    /* Output blob */
-  Blob tmp;                       /* Blob used as temp space for compression */
+  Blob *pBlob;                    /* Output blob.  NULL for the CGI reply */
+  WorkPipe *pPipe;                /* Helper threads compressing files */
   sqlite3 *db;                    /* Db used to assemble sqlar archive */
   sqlite3_stmt *pInsert;          /* INSERT statement for SQLAR */
   sqlite3_vfs vfs;                /* VFS object */
@@ -213,6 +214,7 @@ static int archiveGetLastError(sqlite3_vfs *pVfs, int nBuf, char *aBuf){
 void zip_open(void){
   blob_zero(&body);
   blob_zero(&toc);
+  iBodyOfst = 0;
   nEntry = 0;
   dosTime = 0;
   dosDate = 0;
@@ -247,41 +249,108 @@ void zip_set_timedate(double rDate){
 }
 
 /*
-** Append a single file to a growing ZIP archive.
+** A file or directory on its way into the archive.  The content is
+** compressed by zip_compress_entry(), possibly on a helper thread, and
+** the entry is then written out by zip_write_entry() on the main thread.
+*/
+typedef struct ZipEntry ZipEntry;
+struct ZipEntry {
+  int eType;                      /* Type of archive (SQLAR or ZIP) */
+  char *zName;                    /* Name of the entry in the archive */
+  int isDir;                      /* True for a directory */
+  int mPerm;                      /* PERM_* permissions of a file */
+  Blob content;                   /* Uncompressed content of a file */
+  Blob compr;                     /* Compressed content, or empty if none */
+  int iCRC;                       /* CRC of content.  ZIP only. */
+};
+
+/*
+** Compress the content of a single archive entry.  This may run on a
+** helper thread, so it must not touch the database or any of the static
+** variables above.
 **
-** pFile is the file to be appended.  zName is the name
-** that the file should be saved as.
+** For ZIP, all non-empty files are compressed with raw deflate.  For
+** SQLAR, files other than symlinks are compressed with zlib and the
+** compressed content is discarded if it is no smaller than the original.
 */
-static void zip_add_file_to_zip(
-  Archive *p,
-  const char *zName, 
-  const Blob *pFile, 
-  int mPerm
-){
-  z_stream stream;
+static void zip_compress_entry(void *pArg){
+  ZipEntry *pEntry = (ZipEntry*)pArg;
+  int nIn = blob_size(&pEntry->content);
+  blob_zero(&pEntry->compr);
+  if( pEntry->isDir ) return;
+  if( pEntry->eType==ARCHIVE_ZIP ){
+    z_stream stream;
+    int toOut = 0;
+    char zOutBuf[100000];
+    if( nIn==0 ) return;
+    /* Compute the CRC and compress the file. */
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = 0;
+    stream.avail_in = nIn;
+    stream.next_in = (unsigned char*)blob_buffer(&pEntry->content);
+    stream.avail_out = sizeof(zOutBuf);
+    stream.next_out = (unsigned char*)zOutBuf;
+    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    pEntry->iCRC = crc32(0, stream.next_in, stream.avail_in);
+    while( stream.avail_in>0 ){
+      deflate(&stream, 0);
+      toOut = sizeof(zOutBuf) - stream.avail_out;
+      blob_append(&pEntry->compr, zOutBuf, toOut);
+      stream.avail_out = sizeof(zOutBuf);
+      stream.next_out = (unsigned char*)zOutBuf;
+    }
+    do{
+      stream.avail_out = sizeof(zOutBuf);
+      stream.next_out = (unsigned char*)zOutBuf;
+      deflate(&stream, Z_FINISH);
+      toOut = sizeof(zOutBuf) - stream.avail_out;
+      blob_append(&pEntry->compr, zOutBuf, toOut);
+    }while( stream.avail_out==0 );
+    deflateEnd(&stream);
+  }else if( pEntry->mPerm!=PERM_LNK ){
+    unsigned long int nOut = nIn;
+    zip_blob_minsize(&pEntry->compr, nIn);
+    compress( (unsigned char*)blob_buffer(&pEntry->compr), &nOut,
+              (unsigned char*)blob_buffer(&pEntry->content), nIn
+    );
+    if( nOut>=(unsigned long int)nIn ){
+      blob_reset(&pEntry->compr);
+    }else{
+      blob_resize(&pEntry->compr, (int)nOut);
+    }
+  }
+}
+
+/*
+** Append a single file to a growing ZIP archive.  The content of the
+** file has already been compressed by zip_compress_entry().
+*/
+static void zip_add_entry_to_zip(Archive *p, const ZipEntry *pEntry){
+  const char *zName = pEntry->zName;
   int nameLen;
-  int toOut = 0;
   int iStart;
   int iCRC = 0;
   int nByte = 0;
   int nByteCompr = 0;
-  int nBlob;                 /* Size of the blob */
   int iMethod;               /* Compression method. */
   int iMode = 0644;          /* Access permissions */
-  char *z;
   char zHdr[30];
   char zExTime[13];
   char zBuf[100];
-  char zOutBuf[100000];
 
-  /* Fill in as much of the header as we know.
+  /* Fill in the header.
   */
   nameLen = (int)strlen(zName);
   if( nameLen==0 ) return;
-  nBlob = pFile ? blob_size(pFile) : 0;
-  if( pFile ){ /* This is a file, possibly empty... */
-    iMethod = (nBlob>0) ? 8 : 0; /* Cannot compress zero bytes. */
-    switch( mPerm ){
+  if( !pEntry->isDir ){ /* This is a file, possibly empty... */
+    nByte = blob_size(&pEntry->content);
+    iMethod = (nByte>0) ? 8 : 0; /* Cannot compress zero bytes. */
+    if( nByte>0 ){
+      iCRC = pEntry->iCRC;
+      nByteCompr = blob_size(&pEntry->compr);
+    }
+    switch( pEntry->mPerm ){
       case PERM_LNK:   iMode = 0120755;   break;
       case PERM_EXE:   iMode = 0100755;   break;
       default:         iMode = 0100644;   break;
@@ -297,6 +366,9 @@ static void zip_add_file_to_zip(
   put16(&zHdr[8], iMethod);
   put16(&zHdr[10], dosTime);
   put16(&zHdr[12], dosDate);
+  put32(&zHdr[14], iCRC);
+  put32(&zHdr[18], nByteCompr);
+  put32(&zHdr[22], nByte);
   put16(&zHdr[26], nameLen);
   put16(&zHdr[28], 13);
 
@@ -307,50 +379,13 @@ static void zip_add_file_to_zip(
   put32(&zExTime[9], unixTime);
 
 
-  /* Write the header and filename.
+  /* Write the header, filename and compressed file.
   */
   iStart = blob_size(&body);
   blob_append(&body, zHdr, 30);
   blob_append(&body, zName, nameLen);
   blob_append(&body, zExTime, 13);
-
-  if( nBlob>0 ){
-    /* Write the compressed file.  Compute the CRC as we progress.
-    */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = 0;
-    stream.avail_in = blob_size(pFile);
-    stream.next_in = (unsigned char*)blob_buffer(pFile);
-    stream.avail_out = sizeof(zOutBuf);
-    stream.next_out = (unsigned char*)zOutBuf;
-    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-    iCRC = crc32(0, stream.next_in, stream.avail_in);
-    while( stream.avail_in>0 ){
-      deflate(&stream, 0);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-    }
-    do{
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-      deflate(&stream, Z_FINISH);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-    }while( stream.avail_out==0 );
-    nByte = stream.total_in;
-    nByteCompr = stream.total_out;
-    deflateEnd(&stream);
-
-    /* Go back and write the header, now that we know the compressed file size.
-    */
-    z = &blob_buffer(&body)[iStart];
-    put32(&z[14], iCRC);
-    put32(&z[18], nByteCompr);
-    put32(&z[22], nByte);
-  }
+  blob_append(&body, blob_buffer(&pEntry->compr), nByteCompr);
 
   /* Make an entry in the tables of contents
   */
@@ -371,20 +406,26 @@ static void zip_add_file_to_zip(
   put16(&zBuf[34], 0);
   put16(&zBuf[36], 0);
   put32(&zBuf[38], ((unsigned)iMode)<<16);
-  put32(&zBuf[42], iStart);
+  put32(&zBuf[42], iBodyOfst + iStart);
   blob_append(&toc, zBuf, 46);
   blob_append(&toc, zName, nameLen);
   put16(&zExTime[2], 5);
   blob_append(&toc, zExTime, 9);
   nEntry++;
+  if( p->pBlob==0 ){
+    /* The archive is being streamed.  Send this file now. */
+    cgi_append_content(blob_buffer(&body), blob_size(&body));
+    iBodyOfst += blob_size(&body);
+    blob_truncate(&body, 0);
+  }
 }
 
-static void zip_add_file_to_sqlar(
-  Archive *p,
-  const char *zName, 
-  const Blob *pFile, 
-  int mPerm
-){
+/*
+** Insert a single file into a growing SQLAR archive.  The content of
+** the file has already been compressed by zip_compress_entry().
+*/
+static void zip_add_entry_to_sqlar(Archive *p, const ZipEntry *pEntry){
+  const char *zName = pEntry->zName;
   int nName = (int)strlen(zName);
 
   if( p->db==0 ){
@@ -407,7 +448,6 @@ static void zip_add_file_to_sqlar(
         SQLITE_OPEN_CREATE|SQLITE_OPEN_READWRITE, p->vfs.zName
     );
     assert( p->db );
-    blob_zero(&p->tmp);
     sqlite3_exec(p->db, 
         "PRAGMA page_size=512;"
         "PRAGMA journal_mode = off;"
@@ -432,7 +472,7 @@ static void zip_add_file_to_sqlar(
   }
 
   if( nName==0 ) return;
-  if( pFile==0 ){
+  if( pEntry->isDir ){
     /* Directory. */
     if( zName[nName-1]=='/' ) nName--;
     sqlite3_bind_text(p->pInsert, 1, zName, nName, SQLITE_STATIC);
@@ -440,31 +480,22 @@ static void zip_add_file_to_sqlar(
     sqlite3_bind_int(p->pInsert, 4, 0);
     sqlite3_bind_null(p->pInsert, 5);
   }else{
+    const Blob *pData = &pEntry->content;
     sqlite3_bind_text(p->pInsert, 1, zName, nName, SQLITE_STATIC);
-    if( mPerm==PERM_LNK ){
+    if( pEntry->mPerm==PERM_LNK ){
       sqlite3_bind_int(p->pInsert, 2, 0120755);
       sqlite3_bind_int(p->pInsert, 4, -1);
       sqlite3_bind_text(p->pInsert, 5, 
-          blob_buffer(pFile), blob_size(pFile), SQLITE_STATIC
+          blob_buffer(pData), blob_size(pData), SQLITE_STATIC
       );
     }else{
-      int nIn = blob_size(pFile);
-      unsigned long int nOut = nIn;
-      sqlite3_bind_int(p->pInsert, 2, mPerm==PERM_EXE ? 0100755 : 0100644);
-      sqlite3_bind_int(p->pInsert, 4, nIn);
-      zip_blob_minsize(&p->tmp, nIn);
-      compress( (unsigned char*)
-          blob_buffer(&p->tmp), &nOut, (unsigned char*)blob_buffer(pFile), nIn
+      sqlite3_bind_int(p->pInsert, 2,
+          pEntry->mPerm==PERM_EXE ? 0100755 : 0100644);
+      sqlite3_bind_int(p->pInsert, 4, blob_size(pData));
+      if( blob_size(&pEntry->compr)>0 ) pData = &pEntry->compr;
+      sqlite3_bind_blob(p->pInsert, 5, 
+          blob_buffer(pData), blob_size(pData), SQLITE_STATIC
       );
-      if( nOut>=nIn ){
-        sqlite3_bind_blob(p->pInsert, 5, 
-            blob_buffer(pFile), blob_size(pFile), SQLITE_STATIC
-        );
-      }else{
-        sqlite3_bind_blob(p->pInsert, 5, 
-            blob_buffer(&p->tmp), nOut, SQLITE_STATIC
-        );
-      }
     }
   }
 
@@ -472,16 +503,105 @@ static void zip_add_file_to_sqlar(
   sqlite3_reset(p->pInsert);
 }
 
+/*
+** Write a compressed entry into the archive and then free it.
+*/
+static void zip_write_entry(Archive *p, ZipEntry *pEntry){
+  if( p->eType==ARCHIVE_ZIP ){
+    zip_add_entry_to_zip(p, pEntry);
+  }else{
+    zip_add_entry_to_sqlar(p, pEntry);
+  }
+  blob_reset(&pEntry->content);
+  blob_reset(&pEntry->compr);
+  fossil_free(pEntry->zName);
+  fossil_free(pEntry);
+}
+
+/*
+** Add a file to the archive.  The file is named zName and its content
+** is taken from *pFile, which is left empty.  If pFile is NULL, the
+** entry is a directory.
+**
+** If the archive has helper threads, the file is compressed by one of
+** them and written out later, but always in the order in which files
+** were added.  Otherwise it is compressed and written right away.
+*/
+static void zip_add_file_take(
+  Archive *p,
+  const char *zName,
+  Blob *pFile,
+  int mPerm
+){
+  ZipEntry *pEntry = fossil_malloc( sizeof(*pEntry) );
+  memset(pEntry, 0, sizeof(*pEntry));
+  pEntry->eType = p->eType;
+  pEntry->zName = fossil_strdup(zName);
+  pEntry->mPerm = mPerm;
+  blob_zero(&pEntry->compr);
+  if( pFile ){
+    pEntry->content = *pFile;
+    blob_zero(pFile);
+  }else{
+    blob_zero(&pEntry->content);
+    pEntry->isDir = 1;
+  }
+  if( p->pPipe==0 ){
+    zip_compress_entry(pEntry);
+    zip_write_entry(p, pEntry);
+    return;
+  }
+  if( workpipe_full(p->pPipe) ){
+    zip_write_entry(p, (ZipEntry*)workpipe_pop(p->pPipe, 1));
+  }
+  workpipe_push(p->pPipe, pEntry);
+  while( (pEntry = (ZipEntry*)workpipe_pop(p->pPipe, 0))!=0 ){
+    zip_write_entry(p, pEntry);
+  }
+}
+
+/*
+** Add a copy of file pFile, or a directory if pFile is NULL, to the
+** archive under the name zName.
+*/
 static void zip_add_file(
   Archive *p,
   const char *zName, 
   const Blob *pFile, 
   int mPerm
 ){
-  if( p->eType==ARCHIVE_ZIP ){
-    zip_add_file_to_zip(p, zName, pFile, mPerm);
+  Blob copy;
+  if( pFile==0 ){
+    zip_add_file_take(p, zName, 0, mPerm);
   }else{
-    zip_add_file_to_sqlar(p, zName, pFile, mPerm);
+    blob_zero(&copy);
+    blob_append(&copy, blob_buffer(pFile), blob_size(pFile));
+    zip_add_file_take(p, zName, &copy, mPerm);
+  }
+}
+
+/*
+** Return the number of helper threads to use to compress an archive.
+** zJobs is the argument to a --jobs option, or NULL to use the
+** archive-jobs setting.  The result is 1 for no helper threads.
+*/
+int archive_thread_count(const char *zJobs){
+  char *zSetting = 0;
+  int n;
+  if( zJobs==0 ) zJobs = zSetting = db_get("archive-jobs", 0);
+  n = fossil_thread_count(zJobs, 1);
+  fossil_free(zSetting);
+  return n;
+}
+
+/*
+** Compress the files of archive p on nJob helper threads.  Nothing
+** changes if nJob is 1 or threads are not available.  The output is
+** the same either way.
+*/
+static void zip_start_threads(Archive *p, int nJob){
+  if( nJob>1 ){
+    p->pPipe = workpipe_new(nJob, nJob*4, zip_compress_entry);
   }
 }
 
@@ -528,18 +648,27 @@ static void free_archive(Archive *p){
 }
 
 /*
-** Write the ZIP archive into the given BLOB.
+** Write the ZIP archive into the given BLOB, or append what remains of
+** it to the CGI reply if there is no output BLOB.
 */
 static void zip_close(Archive *p){
   int i;
+  if( p->pPipe ){
+    ZipEntry *pEntry;
+    while( (pEntry = (ZipEntry*)workpipe_pop(p->pPipe, 1))!=0 ){
+      zip_write_entry(p, pEntry);
+    }
+    workpipe_free(p->pPipe);
+    p->pPipe = 0;
+  }
   if( p->eType==ARCHIVE_ZIP ){
     int iTocStart;
     int iTocEnd;
     char zBuf[30];
 
-    iTocStart = blob_size(&body);
+    iTocStart = iBodyOfst + blob_size(&body);
     blob_append(&body, blob_buffer(&toc), blob_size(&toc));
-    iTocEnd = blob_size(&body);
+    iTocEnd = iBodyOfst + blob_size(&body);
 
     memset(zBuf, 0, sizeof(zBuf));
     put32(&zBuf[0], 0x06054b50);
@@ -552,12 +681,16 @@ static void zip_close(Archive *p){
     put16(&zBuf[20], 0);
     blob_append(&body, zBuf, 22);
     blob_reset(&toc);
-    *(p->pBlob) = body;
+    if( p->pBlob ){
+      *(p->pBlob) = body;
+    }else{
+      cgi_append_content(blob_buffer(&body), blob_size(&body));
+      blob_reset(&body);
+    }
     blob_zero(&body);
   }else{
     if( p->db ) sqlite3_exec(p->db, "COMMIT", 0, 0, 0);
     free_archive(p);
-    blob_reset(&p->tmp);
   }
 
   nEntry = 0;
@@ -612,24 +745,34 @@ void filezip_cmd(void){
 ** If the RID object does not exist in the repository, then
 ** pZip is zeroed.
 **
+** If pZip is NULL, a ZIP archive is appended to the CGI reply, one
+** file at a time as the archive is built, so that a streamed reply
+** (see cgi_stream_begin()) does not have to hold the whole archive in
+** memory.  SQLAR archives always need pZip.
+**
 ** zDir is a "synthetic" subdirectory which all zipped files get
 ** added to as part of the zip file. It may be 0 or an empty string,
 ** in which case it is ignored. The intention is to create a zip which
 ** politely expands into a subdir instead of filling your current dir
 ** with source files. For example, pass a commit hash or "ProjectName".
 **
+** Files are compressed on nJob helper threads if nJob is more than 1.
 */
 static void zip_of_checkin(
   int eType,          /* Type of archive (ZIP or SQLAR) */
   int rid,            /* The RID of the checkin to build the archive from */
-  Blob *pZip,         /* Write the archive content into this blob */
+  Blob *pZip,         /* Write the archive content into this blob or NULL */
   const char *zDir,   /* Top-level directory of the archive */
   Glob *pInclude,     /* Only include files that match this pattern */
-  Glob *pExclude      /* Exclude files that match this pattern */
+  Glob *pExclude,     /* Exclude files that match this pattern */
+  int nJob            /* Number of helper threads for compression */
 ){
   Blob mfile, hash, file;
   Manifest *pManifest;
   ManifestFile *pFile;
+  ManifestFile **apFile = 0;   /* Files to put in the archive */
+  int nFile = 0, nFileAlloc = 0, i;
+  ContentBatch files;          /* Content of the files in apFile[] */
   Blob filename;
   int nPrefix;
 
@@ -637,8 +780,8 @@ static void zip_of_checkin(
   memset(&sArchive, 0, sizeof(Archive));
   sArchive.eType = eType;
   sArchive.pBlob = pZip;
-  blob_zero(&sArchive.tmp);
-  blob_zero(pZip);
+  assert( pZip!=0 || eType==ARCHIVE_ZIP );
+  if( pZip ) blob_zero(pZip);
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
@@ -647,6 +790,7 @@ static void zip_of_checkin(
   blob_set_dynamic(&hash, rid_to_uuid(rid));
   blob_zero(&filename);
   zip_open();
+  zip_start_threads(&sArchive, nJob);
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -706,21 +850,34 @@ static void zip_of_checkin(
     }
     manifest_file_rewind(pManifest);
     zip_add_file(&sArchive, "", 0, 0);
+    /* Fetch the file content in batches, so that delta bases that the
+    ** files have in common are only expanded once */
+    content_batch_init(&files);
     while( (pFile = manifest_file_next(pManifest,0))!=0 ){
       int fid;
       if( pInclude!=0 && !glob_match(pInclude, pFile->zName) ) continue;
       if( glob_match(pExclude, pFile->zName) ) continue;
       fid = uuid_to_rid(pFile->zUuid, 0);
       if( fid ){
-        content_get(fid, &file);
-        blob_resize(&filename, nPrefix);
-        blob_append(&filename, pFile->zName, -1);
-        zName = blob_str(&filename);
-        zip_add_folders(&sArchive, zName);
-        zip_add_file(&sArchive, zName, &file, manifest_file_mperm(pFile));
-        blob_reset(&file);
+        if( nFile>=nFileAlloc ){
+          nFileAlloc = nFileAlloc*2 + 100;
+          apFile = fossil_realloc(apFile, sizeof(apFile[0])*nFileAlloc);
+        }
+        apFile[nFile++] = pFile;
+        content_batch_add(&files, fid);
       }
     }
+    for(i=0; i<nFile; i++){
+      pFile = apFile[i];
+      content_batch_next(&files, &file);
+      blob_resize(&filename, nPrefix);
+      blob_append(&filename, pFile->zName, -1);
+      zName = blob_str(&filename);
+      zip_add_folders(&sArchive, zName);
+      zip_add_file_take(&sArchive, zName, &file, manifest_file_mperm(pFile));
+    }
+    content_batch_reset(&files);
+    fossil_free(apFile);
   }
   blob_reset(&mfile);
   manifest_destroy(pManifest);
@@ -729,6 +886,51 @@ static void zip_of_checkin(
   zip_close(&sArchive);
 }
 
+/*
+** Build the archive that the /tarball, /zip or /sqlar page, as named
+** by zPage, sends for check-in rid with a top-level directory of zName
+** and no in= or ex= query parameters.  Write it into pOut.
+*/
+void archive_of_checkin(
+  const char *zPage,
+  int rid,
+  const char *zName,
+  Blob *pOut
+){
+  int nJob = archive_thread_count(0);
+  if( fossil_strcmp(zPage, "tarball")==0 ){
+    tarball_of_checkin(rid, pOut, zName, 0, 0, nJob);
+  }else{
+    int eType = fossil_strcmp(zPage, "sqlar")==0 ? ARCHIVE_SQLAR : ARCHIVE_ZIP;
+    zip_of_checkin(eType, rid, pOut, zName, 0, 0, nJob);
+  }
+}
+
+/*
+** Return the project name as it appears in the names of archives on
+** the "Downloads" line of the /info page: the short project name, or
+** the project name, with characters that do not belong in a filename
+** changed into "_".  The caller must fossil_free() the result.
+*/
+char *archive_project_name(void){
+  char *zPJ = db_get("short-project-name", 0);
+  Blob projName;
+  int jj;
+  if( zPJ==0 ) zPJ = db_get("project-name", "unnamed");
+  blob_zero(&projName);
+  blob_append(&projName, zPJ, -1);
+  fossil_free(zPJ);
+  blob_trim(&projName);
+  zPJ = fossil_strdup(blob_str(&projName));
+  blob_reset(&projName);
+  for(jj=0; zPJ[jj]; jj++){
+    if( (zPJ[jj]>0 && zPJ[jj]<' ') || strchr("\"*/:<>?\\|", zPJ[jj]) ){
+      zPJ[jj] = '_';
+    }
+  }
+  return zPJ;
+}
+
 /*
 ** Implementation of zip_cmd and sqlar_cmd.
 */
@@ -740,13 +942,17 @@ static void archive_cmd(int eType){
   Glob *pExclude = 0;
   const char *zInclude;
   const char *zExclude;
+  const char *zJobs;
+  int nJob;
 
   zName = find_option("name", 0, 1);
   zExclude = find_option("exclude", "X", 1);
   if( zExclude ) pExclude = glob_create(zExclude);
   zInclude = find_option("include", 0, 1);
   if( zInclude ) pInclude = glob_create(zInclude);
+  zJobs = find_option("jobs", 0, 1);
   db_find_and_open_repository(0, 0);
+  nJob = archive_thread_count(zJobs);
 
   /* We should be done with options.. */
   verify_all_options();
@@ -772,7 +978,7 @@ static void archive_cmd(int eType){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude);
+  zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude, nJob);
   glob_free(pInclude);
   glob_free(pExclude);
   blob_write_to_file(&zip, g.argv[3]);
@@ -798,6 +1004,9 @@ static void archive_cmd(int eType){
 ** Options:
 **   -X|--exclude GLOBLIST   Comma-separated list of GLOBs of files to exclude
 **   --include GLOBLIST      Comma-separated list of GLOBs of files to include
+**   --jobs N                Compress files on N helper threads.  "auto"
+**                           means one per CPU.  Default: the archive-jobs
+**                           setting
 **   --name DIRECTORYNAME    The name of the top-level directory in the archive
 **   -R REPOSITORY           Specify a Fossil repository
 */
@@ -824,6 +1033,9 @@ void zip_cmd(void){
 ** Options:
 **   -X|--exclude GLOBLIST   Comma-separated list of GLOBs of files to exclude
 **   --include GLOBLIST      Comma-separated list of GLOBs of files to include
+**   --jobs N                Compress files on N helper threads.  "auto"
+**                           means one per CPU.  Default: the archive-jobs
+**                           setting
 **   --name DIRECTORYNAME    The name of the top-level directory in the archive
 **   -R REPOSITORY           Specify a Fossil repository
 */
@@ -972,9 +1184,26 @@ void baseline_zip_page(void){
     return;
   }
   blob_zero(&zip);
+  if( eType==ARCHIVE_ZIP ){
+    cgi_set_content_type("application/zip");
+  }else{
+    cgi_set_content_type("application/sqlar");
+  }
   if( cache_read(&zip, zKey)==0 ){
-    zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude);
-    cache_write(&zip, zKey);
+    i64 tmStart = current_time_in_milliseconds();
+    /* A ZIP archive is sent while it is being built, keeping a copy
+    ** only if it is going into the cache */
+    if( eType==ARCHIVE_ZIP
+     && cgi_stream_begin(cache_is_enabled() ? &zip : 0)
+    ){
+      zip_of_checkin(eType, rid, 0, zName, pInclude, pExclude,
+                     archive_thread_count(0));
+      cgi_stream_flush();
+    }else{
+      zip_of_checkin(eType, rid, &zip, zName, pInclude, pExclude,
+                     archive_thread_count(0));
+    }
+    cache_write(&zip, zKey, current_time_in_milliseconds()-tmStart);
   }
   glob_free(pInclude);
   glob_free(pExclude);
@@ -982,10 +1211,9 @@ void baseline_zip_page(void){
   fossil_free(zRid);
   g.zOpenRevision = 0;
   blob_reset(&cacheKey);
-  cgi_set_content(&zip);
-  if( eType==ARCHIVE_ZIP ){
-    cgi_set_content_type("application/zip");
+  if( cgi_is_streaming() ){
+    blob_reset(&zip);
   }else{
-    cgi_set_content_type("application/sqlar");
+    cgi_set_content(&zip);
   }
 }
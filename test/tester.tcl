@@ -279,6 +279,8 @@ proc get_all_settings {} {
       access-log \
       admin-log \
       allow-symlinks \
+      archive-jobs \
+      archive-pregen \
       auto-captcha \
       auto-hyperlink \
       auto-shun \
@@ -296,6 +298,7 @@ proc get_all_settings {} {
       crnl-glob \
       default-csp \
       default-perms \
+      diff-algorithm \
       diff-binary \
       diff-command \
       dont-push \
@@ -326,6 +329,10 @@ proc get_all_settings {} {
       lock-timeout \
       main-branch \
       manifest \
+      manifest-index \
+      max-annotate-cache \
+      max-artifact-cache \
+      max-clone-pack-cache \
       max-loadavg \
       max-upload \
       mimetypes \
@@ -341,6 +348,8 @@ proc get_all_settings {} {
       ssh-command \
       ssl-ca-location \
       ssl-identity \
+      sync-pipeline \
+      sync-reconcile \
       tclsh \
       th1-setup \
       th1-uri-regexp \